@@ -0,0 +1,284 @@
+// Front-end throughput benchmark. Generates a large synthetic program (or
+// reads one with --input) and times scan, parse_program and arena teardown
+// separately, plus conversion to the flat AST and a full walk of each form.
+//
+//   cc -O2 -o frontend_bench bench/frontend_bench.c bench/synth.c src/*.c
+//      -lpthread -lm -ldl
+//   ./frontend_bench [--functions N] [--depth N] [--terms N] [--rank N]
+//                    [--statements N] [--repeat N] [--input FILE]
+//                    [--emit FILE] [--threads N] [--json]
+//
+// --threads N adds a parse_parallel phase that parses top-level functions on a
+// pool of N threads (0 for one per CPU).
+//
+// Each phase also reports the peak resident set size reached while it ran,
+// or, where the peak cannot be reset, the process-wide peak by its end.
+//
+// With --json, one JSON object is printed per phase so results can be
+// collected and compared across commits.
+
+#include "../src/arena.h"
+#include "../src/ast.h"
+#include "../src/flat_ast.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/thread_pool.h"
+#include "../src/utils.h"
+#include "synth.h"
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+typedef struct PhaseResult {
+  const char *name;
+  double best;
+  double total;
+  long peak_rss_kb;
+} PhaseResult;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Whether the peak can be reset between phases. Where it cannot, each phase
+// reports the process-wide peak reached by its end instead.
+static bool phase_peaks = false;
+
+// Resets the resident-set high-water mark, which Linux allows by writing 5 to
+// clear_refs.
+static void reset_peak_rss(void) {
+#ifdef __linux__
+  FILE *fp = fopen("/proc/self/clear_refs", "w");
+  if (fp != NULL) {
+    bool ok = fputs("5", fp) >= 0;
+    phase_peaks = fclose(fp) == 0 && ok;
+  }
+#endif
+}
+
+static long peak_rss_kb(void) {
+#ifdef __linux__
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (fp != NULL) {
+    char line[256];
+    long kb = -1;
+    while (kb < 0 && fgets(line, sizeof(line), fp) != NULL)
+      sscanf(line, "VmHWM: %ld kB", &kb);
+    fclose(fp);
+    if (kb >= 0)
+      return kb;
+  }
+#endif
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+// Each phase is timed from here, after the peak is reset so that the one
+// read by record covers this phase alone.
+static double start_phase(void) {
+  reset_peak_rss();
+  return now_seconds();
+}
+
+static void record(PhaseResult *phase, double elapsed) {
+  if (phase->total == 0.0 || elapsed < phase->best)
+    phase->best = elapsed;
+  phase->total += elapsed;
+  long peak = peak_rss_kb();
+  if (peak > phase->peak_rss_kb)
+    phase->peak_rss_kb = peak;
+}
+
+static void report(PhaseResult *phase, int repeat, long bytes, long tokens,
+                   long nodes, bool json) {
+  double t = phase->best;
+  if (json) {
+    printf("{\"phase\":\"%s\",\"best_s\":%.9f,\"mean_s\":%.9f,"
+           "\"bytes_per_s\":%.1f,\"tokens_per_s\":%.1f,\"nodes_per_s\":%.1f,"
+           "\"bytes\":%ld,\"tokens\":%ld,\"nodes\":%ld,\"peak_rss_kb\":%ld,"
+           "\"peak_rss_scope\":\"%s\"}\n",
+           phase->name, t, phase->total / repeat, bytes / t, tokens / t,
+           nodes / t, bytes, tokens, nodes, phase->peak_rss_kb,
+           phase_peaks ? "phase" : "process");
+  } else {
+    printf("%-14s %10.3f ms %9.1f MB/s %9.2f Mtok/s %9.2f Mnode/s "
+           "%8ld KB %s\n",
+           phase->name, t * 1e3, bytes / t / (1024.0 * 1024.0),
+           tokens / t / 1e6, nodes / t / 1e6, phase->peak_rss_kb,
+           phase_peaks ? "peak" : "process peak");
+  }
+}
+
+static int int_arg(int argc, char **argv, int *i) {
+  if (*i + 1 >= argc) {
+    fprintf(stderr, "missing value for %s\n", argv[*i]);
+    exit(1);
+  }
+  return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+  SynthConfig config = synth_default_config();
+  int repeat = 5;
+  bool json = false;
+  const char *input_path = NULL;
+  const char *emit_path = NULL;
+  int threads = -1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--functions") == 0) {
+      config.functions = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--depth") == 0) {
+      config.loop_depth = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--terms") == 0) {
+      config.expr_terms = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--rank") == 0) {
+      config.rank = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--statements") == 0) {
+      config.statements = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--repeat") == 0) {
+      repeat = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+      input_path = argv[++i];
+    } else if (strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+      emit_path = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      threads = int_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      fprintf(stderr, "unknown argument '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+  if (repeat < 1)
+    repeat = 1;
+
+  SourceFile source;
+  char *generated = NULL;
+  if (input_path != NULL) {
+    if (!load_ein_source(input_path, &source)) {
+      fprintf(stderr, "could not read '%s'\n", input_path);
+      return 1;
+    }
+  } else {
+    size_t length = 0;
+    generated = synth_generate(&config, &length);
+    source.data = generated;
+    source.length = (long)length;
+    source.mapped = false;
+  }
+
+  if (emit_path != NULL) {
+    FILE *fp = fopen(emit_path, "wb");
+    if (fp == NULL || fwrite(source.data, 1, source.length, fp) !=
+                          (size_t)source.length) {
+      fprintf(stderr, "could not write '%s'\n", emit_path);
+      return 1;
+    }
+    fclose(fp);
+    return 0;
+  }
+
+  PhaseResult scan_phase = {"scan", 0, 0, 0};
+  PhaseResult parse_phase = {"parse_program", 0, 0, 0};
+  PhaseResult teardown_phase = {"teardown", 0, 0, 0};
+  PhaseResult parallel_phase = {"parse_parallel", 0, 0, 0};
+  PhaseResult flatten_phase = {"flatten", 0, 0, 0};
+  PhaseResult walk_tree_phase = {"walk_tree", 0, 0, 0};
+  PhaseResult walk_flat_phase = {"walk_flat", 0, 0, 0};
+  long tokens = 0;
+  long nodes = 0;
+
+  for (int r = 0; r < repeat; r++) {
+    Lexer *lexer = init_lexer(source.data, source.length);
+    double start = start_phase();
+    scan(lexer);
+    record(&scan_phase, now_seconds() - start);
+    tokens = lexer->token_count;
+    free_lexer(lexer);
+  }
+
+  for (int r = 0; r < repeat; r++) {
+    Arena *arena = init_arena(ARENA_DEFAULT_CHUNK_SIZE);
+    Lexer *lexer = init_lexer(source.data, source.length);
+    Parser *p = init_parser(lexer, arena);
+
+    // The parser pulls tokens from the lexer, so this phase includes lexing.
+    double start = start_phase();
+    ASTNode *program = parse_program(p);
+    record(&parse_phase, now_seconds() - start);
+
+    start = start_phase();
+    nodes = count_ast_nodes(program);
+    record(&walk_tree_phase, now_seconds() - start);
+
+    start = start_phase();
+    FlatAST *flat = flatten_ast(program);
+    record(&flatten_phase, now_seconds() - start);
+
+    // Pre-order layout makes a full walk of the flat form a linear scan.
+    start = start_phase();
+    long flat_nodes = 0;
+    for (uint32_t i = 0; i < flat->node_count; i++)
+      flat_nodes += flat->nodes[i].type != NODE_PROGRAM;
+    record(&walk_flat_phase, now_seconds() - start);
+    if (flat_nodes + 1 != nodes)
+      fprintf(stderr, "warning: flat AST has %ld nodes, tree has %ld\n",
+              flat_nodes + 1, nodes);
+
+    free_flat_ast(flat);
+    free_parser(p);
+    free_lexer(lexer);
+
+    start = start_phase();
+    free_arena(arena);
+    record(&teardown_phase, now_seconds() - start);
+  }
+
+  if (threads >= 0) {
+    ThreadPool *pool = init_thread_pool(threads);
+    for (int r = 0; r < repeat; r++) {
+      Arena *arena = init_arena(ARENA_DEFAULT_CHUNK_SIZE);
+      Lexer *lexer = init_lexer(source.data, source.length);
+
+      double start = start_phase();
+      parse_program_parallel(lexer, arena, pool);
+      record(&parallel_phase, now_seconds() - start);
+
+      free_lexer(lexer);
+      free_arena(arena);
+    }
+    threads = thread_pool_size(pool);
+    free_thread_pool(pool);
+  }
+
+  if (!json) {
+    printf("input: %ld bytes, %ld tokens, %ld AST nodes, best of %d\n",
+           source.length, tokens, nodes, repeat);
+  }
+  report(&scan_phase, repeat, source.length, tokens, 0, json);
+  report(&parse_phase, repeat, source.length, tokens, nodes, json);
+  report(&teardown_phase, repeat, source.length, 0, nodes, json);
+  report(&flatten_phase, repeat, source.length, 0, nodes, json);
+  report(&walk_tree_phase, repeat, source.length, 0, nodes, json);
+  report(&walk_flat_phase, repeat, source.length, 0, nodes, json);
+  if (threads >= 0) {
+    if (!json)
+      printf("parse_parallel used %d threads\n", threads);
+    report(&parallel_phase, repeat, source.length, tokens, nodes, json);
+  }
+
+  if (generated != NULL)
+    free(generated);
+  else
+    release_ein_source(&source);
+  return 0;
+}
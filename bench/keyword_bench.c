@@ -0,0 +1,181 @@
+// Microbenchmark for word classification in the lexer on identifier-heavy
+// input. Compares scan() against the strndup + strcmp chain it replaced.
+//
+//   cc -O2 -o keyword_bench bench/keyword_bench.c src/lexer.c
+//   ./keyword_bench [words] [iterations]
+
+#include "../src/lexer.h"
+#include <time.h>
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned long rng_state = 0x9e3779b97f4a7c15UL;
+
+static unsigned long next_random(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Roughly one word in five is a keyword or number; the rest are identifiers
+// of varying length, several of which share a prefix with a keyword.
+static char *generate_input(int words, int *out_length) {
+  static const char *fixed[] = {"func", "for",   "in",   "range", "if",
+                                "else", "return", "tensor", "and", "or",
+                                "42",   "3.14",  "forge", "iffy", "tensors"};
+  static const char alphabet[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  int fixed_count = sizeof(fixed) / sizeof(fixed[0]);
+
+  int capacity = words * 16;
+  char *buffer = (char *)malloc(capacity);
+  int length = 0;
+
+  for (int i = 0; i < words; i++) {
+    if (next_random() % 5 == 0) {
+      const char *w = fixed[next_random() % fixed_count];
+      int n = (int)strlen(w);
+      memcpy(buffer + length, w, n);
+      length += n;
+    } else {
+      int n = 1 + (int)(next_random() % 12);
+      buffer[length++] = alphabet[next_random() % 52];
+      for (int j = 1; j < n; j++)
+        buffer[length++] = alphabet[next_random() % 62];
+    }
+    buffer[length++] = (i % 8 == 7) ? '\n' : ' ';
+  }
+
+  *out_length = length;
+  return buffer;
+}
+
+static bool legacy_isint(const char *str) {
+  if (*str == '+' || *str == '-')
+    str++;
+  if (*str == '\0')
+    return false;
+  for (; *str; str++) {
+    if (*str < '0' || *str > '9')
+      return false;
+  }
+  return true;
+}
+
+static bool legacy_isfloat(const char *str) {
+  if (*str == '+' || *str == '-')
+    str++;
+  bool has_digit = false;
+  bool has_dot = false;
+  for (; *str; str++) {
+    if (*str >= '0' && *str <= '9') {
+      has_digit = true;
+    } else if (*str == '.') {
+      if (has_dot)
+        return false;
+      has_dot = true;
+    } else {
+      return false;
+    }
+  }
+  return has_digit;
+}
+
+static bool legacy_isalphanumeric(const char *str) {
+  for (; *str; str++) {
+    char c = *str;
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9')))
+      return false;
+  }
+  return true;
+}
+
+// The word classification scan() used before single-pass classification.
+static TokenType legacy_classify(const char *start, int length) {
+  char *literal = strndup(start, length);
+  TokenType type = UNKNOWN;
+  if (strcmp(literal, "func") == 0)
+    type = FUNC;
+  else if (strcmp(literal, "range") == 0)
+    type = RANGE;
+  else if (strcmp(literal, "for") == 0)
+    type = FOR;
+  else if (strcmp(literal, "if") == 0)
+    type = IF;
+  else if (strcmp(literal, "else") == 0)
+    type = ELSE;
+  else if (strcmp(literal, "return") == 0)
+    type = RETURN;
+  else if (strcmp(literal, "tensor") == 0)
+    type = TENSOR;
+  else if (strcmp(literal, "in") == 0)
+    type = IN;
+  else if (strcmp(literal, "or") == 0 || strcmp(literal, "OR") == 0)
+    type = OR;
+  else if (strcmp(literal, "and") == 0)
+    type = AND;
+  else if (legacy_isint(literal))
+    type = INT;
+  else if (legacy_isfloat(literal))
+    type = FLOAT;
+  else if (legacy_isalphanumeric(literal))
+    type = IDENTIFIER;
+  free(literal);
+  return type;
+}
+
+int main(int argc, char **argv) {
+  int words = argc > 1 ? atoi(argv[1]) : 1000000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+  int length = 0;
+  char *input = generate_input(words, &length);
+
+  double scan_time = 0.0;
+  int token_count = 0;
+  Lexer *reference = NULL;
+  for (int it = 0; it < iterations; it++) {
+    Lexer *lexer = init_lexer(input, length);
+    double start = now_seconds();
+    scan(lexer);
+    scan_time += now_seconds() - start;
+    token_count = lexer->token_count;
+    if (reference == NULL)
+      reference = lexer;
+    else
+      free_lexer(lexer);
+  }
+
+  double legacy_time = 0.0;
+  int mismatches = 0;
+  for (int it = 0; it < iterations; it++) {
+    double start = now_seconds();
+    for (int i = 0; i < reference->token_count; i++) {
+      Token t = reference->token_list[i];
+      TokenType type = legacy_classify(input + t.offset, t.length);
+      mismatches += type != t.tokenType;
+    }
+    legacy_time += now_seconds() - start;
+  }
+
+  double mb = (double)length * iterations / (1024.0 * 1024.0);
+  double tokens = (double)token_count * iterations;
+  printf("input: %d words, %d bytes, %d tokens\n", words, length, token_count);
+  printf("scan:            %8.2f Mtokens/s %8.2f MB/s %6.1f ns/token\n",
+         tokens / scan_time / 1e6, mb / scan_time, scan_time / tokens * 1e9);
+  printf("legacy classify: %8.2f Mtokens/s %8.2f MB/s %6.1f ns/token\n",
+         tokens / legacy_time / 1e6, mb / legacy_time,
+         legacy_time / tokens * 1e9);
+  if (mismatches > 0)
+    printf("warning: %d classification mismatches\n", mismatches / iterations);
+
+  free_lexer(reference);
+  free(input);
+  return mismatches > 0;
+}
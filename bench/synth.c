@@ -0,0 +1,142 @@
+#include "synth.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+static void append(Buffer *b, const char *fmt, ...) {
+  for (;;) {
+    va_list args;
+    va_start(args, fmt);
+    size_t room = b->capacity - b->length;
+    int n = vsnprintf(b->data + b->length, room, fmt, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n < room) {
+      b->length += n;
+      return;
+    }
+    b->capacity = b->capacity * 2 + (n > 0 ? n : 0);
+    b->data = realloc(b->data, b->capacity);
+    if (b->data == NULL) {
+      fprintf(stderr, "synth: out of memory\n");
+      exit(1);
+    }
+  }
+}
+
+static void indent(Buffer *b, int depth) {
+  for (int i = 0; i < depth; i++)
+    append(b, "  ");
+}
+
+static unsigned long next_random(unsigned long *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+SynthConfig synth_default_config(void) {
+  SynthConfig config;
+  config.functions = 2000;
+  config.loop_depth = 4;
+  config.expr_terms = 12;
+  config.rank = 4;
+  config.statements = 3;
+  config.seed = 0x2545f4914f6cdd1dUL;
+  return config;
+}
+
+static void tensor_type(Buffer *b, int rank) {
+  append(b, "tensor<");
+  for (int d = 0; d < rank; d++)
+    append(b, "D%dx", d);
+  append(b, "f32>");
+}
+
+static void tensor_access(Buffer *b, char name, int rank, int loop_depth) {
+  append(b, "%c[", name);
+  for (int d = 0; d < rank; d++)
+    append(b, "%si%d", d > 0 ? ", " : "", d % loop_depth);
+  append(b, "]");
+}
+
+char *synth_generate(const SynthConfig *config, size_t *out_length) {
+  Buffer b = {malloc(1 << 16), 0, 1 << 16};
+  unsigned long state = config->seed ? config->seed : 1;
+  int depth = config->loop_depth > 0 ? config->loop_depth : 1;
+  static const char *ops[] = {" + ", " - ", " * "};
+
+  for (int f = 0; f < config->functions; f++) {
+    append(&b, "func kernel%d(A: ", f);
+    tensor_type(&b, config->rank);
+    append(&b, ", B: ");
+    tensor_type(&b, config->rank);
+    append(&b, ", alpha: f32) -> ");
+    tensor_type(&b, config->rank);
+    append(&b, " {\n");
+
+    indent(&b, 1);
+    append(&b, "C: ");
+    tensor_type(&b, config->rank);
+    append(&b, " = 0.0\n");
+
+    for (int l = 0; l < depth; l++) {
+      indent(&b, l + 1);
+      append(&b, "for i%d in range(0, D%d) {\n", l, l % config->rank);
+    }
+
+    for (int s = 0; s < config->statements; s++) {
+      indent(&b, depth + 1);
+      tensor_access(&b, 'C', config->rank, depth);
+      append(&b, " = ");
+      for (int t = 0; t < config->expr_terms; t++) {
+        if (t > 0)
+          append(&b, "%s", ops[next_random(&state) % 3]);
+        switch (next_random(&state) % 4) {
+        case 0:
+          tensor_access(&b, 'A', config->rank, depth);
+          break;
+        case 1:
+          tensor_access(&b, 'B', config->rank, depth);
+          break;
+        case 2:
+          append(&b, "alpha");
+          break;
+        default:
+          append(&b, "%lu.%lu", next_random(&state) % 100,
+                 next_random(&state) % 1000);
+          break;
+        }
+      }
+      append(&b, "\n");
+    }
+
+    indent(&b, depth + 1);
+    append(&b, "if alpha > 0 and alpha <= 1 {\n");
+    indent(&b, depth + 2);
+    tensor_access(&b, 'C', config->rank, depth);
+    append(&b, " = -alpha * ");
+    tensor_access(&b, 'C', config->rank, depth);
+    append(&b, "\n");
+    indent(&b, depth + 1);
+    append(&b, "}\n");
+
+    for (int l = depth - 1; l >= 0; l--) {
+      indent(&b, l + 1);
+      append(&b, "}\n");
+    }
+    indent(&b, 1);
+    append(&b, "return C\n}\n\n");
+  }
+
+  if (out_length)
+    *out_length = b.length;
+  return b.data;
+}
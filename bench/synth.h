@@ -0,0 +1,21 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stddef.h>
+
+// Shape of a synthetic Ein program used by the front-end benchmarks.
+typedef struct SynthConfig {
+  int functions;  // Number of top-level funcs.
+  int loop_depth; // Nesting depth of the for loops in each body.
+  int expr_terms; // Operands in the expression chain of each assignment.
+  int rank;       // Dimensions of each tensor parameter.
+  int statements; // Assignments in the innermost loop.
+  unsigned long seed;
+} SynthConfig;
+
+SynthConfig synth_default_config(void);
+
+// Returns a heap-allocated, NUL-terminated program; length excludes the NUL.
+char *synth_generate(const SynthConfig *config, size_t *out_length);
+
+#endif // !SYNTH_H
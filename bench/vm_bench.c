@@ -0,0 +1,269 @@
+// Execution benchmark for matmul. Times the bytecode VM against a direct
+// recursive walk of the AST (name lookups and all) and against the same loop
+// nest compiled natively, and checks that all three agree.
+//
+//   cc -O2 -o vm_bench bench/vm_bench.c src/*.c -lpthread -lm -ldl
+//   ./vm_bench [size] [repeat]
+
+#include "../src/arena.h"
+#include "../src/intern.h"
+#include "../src/ast.h"
+#include "../src/loop_ir.h"
+#include "../src/parser.h"
+#include "../src/shape.h"
+#include "../src/vm.h"
+#include <math.h>
+#include <time.h>
+
+static const char *matmul_source =
+    "func matmul(A: tensor<MxKxf32>, B: tensor<KxNxf32>) -> tensor<MxNxf32> {\n"
+    "  C: tensor<MxNxf32> = 0.0\n"
+    "  for i in range(0, M) {\n"
+    "    for j in range(0, N) {\n"
+    "      for k in range(0, K) {\n"
+    "        C[i, j] = C[i, j] + A[i, k] * B[k, j]\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "  return C\n"
+    "}\n";
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A deliberately plain tree-walking interpreter: every identifier is looked
+// up by name in a flat environment and every node is dispatched on its type.
+typedef struct WalkVar {
+  const char *name;
+  float *data;
+  long shape[VM_MAX_RANK];
+  int rank;
+  long scalar;
+} WalkVar;
+
+typedef struct Walker {
+  WalkVar vars[64];
+  int count;
+} Walker;
+
+static WalkVar *walk_lookup(Walker *w, const char *name) {
+  for (int i = w->count - 1; i >= 0; i--) {
+    if (w->vars[i].name == name)
+      return &w->vars[i];
+  }
+  return NULL;
+}
+
+static float *walk_element(Walker *w, ASTNode *node);
+
+static double walk_expr(Walker *w, ASTNode *node) {
+  switch (node->nodeType) {
+  case NODE_INT_LITERAL:
+    return (double)node->data.int_literal.value;
+  case NODE_FLOAT_LITERAL:
+    return node->data.float_literal.value;
+  case NODE_IDENTIFIER: {
+    WalkVar *var = walk_lookup(w, node->data.identifier.name);
+    return var->rank == 0 && var->data != NULL ? var->data[0]
+                                               : (double)var->scalar;
+  }
+  case NODE_INDEX_EXPR:
+    return *walk_element(w, node);
+  case NODE_BINARY_EXPR: {
+    double left = walk_expr(w, node->data.binary_op.left);
+    double right = walk_expr(w, node->data.binary_op.right);
+    switch (node->data.binary_op.op) {
+    case PLUS:
+      return (float)(left + right);
+    case MINUS:
+      return (float)(left - right);
+    case STAR:
+      return (float)(left * right);
+    default:
+      return 0.0;
+    }
+  }
+  default:
+    return 0.0;
+  }
+}
+
+static float *walk_element(Walker *w, ASTNode *node) {
+  WalkVar *var =
+      walk_lookup(w, node->data.index_expression.object->data.identifier.name);
+  long offset = 0;
+  for (int i = 0; i < node->data.index_expression.index_count; i++) {
+    long index = (long)walk_expr(w, node->data.index_expression.indices[i]);
+    offset = offset * var->shape[i] + index;
+  }
+  return &var->data[offset];
+}
+
+static WalkVar *walk_stmt(Walker *w, ASTNode *node);
+
+static WalkVar *walk_block(Walker *w, ASTNode *block) {
+  for (int i = 0; i < block->data.block.count_statements; i++) {
+    WalkVar *result = walk_stmt(w, block->data.block.statements[i]);
+    if (result != NULL)
+      return result;
+  }
+  return NULL;
+}
+
+static WalkVar *walk_stmt(Walker *w, ASTNode *node) {
+  switch (node->nodeType) {
+  case NODE_VAR_DECL: {
+    ASTNode *type = node->data.var_decl.type;
+    WalkVar *var = &w->vars[w->count++];
+    var->name = node->data.var_decl.name;
+    var->rank = type->data.tensor_type.dim_count;
+    long size = 1;
+    for (int i = 0; i < var->rank; i++) {
+      var->shape[i] = walk_lookup(w, type->data.tensor_type.dims[i])->scalar;
+      size *= var->shape[i];
+    }
+    var->data = (float *)malloc(sizeof(float) * size);
+    float fill = (float)walk_expr(w, node->data.var_decl.initializer);
+    for (long i = 0; i < size; i++)
+      var->data[i] = fill;
+    return NULL;
+  }
+  case NODE_ASSIGNMENT:
+    *walk_element(w, node->data.assignment.target) =
+        (float)walk_expr(w, node->data.assignment.value);
+    return NULL;
+  case NODE_FOR: {
+    ASTNode **args = node->data.for_loop.iterable->data.func_call.args;
+    long lo = (long)walk_expr(w, args[0]);
+    long hi = (long)walk_expr(w, args[1]);
+    WalkVar *var = &w->vars[w->count++];
+    memset(var, 0, sizeof(WalkVar));
+    var->name = node->data.for_loop.variable->data.identifier.name;
+    for (var->scalar = lo; var->scalar < hi; var->scalar++)
+      walk_block(w, node->data.for_loop.body);
+    w->count--;
+    return NULL;
+  }
+  case NODE_RETURN:
+    return walk_lookup(
+        w, node->data.return_value.return_val->data.identifier.name);
+  default:
+    return NULL;
+  }
+}
+
+static void native_matmul(const float *restrict A, const float *restrict B,
+                          float *restrict C, long M, long N, long K) {
+  for (long i = 0; i < M * N; i++)
+    C[i] = 0.0f;
+  for (long i = 0; i < M; i++)
+    for (long j = 0; j < N; j++)
+      for (long k = 0; k < K; k++)
+        C[i * N + j] = C[i * N + j] + A[i * K + k] * B[k * N + j];
+}
+
+static double max_difference(const float *a, const float *b, long count) {
+  double worst = 0.0;
+  for (long i = 0; i < count; i++) {
+    double d = fabs((double)a[i] - (double)b[i]);
+    if (d > worst)
+      worst = d;
+  }
+  return worst;
+}
+
+int main(int argc, char **argv) {
+  long n = argc > 1 ? atol(argv[1]) : 128;
+  int repeat = argc > 2 ? atoi(argv[2]) : 3;
+  if (repeat < 1)
+    repeat = 1;
+
+  Arena *arena = init_arena(0);
+  Lexer *lexer = init_lexer(matmul_source, (int)strlen(matmul_source));
+  Parser *parser = init_parser(lexer, arena);
+  ASTNode *program = parse_program(parser);
+  if (check_shapes(arena, program) > 0)
+    return 1;
+  IRModule *module = lower_program(arena, program);
+  VMProgram *vm = module != NULL ? compile_vm_program(module) : NULL;
+  if (vm == NULL)
+    return 1;
+  VMFunction *fn = vm_find_function(vm, "matmul");
+
+  Tensor args[2];
+  float *inputs[2];
+  long shape[2] = {n, n};
+  for (int t = 0; t < 2; t++) {
+    if (!tensor_alloc(&args[t], TENSOR_F32, 2, shape))
+      return 1;
+    inputs[t] = (float *)args[t].data;
+    for (long i = 0; i < n * n; i++)
+      inputs[t][i] = (float)((i * 7 + t * 3) % 11 - 5) * 0.25f;
+  }
+  float *expected = (float *)malloc(sizeof(float) * n * n);
+
+  double native_best = 1e30, vm_best = 1e30, walk_best = 1e30;
+  double vm_error = 0.0, walk_error = 0.0;
+  for (int r = 0; r < repeat; r++) {
+    double start = now_seconds();
+    native_matmul(inputs[0], inputs[1], expected, n, n, n);
+    native_best = fmin(native_best, now_seconds() - start);
+
+    Tensor result;
+    start = now_seconds();
+    if (!vm_call(fn, args, 2, &result))
+      return 1;
+    vm_best = fmin(vm_best, now_seconds() - start);
+    vm_error = max_difference((const float *)result.data, expected, n * n);
+    tensor_release(&result);
+
+    Walker walker;
+    memset(&walker, 0, sizeof(walker));
+    const char *names[] = {"M", "N", "K"};
+    for (int i = 0; i < 3; i++) {
+      walker.vars[walker.count].name = intern_cstring(names[i]);
+      walker.vars[walker.count++].scalar = n;
+    }
+    walker.vars[walker.count].name = intern_cstring("A");
+    walker.vars[walker.count].data = inputs[0];
+    walker.vars[walker.count].rank = 2;
+    walker.vars[walker.count].shape[0] = n;
+    walker.vars[walker.count++].shape[1] = n;
+    walker.vars[walker.count] = walker.vars[walker.count - 1];
+    walker.vars[walker.count].name = intern_cstring("B");
+    walker.vars[walker.count++].data = inputs[1];
+
+    ASTNode *matmul = program->data.program.functions[0];
+    start = now_seconds();
+    WalkVar *c = walk_block(&walker, matmul->data.function_decl.body);
+    walk_best = fmin(walk_best, now_seconds() - start);
+    walk_error = max_difference(c->data, expected, n * n);
+    free(c->data);
+  }
+
+  double flops = 2.0 * n * n * n;
+  printf("matmul %ldx%ld, best of %d\n", n, n, repeat);
+  printf("native     %10.3f ms %8.3f GFLOP/s\n", native_best * 1e3,
+         flops / native_best * 1e-9);
+  printf("vm         %10.3f ms %8.3f GFLOP/s %6.1fx slower than native, "
+         "max error %g\n",
+         vm_best * 1e3, flops / vm_best * 1e-9, vm_best / native_best,
+         vm_error);
+  printf("ast walk   %10.3f ms %8.3f GFLOP/s %6.1fx slower than vm, "
+         "max error %g\n",
+         walk_best * 1e3, flops / walk_best * 1e-9, walk_best / vm_best,
+         walk_error);
+
+  free(expected);
+  tensor_release(&args[0]);
+  tensor_release(&args[1]);
+  free_vm_program(vm);
+  free_parser(parser);
+  free_lexer(lexer);
+  free_arena(arena);
+  free_interner();
+  return vm_error > 1e-3 || walk_error > 1e-3;
+}
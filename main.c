@@ -1,22 +1,430 @@
+#include "src/arena.h"
+#include "src/intern.h"
 #include "src/ast.h"
+#include "src/codegen.h"
+#include "src/dependence.h"
+#include "src/flat_ast.h"
+#include "src/jit.h"
 #include "src/lexer.h"
+#include "src/loop_ir.h"
 #include "src/parser.h"
+#include "src/shape.h"
+#include "src/tensor.h"
+#include "src/thread_pool.h"
+#include "src/transform.h"
 #include "src/utils.h"
+#include "src/vm.h"
+#include <string.h>
+#include <time.h>
 
-int main() {
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--threads N] [--flat] [--save-flat FILE] [--ir] "
+          "[--deps] [--emit-c] [transforms] [file.ein | -]\n"
+          "       %s --run FUNC [--jit] [--threads N] [--size NAME=N]... "
+          "[transforms] [file.ein | -]\n"
+          "       %s --load-flat FILE\n"
+          "transforms: [--gemm] [--fuse] [--interchange] [--tile SIZES] "
+          "[--no-promote] [--parallel] [--vectorize sse|avx2|avx512]\n",
+          program, program, program);
+}
+
+#define MAX_SIZE_ARGS 32
+#define DEFAULT_RUN_SIZE 16
+
+typedef struct Options {
+  const char *file_name;
+  const char *save_path;
+  const char *run;
+  bool flat;
+  bool ir;
+  bool deps;
+  bool emit_c;
+  bool jit;
+  int threads;
+  ThreadPool *pool; // Started when threads != 1.
+  TransformOptions transforms;
+
+  // --size NAME=N values for --run; other sizes default to DEFAULT_RUN_SIZE.
+  const char *size_names[MAX_SIZE_ARGS];
+  long size_values[MAX_SIZE_ARGS];
+  int size_count;
+} Options;
+
+// Prints an AST image written by --save-flat without parsing anything.
+static int print_saved_ast(const char *path) {
+  SourceFile image;
+  if (!load_ein_source(path, &image)) {
+    fprintf(stderr, "error: could not read '%s'\n", path);
+    return 1;
+  }
+
+  FlatAST ast;
+  if (!view_flat_ast(image.data, image.length, &ast)) {
+    fprintf(stderr, "error: '%s' is not a valid AST image\n", path);
+    release_ein_source(&image);
+    return 1;
+  }
+  print_flat_ast(&ast, ast.root, 0);
+  release_ein_source(&image);
+  return 0;
+}
+
+// --flat prints through the flat form; the output is identical.
+static int emit_ast(ASTNode *node, bool flat, const char *save_path) {
+  if (!flat && save_path == NULL) {
+    print_ast(node, 0);
+    return 0;
+  }
+
+  FlatAST *ast = flatten_ast(node);
+  if (ast == NULL) {
+    fprintf(stderr, "error: out of memory\n");
+    return 1;
+  }
+  if (save_path != NULL) {
+    FILE *fp = fopen(save_path, "wb");
+    bool written = fp != NULL && write_flat_ast(ast, fp);
+    if (fp != NULL)
+      fclose(fp);
+    if (!written) {
+      fprintf(stderr, "error: could not write '%s'\n", save_path);
+      free_flat_ast(ast);
+      return 1;
+    }
+  }
+  if (flat)
+    print_flat_ast(ast, ast->root, 0);
+  else
+    print_ast(node, 0);
+  free_flat_ast(ast);
+  return 0;
+}
+
+// Lowers the program and applies the requested loop transformations,
+// verifying the result.
+static IRModule *lower_module(Arena *arena, ASTNode *node,
+                              const Options *options) {
+  IRModule *module = lower_program(arena, node);
+  if (module == NULL || verify_ir_module(module) > 0)
+    return NULL;
+  transform_module(module, &options->transforms);
+  return verify_ir_module(module) > 0 ? NULL : module;
+}
+
+// --ir prints the verified loop-nest IR instead of the AST.
+static int emit_ir(Arena *arena, ASTNode *node, const Options *options) {
+  IRModule *module = lower_module(arena, node, options);
+  if (module == NULL)
+    return 1;
+  print_ir_module(stdout, module);
+  return 0;
+}
+
+// --deps prints the dependences of every outermost loop after the
+// transformations.
+static int emit_deps(Arena *arena, ASTNode *node, const Options *options) {
+  IRModule *module = lower_module(arena, node, options);
+  if (module == NULL)
+    return 1;
+  print_module_dependences(stdout, module);
+  return 0;
+}
+
+// --emit-c prints the program as a C translation unit.
+static int emit_c(Arena *arena, ASTNode *node, const Options *options) {
+  IRModule *module = lower_module(arena, node, options);
+  if (module == NULL)
+    return 1;
+  return emit_c_module(stdout, module) ? 0 : 1;
+}
+
+static long size_value(const Options *options, const char *name) {
+  for (int i = 0; i < options->size_count; i++) {
+    if (options->size_names[i] == name)
+      return options->size_values[i];
+  }
+  return DEFAULT_RUN_SIZE;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1e3 +
+         (end.tv_nsec - start->tv_nsec) * 1e-6;
+}
+
+static long eval_shape(const AffineExpr *dim, const long *symbol_values) {
+  long extent = dim->constant;
+  for (int k = 0; k < dim->term_count; k++)
+    extent += dim->terms[k].coeff * symbol_values[dim->terms[k].symbol];
+  return extent;
+}
+
+static bool call_vm(IRModule *module, const IRFunction *ir,
+                    const Tensor *args, Tensor *result, double *ms) {
+  VMProgram *program = compile_vm_program(module);
+  if (program == NULL)
+    return false;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bool ok = vm_call(vm_find_function(program, ir->name), args,
+                    ir->param_count, result);
+  *ms = elapsed_ms(&start);
+  free_vm_program(program);
+  return ok;
+}
+
+// Calls the JIT entry point with the sizes in symbol order and a result
+// buffer shaped from the declared return type.
+static bool call_jit(Arena *arena, ASTNode *node, const Options *options,
+                     const IRFunction *ir, const long *symbol_values,
+                     const Tensor *args, Tensor *result, double *ms) {
+  JitOptions jit_options = {NULL, NULL, NULL, &options->transforms,
+                            options->pool};
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  JitModule *module = jit_compile(arena, node, &jit_options);
+  if (module == NULL)
+    return false;
+  printf("jit: %s %s in %.3f ms\n",
+         module->cached ? "loaded cached" : "compiled", module->key,
+         elapsed_ms(&start));
+
+  JitEntry entry = jit_entry(module, ir->name);
+  long *sizes = (long *)calloc(ir->symbol_count + 1, sizeof(long));
+  float **data = (float **)calloc(ir->param_count + 1, sizeof(float *));
+  bool ok = entry != NULL && sizes != NULL && data != NULL;
+  int size_count = 0;
+  for (int i = 0; ok && i < ir->symbol_count; i++) {
+    if (ir->symbols[i].kind == IR_SYM_PARAM)
+      sizes[size_count++] = symbol_values[i];
+  }
+  for (int t = 0; ok && t < ir->param_count; t++) {
+    // The generated code indexes its arguments as dense row-major arrays.
+    if (!tensor_is_contiguous(&args[t])) {
+      fprintf(stderr, "error: argument '%s' is not contiguous\n",
+              ir->tensors[t].name);
+      ok = false;
+    }
+    data[t] = (float *)args[t].data;
+  }
+
+  long shape[TENSOR_MAX_RANK];
+  int rank = ir->result.rank > 0 ? ir->result.rank : 0;
+  for (int d = 0; d < rank; d++)
+    shape[d] = eval_shape(&ir->result.shape[d], symbol_values);
+  if (ok && ir->result.rank >= 0)
+    ok = tensor_alloc(result, ir->result.dtype, rank, shape);
+
+  if (ok) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    entry(sizes, data, (float *)result->data);
+    *ms = elapsed_ms(&start);
+  }
+  free(sizes);
+  free(data);
+  free_jit_module(module);
+  return ok;
+}
+
+// --run calls one function on deterministic inputs whose shapes come from
+// --size, through the VM or with --jit as native code, then prints a summary
+// of the result.
+static int run_function(Arena *arena, ASTNode *node, const Options *options) {
+  IRModule *module = lower_module(arena, node, options);
+  if (module == NULL)
+    return 1;
+
+  IRFunction *ir = ir_find_function(module, intern_cstring(options->run));
+  if (ir == NULL) {
+    fprintf(stderr, "error: no function named '%s'\n", options->run);
+    return 1;
+  }
+
+  long *symbol_values = (long *)calloc(ir->symbol_count + 1, sizeof(long));
+  Tensor *args = (Tensor *)calloc(ir->param_count + 1, sizeof(Tensor));
+  if (symbol_values == NULL || args == NULL) {
+    fprintf(stderr, "error: out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < ir->symbol_count; i++)
+    symbol_values[i] = size_value(options, ir->symbols[i].name);
+
+  bool ok = true;
+  for (int t = 0; ok && t < ir->param_count; t++) {
+    const IRTensor *info = &ir->tensors[t];
+    long shape[TENSOR_MAX_RANK];
+    int rank = info->rank > 0 ? info->rank : 0;
+    for (int d = 0; d < rank && d < TENSOR_MAX_RANK; d++)
+      shape[d] = eval_shape(&info->shape[d], symbol_values);
+    ok = tensor_alloc(&args[t], info->dtype, rank, shape);
+    if (!ok) {
+      fprintf(stderr, "error: cannot allocate argument '%s'\n", info->name);
+      break;
+    }
+    float *data = (float *)args[t].data;
+    for (long k = 0; k < tensor_element_count(&args[t]); k++)
+      data[k] = (float)((k * 7 + t * 3) % 11 - 5) * 0.25f;
+  }
+
+  Tensor result;
+  memset(&result, 0, sizeof(result));
+  double ms = 0.0;
+  if (ok && options->jit)
+    ok = call_jit(arena, node, options, ir, symbol_values, args, &result,
+                  &ms);
+  else if (ok)
+    ok = call_vm(module, ir, args, &result, &ms);
+
+  if (ok) {
+    const float *data = (const float *)result.data;
+    long count = 1;
+    printf("%s returned ", ir->name);
+    if (result.data == NULL) {
+      printf("nothing");
+      count = 0;
+    } else if (result.rank == 0) {
+      printf("scalar");
+    } else {
+      printf("tensor<");
+      for (int d = 0; d < result.rank; d++) {
+        printf("%s%ld", d > 0 ? "x" : "", result.shape[d]);
+        count *= result.shape[d];
+      }
+      printf(">");
+    }
+    double sum = 0.0;
+    for (long k = 0; k < count; k++)
+      sum += data[k];
+    printf(" sum=%.6f in %.3f ms\n", sum, ms);
+    for (long k = 0; k < count && k < 8; k++)
+      printf("  [%ld] = %f\n", k, data[k]);
+  }
+  tensor_release(&result);
+
+  for (int t = 0; t < ir->param_count; t++)
+    tensor_release(&args[t]);
+  free(args);
+  free(symbol_values);
+  return ok ? 0 : 1;
+}
+
+static bool parse_size(Options *options, const char *arg) {
+  const char *equals = strchr(arg, '=');
+  if (equals == NULL || equals == arg || options->size_count == MAX_SIZE_ARGS)
+    return false;
+
+  options->size_names[options->size_count] =
+      intern_string(arg, (int)(equals - arg));
+  options->size_values[options->size_count] = atol(equals + 1);
+  options->size_count++;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  memset(&options, 0, sizeof(options));
+  options.file_name = "examples/matmul.ein";
+  options.threads = 1;
+  options.transforms.promote = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--ir") == 0) {
+      options.ir = true;
+    } else if (strcmp(argv[i], "--deps") == 0) {
+      options.deps = true;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      options.emit_c = true;
+    } else if (strcmp(argv[i], "--gemm") == 0) {
+      options.transforms.gemm = true;
+    } else if (strcmp(argv[i], "--fuse") == 0) {
+      options.transforms.fuse = true;
+    } else if (strcmp(argv[i], "--no-promote") == 0) {
+      options.transforms.promote = false;
+    } else if (strcmp(argv[i], "--parallel") == 0) {
+      options.transforms.parallel = true;
+    } else if (strcmp(argv[i], "--interchange") == 0) {
+      options.transforms.interchange = true;
+    } else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+      if (!parse_tile_sizes(&options.transforms, argv[++i])) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--vectorize") == 0 && i + 1 < argc) {
+      if (!parse_vector_width(&options.transforms, argv[++i])) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      options.jit = true;
+    } else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc) {
+      options.run = argv[++i];
+    } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (!parse_size(&options, argv[++i])) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--flat") == 0) {
+      options.flat = true;
+    } else if (strcmp(argv[i], "--save-flat") == 0 && i + 1 < argc) {
+      options.save_path = argv[++i];
+    } else if (strcmp(argv[i], "--load-flat") == 0 && i + 1 < argc) {
+      return print_saved_ast(argv[++i]);
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      options.file_name = argv[i];
+    }
+  }
+
+  // Reads the given file, or stdin when it is "-".
+  SourceFile source;
+  if (!load_ein_source(options.file_name, &source)) {
+    fprintf(stderr, "error: could not read '%s'\n", options.file_name);
+    return 1;
+  }
 
-  long len;
-  char file_name[] = "examples/matmul.ein";
-  char *input = read_ein_file(file_name, &len);
+  Lexer *lexer = init_lexer(source.data, source.length);
+  Arena *arena = init_arena(ARENA_DEFAULT_CHUNK_SIZE);
+  ASTNode *node = NULL;
 
-  Lexer *lexer = init_lexer(input, len);
-  scan(lexer);
+  // --threads 0 uses one thread per CPU. The pool also runs parallel loops
+  // under --run --jit.
+  if (options.threads != 1) {
+    options.pool = init_thread_pool(options.threads);
+    node = parse_program_parallel(lexer, arena, options.pool);
+  } else {
+    Parser *p = init_parser(lexer, arena);
+    node = parse_program(p);
+    free_parser(p);
+  }
 
-  Parser *p = init_parser(lexer);
-  ASTNode *node = parse_program(p);
-  print_ast(node, 0);
+  int status = 0;
+  int shape_errors = check_shapes(arena, node);
+  if (shape_errors > 0) {
+    fprintf(stderr, "%d shape error%s\n", shape_errors,
+            shape_errors == 1 ? "" : "s");
+    status = 1;
+  } else if (options.run != NULL) {
+    status = run_function(arena, node, &options);
+  } else if (options.emit_c) {
+    status = emit_c(arena, node, &options);
+  } else if (options.deps) {
+    status = emit_deps(arena, node, &options);
+  } else if (options.ir) {
+    status = emit_ir(arena, node, &options);
+  } else {
+    status = emit_ast(node, options.flat, options.save_path);
+  }
 
+  free_thread_pool(options.pool);
   free_lexer(lexer);
-  free_parser(p);
-  free_ast(node);
+  free_arena(arena);
+  free_interner();
+  release_ein_source(&source);
+  return status;
 }
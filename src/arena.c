@@ -0,0 +1,147 @@
+#include "arena.h"
+
+static size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t chunk_header_size(void) {
+  return align_up(sizeof(ArenaChunk), ARENA_ALIGNMENT);
+}
+
+static char *chunk_payload(ArenaChunk *chunk) {
+  return (char *)chunk + chunk_header_size();
+}
+
+static ArenaChunk *new_chunk(size_t capacity) {
+  ArenaChunk *chunk = (ArenaChunk *)malloc(chunk_header_size() + capacity);
+  if (chunk == NULL)
+    return NULL;
+
+  chunk->next = NULL;
+  chunk->capacity = capacity;
+  chunk->used = 0;
+  return chunk;
+}
+
+Arena *init_arena(size_t chunk_size) {
+  Arena *arena = (Arena *)malloc(sizeof(Arena));
+  if (arena == NULL)
+    return NULL;
+
+  arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+  arena->head = NULL;
+  arena->total_allocated = 0;
+  return arena;
+}
+
+void free_arena(Arena *arena) {
+  if (arena == NULL)
+    return;
+
+  ArenaChunk *chunk = arena->head;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+
+// Keeps the most recent chunk for reuse and releases the rest, so parsing the
+// next compilation unit into the same arena does not go back to malloc.
+void arena_reset(Arena *arena) {
+  if (arena == NULL || arena->head == NULL)
+    return;
+
+  ArenaChunk *chunk = arena->head->next;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->head->next = NULL;
+  arena->head->used = 0;
+  arena->total_allocated = 0;
+}
+
+// Moves every chunk of `other` into `arena` and frees `other`. Memory handed
+// out by `other` stays valid and is now released with `arena`. Chunks are
+// linked behind the head so `arena` keeps bumping into its current chunk.
+void arena_adopt(Arena *arena, Arena *other) {
+  if (arena == NULL || other == NULL)
+    return;
+
+  ArenaChunk *first = other->head;
+  if (first != NULL) {
+    ArenaChunk *last = first;
+    while (last->next != NULL)
+      last = last->next;
+
+    if (arena->head == NULL) {
+      arena->head = first;
+    } else {
+      last->next = arena->head->next;
+      arena->head->next = first;
+    }
+  }
+
+  arena->total_allocated += other->total_allocated;
+  other->head = NULL;
+  free_arena(other);
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  if (arena == NULL)
+    return NULL;
+
+  size = align_up(size > 0 ? size : 1, ARENA_ALIGNMENT);
+
+  ArenaChunk *chunk = arena->head;
+  if (chunk == NULL || chunk->used + size > chunk->capacity) {
+    if (size > arena->chunk_size && chunk != NULL) {
+      // Oversized requests get a dedicated chunk behind the head so the
+      // remaining space in the current chunk is not abandoned.
+      ArenaChunk *large = new_chunk(size);
+      if (large == NULL)
+        return NULL;
+      large->used = size;
+      large->next = chunk->next;
+      chunk->next = large;
+      arena->total_allocated += size;
+      return chunk_payload(large);
+    }
+
+    size_t capacity = size > arena->chunk_size ? size : arena->chunk_size;
+    chunk = new_chunk(capacity);
+    if (chunk == NULL)
+      return NULL;
+    chunk->next = arena->head;
+    arena->head = chunk;
+  }
+
+  void *ptr = chunk_payload(chunk) + chunk->used;
+  chunk->used += size;
+  arena->total_allocated += size;
+  return ptr;
+}
+
+void *arena_memdup(Arena *arena, const void *src, size_t size) {
+  void *dst = arena_alloc(arena, size);
+  if (dst != NULL && size > 0)
+    memcpy(dst, src, size);
+  return dst;
+}
+
+char *arena_strndup(Arena *arena, const char *src, size_t length) {
+  char *dst = (char *)arena_alloc(arena, length + 1);
+  if (dst == NULL)
+    return NULL;
+
+  memcpy(dst, src, length);
+  dst[length] = '\0';
+  return dst;
+}
+
+char *arena_strdup(Arena *arena, const char *src) {
+  return arena_strndup(arena, src, strlen(src));
+}
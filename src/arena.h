@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bump allocator that owns every AST node, child array and string of one
+// compilation unit. Allocations are never freed individually; the whole
+// arena is released at once with arena_reset or free_arena.
+
+typedef struct ArenaChunk ArenaChunk;
+
+struct ArenaChunk {
+  ArenaChunk *next;
+  size_t capacity;
+  size_t used;
+  // Payload follows the header, aligned to ARENA_ALIGNMENT.
+};
+
+typedef struct Arena {
+  ArenaChunk *head;
+  size_t chunk_size;
+  size_t total_allocated;
+} Arena;
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+Arena *init_arena(size_t chunk_size);
+void free_arena(Arena *arena);
+void arena_reset(Arena *arena);
+void arena_adopt(Arena *arena, Arena *other);
+
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_memdup(Arena *arena, const void *src, size_t size);
+char *arena_strndup(Arena *arena, const char *src, size_t length);
+char *arena_strdup(Arena *arena, const char *src);
+
+#endif // !ARENA_H
@@ -6,7 +6,7 @@ static void print_indent(int indent) {
   }
 }
 
-static const char *token_type_name(TokenType tokenType) {
+const char *token_type_name(TokenType tokenType) {
   switch (tokenType) {
   case IDENTIFIER:
     return "IDENTIFIER";
@@ -82,13 +82,15 @@ static const char *token_type_name(TokenType tokenType) {
     return "LEFT_BRACKET";
   case RIGHT_BRACKET:
     return "RIGHT_BRACKET";
+  case END_OF_FILE:
+    return "END_OF_FILE";
   default:
     return "TOKEN_UNKNOWN";
   }
 }
 
-ASTNode *create_node(NodeType nodeType, int line) {
-  ASTNode *node = (ASTNode *)malloc(sizeof(ASTNode));
+ASTNode *create_node(Arena *arena, NodeType nodeType, int line) {
+  ASTNode *node = (ASTNode *)arena_alloc(arena, sizeof(ASTNode));
   if (!node)
     return NULL;
 
@@ -97,8 +99,8 @@ ASTNode *create_node(NodeType nodeType, int line) {
   return node;
 }
 
-ASTNode *ast_node_int_literal(long value, int line) {
-  ASTNode *node = create_node(NODE_INT_LITERAL, line);
+ASTNode *ast_node_int_literal(Arena *arena, long value, int line) {
+  ASTNode *node = create_node(arena, NODE_INT_LITERAL, line);
   if (!node)
     return NULL;
 
@@ -106,8 +108,8 @@ ASTNode *ast_node_int_literal(long value, int line) {
   return node;
 }
 
-ASTNode *ast_node_float_literal(double value, int line) {
-  ASTNode *node = create_node(NODE_FLOAT_LITERAL, line);
+ASTNode *ast_node_float_literal(Arena *arena, double value, int line) {
+  ASTNode *node = create_node(arena, NODE_FLOAT_LITERAL, line);
   if (!node)
     return NULL;
 
@@ -115,8 +117,9 @@ ASTNode *ast_node_float_literal(double value, int line) {
   return node;
 }
 
-ASTNode *ast_node_program(ASTNode **functions, int function_count, int line) {
-  ASTNode *node = create_node(NODE_PROGRAM, line);
+ASTNode *ast_node_program(Arena *arena, ASTNode **functions,
+                          int function_count, int line) {
+  ASTNode *node = create_node(arena, NODE_PROGRAM, line);
   if (!node)
     return NULL;
 
@@ -125,14 +128,14 @@ ASTNode *ast_node_program(ASTNode **functions, int function_count, int line) {
   return node;
 }
 
-ASTNode *ast_node_function_decl(char *name, ASTNode **params, int count_params,
+ASTNode *ast_node_function_decl(Arena *arena, const char *name,
+                                ASTNode **params, int count_params,
                                 ASTNode *return_type, ASTNode *body, int line) {
-
-  ASTNode *node = create_node(NODE_FUNC_DEF, line);
+  ASTNode *node = create_node(arena, NODE_FUNC_DEF, line);
   if (!node)
     return NULL;
 
-  node->data.function_decl.name = strdup(name);
+  node->data.function_decl.name = name;
   node->data.function_decl.params = params;
   node->data.function_decl.count_params = count_params;
   node->data.function_decl.return_type = return_type;
@@ -140,9 +143,9 @@ ASTNode *ast_node_function_decl(char *name, ASTNode **params, int count_params,
   return node;
 }
 
-ASTNode *ast_node_block(ASTNode **statements, int count_statements, int line) {
-
-  ASTNode *node = create_node(NODE_BLOCK, line);
+ASTNode *ast_node_block(Arena *arena, ASTNode **statements,
+                        int count_statements, int line) {
+  ASTNode *node = create_node(arena, NODE_BLOCK, line);
   if (!node)
     return NULL;
 
@@ -151,37 +154,39 @@ ASTNode *ast_node_block(ASTNode **statements, int count_statements, int line) {
   return node;
 }
 
-ASTNode *ast_var_decl(char *name, ASTNode *type, ASTNode *initializer,
-                      int line) {
-  ASTNode *node = create_node(NODE_VAR_DECL, line);
+ASTNode *ast_var_decl(Arena *arena, const char *name, ASTNode *type,
+                      ASTNode *initializer, int line) {
+  ASTNode *node = create_node(arena, NODE_VAR_DECL, line);
   if (!node)
     return NULL;
 
-  node->data.var_decl.name = strdup(name);
+  node->data.var_decl.name = name;
   node->data.var_decl.type = type;
   node->data.var_decl.initializer = initializer;
 
   return node;
 }
 
-ASTNode *ast_node_var_decl(char *name, ASTNode *type, ASTNode *initializer,
-                           int line) {
-  return ast_var_decl(name, type, initializer, line);
+ASTNode *ast_node_var_decl(Arena *arena, const char *name, ASTNode *type,
+                           ASTNode *initializer, int line) {
+  return ast_var_decl(arena, name, type, initializer, line);
 }
 
-ASTNode *ast_node_assignment(ASTNode *target, ASTNode *value, int line) {
-  ASTNode *node = create_node(NODE_ASSIGNMENT, line);
+ASTNode *ast_node_assignment(Arena *arena, TokenType op, ASTNode *target,
+                             ASTNode *value, int line) {
+  ASTNode *node = create_node(arena, NODE_ASSIGNMENT, line);
   if (!node)
     return NULL;
 
+  node->data.assignment.op = op;
   node->data.assignment.target = target;
   node->data.assignment.value = value;
   return node;
 }
 
-ASTNode *ast_node_for(ASTNode *variable, ASTNode *iterable, ASTNode *body,
-                      int line) {
-  ASTNode *node = create_node(NODE_FOR, line);
+ASTNode *ast_node_for(Arena *arena, ASTNode *variable, ASTNode *iterable,
+                      ASTNode *body, int line) {
+  ASTNode *node = create_node(arena, NODE_FOR, line);
   if (!node)
     return NULL;
 
@@ -191,9 +196,9 @@ ASTNode *ast_node_for(ASTNode *variable, ASTNode *iterable, ASTNode *body,
   return node;
 }
 
-ASTNode *ast_node_if(ASTNode *condition, ASTNode *then_block,
+ASTNode *ast_node_if(Arena *arena, ASTNode *condition, ASTNode *then_block,
                      ASTNode *else_block, int line) {
-  ASTNode *node = create_node(NODE_IF, line);
+  ASTNode *node = create_node(arena, NODE_IF, line);
   if (!node)
     return NULL;
 
@@ -203,8 +208,8 @@ ASTNode *ast_node_if(ASTNode *condition, ASTNode *then_block,
   return node;
 }
 
-ASTNode *ast_node_return(ASTNode *return_val, int line) {
-  ASTNode *node = create_node(NODE_RETURN, line);
+ASTNode *ast_node_return(Arena *arena, ASTNode *return_val, int line) {
+  ASTNode *node = create_node(arena, NODE_RETURN, line);
   if (!node)
     return NULL;
 
@@ -212,18 +217,18 @@ ASTNode *ast_node_return(ASTNode *return_val, int line) {
   return node;
 }
 
-ASTNode *ast_node_identifier(char *name, int line) {
-  ASTNode *node = create_node(NODE_IDENTIFIER, line);
+ASTNode *ast_node_identifier(Arena *arena, const char *name, int line) {
+  ASTNode *node = create_node(arena, NODE_IDENTIFIER, line);
   if (!node)
     return NULL;
 
-  node->data.identifier.name = strdup(name);
+  node->data.identifier.name = name;
   return node;
 }
 
-ASTNode *ast_node_binary_expr(TokenType op, ASTNode *left, ASTNode *right,
-                              int line) {
-  ASTNode *node = create_node(NODE_BINARY_EXPR, line);
+ASTNode *ast_node_binary_expr(Arena *arena, TokenType op, ASTNode *left,
+                              ASTNode *right, int line) {
+  ASTNode *node = create_node(arena, NODE_BINARY_EXPR, line);
   if (!node)
     return NULL;
 
@@ -233,8 +238,9 @@ ASTNode *ast_node_binary_expr(TokenType op, ASTNode *left, ASTNode *right,
   return node;
 }
 
-ASTNode *ast_node_unary_expr(TokenType op, ASTNode *operand, int line) {
-  ASTNode *node = create_node(NODE_UNARY_EXPR, line);
+ASTNode *ast_node_unary_expr(Arena *arena, TokenType op, ASTNode *operand,
+                             int line) {
+  ASTNode *node = create_node(arena, NODE_UNARY_EXPR, line);
   if (!node)
     return NULL;
 
@@ -243,42 +249,41 @@ ASTNode *ast_node_unary_expr(TokenType op, ASTNode *operand, int line) {
   return node;
 }
 
-ASTNode *ast_node_index_expr(ASTNode *object, ASTNode **indices, int index_count,
-                             int line) {
-  ASTNode *node = create_node(NODE_INDEX_EXPR, line);
+ASTNode *ast_node_index_expr(Arena *arena, ASTNode *object, ASTNode **indices,
+                             int index_count, int line) {
+  ASTNode *node = create_node(arena, NODE_INDEX_EXPR, line);
   if (!node)
     return NULL;
 
   node->data.index_expression.object = object;
   node->data.index_expression.indices = indices;
   node->data.index_expression.index_count = index_count;
+  node->data.index_expression.extents = NULL;
+  node->data.index_expression.proven = NULL;
   return node;
 }
 
-ASTNode *ast_node_func_call(char *func_name, ASTNode **args, int arg_count,
-                            int line) {
-  ASTNode *node = create_node(NODE_FUNC_CALL, line);
+ASTNode *ast_node_func_call(Arena *arena, const char *func_name,
+                            ASTNode **args, int arg_count, int line) {
+  ASTNode *node = create_node(arena, NODE_FUNC_CALL, line);
   if (!node)
     return NULL;
 
-  node->data.func_call.func_name = strdup(func_name);
+  node->data.func_call.func_name = func_name;
   node->data.func_call.args = args;
   node->data.func_call.arg_count = arg_count;
   return node;
 }
 
-ASTNode *ast_node_tensor_type(char **dims, int dim_count, char *data_type,
-                              int line) {
-  ASTNode *node = create_node(NODE_TENSOR_TYPE, line);
+ASTNode *ast_node_tensor_type(Arena *arena, const char **dims,
+                              int dim_count, const char *data_type, int line) {
+  ASTNode *node = create_node(arena, NODE_TENSOR_TYPE, line);
   if (!node)
     return NULL;
 
-  node->data.tensor_type.dims = (char **)malloc(sizeof(char *) * dim_count);
-  for (int i = 0; i < dim_count; i++) {
-    node->data.tensor_type.dims[i] = strdup(dims[i]);
-  }
+  node->data.tensor_type.dims = dims;
   node->data.tensor_type.dim_count = dim_count;
-  node->data.tensor_type.data_type = strdup(data_type);
+  node->data.tensor_type.data_type = data_type;
   return node;
 }
 
@@ -331,7 +336,10 @@ void print_ast(ASTNode *node, int indent) {
     break;
   case NODE_ASSIGNMENT:
     print_indent(indent);
-    printf("Assignment\n");
+    if (node->data.assignment.op == EQUAL)
+      printf("Assignment\n");
+    else
+      printf("Assignment op=%s\n", token_type_name(node->data.assignment.op));
     print_indent(indent + 1);
     printf("Target\n");
     print_ast(node->data.assignment.target, indent + 2);
@@ -431,84 +439,68 @@ void print_ast(ASTNode *node, int indent) {
   }
 }
 
-void free_ast(ASTNode *node) {
+int count_ast_nodes(ASTNode *node) {
   if (!node)
-    return;
+    return 0;
 
+  int count = 1;
   switch (node->nodeType) {
   case NODE_PROGRAM:
     for (int i = 0; i < node->data.program.function_count; i++)
-      free_ast(node->data.program.functions[i]);
-    free(node->data.program.functions);
+      count += count_ast_nodes(node->data.program.functions[i]);
     break;
   case NODE_FUNC_DEF:
-    free(node->data.function_decl.name);
     for (int i = 0; i < node->data.function_decl.count_params; i++)
-      free_ast(node->data.function_decl.params[i]);
-    free(node->data.function_decl.params);
-    free_ast(node->data.function_decl.return_type);
-    free_ast(node->data.function_decl.body);
+      count += count_ast_nodes(node->data.function_decl.params[i]);
+    count += count_ast_nodes(node->data.function_decl.return_type);
+    count += count_ast_nodes(node->data.function_decl.body);
     break;
   case NODE_BLOCK:
     for (int i = 0; i < node->data.block.count_statements; i++)
-      free_ast(node->data.block.statements[i]);
-    free(node->data.block.statements);
+      count += count_ast_nodes(node->data.block.statements[i]);
     break;
   case NODE_VAR_DECL:
-    free(node->data.var_decl.name);
-    free_ast(node->data.var_decl.type);
-    free_ast(node->data.var_decl.initializer);
+    count += count_ast_nodes(node->data.var_decl.type);
+    count += count_ast_nodes(node->data.var_decl.initializer);
     break;
   case NODE_ASSIGNMENT:
-    free_ast(node->data.assignment.target);
-    free_ast(node->data.assignment.value);
+    count += count_ast_nodes(node->data.assignment.target);
+    count += count_ast_nodes(node->data.assignment.value);
     break;
   case NODE_FOR:
-    free_ast(node->data.for_loop.variable);
-    free_ast(node->data.for_loop.iterable);
-    free_ast(node->data.for_loop.body);
+    count += count_ast_nodes(node->data.for_loop.variable);
+    count += count_ast_nodes(node->data.for_loop.iterable);
+    count += count_ast_nodes(node->data.for_loop.body);
     break;
   case NODE_IF:
-    free_ast(node->data.if_else.condition);
-    free_ast(node->data.if_else.then);
-    free_ast(node->data.if_else.else_block);
+    count += count_ast_nodes(node->data.if_else.condition);
+    count += count_ast_nodes(node->data.if_else.then);
+    count += count_ast_nodes(node->data.if_else.else_block);
     break;
   case NODE_RETURN:
-    free_ast(node->data.return_value.return_val);
-    break;
-  case NODE_INT_LITERAL:
-    break;
-  case NODE_FLOAT_LITERAL:
-    break;
-  case NODE_IDENTIFIER:
-    free(node->data.identifier.name);
+    count += count_ast_nodes(node->data.return_value.return_val);
     break;
   case NODE_BINARY_EXPR:
-    free_ast(node->data.binary_op.left);
-    free_ast(node->data.binary_op.right);
+    count += count_ast_nodes(node->data.binary_op.left);
+    count += count_ast_nodes(node->data.binary_op.right);
     break;
   case NODE_UNARY_EXPR:
-    free_ast(node->data.unary_op.operand);
+    count += count_ast_nodes(node->data.unary_op.operand);
     break;
   case NODE_INDEX_EXPR:
-    free_ast(node->data.index_expression.object);
+    count += count_ast_nodes(node->data.index_expression.object);
     for (int i = 0; i < node->data.index_expression.index_count; i++)
-      free_ast(node->data.index_expression.indices[i]);
-    free(node->data.index_expression.indices);
+      count += count_ast_nodes(node->data.index_expression.indices[i]);
     break;
   case NODE_FUNC_CALL:
-    free(node->data.func_call.func_name);
     for (int i = 0; i < node->data.func_call.arg_count; i++)
-      free_ast(node->data.func_call.args[i]);
-    free(node->data.func_call.args);
+      count += count_ast_nodes(node->data.func_call.args[i]);
     break;
+  case NODE_INT_LITERAL:
+  case NODE_FLOAT_LITERAL:
+  case NODE_IDENTIFIER:
   case NODE_TENSOR_TYPE:
-    for (int i = 0; i < node->data.tensor_type.dim_count; i++)
-      free(node->data.tensor_type.dims[i]);
-    free(node->data.tensor_type.dims);
-    free(node->data.tensor_type.data_type);
     break;
   }
-
-  free(node);
+  return count;
 }
@@ -1,6 +1,8 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 
 typedef enum NodeType {
@@ -29,6 +31,20 @@ typedef enum NodeType {
   NODE_TENSOR_TYPE,
 } NodeType;
 
+// A tensor extent as resolved by the shape pass: a named dim such as `M`, a
+// literal size, or unknown when nothing pins it down statically.
+typedef enum DimKind {
+  DIM_UNKNOWN,
+  DIM_CONST,
+  DIM_SYMBOL,
+} DimKind;
+
+typedef struct Dim {
+  DimKind kind;
+  long value;
+  const char *symbol;
+} Dim;
+
 typedef struct ASTNode ASTNode;
 
 struct ASTNode {
@@ -42,7 +58,7 @@ struct ASTNode {
     } program;
 
     struct {
-      char *name;
+      const char *name;
       ASTNode **params;
       int count_params;
       ASTNode *return_type;
@@ -55,12 +71,13 @@ struct ASTNode {
     } block;
 
     struct {
-      char *name;
+      const char *name;
       ASTNode *type;
       ASTNode *initializer;
     } var_decl;
 
     struct {
+      TokenType op; // EQUAL, PLUS_EQUAL or MINUS_EQUAL.
       ASTNode *target;
       ASTNode *value;
     } assignment;
@@ -90,7 +107,7 @@ struct ASTNode {
     } float_literal;
 
     struct {
-      char *name;
+      const char *name;
     } identifier;
 
     struct {
@@ -108,51 +125,67 @@ struct ASTNode {
       ASTNode *object;
       ASTNode **indices;
       int index_count;
+      // Extent of each indexed dimension, filled in by check_shapes. NULL
+      // until the pass has run.
+      Dim *extents;
+      // Per index, whether check_shapes proved it within its dimension, so
+      // nothing need check it at run time. NULL until the pass has run.
+      bool *proven;
     } index_expression;
 
     struct {
-      char *func_name;
+      const char *func_name;
       ASTNode **args;
       int arg_count;
     } func_call;
 
     struct {
-      char **dims;
+      const char **dims;
       int dim_count;
-      char *data_type;
+      const char *data_type;
     } tensor_type;
 
   } data;
 };
 
-ASTNode *create_node(NodeType nodeType, int line);
-ASTNode *ast_node_program(ASTNode **functions, int function_count, int line);
-ASTNode *ast_node_function_decl(char *name, ASTNode **params, int count_params,
+// Nodes and child arrays live in the arena passed to the constructors. Child
+// arrays must already be arena-allocated and are adopted rather than copied.
+// Names (identifiers, dims, dtypes) are interned strings, so they outlive the
+// arena and can be compared by pointer.
+ASTNode *create_node(Arena *arena, NodeType nodeType, int line);
+ASTNode *ast_node_program(Arena *arena, ASTNode **functions,
+                          int function_count, int line);
+ASTNode *ast_node_function_decl(Arena *arena, const char *name,
+                                ASTNode **params, int count_params,
                                 ASTNode *return_type, ASTNode *body, int line);
-ASTNode *ast_node_block(ASTNode **statements, int count_statements, int line);
-ASTNode *ast_var_decl(char *name, ASTNode *type, ASTNode *initializer,
-                      int line);
-ASTNode *ast_node_var_decl(char *name, ASTNode *type, ASTNode *initializer,
-                           int line);
-ASTNode *ast_node_assignment(ASTNode *target, ASTNode *value, int line);
-ASTNode *ast_node_for(ASTNode *variable, ASTNode *iterable, ASTNode *body,
-                      int line);
-ASTNode *ast_node_if(ASTNode *condition, ASTNode *then_block,
+ASTNode *ast_node_block(Arena *arena, ASTNode **statements,
+                        int count_statements, int line);
+ASTNode *ast_var_decl(Arena *arena, const char *name, ASTNode *type,
+                      ASTNode *initializer, int line);
+ASTNode *ast_node_var_decl(Arena *arena, const char *name, ASTNode *type,
+                           ASTNode *initializer, int line);
+ASTNode *ast_node_assignment(Arena *arena, TokenType op, ASTNode *target,
+                             ASTNode *value, int line);
+ASTNode *ast_node_for(Arena *arena, ASTNode *variable, ASTNode *iterable,
+                      ASTNode *body, int line);
+ASTNode *ast_node_if(Arena *arena, ASTNode *condition, ASTNode *then_block,
                      ASTNode *else_block, int line);
-ASTNode *ast_node_return(ASTNode *return_val, int line);
-ASTNode *ast_node_int_literal(long value, int line);
-ASTNode *ast_node_float_literal(double value, int line);
-ASTNode *ast_node_identifier(char *name, int line);
-ASTNode *ast_node_binary_expr(TokenType op, ASTNode *left, ASTNode *right,
-                              int line);
-ASTNode *ast_node_unary_expr(TokenType op, ASTNode *operand, int line);
-ASTNode *ast_node_index_expr(ASTNode *object, ASTNode **indices, int index_count,
+ASTNode *ast_node_return(Arena *arena, ASTNode *return_val, int line);
+ASTNode *ast_node_int_literal(Arena *arena, long value, int line);
+ASTNode *ast_node_float_literal(Arena *arena, double value, int line);
+ASTNode *ast_node_identifier(Arena *arena, const char *name, int line);
+ASTNode *ast_node_binary_expr(Arena *arena, TokenType op, ASTNode *left,
+                              ASTNode *right, int line);
+ASTNode *ast_node_unary_expr(Arena *arena, TokenType op, ASTNode *operand,
                              int line);
-ASTNode *ast_node_func_call(char *func_name, ASTNode **args, int arg_count,
-                            int line);
-ASTNode *ast_node_tensor_type(char **dims, int dim_count, char *data_type,
-                              int line);
+ASTNode *ast_node_index_expr(Arena *arena, ASTNode *object, ASTNode **indices,
+                             int index_count, int line);
+ASTNode *ast_node_func_call(Arena *arena, const char *func_name,
+                            ASTNode **args, int arg_count, int line);
+ASTNode *ast_node_tensor_type(Arena *arena, const char **dims,
+                              int dim_count, const char *data_type, int line);
+const char *token_type_name(TokenType tokenType);
 void print_ast(ASTNode *node, int indent);
-void free_ast(ASTNode *node);
+int count_ast_nodes(ASTNode *node);
 
 #endif // !AST_H
@@ -0,0 +1,1531 @@
+#include "codegen.h"
+#include "workspace.h"
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+
+typedef struct Emitter {
+  FILE *out;
+  const IRFunction *fn;
+  char **symbol_names;
+  char **tensor_names;
+  bool *stored;  // Tensor is the target of some statement.
+  bool *private_scalar; // Scalar local that only parallel loops use.
+  int alias;     // Local tensor written straight into ein_out, or -1.
+  WorkspacePlan plan; // Slots of the other local tensors in ein_workspace.
+  int indent;
+  int parallel_count; // Parallel loops emitted so far.
+  bool failed;
+} Emitter;
+
+static void codegen_error(Emitter *e, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "Codegen error in function '%s': ", e->fn->name);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  e->failed = true;
+}
+
+static const char *const c_keywords[] = {
+    "auto",     "break",    "case",     "char",   "const",    "continue",
+    "default",  "do",       "double",   "else",   "enum",     "extern",
+    "float",    "for",      "goto",     "if",     "inline",   "int",
+    "long",     "register", "restrict", "return", "short",    "signed",
+    "sizeof",   "static",   "struct",   "switch", "typedef",  "union",
+    "unsigned", "void",     "volatile", "while",  "_Bool",    "_Complex",
+    "bool",     "true",     "false",    "NULL",   "INFINITY", "NAN",
+};
+
+// Ein names are used as-is unless they would collide with C, with the
+// helpers below (all prefixed `ein_`) or with another name in the function.
+static bool reserved_name(const char *name) {
+  if (strncmp(name, "ein_", 4) == 0)
+    return true;
+  for (size_t i = 0; i < sizeof(c_keywords) / sizeof(c_keywords[0]); i++) {
+    if (strcmp(name, c_keywords[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+static char *make_name(const char *name, bool suffix, int id) {
+  size_t size = strlen(name) + 16;
+  char *buffer = (char *)malloc(size);
+  assert(buffer != NULL);
+  if (suffix)
+    snprintf(buffer, size, "%s_%d", name, id);
+  else
+    snprintf(buffer, size, "%s", name);
+  return buffer;
+}
+
+// Names are interned, so duplicates compare equal by pointer. Loop variables
+// from different loops may share a name and are renamed apart, since a
+// generated loop can nest inside a source loop using the same name; so are
+// locals a pass added under one name more than once.
+static void assign_names(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  e->symbol_names = (char **)calloc(fn->symbol_count + 1, sizeof(char *));
+  e->tensor_names = (char **)calloc(fn->tensor_count + 1, sizeof(char *));
+  assert(e->symbol_names != NULL && e->tensor_names != NULL);
+
+  for (int t = 0; t < fn->tensor_count; t++) {
+    const char *name = fn->tensors[t].name;
+    bool clash = reserved_name(name);
+    for (int u = 0; u < t && !clash; u++)
+      clash = fn->tensors[u].name == name;
+    e->tensor_names[t] = make_name(name, clash, t);
+  }
+  for (int i = 0; i < fn->symbol_count; i++) {
+    const char *name = fn->symbols[i].name;
+    bool clash = reserved_name(name);
+    for (int j = 0; j < fn->symbol_count && !clash; j++)
+      clash = j != i && fn->symbols[j].name == name;
+    for (int t = 0; t < fn->tensor_count && !clash; t++)
+      clash = fn->tensors[t].name == name;
+    e->symbol_names[i] = make_name(name, clash, i);
+  }
+}
+
+static void free_names(Emitter *e) {
+  for (int i = 0; i < e->fn->symbol_count; i++)
+    free(e->symbol_names[i]);
+  for (int t = 0; t < e->fn->tensor_count; t++)
+    free(e->tensor_names[t]);
+  free(e->symbol_names);
+  free(e->tensor_names);
+}
+
+static void scan_list(Emitter *e, const IRList *list, int *returned);
+
+// Marks stored tensors and finds the local every tensor return refers to,
+// setting *returned to -2 when there is more than one.
+static void scan_node(Emitter *e, const IRNode *node, int *returned) {
+  switch (node->kind) {
+  case IR_LOOP:
+    scan_list(e, &node->data.loop.body, returned);
+    break;
+  case IR_STMT:
+    if (node->data.stmt.target.tensor >= 0)
+      e->stored[node->data.stmt.target.tensor] = true;
+    break;
+  case IR_IF:
+    scan_list(e, &node->data.if_else.then_body, returned);
+    scan_list(e, &node->data.if_else.else_body, returned);
+    break;
+  case IR_RETURN:
+    if (node->data.ret.tensor >= 0 && *returned != -2) {
+      if (*returned == -1)
+        *returned = node->data.ret.tensor;
+      else if (*returned != node->data.ret.tensor)
+        *returned = -2;
+    }
+    break;
+  }
+}
+
+static void scan_list(Emitter *e, const IRList *list, int *returned) {
+  for (int i = 0; i < list->count; i++)
+    scan_node(e, list->items[i], returned);
+}
+
+static void emit_indent(Emitter *e) {
+  for (int i = 0; i < e->indent; i++)
+    fputs("  ", e->out);
+}
+
+static void emit_line(Emitter *e, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  emit_indent(e);
+  vfprintf(e->out, format, args);
+  fputc('\n', e->out);
+  va_end(args);
+}
+
+static bool affine_is_simple(const AffineExpr *expr) {
+  return affine_is_constant(expr) ||
+         (expr->term_count == 1 && expr->constant == 0 &&
+          expr->terms[0].coeff == 1);
+}
+
+static void emit_affine(Emitter *e, const AffineExpr *expr) {
+  if (expr->term_count == 0) {
+    fprintf(e->out, "%ld", expr->constant);
+    return;
+  }
+
+  for (int i = 0; i < expr->term_count; i++) {
+    long coeff = expr->terms[i].coeff;
+    const char *name = e->symbol_names[expr->terms[i].symbol];
+    if (i > 0)
+      fputs(coeff < 0 ? " - " : " + ", e->out);
+    else if (coeff < 0)
+      fputc('-', e->out);
+    long magnitude = coeff < 0 ? -coeff : coeff;
+    if (magnitude == 1)
+      fprintf(e->out, "%s", name);
+    else
+      fprintf(e->out, "%ld * %s", magnitude, name);
+  }
+  if (expr->constant != 0) {
+    fprintf(e->out, " %c %ld", expr->constant < 0 ? '-' : '+',
+            expr->constant < 0 ? -expr->constant : expr->constant);
+  }
+}
+
+static void emit_affine_operand(Emitter *e, const AffineExpr *expr) {
+  if (affine_is_simple(expr) && expr->constant >= 0) {
+    emit_affine(e, expr);
+    return;
+  }
+  fputc('(', e->out);
+  emit_affine(e, expr);
+  fputc(')', e->out);
+}
+
+static void emit_bound(Emitter *e, const IRBound *bound, bool upper) {
+  for (int i = 1; i < bound->count; i++)
+    fprintf(e->out, "%s(", upper ? "ein_min" : "ein_max");
+  emit_affine(e, &bound->exprs[0]);
+  for (int i = 1; i < bound->count; i++) {
+    fputs(", ", e->out);
+    emit_affine(e, &bound->exprs[i]);
+    fputc(')', e->out);
+  }
+}
+
+// Number of elements in tensor `t`.
+static void emit_size(Emitter *e, int t) {
+  const IRTensor *tensor = &e->fn->tensors[t];
+  for (int d = 0; d < tensor->rank; d++) {
+    if (d > 0)
+      fputs(" * ", e->out);
+    emit_affine_operand(e, &tensor->shape[d]);
+  }
+}
+
+static void emit_float(Emitter *e, double value) {
+  if (isnan(value)) {
+    fputs("NAN", e->out);
+    return;
+  }
+  if (isinf(value)) {
+    fputs(value < 0 ? "-INFINITY" : "INFINITY", e->out);
+    return;
+  }
+
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  fputs(buffer, e->out);
+  if (strpbrk(buffer, ".e") == NULL)
+    fputs(".0", e->out);
+  fputc('f', e->out);
+}
+
+static void emit_value(Emitter *e, const IRExpr *expr);
+static void emit_cond(Emitter *e, const IRExpr *expr);
+
+// Integer value of a general (non-affine) subscript.
+static void emit_index(Emitter *e, const IRExpr *expr) {
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+    fprintf(e->out, "%ld", expr->data.int_value);
+    return;
+  case IR_EXPR_SYMBOL:
+    fputs(e->symbol_names[expr->data.symbol], e->out);
+    return;
+  case IR_EXPR_BINARY:
+    if (expr->data.binary.op == PLUS || expr->data.binary.op == MINUS ||
+        expr->data.binary.op == STAR) {
+      TokenType op = expr->data.binary.op;
+      fputc('(', e->out);
+      emit_index(e, expr->data.binary.left);
+      fputs(op == PLUS ? " + " : op == MINUS ? " - " : " * ", e->out);
+      emit_index(e, expr->data.binary.right);
+      fputc(')', e->out);
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  fputs("(long)", e->out);
+  emit_value(e, expr);
+}
+
+// Row-major element offset, in Horner form: (i0 * e1 + i1) * e2 + i2.
+static void emit_offset(Emitter *e, const IRAccess *access) {
+  const IRTensor *tensor = &e->fn->tensors[access->tensor];
+  for (int i = 2; i < access->count; i++)
+    fputc('(', e->out);
+  for (int i = 0; i < access->count; i++) {
+    const IRIndex *index = &access->indices[i];
+    if (i > 0) {
+      fputs(" * ", e->out);
+      emit_affine_operand(e, &tensor->shape[i]);
+      fputs(" + ", e->out);
+    }
+    if (index->affine && index->proven) {
+      if (i == 0 && access->count > 1)
+        emit_affine_operand(e, &index->expr);
+      else
+        emit_affine(e, &index->expr);
+    } else {
+      fputs("ein_index(", e->out);
+      if (index->affine)
+        emit_affine(e, &index->expr);
+      else
+        emit_index(e, index->general);
+      fputs(", ", e->out);
+      emit_affine(e, &tensor->shape[i]);
+      fputc(')', e->out);
+    }
+    if (i > 0 && i < access->count - 1)
+      fputc(')', e->out);
+  }
+}
+
+static void emit_access(Emitter *e, const IRAccess *access) {
+  fputs(e->tensor_names[access->tensor], e->out);
+  if (e->fn->tensors[access->tensor].rank <= 0)
+    return;
+  fputc('[', e->out);
+  emit_offset(e, access);
+  fputc(']', e->out);
+}
+
+static void emit_call(Emitter *e, const IRExpr *expr) {
+  static const struct {
+    const char *name;
+    int args;
+    const char *c_name;
+  } builtins[] = {
+      {"sqrt", 1, "sqrtf"}, {"exp", 1, "expf"},   {"log", 1, "logf"},
+      {"abs", 1, "fabsf"},  {"tanh", 1, "tanhf"}, {"min", 2, "fminf"},
+      {"max", 2, "fmaxf"},
+  };
+
+  const char *name = expr->data.call.name;
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+    if (strcmp(name, builtins[i].name) != 0)
+      continue;
+    if (expr->data.call.arg_count != builtins[i].args) {
+      codegen_error(e, "%s takes %d argument%s", name, builtins[i].args,
+                    builtins[i].args == 1 ? "" : "s");
+      return;
+    }
+    fprintf(e->out, "%s(", builtins[i].c_name);
+    for (int a = 0; a < builtins[i].args; a++) {
+      if (a > 0)
+        fputs(", ", e->out);
+      emit_value(e, expr->data.call.args[a]);
+    }
+    fputc(')', e->out);
+    return;
+  }
+
+  codegen_error(e, "unsupported call to '%s'", name);
+}
+
+static bool is_condition(TokenType op) {
+  switch (op) {
+  case LESS:
+  case LESS_EQUAL:
+  case GREATER:
+  case GREATER_EQUAL:
+  case EQUAL_EQUAL:
+  case BANG_EQUAL:
+  case AND:
+  case OR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void emit_value(Emitter *e, const IRExpr *expr) {
+  if (expr == NULL) {
+    codegen_error(e, "missing expression");
+    return;
+  }
+
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+    emit_float(e, (double)expr->data.int_value);
+    break;
+  case IR_EXPR_FLOAT:
+    emit_float(e, (double)(float)expr->data.float_value);
+    break;
+  case IR_EXPR_SYMBOL:
+    fprintf(e->out, "(float)%s", e->symbol_names[expr->data.symbol]);
+    break;
+  case IR_EXPR_LOAD:
+    emit_access(e, &expr->data.load);
+    break;
+  case IR_EXPR_BINARY: {
+    TokenType op = expr->data.binary.op;
+    if (is_condition(op)) {
+      fputs("(float)", e->out);
+      emit_cond(e, expr);
+      break;
+    }
+    if (op != PLUS && op != MINUS && op != STAR) {
+      codegen_error(e, "unsupported operator %s", token_type_name(op));
+      break;
+    }
+    fputc('(', e->out);
+    emit_value(e, expr->data.binary.left);
+    fputs(op == PLUS ? " + " : op == MINUS ? " - " : " * ", e->out);
+    emit_value(e, expr->data.binary.right);
+    fputc(')', e->out);
+    break;
+  }
+  case IR_EXPR_UNARY:
+    if (expr->data.unary.op == BANG) {
+      fputs("(float)", e->out);
+      emit_cond(e, expr);
+    } else {
+      fputs("(-", e->out);
+      emit_value(e, expr->data.unary.operand);
+      fputc(')', e->out);
+    }
+    break;
+  case IR_EXPR_CALL:
+    emit_call(e, expr);
+    break;
+  }
+}
+
+static void emit_cond(Emitter *e, const IRExpr *expr) {
+  if (expr->kind == IR_EXPR_UNARY && expr->data.unary.op == BANG) {
+    fputc('!', e->out);
+    emit_cond(e, expr->data.unary.operand);
+    return;
+  }
+  if (expr->kind != IR_EXPR_BINARY || !is_condition(expr->data.binary.op)) {
+    fputc('(', e->out);
+    emit_value(e, expr);
+    fputs(" != 0.0f)", e->out);
+    return;
+  }
+
+  TokenType op = expr->data.binary.op;
+  bool logical = op == AND || op == OR;
+  const char *c_op = op == AND             ? " && "
+                     : op == OR            ? " || "
+                     : op == LESS          ? " < "
+                     : op == LESS_EQUAL    ? " <= "
+                     : op == GREATER       ? " > "
+                     : op == GREATER_EQUAL ? " >= "
+                     : op == EQUAL_EQUAL   ? " == "
+                                           : " != ";
+  fputc('(', e->out);
+  if (logical)
+    emit_cond(e, expr->data.binary.left);
+  else
+    emit_value(e, expr->data.binary.left);
+  fputs(c_op, e->out);
+  if (logical)
+    emit_cond(e, expr->data.binary.right);
+  else
+    emit_value(e, expr->data.binary.right);
+  fputc(')', e->out);
+}
+
+static void emit_frees(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  for (int t = fn->param_count; t < fn->tensor_count; t++) {
+    if (fn->tensors[t].rank > 0 && t != e->alias && e->plan.slots[t] < 0)
+      emit_line(e, "ein_free(%s);", e->tensor_names[t]);
+  }
+  if (e->plan.slot_count > 0)
+    emit_line(e, "ein_free(ein_workspace);");
+}
+
+// Whether control can reach the end of `list` without returning.
+static bool falls_through(const IRList *list) {
+  if (list->count == 0)
+    return true;
+  const IRNode *last = list->items[list->count - 1];
+  if (last->kind == IR_RETURN)
+    return false;
+  if (last->kind == IR_IF)
+    return falls_through(&last->data.if_else.then_body) ||
+           falls_through(&last->data.if_else.else_body);
+  return true;
+}
+
+static void emit_list(Emitter *e, const IRList *list);
+
+// Value of `expr` for `width` consecutive iterations of `var`, as checked by
+// vectorize_function: anything not moving with `var` is broadcast.
+static void emit_vector(Emitter *e, const IRExpr *expr, int var, int width) {
+  if (!ir_expr_uses_symbol(expr, var)) {
+    fprintf(e->out, "ein_splat_f32x%d(", width);
+    emit_value(e, expr);
+    fputc(')', e->out);
+    return;
+  }
+
+  switch (expr->kind) {
+  case IR_EXPR_SYMBOL:
+    fprintf(e->out, "ein_iota_f32x%d(%s)", width, e->symbol_names[var]);
+    break;
+  case IR_EXPR_LOAD:
+    fprintf(e->out, "ein_load_f32x%d(&", width);
+    emit_access(e, &expr->data.load);
+    fputc(')', e->out);
+    break;
+  case IR_EXPR_BINARY: {
+    TokenType op = expr->data.binary.op;
+    fputc('(', e->out);
+    emit_vector(e, expr->data.binary.left, var, width);
+    fputs(op == PLUS ? " + " : op == MINUS ? " - " : " * ", e->out);
+    emit_vector(e, expr->data.binary.right, var, width);
+    fputc(')', e->out);
+    break;
+  }
+  case IR_EXPR_UNARY:
+    fputs("(-", e->out);
+    emit_vector(e, expr->data.unary.operand, var, width);
+    fputc(')', e->out);
+    break;
+  case IR_EXPR_CALL:
+    fprintf(e->out, "ein_%s_f32x%d(", expr->data.call.name, width);
+    emit_vector(e, expr->data.call.args[0], var, width);
+    fputs(", ", e->out);
+    emit_vector(e, expr->data.call.args[1], var, width);
+    fputc(')', e->out);
+    break;
+  default:
+    codegen_error(e, "cannot vectorise expression");
+    break;
+  }
+}
+
+// A loop marked by vectorize_function runs `width` iterations at a time,
+// with one vector accumulator per reduction, and finishes the remainder with
+// the scalar loop. Compilers without vector extensions only see the latter.
+static void emit_vector_loop(Emitter *e, const IRNode *node) {
+  int var = node->data.loop.var;
+  int width = node->data.loop.vector_width;
+  const char *name = e->symbol_names[var];
+  const IRList *body = &node->data.loop.body;
+
+  emit_line(e, "{");
+  e->indent++;
+  emit_indent(e);
+  fprintf(e->out, "long %s = ", name);
+  emit_bound(e, &node->data.loop.lower, false);
+  fputs(";\n", e->out);
+  emit_indent(e);
+  fputs("const long ein_end = ", e->out);
+  emit_bound(e, &node->data.loop.upper, true);
+  fputs(";\n#ifdef EIN_VECTOR\n", e->out);
+
+  for (int i = 0; i < body->count; i++) {
+    if (!ir_access_uses_symbol(&body->items[i]->data.stmt.target, var))
+      emit_line(e, "ein_f32x%d ein_acc%d = ein_splat_f32x%d(0.0f);", width, i,
+                width);
+  }
+  emit_line(e, "for (; %s + %d <= ein_end; %s += %d) {", name, width, name,
+            width);
+  e->indent++;
+  for (int i = 0; i < body->count; i++) {
+    const IRNode *stmt = body->items[i];
+    const IRAccess *target = &stmt->data.stmt.target;
+    emit_indent(e);
+    if (ir_access_uses_symbol(target, var)) {
+      fprintf(e->out, "ein_store_f32x%d(&", width);
+      emit_access(e, target);
+      fputs(", ", e->out);
+      emit_vector(e, stmt->data.stmt.value, var, width);
+      fputs(");\n", e->out);
+    } else {
+      fprintf(e->out, "ein_acc%d += ", i);
+      emit_vector(e, ir_reduction_operand(stmt), var, width);
+      fputs(";\n", e->out);
+    }
+  }
+  e->indent--;
+  emit_line(e, "}");
+  for (int i = 0; i < body->count; i++) {
+    const IRNode *stmt = body->items[i];
+    const IRAccess *target = &stmt->data.stmt.target;
+    if (ir_access_uses_symbol(target, var))
+      continue;
+    emit_indent(e);
+    emit_access(e, target);
+    fputs(" = ", e->out);
+    emit_access(e, target);
+    fprintf(e->out, " %c ein_sum_f32x%d(ein_acc%d);\n",
+            stmt->data.stmt.value->data.binary.op == MINUS ? '-' : '+', width,
+            i);
+  }
+  fputs("#endif\n", e->out);
+
+  emit_line(e, "for (; %s < ein_end; %s++) {", name, name);
+  e->indent++;
+  emit_list(e, body);
+  e->indent--;
+  emit_line(e, "}");
+  e->indent--;
+  emit_line(e, "}");
+}
+
+// What the body of a parallel loop needs from the function around it.
+typedef struct Captures {
+  bool *symbols; // Size parameters and enclosing loop variables used.
+  bool *tensors; // Tensors used.
+  bool *stored;  // Tensors stored to in the loop.
+} Captures;
+
+static void capture_affine(Captures *c, const AffineExpr *expr) {
+  for (int t = 0; t < expr->term_count; t++)
+    c->symbols[expr->terms[t].symbol] = true;
+}
+
+static void capture_expr(Captures *c, const IRFunction *fn,
+                         const IRExpr *expr);
+
+// Offsets use the extents past the first, and checked subscripts their
+// own, as emit_offset writes them.
+static void capture_access(Captures *c, const IRFunction *fn,
+                           const IRAccess *access) {
+  const IRTensor *tensor = &fn->tensors[access->tensor];
+  c->tensors[access->tensor] = true;
+  for (int d = 0; d < access->count; d++) {
+    if (d > 0 || !access->indices[d].proven)
+      capture_affine(c, &tensor->shape[d]);
+    if (access->indices[d].affine)
+      capture_affine(c, &access->indices[d].expr);
+    else
+      capture_expr(c, fn, access->indices[d].general);
+  }
+}
+
+static void capture_expr(Captures *c, const IRFunction *fn,
+                         const IRExpr *expr) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_SYMBOL:
+    c->symbols[expr->data.symbol] = true;
+    break;
+  case IR_EXPR_LOAD:
+    capture_access(c, fn, &expr->data.load);
+    break;
+  case IR_EXPR_BINARY:
+    capture_expr(c, fn, expr->data.binary.left);
+    capture_expr(c, fn, expr->data.binary.right);
+    break;
+  case IR_EXPR_UNARY:
+    capture_expr(c, fn, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      capture_expr(c, fn, expr->data.call.args[i]);
+    break;
+  default:
+    break;
+  }
+}
+
+static void capture_node(Captures *c, const IRFunction *fn,
+                         const IRNode *node, bool *declared) {
+  switch (node->kind) {
+  case IR_LOOP:
+    for (int i = 0; i < node->data.loop.lower.count; i++)
+      capture_affine(c, &node->data.loop.lower.exprs[i]);
+    for (int i = 0; i < node->data.loop.upper.count; i++)
+      capture_affine(c, &node->data.loop.upper.exprs[i]);
+    declared[node->data.loop.var] = true;
+    for (int i = 0; i < node->data.loop.body.count; i++)
+      capture_node(c, fn, node->data.loop.body.items[i], declared);
+    break;
+  case IR_STMT:
+    capture_expr(c, fn, node->data.stmt.value);
+    if (node->data.stmt.target.tensor >= 0) {
+      capture_access(c, fn, &node->data.stmt.target);
+      c->stored[node->data.stmt.target.tensor] = true;
+    }
+    break;
+  case IR_IF:
+    capture_expr(c, fn, node->data.if_else.condition);
+    for (int i = 0; i < node->data.if_else.then_body.count; i++)
+      capture_node(c, fn, node->data.if_else.then_body.items[i], declared);
+    for (int i = 0; i < node->data.if_else.else_body.count; i++)
+      capture_node(c, fn, node->data.if_else.else_body.items[i], declared);
+    break;
+  case IR_RETURN:
+    break;
+  }
+}
+
+static Captures collect_captures(const IRFunction *fn, const IRNode *loop) {
+  Captures c;
+  c.symbols = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  c.tensors = (bool *)calloc(fn->tensor_count + 1, sizeof(bool));
+  c.stored = (bool *)calloc(fn->tensor_count + 1, sizeof(bool));
+  bool *declared = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  assert(c.symbols != NULL && c.tensors != NULL && c.stored != NULL &&
+         declared != NULL);
+  // The loop's upper bound only goes into the trip count at the call.
+  for (int i = 0; i < loop->data.loop.lower.count; i++)
+    capture_affine(&c, &loop->data.loop.lower.exprs[i]);
+  declared[loop->data.loop.var] = true;
+  for (int i = 0; i < loop->data.loop.body.count; i++)
+    capture_node(&c, fn, loop->data.loop.body.items[i], declared);
+  for (int i = 0; i < fn->symbol_count; i++)
+    c.symbols[i] = c.symbols[i] && !declared[i];
+  free(declared);
+  return c;
+}
+
+static void free_captures(Captures *c) {
+  free(c->symbols);
+  free(c->tensors);
+  free(c->stored);
+}
+
+// Scalars the loop stores to are private to each iteration, as
+// parallelize_function checked; everything else is passed in.
+static bool captured_tensor(const Emitter *e, const Captures *c, int t) {
+  return c->tensors[t] && (e->fn->tensors[t].rank > 0 || !c->stored[t]);
+}
+
+static void parallel_name(const Emitter *e, char *buffer, size_t size,
+                          const char *kind, int index) {
+  char name[256];
+  c_function_name(name, sizeof(name), e->fn->name);
+  snprintf(buffer, size, "%s__%s%d", name, kind, index);
+}
+
+// A parallel loop calls its body, outlined by emit_parallel_body, through
+// ein_parallel with the values it captures packed into a struct.
+static void emit_parallel_loop(Emitter *e, const IRNode *node) {
+  char body[300], context[300];
+  int index = e->parallel_count++;
+  parallel_name(e, body, sizeof(body), "par", index);
+  parallel_name(e, context, sizeof(context), "ctx", index);
+  Captures c = collect_captures(e->fn, node);
+
+  emit_line(e, "{");
+  e->indent++;
+  emit_indent(e);
+  fprintf(e->out, "%s ein_ctx = {", context);
+  bool first = true;
+  for (int i = 0; i < e->fn->symbol_count; i++) {
+    if (!c.symbols[i])
+      continue;
+    fprintf(e->out, "%s%s", first ? "" : ", ", e->symbol_names[i]);
+    first = false;
+  }
+  for (int t = 0; t < e->fn->tensor_count; t++) {
+    if (!captured_tensor(e, &c, t))
+      continue;
+    fprintf(e->out, "%s%s", first ? "" : ", ", e->tensor_names[t]);
+    first = false;
+  }
+  fprintf(e->out, "%s};\n", first ? "0" : "");
+  emit_indent(e);
+  fputs("const long ein_lo = ", e->out);
+  emit_bound(e, &node->data.loop.lower, false);
+  fputs(";\n", e->out);
+  emit_indent(e);
+  long step = node->data.loop.step;
+  fputs("ein_parallel(ein_max(0, ((", e->out);
+  emit_bound(e, &node->data.loop.upper, true);
+  if (step == 1)
+    fprintf(e->out, ") - ein_lo)), %s, &ein_ctx);\n", body);
+  else
+    fprintf(e->out, ") - ein_lo + %ld) / %ld), %s, &ein_ctx);\n", step - 1,
+            step, body);
+  e->indent--;
+  emit_line(e, "}");
+  free_captures(&c);
+}
+
+// A nest marked by gemm_function becomes one call; row-major matrices have
+// their leading dimension in the second extent.
+static void emit_gemm(Emitter *e, const IRGemm *gemm) {
+  const IRTensor *tensors = e->fn->tensors;
+  emit_indent(e);
+  fprintf(e->out, "ein_sgemm%s(%d, %d, ", gemm->parallel ? "_parallel" : "",
+          gemm->trans_a, gemm->trans_b);
+  emit_affine(e, &gemm->m);
+  fputs(", ", e->out);
+  emit_affine(e, &gemm->n);
+  fputs(", ", e->out);
+  emit_affine(e, &gemm->k);
+  fprintf(e->out, ", %s, %s, ", gemm->alpha < 0 ? "-1.0f" : "1.0f",
+          e->tensor_names[gemm->a]);
+  emit_affine(e, &tensors[gemm->a].shape[1]);
+  fprintf(e->out, ", %s, ", e->tensor_names[gemm->b]);
+  emit_affine(e, &tensors[gemm->b].shape[1]);
+  fprintf(e->out, ", %s, ", e->tensor_names[gemm->c]);
+  emit_affine(e, &tensors[gemm->c].shape[1]);
+  fputs(");\n", e->out);
+}
+
+static void emit_node(Emitter *e, const IRNode *node) {
+  switch (node->kind) {
+  case IR_LOOP: {
+    if (node->data.loop.gemm != NULL) {
+      emit_gemm(e, node->data.loop.gemm);
+      break;
+    }
+    if (node->data.loop.parallel) {
+      emit_parallel_loop(e, node);
+      break;
+    }
+    if (node->data.loop.vector_width > 0) {
+      emit_vector_loop(e, node);
+      break;
+    }
+    const char *var = e->symbol_names[node->data.loop.var];
+    emit_indent(e);
+    fprintf(e->out, "for (long %s = ", var);
+    emit_bound(e, &node->data.loop.lower, false);
+    fprintf(e->out, "; %s < ", var);
+    emit_bound(e, &node->data.loop.upper, true);
+    if (node->data.loop.step == 1)
+      fprintf(e->out, "; %s++) {\n", var);
+    else
+      fprintf(e->out, "; %s += %ld) {\n", var, node->data.loop.step);
+    e->indent++;
+    emit_list(e, &node->data.loop.body);
+    e->indent--;
+    emit_line(e, "}");
+    break;
+  }
+  case IR_STMT:
+    emit_indent(e);
+    if (node->data.stmt.target.tensor < 0) {
+      fputs("(void)", e->out);
+    } else {
+      emit_access(e, &node->data.stmt.target);
+      fputs(" = ", e->out);
+    }
+    emit_value(e, node->data.stmt.value);
+    fputs(";\n", e->out);
+    break;
+  case IR_IF:
+    emit_indent(e);
+    fputs("if ", e->out);
+    emit_cond(e, node->data.if_else.condition);
+    fputs(" {\n", e->out);
+    e->indent++;
+    emit_list(e, &node->data.if_else.then_body);
+    e->indent--;
+    if (node->data.if_else.else_body.count > 0) {
+      emit_line(e, "} else {");
+      e->indent++;
+      emit_list(e, &node->data.if_else.else_body);
+      e->indent--;
+    }
+    emit_line(e, "}");
+    break;
+  case IR_RETURN: {
+    int t = node->data.ret.tensor;
+    if (t >= 0 && t != e->alias && e->fn->result.rank > 0) {
+      emit_indent(e);
+      fprintf(e->out, "memcpy(ein_out, %s, sizeof(float) * ",
+              e->tensor_names[t]);
+      emit_size(e, t);
+      fputs(");\n", e->out);
+    }
+    emit_frees(e);
+    if (t < 0 && node->data.ret.value != NULL && e->fn->result.rank == 0) {
+      emit_indent(e);
+      fputs("return ", e->out);
+      emit_value(e, node->data.ret.value);
+      fputs(";\n", e->out);
+    } else {
+      emit_line(e, e->fn->result.rank == 0 ? "return 0.0f;" : "return;");
+    }
+    break;
+  }
+  }
+}
+
+static void emit_list(Emitter *e, const IRList *list) {
+  for (int i = 0; i < list->count && !e->failed; i++)
+    emit_node(e, list->items[i]);
+}
+
+// The context struct and range function for one parallel loop. Each call
+// runs iterations [ein_begin, ein_end) of the loop, counted from 0.
+static void emit_parallel_body(Emitter *e, const IRNode *node, int index) {
+  const IRFunction *fn = e->fn;
+  char body[300], context[300];
+  parallel_name(e, body, sizeof(body), "par", index);
+  parallel_name(e, context, sizeof(context), "ctx", index);
+  Captures c = collect_captures(fn, node);
+
+  fputs("\ntypedef struct {\n", e->out);
+  bool any = false;
+  for (int i = 0; i < fn->symbol_count; i++) {
+    if (c.symbols[i])
+      fprintf(e->out, "  long %s;\n", e->symbol_names[i]);
+    any = any || c.symbols[i];
+  }
+  for (int t = 0; t < fn->tensor_count; t++) {
+    if (!captured_tensor(e, &c, t))
+      continue;
+    if (fn->tensors[t].rank <= 0)
+      fprintf(e->out, "  float %s;\n", e->tensor_names[t]);
+    else
+      fprintf(e->out, "  %sfloat *%s;\n", e->stored[t] ? "" : "const ",
+              e->tensor_names[t]);
+    any = true;
+  }
+  if (!any)
+    fputs("  int ein_unused;\n", e->out);
+  fprintf(e->out, "} %s;\n", context);
+
+  int align = (int)strlen(body) + 13;
+  fprintf(e->out,
+          "\nstatic void %s(void *ein_context, long ein_begin, long ein_end,\n"
+          "%*sint ein_worker) {\n",
+          body, align, "");
+  e->indent = 1;
+  emit_line(e, "const %s *ein_ctx = (const %s *)ein_context;", context,
+            context);
+  for (int i = 0; i < fn->symbol_count; i++) {
+    if (c.symbols[i])
+      emit_line(e, "const long %s = ein_ctx->%s;", e->symbol_names[i],
+                e->symbol_names[i]);
+  }
+  for (int t = 0; t < fn->tensor_count; t++) {
+    const char *name = e->tensor_names[t];
+    if (!c.tensors[t])
+      continue;
+    if (fn->tensors[t].rank > 0)
+      emit_line(e, "%sfloat *restrict %s = ein_ctx->%s;",
+                e->stored[t] ? "" : "const ", name, name);
+    else if (c.stored[t]) {
+      emit_line(e, "float %s = 0.0f;", name);
+      e->private_scalar[t] = true;
+    }
+    else
+      emit_line(e, "const float %s = ein_ctx->%s;", name, name);
+  }
+  if (!any)
+    emit_line(e, "(void)ein_ctx;");
+  emit_line(e, "(void)ein_worker;");
+
+  const char *var = e->symbol_names[node->data.loop.var];
+  long step = node->data.loop.step;
+  emit_indent(e);
+  fputs("const long ein_lo = ", e->out);
+  emit_bound(e, &node->data.loop.lower, false);
+  fputs(";\n", e->out);
+  if (step == 1)
+    emit_line(e, "for (long %s = ein_lo + ein_begin; %s < ein_lo + ein_end; "
+                 "%s++) {",
+              var, var, var);
+  else
+    emit_line(e, "for (long %s = ein_lo + ein_begin * %ld; %s < ein_lo + "
+                 "ein_end * %ld; %s += %ld) {",
+              var, step, var, step, var, step);
+  e->indent++;
+  emit_list(e, &node->data.loop.body);
+  e->indent--;
+  emit_line(e, "}");
+  fputs("}\n", e->out);
+  free_captures(&c);
+}
+
+// Bodies are emitted in the order emit_node reaches their loops, which
+// numbers them the same way.
+static void emit_parallel_bodies(Emitter *e, const IRList *list) {
+  for (int i = 0; i < list->count && !e->failed; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP && node->data.loop.parallel) {
+      emit_parallel_body(e, node, e->parallel_count++);
+    } else if (node->kind == IR_LOOP) {
+      emit_parallel_bodies(e, &node->data.loop.body);
+    } else if (node->kind == IR_IF) {
+      emit_parallel_bodies(e, &node->data.if_else.then_body);
+      emit_parallel_bodies(e, &node->data.if_else.else_body);
+    }
+  }
+}
+
+static void emit_signature(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  char name[256];
+  c_function_name(name, sizeof(name), fn->name);
+  fprintf(e->out, "%s %s(", fn->result.rank == 0 ? "float" : "void", name);
+
+  bool first = true;
+  for (int i = 0; i < fn->symbol_count; i++) {
+    if (fn->symbols[i].kind != IR_SYM_PARAM)
+      continue;
+    fprintf(e->out, "%slong %s", first ? "" : ", ", e->symbol_names[i]);
+    first = false;
+  }
+  for (int t = 0; t < fn->param_count; t++) {
+    fputs(first ? "" : ", ", e->out);
+    first = false;
+    if (fn->tensors[t].rank <= 0)
+      fprintf(e->out, "float %s", e->tensor_names[t]);
+    else
+      fprintf(e->out, "%sfloat *restrict %s", e->stored[t] ? "" : "const ",
+              e->tensor_names[t]);
+  }
+  if (fn->result.rank > 0)
+    fprintf(e->out, "%sfloat *restrict ein_out", first ? "" : ", ");
+  else if (first)
+    fputs("void", e->out);
+  fputs(")", e->out);
+}
+
+// Uniform wrapper for callers that only know the function at run time.
+static void emit_entry(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  char name[256], entry[256];
+  c_function_name(name, sizeof(name), fn->name);
+  c_entry_name(entry, sizeof(entry), fn->name);
+
+  int sizes = 0;
+  for (int i = 0; i < fn->symbol_count; i++)
+    sizes += fn->symbols[i].kind == IR_SYM_PARAM;
+
+  fprintf(e->out,
+          "\nvoid %s(const long *sizes, float *const *args, float *out) {\n",
+          entry);
+  if (sizes == 0)
+    fputs("  (void)sizes;\n", e->out);
+  if (fn->param_count == 0)
+    fputs("  (void)args;\n", e->out);
+  if (fn->result.rank < 0)
+    fputs("  (void)out;\n", e->out);
+  fprintf(e->out, "  %s%s(", fn->result.rank == 0 ? "*out = " : "", name);
+  bool first = true;
+  for (int size = 0; size < sizes; size++) {
+    fprintf(e->out, "%ssizes[%d]", first ? "" : ", ", size);
+    first = false;
+  }
+  for (int t = 0; t < fn->param_count; t++) {
+    fprintf(e->out, "%s%sargs[%d]", first ? "" : ", ",
+            fn->tensors[t].rank <= 0 ? "*" : "", t);
+    first = false;
+  }
+  if (fn->result.rank > 0)
+    fprintf(e->out, "%sout", first ? "" : ", ");
+  fputs(");\n}\n", e->out);
+}
+
+static bool same_shape(const IRTensor *a, const IRTensor *b) {
+  if (a->rank != b->rank)
+    return false;
+  for (int d = 0; d < a->rank; d++) {
+    if (!affine_equal(&a->shape[d], &b->shape[d]))
+      return false;
+  }
+  return true;
+}
+
+// Sizes each slot for the largest local in it and allocates them all at
+// once, zeroed.
+static void emit_workspace(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  int *members = (int *)malloc(sizeof(int) * (fn->tensor_count + 1));
+  assert(members != NULL);
+  for (int s = 0; s < e->plan.slot_count; s++) {
+    int count = 0;
+    for (int t = fn->param_count; t < fn->tensor_count; t++) {
+      bool seen = e->plan.slots[t] != s;
+      for (int i = 0; i < count && !seen; i++)
+        seen = same_shape(&fn->tensors[members[i]], &fn->tensors[t]);
+      if (!seen)
+        members[count++] = t;
+    }
+
+    emit_indent(e);
+    fprintf(e->out, "long ein_slot%d = ", s);
+    for (int i = 0; i < count; i++) {
+      fputs(i + 1 < count ? "ein_max(ein_slot_size(" : "ein_slot_size(",
+            e->out);
+      emit_size(e, members[i]);
+      fputs(i + 1 < count ? "), " : ")", e->out);
+    }
+    for (int i = 1; i < count; i++)
+      fputc(')', e->out);
+    fputs(";\n", e->out);
+  }
+  free(members);
+
+  if (e->plan.slot_count == 0)
+    return;
+  emit_indent(e);
+  fputs("float *ein_workspace = ein_alloc(", e->out);
+  for (int s = 0; s < e->plan.slot_count; s++)
+    fprintf(e->out, "%sein_slot%d", s > 0 ? " + " : "", s);
+  fputs(");\n", e->out);
+}
+
+static void emit_function(Emitter *e) {
+  const IRFunction *fn = e->fn;
+  e->stored = (bool *)calloc(fn->tensor_count + 1, sizeof(bool));
+  e->private_scalar = (bool *)calloc(fn->tensor_count + 1, sizeof(bool));
+  assert(e->stored != NULL && e->private_scalar != NULL);
+  assign_names(e);
+
+  // A local that is the only tensor ever returned is computed in place in
+  // the caller's buffer instead of being copied out at the end.
+  int returned = -1;
+  scan_list(e, &fn->body, &returned);
+  e->alias = returned >= fn->param_count && fn->result.rank > 0 ? returned
+                                                                 : -1;
+
+  emit_parallel_bodies(e, &fn->body);
+  e->parallel_count = 0;
+
+  fputc('\n', e->out);
+  emit_signature(e);
+  fputs(" {\n", e->out);
+  e->indent = 1;
+
+  plan_workspace(fn, &e->plan);
+  emit_workspace(e);
+  for (int t = fn->param_count; t < fn->tensor_count; t++) {
+    const char *name = e->tensor_names[t];
+    int slot = e->plan.slots[t];
+    if (fn->tensors[t].rank <= 0) {
+      if (!e->private_scalar[t])
+        emit_line(e, "float %s = 0.0f;", name);
+      continue;
+    }
+    emit_indent(e);
+    if (slot >= 0) {
+      // Locals sharing a slot alias each other, though never while both
+      // are live.
+      fprintf(e->out, "float *%s%s = ein_workspace",
+              workspace_slot_shared(&e->plan, t) ? "" : "restrict ", name);
+      for (int s = 0; s < slot; s++)
+        fprintf(e->out, " + ein_slot%d", s);
+      fputs(";\n", e->out);
+      continue;
+    }
+    if (t == e->alias) {
+      fprintf(e->out, "float *restrict %s = ein_out;\n", name);
+      // The caller's buffer is not zeroed as ein_alloc's is, unless the
+      // first statement overwrites all of it anyway.
+      if (fn->body.count > 0 && stores_every_element(fn, fn->body.items[0], t))
+        continue;
+      emit_indent(e);
+      fprintf(e->out, "memset(%s, 0, sizeof(float) * ", name);
+    } else {
+      fprintf(e->out, "float *restrict %s = ein_alloc(", name);
+    }
+    emit_size(e, t);
+    fputs(");\n", e->out);
+  }
+
+  emit_list(e, &fn->body);
+  if (falls_through(&fn->body)) {
+    emit_frees(e);
+    if (fn->result.rank == 0)
+      emit_line(e, "return 0.0f;");
+  }
+  fputs("}\n", e->out);
+  emit_entry(e);
+
+  free_names(e);
+  free_workspace_plan(&e->plan);
+  free(e->stored);
+  free(e->private_scalar);
+}
+
+static const char *prelude =
+    "// Generated by ein from the loop-nest IR.\n"
+    "\n"
+    "#include <math.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static inline long ein_min(long a, long b) { return a < b ? a : b; }\n"
+    "static inline long ein_max(long a, long b) { return a > b ? a : b; }\n"
+    "\n"
+    "static inline long ein_index(long i, long n) {\n"
+    "  if (i < 0 || i >= n) {\n"
+    "    fprintf(stderr, \"ein: index %ld out of bounds for extent %ld\\n\", "
+    "i, n);\n"
+    "    abort();\n"
+    "  }\n"
+    "  return i;\n"
+    "}\n"
+    "\n"
+    "// Zeroed and 64-byte aligned, with the block from calloc kept just\n"
+    "// before the data for ein_free.\n"
+    "static inline float *ein_alloc(long n) {\n"
+    "  size_t bytes = sizeof(float) * (size_t)(n > 0 ? n : 1);\n"
+    "  char *block = (char *)calloc(bytes + 64 + sizeof(void *), 1);\n"
+    "  if (block == NULL)\n"
+    "    abort();\n"
+    "  uintptr_t p = (uintptr_t)(block + sizeof(void *));\n"
+    "  p = (p + 63) & ~(uintptr_t)63;\n"
+    "  ((void **)p)[-1] = block;\n"
+    "  return (float *)p;\n"
+    "}\n"
+    "\n"
+    "static inline void ein_free(float *p) { free(((void **)p)[-1]); }\n"
+    "\n"
+    "// Elements of a workspace slot holding `n`, kept to whole cache lines.\n"
+    "static inline long ein_slot_size(long n) {\n"
+    "  return (ein_max(n, 1) + 15) / 16 * 16;\n"
+    "}\n";
+
+// Vector types and helpers for one width, written with '@' for the number
+// of lanes. Loads and stores go through memcpy, so they need no alignment.
+static const char *vector_prelude =
+    "\n"
+    "#ifdef EIN_VECTOR\n"
+    "typedef float ein_f32x@ __attribute__((vector_size(@ * sizeof(float))));\n"
+    "typedef int ein_i32x@ __attribute__((vector_size(@ * sizeof(int))));\n"
+    "\n"
+    "static inline ein_f32x@ ein_load_f32x@(const float *p) {\n"
+    "  ein_f32x@ v;\n"
+    "  memcpy(&v, p, sizeof(v));\n"
+    "  return v;\n"
+    "}\n"
+    "\n"
+    "static inline void ein_store_f32x@(float *p, ein_f32x@ v) {\n"
+    "  memcpy(p, &v, sizeof(v));\n"
+    "}\n"
+    "\n"
+    "static inline ein_f32x@ ein_splat_f32x@(float s) {\n"
+    "  ein_f32x@ v = {0};\n"
+    "  return v + s;\n"
+    "}\n"
+    "\n"
+    "static inline ein_f32x@ ein_iota_f32x@(long i) {\n"
+    "  ein_f32x@ v;\n"
+    "  for (int k = 0; k < @; k++)\n"
+    "    v[k] = (float)(i + k);\n"
+    "  return v;\n"
+    "}\n"
+    "\n"
+    "static inline float ein_sum_f32x@(ein_f32x@ v) {\n"
+    "  float s = 0.0f;\n"
+    "  for (int k = 0; k < @; k++)\n"
+    "    s += v[k];\n"
+    "  return s;\n"
+    "}\n"
+    "\n"
+    "// As fminf and fmaxf, a NaN operand yields the other one.\n"
+    "static inline ein_f32x@ ein_min_f32x@(ein_f32x@ a, ein_f32x@ b) {\n"
+    "  ein_i32x@ m = (a < b) | (b != b);\n"
+    "  return (ein_f32x@)(((ein_i32x@)a & m) | ((ein_i32x@)b & ~m));\n"
+    "}\n"
+    "\n"
+    "static inline ein_f32x@ ein_max_f32x@(ein_f32x@ a, ein_f32x@ b) {\n"
+    "  ein_i32x@ m = (a > b) | (b != b);\n"
+    "  return (ein_f32x@)(((ein_i32x@)a & m) | ((ein_i32x@)b & ~m));\n"
+    "}\n"
+    "#endif\n";
+
+// Packed, register-blocked GEMM for nests marked by gemm_function. B is
+// packed a KC x NC panel at a time and A an MC x KC block at a time into
+// slivers that the microkernel streams through. MR and the vector width are
+// picked per target when the unit is compiled.
+static const char *gemm_prelude =
+    "\n"
+    "// C[m, n] += alpha * op(A)[m, k] * op(B)[k, n], all row-major.\n"
+    "#if defined(__GNUC__) && !defined(EIN_NO_VECTOR)\n"
+    "// An MR x NR tile of C stays in 2 * MR vector registers while A and B\n"
+    "// stream through packed panels.\n"
+    "#if defined(__AVX512F__)\n"
+    "#define EIN_GEMM_LANES 16\n"
+    "#define EIN_GEMM_MR 14\n"
+    "#elif defined(__AVX__)\n"
+    "#define EIN_GEMM_LANES 8\n"
+    "#define EIN_GEMM_MR 6\n"
+    "#else\n"
+    "#define EIN_GEMM_LANES 4\n"
+    "#define EIN_GEMM_MR 6\n"
+    "#endif\n"
+    "#define EIN_GEMM_NR (2 * EIN_GEMM_LANES)\n"
+    "#define EIN_GEMM_KC 256\n"
+    "#define EIN_GEMM_MC (16 * EIN_GEMM_MR)\n"
+    "#define EIN_GEMM_NC 4096\n"
+    "// Tiles of C that threads take whole.\n"
+    "#define EIN_GEMM_TM EIN_GEMM_MC\n"
+    "#define EIN_GEMM_TN (8 * EIN_GEMM_NR)\n"
+    "\n"
+    "typedef float ein_gemm_v\n"
+    "    __attribute__((vector_size(EIN_GEMM_LANES * sizeof(float))));\n"
+    "\n"
+    "// Rows of A in slivers of MR, each laid out k by k, zero-padded.\n"
+    "static void ein_gemm_pack_a(long mc, long kc, const float *a, long lda,\n"
+    "                            int trans, float *restrict out) {\n"
+    "  for (long i0 = 0; i0 < mc; i0 += EIN_GEMM_MR) {\n"
+    "    for (long p = 0; p < kc; p++) {\n"
+    "      for (long i = i0; i < i0 + EIN_GEMM_MR; i++)\n"
+    "        *out++ = i >= mc  ? 0.0f\n"
+    "                 : trans ? a[p * lda + i]\n"
+    "                         : a[i * lda + p];\n"
+    "    }\n"
+    "  }\n"
+    "}\n"
+    "\n"
+    "// Columns of B in slivers of NR, each laid out k by k, zero-padded.\n"
+    "static void ein_gemm_pack_b(long kc, long nc, const float *b, long ldb,\n"
+    "                            int trans, float *restrict out) {\n"
+    "  for (long j0 = 0; j0 < nc; j0 += EIN_GEMM_NR) {\n"
+    "    for (long p = 0; p < kc; p++) {\n"
+    "      for (long j = j0; j < j0 + EIN_GEMM_NR; j++)\n"
+    "        *out++ = j >= nc  ? 0.0f\n"
+    "                 : trans ? b[j * ldb + p]\n"
+    "                         : b[p * ldb + j];\n"
+    "    }\n"
+    "  }\n"
+    "}\n"
+    "\n"
+    "static void ein_gemm_kernel(long kc, const float *restrict a,\n"
+    "                            const float *restrict b, float *restrict c,\n"
+    "                            long ldc, float alpha, long mr, long nr) {\n"
+    "  ein_gemm_v acc[EIN_GEMM_MR][2];\n"
+    "  ein_gemm_v zero = {0};\n"
+    "#pragma GCC unroll 16\n"
+    "  for (int i = 0; i < EIN_GEMM_MR; i++)\n"
+    "    acc[i][0] = acc[i][1] = zero;\n"
+    "\n"
+    "  for (long p = 0; p < kc; p++) {\n"
+    "    ein_gemm_v b0, b1;\n"
+    "    memcpy(&b0, b, sizeof(b0));\n"
+    "    memcpy(&b1, b + EIN_GEMM_LANES, sizeof(b1));\n"
+    "#pragma GCC unroll 16\n"
+    "    for (int i = 0; i < EIN_GEMM_MR; i++) {\n"
+    "      acc[i][0] += a[i] * b0;\n"
+    "      acc[i][1] += a[i] * b1;\n"
+    "    }\n"
+    "    a += EIN_GEMM_MR;\n"
+    "    b += EIN_GEMM_NR;\n"
+    "  }\n"
+    "\n"
+    "  if (mr == EIN_GEMM_MR && nr == EIN_GEMM_NR) {\n"
+    "#pragma GCC unroll 16\n"
+    "    for (int i = 0; i < EIN_GEMM_MR; i++) {\n"
+    "      ein_gemm_v c0, c1;\n"
+    "      memcpy(&c0, &c[i * ldc], sizeof(c0));\n"
+    "      memcpy(&c1, &c[i * ldc + EIN_GEMM_LANES], sizeof(c1));\n"
+    "      c0 += alpha * acc[i][0];\n"
+    "      c1 += alpha * acc[i][1];\n"
+    "      memcpy(&c[i * ldc], &c0, sizeof(c0));\n"
+    "      memcpy(&c[i * ldc + EIN_GEMM_LANES], &c1, sizeof(c1));\n"
+    "    }\n"
+    "    return;\n"
+    "  }\n"
+    "  for (long i = 0; i < mr; i++) {\n"
+    "    for (long j = 0; j < nr; j++)\n"
+    "      c[i * ldc + j] +=\n"
+    "          alpha * acc[i][j / EIN_GEMM_LANES][j % EIN_GEMM_LANES];\n"
+    "  }\n"
+    "}\n"
+    "\n"
+    "static void ein_sgemm(int trans_a, int trans_b, long m, long n,\n"
+    "                      long k, float alpha, const float *a, long lda,\n"
+    "                      const float *b, long ldb, float *c, long ldc) {\n"
+    "  if (m <= 0 || n <= 0 || k <= 0)\n"
+    "    return;\n"
+    "  float *ap =\n"
+    "      (float *)malloc(sizeof(float) * EIN_GEMM_MC * EIN_GEMM_KC);\n"
+    "  float *bp = (float *)malloc(sizeof(float) * EIN_GEMM_KC *\n"
+    "                              (ein_min(n, EIN_GEMM_NC) + EIN_GEMM_NR));\n"
+    "  if (ap == NULL || bp == NULL)\n"
+    "    abort();\n"
+    "\n"
+    "  for (long jc = 0; jc < n; jc += EIN_GEMM_NC) {\n"
+    "    long nc = ein_min(EIN_GEMM_NC, n - jc);\n"
+    "    for (long pc = 0; pc < k; pc += EIN_GEMM_KC) {\n"
+    "      long kc = ein_min(EIN_GEMM_KC, k - pc);\n"
+    "      const float *bc = trans_b ? &b[jc * ldb + pc] : &b[pc * ldb + jc];\n"
+    "      ein_gemm_pack_b(kc, nc, bc, ldb, trans_b, bp);\n"
+    "      for (long ic = 0; ic < m; ic += EIN_GEMM_MC) {\n"
+    "        long mc = ein_min(EIN_GEMM_MC, m - ic);\n"
+    "        const float *ac =\n"
+    "            trans_a ? &a[pc * lda + ic] : &a[ic * lda + pc];\n"
+    "        ein_gemm_pack_a(mc, kc, ac, lda, trans_a, ap);\n"
+    "        for (long jr = 0; jr < nc; jr += EIN_GEMM_NR) {\n"
+    "          for (long ir = 0; ir < mc; ir += EIN_GEMM_MR) {\n"
+    "            ein_gemm_kernel(kc, &ap[ir * kc], &bp[jr * kc],\n"
+    "                            &c[(ic + ir) * ldc + jc + jr], ldc, alpha,\n"
+    "                            ein_min(EIN_GEMM_MR, mc - ir),\n"
+    "                            ein_min(EIN_GEMM_NR, nc - jr));\n"
+    "          }\n"
+    "        }\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "  free(ap);\n"
+    "  free(bp);\n"
+    "}\n"
+    "#else\n"
+    "#define EIN_GEMM_TM 64\n"
+    "#define EIN_GEMM_TN 256\n"
+    "\n"
+    "static void ein_sgemm(int trans_a, int trans_b, long m, long n,\n"
+    "                      long k, float alpha, const float *a, long lda,\n"
+    "                      const float *b, long ldb, float *c, long ldc) {\n"
+    "  for (long i = 0; i < m; i++) {\n"
+    "    for (long p = 0; p < k; p++) {\n"
+    "      float x = alpha * (trans_a ? a[p * lda + i] : a[i * lda + p]);\n"
+    "      for (long j = 0; j < n; j++) {\n"
+    "        float y = trans_b ? b[j * ldb + p] : b[p * ldb + j];\n"
+    "        c[i * ldc + j] += x * y;\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "}\n"
+    "#endif\n";
+
+// GEMM nests marked parallel split C into tiles for the thread pool.
+static const char *gemm_parallel_prelude =
+    "\n"
+    "typedef struct ein_gemm_job {\n"
+    "  int trans_a, trans_b;\n"
+    "  long m, n, k, tiles_n;\n"
+    "  float alpha;\n"
+    "  const float *a, *b;\n"
+    "  float *c;\n"
+    "  long lda, ldb, ldc;\n"
+    "} ein_gemm_job;\n"
+    "\n"
+    "// Threads take whole tiles of C, each a product of its own.\n"
+    "static void ein_gemm_tiles(void *context, long begin, long end,\n"
+    "                           int worker) {\n"
+    "  const ein_gemm_job *g = (const ein_gemm_job *)context;\n"
+    "  (void)worker;\n"
+    "  for (long t = begin; t < end; t++) {\n"
+    "    long i = t / g->tiles_n * EIN_GEMM_TM;\n"
+    "    long j = t % g->tiles_n * EIN_GEMM_TN;\n"
+    "    const float *a = g->trans_a ? &g->a[i] : &g->a[i * g->lda];\n"
+    "    const float *b = g->trans_b ? &g->b[j * g->ldb] : &g->b[j];\n"
+    "    ein_sgemm(g->trans_a, g->trans_b, ein_min(EIN_GEMM_TM, g->m - i),\n"
+    "              ein_min(EIN_GEMM_TN, g->n - j), g->k, g->alpha, a, g->lda,\n"
+    "              b, g->ldb, &g->c[i * g->ldc + j], g->ldc);\n"
+    "  }\n"
+    "}\n"
+    "\n"
+    "static void ein_sgemm_parallel(int trans_a, int trans_b, long m, long n,\n"
+    "                               long k, float alpha, const float *a,\n"
+    "                               long lda, const float *b, long ldb,\n"
+    "                               float *c, long ldc) {\n"
+    "  if (m <= 0 || n <= 0)\n"
+    "    return;\n"
+    "  long tiles_n = (n + EIN_GEMM_TN - 1) / EIN_GEMM_TN;\n"
+    "  ein_gemm_job job = {trans_a, trans_b, m, n, k, tiles_n, alpha,\n"
+    "                      a, b, c, lda, ldb, ldc};\n"
+    "  ein_parallel((m + EIN_GEMM_TM - 1) / EIN_GEMM_TM * tiles_n,\n"
+    "               ein_gemm_tiles, &job);\n"
+    "}\n";
+
+// Hook for parallel loops. The host points it at a thread pool after
+// loading the unit; left unset, parallel loops run on the calling thread.
+static const char *parallel_prelude =
+    "\n"
+    "typedef void (*ein_range_fn)(void *, long, long, int);\n"
+    "void *ein_parallel_pool = NULL;\n"
+    "void (*ein_parallel_for)(void *, long, ein_range_fn, void *) = NULL;\n"
+    "\n"
+    "static void ein_parallel(long count, ein_range_fn body, void *context) {\n"
+    "  if (ein_parallel_for != NULL)\n"
+    "    ein_parallel_for(ein_parallel_pool, count, body, context);\n"
+    "  else if (count > 0)\n"
+    "    body(context, 0, count, 0);\n"
+    "}\n";
+
+typedef struct Uses {
+  bool widths[CODEGEN_MAX_VECTOR_WIDTH + 1];
+  bool gemm;
+  bool gemm_parallel;
+  bool parallel;
+} Uses;
+
+static void collect_uses(const IRList *list, Uses *uses) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP) {
+      int width = node->data.loop.vector_width;
+      const IRGemm *gemm = node->data.loop.gemm;
+      if (width > 0 && width <= CODEGEN_MAX_VECTOR_WIDTH)
+        uses->widths[width] = true;
+      uses->gemm = uses->gemm || gemm != NULL;
+      uses->gemm_parallel =
+          uses->gemm_parallel || (gemm != NULL && gemm->parallel);
+      uses->parallel = uses->parallel || node->data.loop.parallel;
+      collect_uses(&node->data.loop.body, uses);
+    } else if (node->kind == IR_IF) {
+      collect_uses(&node->data.if_else.then_body, uses);
+      collect_uses(&node->data.if_else.else_body, uses);
+    }
+  }
+}
+
+// Helpers only go into units that use them.
+static void emit_helpers(FILE *out, const IRModule *module) {
+  Uses uses;
+  memset(&uses, 0, sizeof(uses));
+  for (int i = 0; i < module->function_count; i++)
+    collect_uses(&module->functions[i]->body, &uses);
+
+  bool any = false;
+  for (int width = 1; width <= CODEGEN_MAX_VECTOR_WIDTH; width++) {
+    if (!uses.widths[width])
+      continue;
+    if (!any) {
+      fputs("\n#if defined(__GNUC__) && !defined(EIN_NO_VECTOR)\n"
+            "#define EIN_VECTOR 1\n"
+            "#endif\n",
+            out);
+    }
+    any = true;
+    for (const char *c = vector_prelude; *c != '\0'; c++) {
+      if (*c == '@')
+        fprintf(out, "%d", width);
+      else
+        fputc(*c, out);
+    }
+  }
+  if (uses.parallel || uses.gemm_parallel)
+    fputs(parallel_prelude, out);
+  if (uses.gemm)
+    fputs(gemm_prelude, out);
+  if (uses.gemm_parallel)
+    fputs(gemm_parallel_prelude, out);
+}
+
+bool emit_c_module(FILE *out, const IRModule *module) {
+  fputs(prelude, out);
+  emit_helpers(out, module);
+
+  bool ok = true;
+  for (int i = 0; i < module->function_count; i++) {
+    Emitter e;
+    memset(&e, 0, sizeof(e));
+    e.out = out;
+    e.fn = module->functions[i];
+    emit_function(&e);
+    ok = ok && !e.failed;
+  }
+  return ok;
+}
+
+void c_function_name(char *buffer, size_t size, const char *name) {
+  snprintf(buffer, size, "ein_%s", name);
+}
+
+void c_entry_name(char *buffer, size_t size, const char *name) {
+  snprintf(buffer, size, "ein_%s__entry", name);
+}
@@ -0,0 +1,64 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "loop_ir.h"
+#include <stdio.h>
+
+// C back end for the loop-nest IR. Each function of a module becomes one C99
+// function in a self-contained translation unit:
+//
+//   void ein_matmul(long M, long N, long K, const float *restrict A,
+//                   const float *restrict B, float *restrict ein_out);
+//
+// Size parameters come first in the order the IR numbered them, then the
+// parameters in declaration order: tensors as row-major f32 pointers, scalars
+// as floats. A function returning a tensor writes it to the trailing
+// `ein_out` buffer, which must hold the whole result; one returning a scalar
+// returns a float. Tensor arguments must not overlap. Local tensors share
+// one zeroed, 64-byte aligned `ein_workspace` per call, laid out by
+// plan_workspace; a local returned other than through `ein_out` gets its own
+// allocation.
+//
+// Loops become plain `for` loops with affine bounds and subscripts inlined,
+// so the host compiler sees simple strided accesses it can vectorise. Loops
+// marked by vectorize_function are written with GCC vector extensions at the
+// marked width, which GCC and Clang lower to SSE, AVX2 or AVX-512 as the
+// target allows, followed by a scalar loop for the remaining iterations.
+// Other compilers, or any with EIN_NO_VECTOR defined, get only the scalar
+// loop. Vector reductions add up their lanes at the end, so sums may round
+// differently from the scalar order.
+//
+// A nest marked by gemm_function is replaced by a call to `ein_sgemm`, a
+// packed, cache-blocked matrix multiply emitted into the unit, so compiling
+// it with -march=native picks its register blocking for the host's widest
+// vectors. It sums in a different order from the loops it replaces.
+//
+// The body of a loop marked by parallelize_function becomes a static
+// `ein_<name>__parN(context, begin, end, worker)` over a range of its
+// iterations, handed to `ein_parallel_for` along with `ein_parallel_pool`.
+// Units with parallel loops or GEMMs export both as variables; a host that
+// sets them, as the JIT does with its thread pool, runs the ranges on its
+// threads, and otherwise the whole loop runs on the calling thread.
+
+// Widest vector the back end writes, in f32 lanes.
+#define CODEGEN_MAX_VECTOR_WIDTH 16
+
+// Writes the translation unit for `module` to `out`. Constructs the back end
+// cannot express are reported as "Codegen error in function '...': ..." and
+// false is returned; `out` may then hold a partial unit.
+bool emit_c_module(FILE *out, const IRModule *module);
+
+// Every function also gets an entry point with one signature for all:
+//
+//   void ein_matmul__entry(const long *sizes, float *const *args, float *out);
+//
+// `sizes` holds the size parameters in order, `args` one pointer per
+// parameter (scalars point at a single float) and `out` receives the result,
+// whether a tensor or a scalar.
+
+// Symbol names of the generated function and of its entry point for `name`,
+// written to `buffer`.
+void c_function_name(char *buffer, size_t size, const char *name);
+void c_entry_name(char *buffer, size_t size, const char *name);
+
+#endif // !CODEGEN_H
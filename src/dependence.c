@@ -0,0 +1,827 @@
+#include "dependence.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Loops from the analysed one down to an access. Subscripts of accesses
+// nested deeper are not analysed.
+#define DEP_MAX_NEST 32
+
+// Products and sums beyond this are treated as unbounded.
+#define DEP_LIMIT (1L << 28)
+
+// Larger sets of direction vectors for one pair are summed up as one.
+#define DEP_MAX_VECTORS 243
+
+// A loop variable is rewritten as lower + step * n for an iteration count
+// n in [0, last]; `last` is -1 when the upper bound is not a constant
+// distance from the lower one. Without a single lower bound, the variable
+// stands for itself and may take any value.
+typedef struct DepLoop {
+  const IRNode *node;
+  bool counted;
+  AffineExpr lower;
+  long last;
+} DepLoop;
+
+// rest + sum(coeffs[p] * n_p) over the iteration counts of the loops around
+// the access; `rest` holds the size parameters and the variables of loops
+// outside the analysed one, which are the same for both instances.
+typedef struct DepSubscript {
+  bool affine;
+  AffineExpr rest;
+  long coeffs[DEP_MAX_NEST];
+} DepSubscript;
+
+typedef struct DepAccess {
+  const IRAccess *access;
+  bool write;
+  int depth;
+  DepLoop loops[DEP_MAX_NEST];
+  DepSubscript *subscripts;
+} DepAccess;
+
+typedef struct DepWalk {
+  DepLoop stack[DEP_MAX_NEST];
+  int depth;
+  int too_deep; // Loops entered past DEP_MAX_NEST.
+
+  DepAccess *items;
+  int count;
+  int capacity;
+  bool has_return;
+} DepWalk;
+
+static DepLoop describe_loop(const IRNode *node) {
+  const IRBound *lower = &node->data.loop.lower;
+  const IRBound *upper = &node->data.loop.upper;
+  long step = node->data.loop.step;
+  DepLoop loop = {node, false, affine_constant(0), -1};
+
+  if (lower->count == 1) {
+    loop.lower = lower->exprs[0];
+  } else {
+    for (int e = 0; e < lower->count; e++) {
+      if (!affine_is_constant(&lower->exprs[e]))
+        return loop;
+      if (e == 0 || lower->exprs[e].constant > loop.lower.constant)
+        loop.lower = lower->exprs[e];
+    }
+  }
+  loop.counted = true;
+
+  for (int e = 0; e < upper->count; e++) {
+    AffineExpr extent = upper->exprs[e];
+    if (!affine_add(&extent, &loop.lower, -1) ||
+        !affine_is_constant(&extent))
+      continue;
+    long last = extent.constant > 0 ? (extent.constant - 1) / step : 0;
+    if (loop.last < 0 || last < loop.last)
+      loop.last = last;
+  }
+  return loop;
+}
+
+// Rewrites the loop variables innermost first, since a lower bound may
+// bring in the variables of loops further out.
+static DepSubscript rewrite_subscript(const DepWalk *walk,
+                                      const IRIndex *index) {
+  DepSubscript sub;
+  memset(&sub, 0, sizeof(sub));
+  sub.affine = index->affine && walk->too_deep == 0;
+  if (!sub.affine)
+    return sub;
+
+  sub.rest = index->expr;
+  for (int p = walk->depth - 1; p >= 0 && sub.affine; p--) {
+    const DepLoop *loop = &walk->stack[p];
+    int var = loop->node->data.loop.var;
+    long coeff = affine_coeff(&sub.rest, var);
+    if (coeff == 0)
+      continue;
+    if (loop->counted) {
+      sub.coeffs[p] = coeff * loop->node->data.loop.step;
+      sub.affine = affine_substitute(&sub.rest, var, &loop->lower);
+    } else {
+      sub.coeffs[p] = coeff;
+      affine_add_term(&sub.rest, var, -coeff);
+    }
+  }
+  return sub;
+}
+
+static void add_access(DepWalk *walk, const IRAccess *access, bool write) {
+  if (walk->count == walk->capacity) {
+    walk->capacity = walk->capacity > 0 ? walk->capacity * 2 : 16;
+    walk->items = (DepAccess *)realloc(walk->items,
+                                       sizeof(DepAccess) * walk->capacity);
+    assert(walk->items != NULL);
+  }
+  DepAccess *item = &walk->items[walk->count++];
+  item->access = access;
+  item->write = write;
+  item->depth = walk->depth;
+  memcpy(item->loops, walk->stack, sizeof(DepLoop) * walk->depth);
+  item->subscripts = NULL;
+  if (access->count > 0) {
+    item->subscripts =
+        (DepSubscript *)malloc(sizeof(DepSubscript) * access->count);
+    assert(item->subscripts != NULL);
+  }
+  for (int d = 0; d < access->count; d++)
+    item->subscripts[d] = rewrite_subscript(walk, &access->indices[d]);
+}
+
+static void walk_expr(DepWalk *walk, const IRExpr *expr) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    add_access(walk, &expr->data.load, false);
+    for (int i = 0; i < expr->data.load.count; i++)
+      walk_expr(walk, expr->data.load.indices[i].general);
+    break;
+  case IR_EXPR_BINARY:
+    walk_expr(walk, expr->data.binary.left);
+    walk_expr(walk, expr->data.binary.right);
+    break;
+  case IR_EXPR_UNARY:
+    walk_expr(walk, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      walk_expr(walk, expr->data.call.args[i]);
+    break;
+  default:
+    break;
+  }
+}
+
+static void walk_loop(DepWalk *walk, const IRNode *loop);
+
+static void walk_list(DepWalk *walk, const IRList *list) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      walk_loop(walk, node);
+      break;
+    case IR_STMT: {
+      const IRAccess *target = &node->data.stmt.target;
+      walk_expr(walk, node->data.stmt.value);
+      if (target->tensor >= 0) {
+        add_access(walk, target, true);
+        for (int d = 0; d < target->count; d++)
+          walk_expr(walk, target->indices[d].general);
+      }
+      break;
+    }
+    case IR_IF:
+      walk_expr(walk, node->data.if_else.condition);
+      walk_list(walk, &node->data.if_else.then_body);
+      walk_list(walk, &node->data.if_else.else_body);
+      break;
+    case IR_RETURN:
+      walk->has_return = true;
+      break;
+    }
+  }
+}
+
+static void walk_loop(DepWalk *walk, const IRNode *loop) {
+  if (walk->depth == DEP_MAX_NEST) {
+    walk->too_deep++;
+    walk_list(walk, &loop->data.loop.body);
+    walk->too_deep--;
+    return;
+  }
+  walk->stack[walk->depth++] = describe_loop(loop);
+  walk_list(walk, &loop->data.loop.body);
+  walk->depth--;
+}
+
+// Interval arithmetic over the values a sum of terms may take.
+typedef struct Range {
+  long lo;
+  long hi;
+  bool no_lo;
+  bool no_hi;
+} Range;
+
+static Range range_of(long lo, long hi) {
+  Range range = {lo, hi, false, false};
+  return range;
+}
+
+static Range unbounded(void) {
+  Range range = {0, 0, true, true};
+  return range;
+}
+
+static Range loop_range(const DepLoop *loop) {
+  Range range = range_of(0, loop->last);
+  range.no_lo = !loop->counted;
+  range.no_hi = !loop->counted || loop->last < 0;
+  return range;
+}
+
+static bool too_large(long value) {
+  return value > DEP_LIMIT || value < -DEP_LIMIT;
+}
+
+static long gcd(long a, long b) {
+  a = a < 0 ? -a : a;
+  b = b < 0 ? -b : b;
+  while (b != 0) {
+    long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// The left-hand side of an equation: the range of its sum, and the gcd of
+// the coefficients of its variables plus the sum of its fixed terms.
+typedef struct Equation {
+  Range sum;
+  long gcd;
+  long fixed;
+} Equation;
+
+// Adds coeff * v for a v within `range`.
+static void add_term(Equation *eq, long coeff, Range range) {
+  if (coeff == 0)
+    return;
+  if (range.no_lo || range.no_hi || range.lo != range.hi ||
+      too_large(coeff) || too_large(range.lo))
+    eq->gcd = gcd(eq->gcd, coeff);
+  else
+    eq->fixed += coeff * range.lo;
+
+  bool no_lo = coeff > 0 ? range.no_lo : range.no_hi;
+  bool no_hi = coeff > 0 ? range.no_hi : range.no_lo;
+  long lo = coeff > 0 ? range.lo : range.hi;
+  long hi = coeff > 0 ? range.hi : range.lo;
+  if (too_large(coeff) || too_large(lo) || too_large(hi)) {
+    no_lo = no_hi = true;
+  } else {
+    lo *= coeff;
+    hi *= coeff;
+  }
+
+  eq->sum.no_lo = eq->sum.no_lo || no_lo;
+  eq->sum.no_hi = eq->sum.no_hi || no_hi;
+  if (!eq->sum.no_lo) {
+    eq->sum.lo += lo;
+    eq->sum.no_lo = too_large(eq->sum.lo);
+  }
+  if (!eq->sum.no_hi) {
+    eq->sum.hi += hi;
+    eq->sum.no_hi = too_large(eq->sum.hi);
+  }
+}
+
+// Adds alpha * n_a - beta * n_b for the iteration counts of one loop around
+// both accesses, ordered as `direction` says.
+static void add_loop_terms(Equation *eq, long alpha, long beta,
+                           const DepLoop *loop, unsigned char direction,
+                           bool *empty) {
+  Range range = loop_range(loop);
+  if (direction == DEP_EQ) {
+    add_term(eq, alpha - beta, range);
+    return;
+  }
+  if (direction != DEP_LT && direction != DEP_GT) {
+    add_term(eq, alpha, range);
+    add_term(eq, -beta, range);
+    return;
+  }
+
+  // With n_b = n_a + delta for `<`, or n_a = n_b + delta for `>`, and
+  // delta >= 1; both counts are then below the last.
+  if (!range.no_hi && range.hi < 1) {
+    *empty = true;
+    return;
+  }
+  Range first = range, delta = range_of(1, range.hi);
+  if (!range.no_hi)
+    first.hi--;
+  delta.no_hi = range.no_hi;
+  add_term(eq, alpha - beta, first);
+  add_term(eq, direction == DEP_LT ? -beta : alpha, delta);
+}
+
+// The equation of one pair of subscripts, less the terms of the loops
+// around both accesses.
+typedef struct DepEquation {
+  bool tested; // Both subscripts are affine.
+  long target;
+  Equation base;
+  int level_count; // Loops around both that either subscript moves with.
+  int levels[DEP_MAX_NEST];
+} DepEquation;
+
+// Subscripts whose equations are kept on the stack.
+#define DEP_LOCAL_RANK 8
+
+typedef struct DepSearch {
+  const DepAccess *a;
+  const DepAccess *b;
+  int common; // Loops around both accesses.
+  int depth;  // Of them, those given directions.
+  unsigned char allowed[DEP_MAX_DEPTH];
+  unsigned char dirs[DEP_MAX_DEPTH];
+  bool moves[DEP_MAX_DEPTH]; // Some tested subscript moves with the loop.
+  DepEquation *equations;
+
+  unsigned char *vectors; // depth entries each.
+  int vector_count;
+  int vector_capacity;
+} DepSearch;
+
+// sum(alpha * n_a) - sum(beta * n_b) = y.rest - x.rest, with any symbol
+// left on the right free to take any value.
+static DepEquation subscript_equation(const DepSearch *s, int d) {
+  const DepSubscript *x = &s->a->subscripts[d];
+  const DepSubscript *y = &s->b->subscripts[d];
+  DepEquation result;
+  result.tested = false;
+  result.target = 0;
+  result.base = (Equation){range_of(0, 0), 0, 0};
+  result.level_count = 0;
+  AffineExpr diff = y->rest;
+  if (!x->affine || !y->affine || !affine_add(&diff, &x->rest, -1))
+    return result;
+
+  result.tested = true;
+  for (int p = 0; p < s->common; p++) {
+    if (x->coeffs[p] != 0 || y->coeffs[p] != 0)
+      result.levels[result.level_count++] = p;
+  }
+  result.target = diff.constant;
+  for (int t = 0; t < diff.term_count; t++)
+    add_term(&result.base, diff.terms[t].coeff, unbounded());
+  for (int p = s->common; p < s->a->depth; p++)
+    add_term(&result.base, x->coeffs[p], loop_range(&s->a->loops[p]));
+  for (int p = s->common; p < s->b->depth; p++)
+    add_term(&result.base, -y->coeffs[p], loop_range(&s->b->loops[p]));
+  return result;
+}
+
+// Whether subscript `d` of both accesses may be equal with the loops in
+// the current directions.
+static bool subscript_may_meet(const DepSearch *s, int d) {
+  const DepEquation *equation = &s->equations[d];
+  if (!equation->tested)
+    return true;
+
+  const DepSubscript *x = &s->a->subscripts[d];
+  const DepSubscript *y = &s->b->subscripts[d];
+  Equation eq = equation->base;
+  bool empty = false;
+  for (int i = 0; i < equation->level_count; i++) {
+    int p = equation->levels[i];
+    unsigned char direction = p < s->depth ? s->dirs[p] : DEP_ALL;
+    add_loop_terms(&eq, x->coeffs[p], y->coeffs[p], &s->a->loops[p],
+                   direction, &empty);
+  }
+  if (empty)
+    return false;
+
+  long target = equation->target;
+  if ((!eq.sum.no_lo && target < eq.sum.lo) ||
+      (!eq.sum.no_hi && target > eq.sum.hi))
+    return false;
+  target -= eq.fixed;
+  return eq.gcd == 0 ? target == 0 : target % eq.gcd == 0;
+}
+
+static bool may_meet(const DepSearch *s) {
+  for (int d = 0; d < s->a->access->count; d++) {
+    if (!subscript_may_meet(s, d))
+      return false;
+  }
+  return true;
+}
+
+static void add_vector(DepSearch *s) {
+  if (s->vector_count == s->vector_capacity) {
+    s->vector_capacity = s->vector_capacity > 0 ? s->vector_capacity * 2 : 8;
+    s->vectors = (unsigned char *)realloc(
+        s->vectors, (size_t)s->vector_capacity * DEP_MAX_DEPTH);
+    assert(s->vectors != NULL);
+  }
+  memcpy(&s->vectors[s->vector_count++ * DEP_MAX_DEPTH], s->dirs,
+         DEP_MAX_DEPTH);
+}
+
+// Fixes the direction of one loop at a time, outermost first, keeping only
+// those some instances can meet in. A loop no subscript moves with keeps
+// every direction it has iterations for.
+static void refine(DepSearch *s, int level) {
+  if (level == s->depth) {
+    add_vector(s);
+    return;
+  }
+  unsigned char allowed = s->allowed[level];
+  const DepLoop *loop = &s->a->loops[level];
+  if (loop->counted && loop->last == 0)
+    allowed &= DEP_EQ;
+  if (!s->moves[level]) {
+    s->dirs[level] = allowed;
+    if (allowed != 0)
+      refine(s, level + 1);
+    s->dirs[level] = s->allowed[level];
+    return;
+  }
+  for (unsigned char bit = DEP_LT; bit <= DEP_GT; bit <<= 1) {
+    if ((allowed & bit) == 0)
+      continue;
+    s->dirs[level] = bit;
+    if (may_meet(s))
+      refine(s, level + 1);
+  }
+  s->dirs[level] = s->allowed[level];
+}
+
+// Distances from subscripts that move with a single counted loop, by the
+// same coefficient in both accesses. Returns false when they show that the
+// accesses never meet.
+static bool pair_distances(const DepSearch *s, bool *known, long *dist) {
+  for (int d = 0; d < s->a->access->count; d++) {
+    const DepSubscript *x = &s->a->subscripts[d];
+    const DepSubscript *y = &s->b->subscripts[d];
+    if (!x->affine || !y->affine)
+      continue;
+    AffineExpr diff = y->rest;
+    if (!affine_add(&diff, &x->rest, -1) || !affine_is_constant(&diff))
+      continue;
+
+    int moving = 0, level = -1;
+    for (int p = 0; p < s->a->depth || p < s->b->depth; p++) {
+      long alpha = p < s->a->depth ? x->coeffs[p] : 0;
+      long beta = p < s->b->depth ? y->coeffs[p] : 0;
+      if (alpha == 0 && beta == 0)
+        continue;
+      moving++;
+      if (p < s->depth && alpha == beta && s->a->loops[p].counted)
+        level = p;
+    }
+    if (moving == 0 && diff.constant != 0)
+      return false;
+    if (moving != 1 || level < 0)
+      continue;
+
+    // alpha * n_a + x.rest = alpha * n_b + y.rest.
+    long alpha = x->coeffs[level];
+    if (diff.constant % alpha != 0)
+      return false;
+    long value = -diff.constant / alpha;
+    if (known[level] && dist[level] != value)
+      return false;
+    known[level] = true;
+    dist[level] = value;
+  }
+  return true;
+}
+
+static void add_dependence(DependenceList *list, const Dependence *dep) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+    list->items = (Dependence *)realloc(list->items,
+                                        sizeof(Dependence) * list->capacity);
+    assert(list->items != NULL);
+  }
+  list->items[list->count++] = *dep;
+}
+
+// Merges vectors that differ at one loop only, a loop at a time from the
+// innermost out, until none do; each remaining one then stands for every
+// combination of its masks.
+static int merge_vectors(unsigned char *vectors, int count, int depth) {
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (int level = depth - 1; level >= 0; level--) {
+      for (int i = 0; i < count; i++) {
+        unsigned char *v = &vectors[i * DEP_MAX_DEPTH];
+        for (int j = i + 1; j < count; j++) {
+          unsigned char *w = &vectors[j * DEP_MAX_DEPTH];
+          bool same = true;
+          for (int d = 0; d < depth && same; d++)
+            same = d == level || v[d] == w[d];
+          if (!same)
+            continue;
+          merged = merged || (v[level] | w[level]) != v[level];
+          v[level] |= w[level];
+          memcpy(w, &vectors[--count * DEP_MAX_DEPTH], DEP_MAX_DEPTH);
+          j--;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+static void analyze_pair(DependenceList *list, const DepAccess *a,
+                         const DepAccess *b) {
+  DepSearch s;
+  memset(&s, 0, sizeof(s));
+  s.a = a;
+  s.b = b;
+  while (s.common < a->depth && s.common < b->depth &&
+         a->loops[s.common].node == b->loops[s.common].node)
+    s.common++;
+  s.depth = s.common < DEP_MAX_DEPTH ? s.common : DEP_MAX_DEPTH;
+
+  Dependence dep;
+  memset(&dep, 0, sizeof(dep));
+  if (!pair_distances(&s, dep.distance_known, dep.distance))
+    return;
+  bool fixed = true;
+  for (int d = 0; d < s.depth; d++) {
+    long value = dep.distance[d];
+    s.allowed[d] = !dep.distance_known[d] ? DEP_ALL
+                   : value > 0            ? DEP_LT
+                   : value < 0            ? DEP_GT
+                                          : DEP_EQ;
+    s.dirs[d] = s.allowed[d];
+    fixed = fixed && dep.distance_known[d];
+  }
+
+  int rank = a->access->count;
+  DepEquation local[DEP_LOCAL_RANK];
+  s.equations = local;
+  if (rank > DEP_LOCAL_RANK) {
+    s.equations = (DepEquation *)malloc(sizeof(DepEquation) * rank);
+    assert(s.equations != NULL);
+  }
+  for (int d = 0; d < rank; d++) {
+    s.equations[d] = subscript_equation(&s, d);
+    for (int i = 0; i < s.equations[d].level_count; i++) {
+      int p = s.equations[d].levels[i];
+      if (p < s.depth)
+        s.moves[p] = true;
+    }
+  }
+  bool meet = may_meet(&s);
+  if (meet && fixed)
+    add_vector(&s);
+  else if (meet)
+    refine(&s, 0);
+  if (s.equations != local)
+    free(s.equations);
+
+  int count = s.vector_count;
+  if (count > DEP_MAX_VECTORS) {
+    for (int i = 1; i < count; i++) {
+      for (int d = 0; d < s.depth; d++)
+        s.vectors[d] |= s.vectors[i * DEP_MAX_DEPTH + d];
+    }
+    count = 1;
+  }
+  count = merge_vectors(s.vectors, count, s.depth);
+
+  dep.source = a->access;
+  dep.sink = b->access;
+  dep.source_write = a->write;
+  dep.sink_write = b->write;
+  dep.depth = s.depth;
+  for (int d = 0; d < s.depth; d++)
+    dep.loops[d] = a->loops[d].node;
+  for (int i = 0; i < count; i++) {
+    memcpy(dep.directions, &s.vectors[i * DEP_MAX_DEPTH], DEP_MAX_DEPTH);
+    add_dependence(list, &dep);
+  }
+  free(s.vectors);
+}
+
+void analyze_dependences(const IRNode *loop, DependenceList *list) {
+  DepWalk walk;
+  memset(&walk, 0, sizeof(walk));
+  walk_loop(&walk, loop);
+  list->has_return = list->has_return || walk.has_return;
+
+  for (int i = 0; i < walk.count; i++) {
+    for (int j = i; j < walk.count; j++) {
+      const DepAccess *a = &walk.items[i];
+      const DepAccess *b = &walk.items[j];
+      if (a->access->tensor != b->access->tensor || (!a->write && !b->write))
+        continue;
+      analyze_pair(list, a, b);
+    }
+  }
+
+  for (int i = 0; i < walk.count; i++)
+    free(walk.items[i].subscripts);
+  free(walk.items);
+}
+
+void free_dependences(DependenceList *list) {
+  free(list->items);
+  list->items = NULL;
+  list->count = list->capacity = 0;
+}
+
+static unsigned char direction_at(const Dependence *dep, int level) {
+  return level < dep->depth ? dep->directions[level] : DEP_ALL;
+}
+
+bool dependence_carried(const Dependence *dep, int level) {
+  for (int d = 0; d < level; d++) {
+    if ((direction_at(dep, d) & DEP_EQ) == 0)
+      return false;
+  }
+  return (direction_at(dep, level) & (DEP_LT | DEP_GT)) != 0;
+}
+
+// One direction vector, +1 where the sink's iteration comes later.
+typedef bool (*VectorTest)(const signed char *v, int depth,
+                           const void *context);
+
+static bool every_vector(const Dependence *dep, int depth, int level,
+                         signed char *v, VectorTest test,
+                         const void *context) {
+  if (level == depth)
+    return test(v, depth, context);
+  static const signed char signs[] = {1, 0, -1};
+  for (int i = 0; i < 3; i++) {
+    if ((direction_at(dep, level) & (DEP_LT << i)) == 0)
+      continue;
+    v[level] = signs[i];
+    if (!every_vector(dep, depth, level + 1, v, test, context))
+      return false;
+  }
+  return true;
+}
+
+static bool every_dependence(const DependenceList *list, int depth,
+                             VectorTest test, const void *context) {
+  assert(depth <= DEP_MAX_DEPTH);
+  signed char v[DEP_MAX_DEPTH];
+  for (int i = 0; i < list->count; i++) {
+    if (!every_vector(&list->items[i], depth, 0, v, test, context))
+      return false;
+  }
+  return true;
+}
+
+static int leading_sign(const signed char *v, const int *order, int depth) {
+  for (int p = 0; p < depth; p++) {
+    int d = order != NULL ? order[p] : p;
+    if (v[d] != 0)
+      return v[d];
+  }
+  return 0;
+}
+
+static bool keeps_order(const signed char *v, int depth, const void *perm) {
+  return leading_sign(v, NULL, depth) ==
+         leading_sign(v, (const int *)perm, depth);
+}
+
+bool dependences_permutable(const DependenceList *list, const int *perm,
+                            int depth) {
+  return every_dependence(list, depth, keeps_order, perm);
+}
+
+static bool runs_forward(const signed char *v, int depth,
+                         const void *context) {
+  (void)context;
+  int sign = leading_sign(v, NULL, depth);
+  for (int d = 0; d < depth; d++) {
+    if (v[d] * sign < 0)
+      return false;
+  }
+  return true;
+}
+
+bool dependences_tileable(const DependenceList *list, int depth) {
+  return every_dependence(list, depth, runs_forward, NULL);
+}
+
+static const char *direction_name(unsigned char mask) {
+  switch (mask) {
+  case DEP_LT:
+    return "<";
+  case DEP_EQ:
+    return "=";
+  case DEP_GT:
+    return ">";
+  case DEP_LT | DEP_EQ:
+    return "<=";
+  case DEP_EQ | DEP_GT:
+    return ">=";
+  case DEP_LT | DEP_GT:
+    return "!=";
+  default:
+    return "*";
+  }
+}
+
+// Prints the vectors of `dep` given by `masks`, from the sink to the source
+// when `reversed`, with each direction and distance turned around.
+static void print_vectors(FILE *out, const IRFunction *fn,
+                          const Dependence *dep, const unsigned char *masks,
+                          bool reversed) {
+  const IRAccess *source = reversed ? dep->sink : dep->source;
+  const IRAccess *sink = reversed ? dep->source : dep->sink;
+  bool source_write = reversed ? dep->sink_write : dep->source_write;
+  bool sink_write = reversed ? dep->source_write : dep->sink_write;
+  fprintf(out, "  %s ", source_write ? "store" : "load");
+  print_ir_access(out, fn, source);
+  fprintf(out, " -> %s ", sink_write ? "store" : "load");
+  print_ir_access(out, fn, sink);
+  fprintf(out, " along ");
+  for (int d = 0; d < dep->depth; d++) {
+    fprintf(out, "%s%s", d > 0 ? ", " : "",
+            fn->symbols[dep->loops[d]->data.loop.var].name);
+  }
+  fprintf(out, ": (");
+  for (int d = 0; d < dep->depth; d++) {
+    unsigned char mask = masks[d];
+    if (reversed)
+      mask = (mask & DEP_EQ) | (mask & DEP_LT ? DEP_GT : 0) |
+             (mask & DEP_GT ? DEP_LT : 0);
+    if (d > 0)
+      fprintf(out, ", ");
+    if (dep->distance_known[d])
+      fprintf(out, "%ld", reversed ? -dep->distance[d] : dep->distance[d]);
+    else
+      fprintf(out, "%s", direction_name(mask));
+  }
+  fprintf(out, ")\n");
+}
+
+// Prints the vectors of `dep` given by `masks`, whose levels before `level`
+// are all `=`, each oriented so that its source runs first: split at the
+// first level that is not `=` into the part where the source's iteration
+// comes first, the part where the sink's does, printed the other way round,
+// and the part where the two agree, split further in. Vectors equal at every
+// level keep the order of the accesses in the body.
+static void print_oriented(FILE *out, const IRFunction *fn,
+                           const Dependence *dep, unsigned char *masks,
+                           int level) {
+  while (level < dep->depth && masks[level] == DEP_EQ)
+    level++;
+  if (level == dep->depth) {
+    print_vectors(out, fn, dep, masks, false);
+    return;
+  }
+
+  unsigned char mask = masks[level];
+  if (mask & DEP_LT) {
+    masks[level] = DEP_LT;
+    print_vectors(out, fn, dep, masks, false);
+  }
+  // An access against itself has the same vectors either way round.
+  if ((mask & DEP_GT) && dep->source != dep->sink) {
+    masks[level] = DEP_GT;
+    print_vectors(out, fn, dep, masks, true);
+  }
+  if (mask & DEP_EQ) {
+    masks[level] = DEP_EQ;
+    print_oriented(out, fn, dep, masks, level + 1);
+  }
+  masks[level] = mask;
+}
+
+void print_dependences(FILE *out, const IRFunction *fn,
+                       const DependenceList *list) {
+  for (int i = 0; i < list->count; i++) {
+    const Dependence *dep = &list->items[i];
+    unsigned char masks[DEP_MAX_DEPTH];
+    memcpy(masks, dep->directions, sizeof(masks));
+    print_oriented(out, fn, dep, masks, 0);
+  }
+}
+
+static void print_list_dependences(FILE *out, const IRFunction *fn,
+                                   const IRList *list) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      print_list_dependences(out, fn, &node->data.if_else.then_body);
+      print_list_dependences(out, fn, &node->data.if_else.else_body);
+      continue;
+    }
+    if (node->kind != IR_LOOP)
+      continue;
+
+    DependenceList deps = {NULL, 0, 0, false};
+    analyze_dependences(node, &deps);
+    fprintf(out, "%s, loop %s (line %d):%s\n", fn->name,
+            fn->symbols[node->data.loop.var].name, node->line,
+            deps.count == 0 ? " none" : "");
+    print_dependences(out, fn, &deps);
+    free_dependences(&deps);
+  }
+}
+
+void print_module_dependences(FILE *out, const IRModule *module) {
+  for (int i = 0; i < module->function_count; i++) {
+    const IRFunction *fn = module->functions[i];
+    print_list_dependences(out, fn, &fn->body);
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef DEPENDENCE_H
+#define DEPENDENCE_H
+
+#include "loop_ir.h"
+#include <stdio.h>
+
+// Array dependence analysis over the loop-nest IR. Two accesses to one
+// tensor, at least one of them a store, depend on each other when some
+// instance of the first and some instance of the second can touch the same
+// element. Every loop variable is first rewritten as its lower bound plus
+// step times an iteration count, so a tile loop and the point loop inside it
+// compare by iteration. Then each direction of the loops around both accesses
+// is tried, outermost loop first, and ruled out when a pair of subscripts
+// cannot be equal: by the GCD test, when the gcd of the coefficients does not
+// divide the constant, or by Banerjee's test, when the constant lies outside
+// the range the loop bounds allow. Subscripts that are not affine rule out
+// nothing.
+
+// Deepest nest of loops around both accesses that is told apart; deeper
+// loops are treated as having any direction.
+#define DEP_MAX_DEPTH 8
+
+// How the source's iteration of a loop may compare with the sink's, as a
+// mask: `<` when the source runs first.
+#define DEP_LT 1
+#define DEP_EQ 2
+#define DEP_GT 4
+#define DEP_ALL (DEP_LT | DEP_EQ | DEP_GT)
+
+// One set of direction vectors of a pair of accesses: every combination of
+// one direction from each mask. A pair may need several to describe its
+// vectors exactly. The source is the access that comes first in the body,
+// or the sink itself.
+typedef struct Dependence {
+  const IRAccess *source;
+  const IRAccess *sink;
+  bool source_write;
+  bool sink_write;
+
+  // Loops around both accesses, from the analysed loop inwards.
+  int depth;
+  const IRNode *loops[DEP_MAX_DEPTH];
+  unsigned char directions[DEP_MAX_DEPTH];
+  // Sink iteration minus source iteration, when it is the same for every
+  // pair of instances that touch the same element.
+  bool distance_known[DEP_MAX_DEPTH];
+  long distance[DEP_MAX_DEPTH];
+} Dependence;
+
+typedef struct DependenceList {
+  Dependence *items;
+  int count;
+  int capacity;
+  bool has_return; // A return statement was seen.
+} DependenceList;
+
+// Appends the dependences between accesses in the body of `loop`, within one
+// iteration of the loops around it.
+void analyze_dependences(const IRNode *loop, DependenceList *list);
+void free_dependences(DependenceList *list);
+
+// Whether two instances in the same iteration of loops[0..level) but
+// different iterations of loops[level] may touch the same element.
+bool dependence_carried(const Dependence *dep, int level);
+
+// Whether running loops[0..depth) in the order perm[0..depth), outermost
+// first, keeps the source and sink of every dependence in the same order.
+bool dependences_permutable(const DependenceList *list, const int *perm,
+                            int depth);
+
+// Whether loops[0..depth) can be tiled: no dependence has a component along
+// them that runs backwards.
+bool dependences_tileable(const DependenceList *list, int depth);
+
+// Writes each dependence source to sink, such as
+//
+//   store A[i] -> load A[i - 1] along i: (1)
+//
+// with the distance along each loop where it is known and otherwise `<`,
+// `=`, `>`, `<=`, `>=`, `!=` or `*`. A dependence that runs both ways is
+// split into lines whose first direction other than `=` is `<`, with the
+// two accesses swapped where the sink runs first.
+void print_dependences(FILE *out, const IRFunction *fn,
+                       const DependenceList *list);
+
+// Analyses and prints every outermost loop of every function.
+void print_module_dependences(FILE *out, const IRModule *module);
+
+#endif // !DEPENDENCE_H
@@ -0,0 +1,607 @@
+#include "flat_ast.h"
+
+typedef struct FlatHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t node_count;
+  uint32_t extra_count;
+  uint32_t strings_size;
+  uint32_t root;
+} FlatHeader;
+
+typedef struct Flattener {
+  FlatAST *ast;
+  // String table offset + 1 for each interned symbol id, 0 if not yet added.
+  uint32_t *string_offsets;
+  uint32_t symbol_count;
+  bool failed;
+} Flattener;
+
+static bool reserve(void **items, uint32_t *capacity, uint32_t needed,
+                    size_t item_size) {
+  if (needed <= *capacity)
+    return true;
+
+  uint32_t new_capacity = *capacity > 0 ? *capacity : 64;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  void *grown = realloc(*items, (size_t)new_capacity * item_size);
+  if (grown == NULL)
+    return false;
+  *items = grown;
+  *capacity = new_capacity;
+  return true;
+}
+
+static uint32_t new_node(Flattener *f, NodeType type, int line) {
+  FlatAST *ast = f->ast;
+  if (!reserve((void **)&ast->nodes, &ast->node_capacity, ast->node_count + 1,
+               sizeof(FlatNode))) {
+    f->failed = true;
+    return FLAT_NONE;
+  }
+
+  FlatNode *node = &ast->nodes[ast->node_count];
+  node->type = (uint8_t)type;
+  node->op = 0;
+  node->reserved = 0;
+  node->line = (uint32_t)line;
+  node->a = node->b = node->c = FLAT_NONE;
+  return ast->node_count++;
+}
+
+// Reserves `count` consecutive slots in the side array. Children are
+// flattened after the reservation, so their own lists land behind it.
+static uint32_t new_extra(Flattener *f, uint32_t count) {
+  FlatAST *ast = f->ast;
+  if (!reserve((void **)&ast->extra, &ast->extra_capacity,
+               ast->extra_count + count, sizeof(uint32_t))) {
+    f->failed = true;
+    return 0;
+  }
+
+  uint32_t offset = ast->extra_count;
+  ast->extra_count += count;
+  return offset;
+}
+
+static uint32_t add_string(Flattener *f, const char *symbol) {
+  if (symbol == NULL)
+    return FLAT_NONE;
+
+  uint32_t id = symbol_id(symbol);
+  if (id < f->symbol_count && f->string_offsets[id] != 0)
+    return f->string_offsets[id] - 1;
+
+  FlatAST *ast = f->ast;
+  uint32_t length = (uint32_t)symbol_length(symbol);
+  if (!reserve((void **)&ast->strings, &ast->strings_capacity,
+               ast->strings_size + length + 1, 1)) {
+    f->failed = true;
+    return FLAT_NONE;
+  }
+
+  uint32_t offset = ast->strings_size;
+  memcpy(ast->strings + offset, symbol, length + 1);
+  ast->strings_size += length + 1;
+  if (id < f->symbol_count)
+    f->string_offsets[id] = offset + 1;
+  return offset;
+}
+
+static uint32_t flatten_node(Flattener *f, ASTNode *node);
+
+static uint32_t flatten_list(Flattener *f, ASTNode **items, int count) {
+  uint32_t offset = new_extra(f, (uint32_t)count);
+  for (int i = 0; i < count && !f->failed; i++) {
+    uint32_t child = flatten_node(f, items[i]);
+    f->ast->extra[offset + i] = child;
+  }
+  return offset;
+}
+
+static void split_bits(uint64_t bits, uint32_t *low, uint32_t *high) {
+  *low = (uint32_t)bits;
+  *high = (uint32_t)(bits >> 32);
+}
+
+// Nodes are emitted in pre-order: a parent's slot is taken before any of its
+// children, so a subtree occupies one contiguous range of the node array.
+static uint32_t flatten_node(Flattener *f, ASTNode *node) {
+  if (node == NULL || f->failed)
+    return FLAT_NONE;
+
+  uint32_t index = new_node(f, node->nodeType, node->line);
+  if (index == FLAT_NONE)
+    return FLAT_NONE;
+
+  uint32_t a = FLAT_NONE, b = FLAT_NONE, c = FLAT_NONE;
+  uint8_t op = 0;
+
+  switch (node->nodeType) {
+  case NODE_PROGRAM:
+    a = (uint32_t)node->data.program.function_count;
+    b = flatten_list(f, node->data.program.functions,
+                     node->data.program.function_count);
+    break;
+  case NODE_FUNC_DEF: {
+    int count = node->data.function_decl.count_params;
+    a = add_string(f, node->data.function_decl.name);
+    b = new_extra(f, 3 + (uint32_t)count);
+    if (f->failed)
+      break;
+    f->ast->extra[b + 2] = (uint32_t)count;
+    for (int i = 0; i < count && !f->failed; i++) {
+      uint32_t param = flatten_node(f, node->data.function_decl.params[i]);
+      f->ast->extra[b + 3 + i] = param;
+    }
+    uint32_t return_type =
+        flatten_node(f, node->data.function_decl.return_type);
+    uint32_t body = flatten_node(f, node->data.function_decl.body);
+    if (!f->failed) {
+      f->ast->extra[b] = return_type;
+      f->ast->extra[b + 1] = body;
+    }
+    break;
+  }
+  case NODE_BLOCK:
+    a = (uint32_t)node->data.block.count_statements;
+    b = flatten_list(f, node->data.block.statements,
+                     node->data.block.count_statements);
+    break;
+  case NODE_VAR_DECL:
+    a = add_string(f, node->data.var_decl.name);
+    b = flatten_node(f, node->data.var_decl.type);
+    c = flatten_node(f, node->data.var_decl.initializer);
+    break;
+  case NODE_ASSIGNMENT:
+    op = (uint8_t)node->data.assignment.op;
+    a = flatten_node(f, node->data.assignment.target);
+    b = flatten_node(f, node->data.assignment.value);
+    break;
+  case NODE_FOR:
+    a = flatten_node(f, node->data.for_loop.variable);
+    b = flatten_node(f, node->data.for_loop.iterable);
+    c = flatten_node(f, node->data.for_loop.body);
+    break;
+  case NODE_IF:
+    a = flatten_node(f, node->data.if_else.condition);
+    b = flatten_node(f, node->data.if_else.then);
+    c = flatten_node(f, node->data.if_else.else_block);
+    break;
+  case NODE_RETURN:
+    a = flatten_node(f, node->data.return_value.return_val);
+    break;
+  case NODE_INT_LITERAL:
+    split_bits((uint64_t)(int64_t)node->data.int_literal.value, &a, &b);
+    break;
+  case NODE_FLOAT_LITERAL: {
+    uint64_t bits;
+    memcpy(&bits, &node->data.float_literal.value, sizeof(bits));
+    split_bits(bits, &a, &b);
+    break;
+  }
+  case NODE_IDENTIFIER:
+    a = add_string(f, node->data.identifier.name);
+    break;
+  case NODE_BINARY_EXPR:
+    op = (uint8_t)node->data.binary_op.op;
+    a = flatten_node(f, node->data.binary_op.left);
+    b = flatten_node(f, node->data.binary_op.right);
+    break;
+  case NODE_UNARY_EXPR:
+    op = (uint8_t)node->data.unary_op.op;
+    a = flatten_node(f, node->data.unary_op.operand);
+    break;
+  case NODE_INDEX_EXPR:
+    a = flatten_node(f, node->data.index_expression.object);
+    b = (uint32_t)node->data.index_expression.index_count;
+    c = flatten_list(f, node->data.index_expression.indices,
+                     node->data.index_expression.index_count);
+    break;
+  case NODE_FUNC_CALL:
+    a = add_string(f, node->data.func_call.func_name);
+    b = (uint32_t)node->data.func_call.arg_count;
+    c = flatten_list(f, node->data.func_call.args,
+                     node->data.func_call.arg_count);
+    break;
+  case NODE_TENSOR_TYPE: {
+    int count = node->data.tensor_type.dim_count;
+    a = add_string(f, node->data.tensor_type.data_type);
+    b = (uint32_t)count;
+    c = new_extra(f, (uint32_t)count);
+    for (int i = 0; i < count && !f->failed; i++) {
+      uint32_t dim = add_string(f, node->data.tensor_type.dims[i]);
+      f->ast->extra[c + i] = dim;
+    }
+    break;
+  }
+  }
+
+  FlatNode *flat = &f->ast->nodes[index];
+  flat->op = op;
+  flat->a = a;
+  flat->b = b;
+  flat->c = c;
+  return index;
+}
+
+FlatAST *flatten_ast(ASTNode *root) {
+  FlatAST *ast = (FlatAST *)calloc(1, sizeof(FlatAST));
+  if (ast == NULL)
+    return NULL;
+
+  Flattener f = {ast, NULL, interned_count(), false};
+  if (f.symbol_count > 0) {
+    f.string_offsets = (uint32_t *)calloc(f.symbol_count, sizeof(uint32_t));
+    if (f.string_offsets == NULL) {
+      free(ast);
+      return NULL;
+    }
+  }
+
+  ast->root = flatten_node(&f, root);
+  free(f.string_offsets);
+  if (f.failed) {
+    free_flat_ast(ast);
+    return NULL;
+  }
+  return ast;
+}
+
+void free_flat_ast(FlatAST *ast) {
+  if (ast == NULL)
+    return;
+
+  free(ast->nodes);
+  free(ast->extra);
+  free(ast->strings);
+  free(ast);
+}
+
+const char *flat_string(const FlatAST *ast, uint32_t offset) {
+  return offset == FLAT_NONE ? NULL : ast->strings + offset;
+}
+
+const uint32_t *flat_extra(const FlatAST *ast, uint32_t offset) {
+  return ast->extra + offset;
+}
+
+static void print_indent(int indent) {
+  for (int i = 0; i < indent; i++) {
+    printf("  ");
+  }
+}
+
+static uint64_t join_bits(uint32_t low, uint32_t high) {
+  return (uint64_t)low | ((uint64_t)high << 32);
+}
+
+// Produces exactly the same output as print_ast on the tree it came from.
+void print_flat_ast(const FlatAST *ast, uint32_t index, int indent) {
+  if (index == FLAT_NONE) {
+    print_indent(indent);
+    printf("(null)\n");
+    return;
+  }
+
+  const FlatNode *node = &ast->nodes[index];
+  const uint32_t *list;
+
+  switch ((NodeType)node->type) {
+  case NODE_PROGRAM:
+    print_indent(indent);
+    printf("Program (functions=%u)\n", node->a);
+    list = flat_extra(ast, node->b);
+    for (uint32_t i = 0; i < node->a; i++) {
+      print_flat_ast(ast, list[i], indent + 1);
+    }
+    break;
+  case NODE_FUNC_DEF:
+    list = flat_extra(ast, node->b);
+    print_indent(indent);
+    printf("FunctionDef name=%s\n", flat_string(ast, node->a));
+    print_indent(indent + 1);
+    printf("Params (%u)\n", list[2]);
+    for (uint32_t i = 0; i < list[2]; i++) {
+      print_flat_ast(ast, list[3 + i], indent + 2);
+    }
+    print_indent(indent + 1);
+    printf("ReturnType\n");
+    print_flat_ast(ast, list[0], indent + 2);
+    print_indent(indent + 1);
+    printf("Body\n");
+    print_flat_ast(ast, list[1], indent + 2);
+    break;
+  case NODE_BLOCK:
+    print_indent(indent);
+    printf("Block (statements=%u)\n", node->a);
+    list = flat_extra(ast, node->b);
+    for (uint32_t i = 0; i < node->a; i++) {
+      print_flat_ast(ast, list[i], indent + 1);
+    }
+    break;
+  case NODE_VAR_DECL:
+    print_indent(indent);
+    printf("VarDecl name=%s\n", flat_string(ast, node->a));
+    print_indent(indent + 1);
+    printf("Type\n");
+    print_flat_ast(ast, node->b, indent + 2);
+    print_indent(indent + 1);
+    printf("Initializer\n");
+    print_flat_ast(ast, node->c, indent + 2);
+    break;
+  case NODE_ASSIGNMENT:
+    print_indent(indent);
+    if ((TokenType)node->op == EQUAL)
+      printf("Assignment\n");
+    else
+      printf("Assignment op=%s\n", token_type_name((TokenType)node->op));
+    print_indent(indent + 1);
+    printf("Target\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    print_indent(indent + 1);
+    printf("Value\n");
+    print_flat_ast(ast, node->b, indent + 2);
+    break;
+  case NODE_FOR:
+    print_indent(indent);
+    printf("For\n");
+    print_indent(indent + 1);
+    printf("Variable\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    print_indent(indent + 1);
+    printf("Iterable\n");
+    print_flat_ast(ast, node->b, indent + 2);
+    print_indent(indent + 1);
+    printf("Body\n");
+    print_flat_ast(ast, node->c, indent + 2);
+    break;
+  case NODE_IF:
+    print_indent(indent);
+    printf("If\n");
+    print_indent(indent + 1);
+    printf("Condition\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    print_indent(indent + 1);
+    printf("Then\n");
+    print_flat_ast(ast, node->b, indent + 2);
+    print_indent(indent + 1);
+    printf("Else\n");
+    print_flat_ast(ast, node->c, indent + 2);
+    break;
+  case NODE_RETURN:
+    print_indent(indent);
+    printf("Return\n");
+    print_flat_ast(ast, node->a, indent + 1);
+    break;
+  case NODE_INT_LITERAL:
+    print_indent(indent);
+    printf("IntLiteral value=%ld\n",
+           (long)(int64_t)join_bits(node->a, node->b));
+    break;
+  case NODE_FLOAT_LITERAL: {
+    uint64_t bits = join_bits(node->a, node->b);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    print_indent(indent);
+    printf("FloatLiteral value=%f\n", value);
+    break;
+  }
+  case NODE_IDENTIFIER:
+    print_indent(indent);
+    printf("Identifier name=%s\n", flat_string(ast, node->a));
+    break;
+  case NODE_BINARY_EXPR:
+    print_indent(indent);
+    printf("BinaryExpr op=%s\n", token_type_name((TokenType)node->op));
+    print_indent(indent + 1);
+    printf("Left\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    print_indent(indent + 1);
+    printf("Right\n");
+    print_flat_ast(ast, node->b, indent + 2);
+    break;
+  case NODE_UNARY_EXPR:
+    print_indent(indent);
+    printf("UnaryExpr op=%s\n", token_type_name((TokenType)node->op));
+    print_indent(indent + 1);
+    printf("Operand\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    break;
+  case NODE_INDEX_EXPR:
+    print_indent(indent);
+    printf("IndexExpr (indices=%u)\n", node->b);
+    print_indent(indent + 1);
+    printf("Object\n");
+    print_flat_ast(ast, node->a, indent + 2);
+    print_indent(indent + 1);
+    printf("Indices\n");
+    list = flat_extra(ast, node->c);
+    for (uint32_t i = 0; i < node->b; i++) {
+      print_flat_ast(ast, list[i], indent + 2);
+    }
+    break;
+  case NODE_FUNC_CALL:
+    print_indent(indent);
+    printf("FuncCall name=%s args=%u\n", flat_string(ast, node->a), node->b);
+    list = flat_extra(ast, node->c);
+    for (uint32_t i = 0; i < node->b; i++) {
+      print_flat_ast(ast, list[i], indent + 1);
+    }
+    break;
+  case NODE_TENSOR_TYPE:
+    print_indent(indent);
+    printf("TensorType dtype=%s dims=%u\n", flat_string(ast, node->a),
+           node->b);
+    list = flat_extra(ast, node->c);
+    for (uint32_t i = 0; i < node->b; i++) {
+      print_indent(indent + 1);
+      printf("Dim[%u]=%s\n", i, flat_string(ast, list[i]));
+    }
+    break;
+  }
+}
+
+bool write_flat_ast(const FlatAST *ast, FILE *fp) {
+  FlatHeader header = {FLAT_AST_MAGIC,    FLAT_AST_VERSION,
+                       ast->node_count,   ast->extra_count,
+                       ast->strings_size, ast->root};
+  return fwrite(&header, sizeof(header), 1, fp) == 1 &&
+         fwrite(ast->nodes, sizeof(FlatNode), ast->node_count, fp) ==
+             ast->node_count &&
+         fwrite(ast->extra, sizeof(uint32_t), ast->extra_count, fp) ==
+             ast->extra_count &&
+         fwrite(ast->strings, 1, ast->strings_size, fp) == ast->strings_size;
+}
+
+// Children always follow their parent in pre-order, which also rules out
+// cycles in a corrupted image.
+static bool valid_child(const FlatAST *ast, uint32_t parent, uint32_t index) {
+  return index == FLAT_NONE || (index > parent && index < ast->node_count);
+}
+
+static bool valid_string(const FlatAST *ast, uint32_t offset) {
+  return offset == FLAT_NONE || offset < ast->strings_size;
+}
+
+static bool valid_list(const FlatAST *ast, uint32_t parent, uint32_t offset,
+                       uint32_t count) {
+  if (offset > ast->extra_count || count > ast->extra_count - offset)
+    return false;
+  for (uint32_t i = 0; i < count; i++) {
+    if (!valid_child(ast, parent, ast->extra[offset + i]))
+      return false;
+  }
+  return true;
+}
+
+// Bounds-checks every index so a truncated or foreign file is rejected up
+// front instead of being trusted by the traversals.
+static bool validate(const FlatAST *ast) {
+  if (ast->root != FLAT_NONE && ast->root >= ast->node_count)
+    return false;
+  if (ast->strings_size > 0 && ast->strings[ast->strings_size - 1] != '\0')
+    return false;
+
+  for (uint32_t i = 0; i < ast->node_count; i++) {
+    const FlatNode *node = &ast->nodes[i];
+    bool ok = true;
+    switch ((NodeType)node->type) {
+    case NODE_PROGRAM:
+    case NODE_BLOCK:
+      ok = valid_list(ast, i, node->b, node->a);
+      break;
+    case NODE_FUNC_DEF:
+      ok = valid_string(ast, node->a) && node->b <= ast->extra_count &&
+           ast->extra_count - node->b >= 3 &&
+           valid_child(ast, i, ast->extra[node->b]) &&
+           valid_child(ast, i, ast->extra[node->b + 1]) &&
+           valid_list(ast, i, node->b + 3, ast->extra[node->b + 2]);
+      break;
+    case NODE_VAR_DECL:
+      ok = valid_string(ast, node->a) && valid_child(ast, i, node->b) &&
+           valid_child(ast, i, node->c);
+      break;
+    case NODE_ASSIGNMENT:
+    case NODE_FOR:
+    case NODE_IF:
+    case NODE_RETURN:
+    case NODE_BINARY_EXPR:
+    case NODE_UNARY_EXPR:
+      ok = valid_child(ast, i, node->a) && valid_child(ast, i, node->b) &&
+           valid_child(ast, i, node->c);
+      break;
+    case NODE_INT_LITERAL:
+    case NODE_FLOAT_LITERAL:
+      break;
+    case NODE_IDENTIFIER:
+      ok = valid_string(ast, node->a);
+      break;
+    case NODE_INDEX_EXPR:
+      ok = valid_child(ast, i, node->a) && valid_list(ast, i, node->c, node->b);
+      break;
+    case NODE_FUNC_CALL:
+      ok = valid_string(ast, node->a) && valid_list(ast, i, node->c, node->b);
+      break;
+    case NODE_TENSOR_TYPE:
+      ok = valid_string(ast, node->a) &&
+           node->c <= ast->extra_count &&
+           node->b <= ast->extra_count - node->c;
+      for (uint32_t d = 0; ok && d < node->b; d++)
+        ok = valid_string(ast, ast->extra[node->c + d]);
+      break;
+    default:
+      ok = false;
+      break;
+    }
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+static bool valid_header(const FlatHeader *header) {
+  return header->magic == FLAT_AST_MAGIC &&
+         header->version == FLAT_AST_VERSION;
+}
+
+FlatAST *read_flat_ast(FILE *fp) {
+  FlatHeader header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 || !valid_header(&header))
+    return NULL;
+
+  FlatAST *ast = (FlatAST *)calloc(1, sizeof(FlatAST));
+  if (ast == NULL)
+    return NULL;
+
+  ast->node_count = ast->node_capacity = header.node_count;
+  ast->extra_count = ast->extra_capacity = header.extra_count;
+  ast->strings_size = ast->strings_capacity = header.strings_size;
+  ast->root = header.root;
+  ast->nodes = (FlatNode *)malloc((size_t)ast->node_count * sizeof(FlatNode));
+  ast->extra = (uint32_t *)malloc((size_t)ast->extra_count * sizeof(uint32_t));
+  ast->strings = (char *)malloc(header.strings_size);
+
+  bool ok =
+      (ast->nodes != NULL || header.node_count == 0) &&
+      (ast->extra != NULL || header.extra_count == 0) &&
+      (ast->strings != NULL || header.strings_size == 0) &&
+      fread(ast->nodes, sizeof(FlatNode), header.node_count, fp) ==
+          header.node_count &&
+      fread(ast->extra, sizeof(uint32_t), header.extra_count, fp) ==
+          header.extra_count &&
+      fread(ast->strings, 1, header.strings_size, fp) == header.strings_size &&
+      validate(ast);
+  if (!ok) {
+    free_flat_ast(ast);
+    return NULL;
+  }
+  return ast;
+}
+
+// No copy is made, so `data` must outlive `out`.
+bool view_flat_ast(const void *data, size_t size, FlatAST *out) {
+  if (size < sizeof(FlatHeader) || ((uintptr_t)data & 3) != 0)
+    return false;
+
+  FlatHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (!valid_header(&header))
+    return false;
+
+  size_t nodes_size = (size_t)header.node_count * sizeof(FlatNode);
+  size_t extra_size = (size_t)header.extra_count * sizeof(uint32_t);
+  if (size - sizeof(header) < nodes_size + extra_size + header.strings_size)
+    return false;
+
+  const char *base = (const char *)data + sizeof(header);
+  out->nodes = (FlatNode *)base;
+  out->node_count = out->node_capacity = header.node_count;
+  out->extra = (uint32_t *)(base + nodes_size);
+  out->extra_count = out->extra_capacity = header.extra_count;
+  out->strings = (char *)(base + nodes_size + extra_size);
+  out->strings_size = out->strings_capacity = header.strings_size;
+  out->root = header.root;
+  return validate(out);
+}
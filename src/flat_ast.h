@@ -0,0 +1,79 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include "ast.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Compact, pointer-free form of the AST. Nodes are laid out in pre-order in
+// one array and refer to each other by 32-bit index. Variable-length child
+// lists live in a shared side array and names in a string table, both also
+// addressed by index, so the whole structure can be written to disk and
+// used again after loading without any pointer fixup.
+//
+// Operand layout per node type (FLAT_NONE marks an absent child):
+//   PROGRAM       a = count, b = extra offset of function nodes
+//   FUNC_DEF      a = name, b = extra offset of [return type, body, count,
+//                 params...]
+//   BLOCK         a = count, b = extra offset of statements
+//   VAR_DECL      a = name, b = type, c = initializer
+//   ASSIGNMENT    op, a = target, b = value
+//   FOR           a = variable, b = iterable, c = body
+//   IF            a = condition, b = then, c = else
+//   RETURN        a = value
+//   INT_LITERAL   a, b = low and high 32 bits of the value
+//   FLOAT_LITERAL a, b = low and high 32 bits of the IEEE-754 double
+//   IDENTIFIER    a = name
+//   BINARY_EXPR   op, a = left, b = right
+//   UNARY_EXPR    op, a = operand
+//   INDEX_EXPR    a = object, b = count, c = extra offset of indices
+//   FUNC_CALL     a = name, b = count, c = extra offset of arguments
+//   TENSOR_TYPE   a = dtype, b = count, c = extra offset of dim names
+// Names are byte offsets of NUL-terminated strings in the string table.
+
+#define FLAT_NONE UINT32_MAX
+#define FLAT_AST_MAGIC 0x464e4945u // "EINF" read as little-endian
+#define FLAT_AST_VERSION 2u
+
+typedef struct FlatNode {
+  uint8_t type;
+  uint8_t op;
+  uint16_t reserved;
+  uint32_t line;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+} FlatNode;
+
+typedef struct FlatAST {
+  FlatNode *nodes;
+  uint32_t node_count;
+  uint32_t node_capacity;
+
+  uint32_t *extra;
+  uint32_t extra_count;
+  uint32_t extra_capacity;
+
+  char *strings;
+  uint32_t strings_size;
+  uint32_t strings_capacity;
+
+  uint32_t root;
+} FlatAST;
+
+FlatAST *flatten_ast(ASTNode *root);
+void free_flat_ast(FlatAST *ast);
+void print_flat_ast(const FlatAST *ast, uint32_t node, int indent);
+
+const char *flat_string(const FlatAST *ast, uint32_t offset);
+const uint32_t *flat_extra(const FlatAST *ast, uint32_t offset);
+
+// The on-disk image is a fixed header followed by the node, extra and string
+// arrays exactly as they are laid out in memory, in host byte order. Images
+// are bounds-checked when loaded. view_flat_ast uses a 4-byte aligned image
+// (e.g. a mapped file) in place; the result is not freed with free_flat_ast.
+bool write_flat_ast(const FlatAST *ast, FILE *fp);
+FlatAST *read_flat_ast(FILE *fp);
+bool view_flat_ast(const void *data, size_t size, FlatAST *out);
+
+#endif // !FLAT_AST_H
@@ -0,0 +1,332 @@
+#include "dependence.h"
+#include "transform.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static bool same_bound(const IRBound *a, const IRBound *b) {
+  if (a->count != b->count)
+    return false;
+  for (int e = 0; e < a->count; e++) {
+    if (!affine_equal(&a->exprs[e], &b->exprs[e]))
+      return false;
+  }
+  return true;
+}
+
+static bool fusable_loop(const IRNode *node) {
+  return node->kind == IR_LOOP && node->data.loop.gemm == NULL &&
+         !node->data.loop.parallel && node->data.loop.vector_width == 0;
+}
+
+static bool same_header(const IRNode *a, const IRNode *b) {
+  return fusable_loop(a) && fusable_loop(b) &&
+         a->data.loop.step == b->data.loop.step &&
+         same_bound(&a->data.loop.lower, &b->data.loop.lower) &&
+         same_bound(&a->data.loop.upper, &b->data.loop.upper);
+}
+
+static void rename_list(IRList *list, int from, int to);
+
+static void rename_affine(AffineExpr *expr, int from, int to) {
+  AffineExpr symbol = affine_symbol(to);
+  bool ok = affine_substitute(expr, from, &symbol);
+  assert(ok);
+  (void)ok;
+}
+
+static void rename_bound(IRBound *bound, int from, int to) {
+  for (int e = 0; e < bound->count; e++)
+    rename_affine(&bound->exprs[e], from, to);
+}
+
+static void rename_expr(IRExpr *expr, int from, int to);
+
+static void rename_access(IRAccess *access, int from, int to) {
+  for (int d = 0; d < access->count; d++) {
+    IRIndex *index = &access->indices[d];
+    if (index->affine)
+      rename_affine(&index->expr, from, to);
+    else
+      rename_expr(index->general, from, to);
+  }
+}
+
+static void rename_expr(IRExpr *expr, int from, int to) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_SYMBOL:
+    if (expr->data.symbol == from)
+      expr->data.symbol = to;
+    break;
+  case IR_EXPR_LOAD:
+    rename_access(&expr->data.load, from, to);
+    break;
+  case IR_EXPR_BINARY:
+    rename_expr(expr->data.binary.left, from, to);
+    rename_expr(expr->data.binary.right, from, to);
+    break;
+  case IR_EXPR_UNARY:
+    rename_expr(expr->data.unary.operand, from, to);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      rename_expr(expr->data.call.args[i], from, to);
+    break;
+  default:
+    break;
+  }
+}
+
+// Rewrites every use of the symbol `from` under `list` as `to`.
+static void rename_list(IRList *list, int from, int to) {
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      rename_bound(&node->data.loop.lower, from, to);
+      rename_bound(&node->data.loop.upper, from, to);
+      rename_list(&node->data.loop.body, from, to);
+      break;
+    case IR_STMT:
+      rename_access(&node->data.stmt.target, from, to);
+      rename_expr(node->data.stmt.value, from, to);
+      break;
+    case IR_IF:
+      rename_expr(node->data.if_else.condition, from, to);
+      rename_list(&node->data.if_else.then_body, from, to);
+      rename_list(&node->data.if_else.else_body, from, to);
+      break;
+    case IR_RETURN:
+      rename_expr(node->data.ret.value, from, to);
+      break;
+    }
+  }
+}
+
+static bool contains_access(const LoopAccessList *list,
+                            const IRAccess *access) {
+  for (int i = 0; i < list->count; i++) {
+    if (list->items[i].access == access)
+      return true;
+  }
+  return false;
+}
+
+// Fuses `second` into `first` when they have the same header and running
+// both bodies in one loop keeps every dependence between them: an element
+// the first loop touches in some iteration may not be touched by the second
+// in an earlier one, where one of the two stores to it.
+static bool fuse_pair(IRFunction *fn, IRNode *first, IRNode *second) {
+  if (!same_header(first, second))
+    return false;
+
+  IRList *body = &first->data.loop.body;
+  IRList *other = &second->data.loop.body;
+  int count = body->count + other->count;
+  IRNode **items = (IRNode **)malloc(sizeof(IRNode *) * (count + 1));
+  assert(items != NULL);
+  memcpy(items, body->items, sizeof(IRNode *) * body->count);
+  memcpy(items + body->count, other->items, sizeof(IRNode *) * other->count);
+
+  int var = first->data.loop.var;
+  rename_list(other, second->data.loop.var, var);
+  IRNode fused = *first;
+  fused.data.loop.body.items = items;
+  fused.data.loop.body.count = count;
+
+  LoopAccessList accesses = {NULL, 0, 0, false};
+  collect_loop_accesses(&accesses, body);
+  DependenceList deps = {NULL, 0, 0, false};
+  analyze_dependences(&fused, &deps);
+  bool ok = !deps.has_return;
+  for (int i = 0; i < deps.count && ok; i++) {
+    const Dependence *dep = &deps.items[i];
+    bool source = contains_access(&accesses, dep->source);
+    bool sink = contains_access(&accesses, dep->sink);
+    if (source == sink)
+      continue;
+    // The access from the first loop must not come in a later iteration.
+    unsigned char later = source ? DEP_GT : DEP_LT;
+    ok = dep->depth > 0 && (dep->directions[0] & later) == 0;
+  }
+  free_dependences(&deps);
+  free_loop_accesses(&accesses);
+
+  if (ok)
+    *body = ir_list_copy(fn->arena, items, count);
+  else
+    rename_list(other, var, second->data.loop.var);
+  free(items);
+  return ok;
+}
+
+static int fuse_list(IRFunction *fn, IRList *list) {
+  int fused = 0;
+  int kept = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (kept > 0 && fuse_pair(fn, list->items[kept - 1], node)) {
+      fused++;
+      continue;
+    }
+    list->items[kept++] = node;
+  }
+  list->count = kept;
+
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP && node->data.loop.gemm == NULL) {
+      fused += fuse_list(fn, &node->data.loop.body);
+    } else if (node->kind == IR_IF) {
+      fused += fuse_list(fn, &node->data.if_else.then_body);
+      fused += fuse_list(fn, &node->data.if_else.else_body);
+    }
+  }
+  return fused;
+}
+
+static bool uses_tensor(const IRList *list, int tensor) {
+  return used_outside(list, NULL, tensor);
+}
+
+static bool gemm_uses(const IRList *list, int tensor) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP) {
+      const IRGemm *gemm = node->data.loop.gemm;
+      if (gemm != NULL &&
+          (gemm->c == tensor || gemm->a == tensor || gemm->b == tensor))
+        return true;
+      if (gemm_uses(&node->data.loop.body, tensor))
+        return true;
+    } else if (node->kind == IR_IF) {
+      if (gemm_uses(&node->data.if_else.then_body, tensor) ||
+          gemm_uses(&node->data.if_else.else_body, tensor))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Innermost loop under `list` whose body holds every access to `tensor`,
+// or NULL.
+static const IRNode *enclosing_loop(const IRList *list, int tensor) {
+  const IRNode *loop = NULL;
+  for (;;) {
+    const IRNode *inner = NULL;
+    for (int i = 0; i < list->count && inner == NULL; i++) {
+      const IRNode *node = list->items[i];
+      if (node->kind == IR_LOOP && !used_outside(list, node, tensor))
+        inner = node;
+    }
+    if (inner == NULL)
+      return loop;
+    loop = inner;
+    list = &inner->data.loop.body;
+  }
+}
+
+static void drop_expr(IRExpr *expr, int tensor) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    for (int d = 0; d < expr->data.load.count; d++)
+      drop_expr(expr->data.load.indices[d].general, tensor);
+    if (expr->data.load.tensor == tensor) {
+      expr->data.load.count = 0;
+      expr->data.load.indices = NULL;
+    }
+    break;
+  case IR_EXPR_BINARY:
+    drop_expr(expr->data.binary.left, tensor);
+    drop_expr(expr->data.binary.right, tensor);
+    break;
+  case IR_EXPR_UNARY:
+    drop_expr(expr->data.unary.operand, tensor);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      drop_expr(expr->data.call.args[i], tensor);
+    break;
+  default:
+    break;
+  }
+}
+
+static void drop_subscripts(IRList *list, int tensor) {
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      drop_subscripts(&node->data.loop.body, tensor);
+      break;
+    case IR_STMT:
+      for (int d = 0; d < node->data.stmt.target.count; d++)
+        drop_expr(node->data.stmt.target.indices[d].general, tensor);
+      if (node->data.stmt.target.tensor == tensor) {
+        node->data.stmt.target.count = 0;
+        node->data.stmt.target.indices = NULL;
+      }
+      drop_expr(node->data.stmt.value, tensor);
+      break;
+    case IR_IF:
+      drop_expr(node->data.if_else.condition, tensor);
+      drop_subscripts(&node->data.if_else.then_body, tensor);
+      drop_subscripts(&node->data.if_else.else_body, tensor);
+      break;
+    case IR_RETURN:
+      drop_expr(node->data.ret.value, tensor);
+      break;
+    }
+  }
+}
+
+// A local tensor whose accesses all lie in one loop, at one affine
+// subscript, and which each iteration writes before reading carries no
+// value from one iteration to the next or out of the loop, so a scalar can
+// stand in for it. The tensor becomes that scalar in place.
+static bool contract_tensor(IRFunction *fn, int tensor) {
+  IRTensor *info = &fn->tensors[tensor];
+  if (info->kind != IR_TENSOR_LOCAL || info->rank <= 0 ||
+      !uses_tensor(&fn->body, tensor) || gemm_uses(&fn->body, tensor))
+    return false;
+  const IRNode *loop = enclosing_loop(&fn->body, tensor);
+  if (loop == NULL)
+    return false;
+
+  LoopAccessList accesses = {NULL, 0, 0, false};
+  collect_loop_accesses(&accesses, &loop->data.loop.body);
+  const IRAccess *first = NULL;
+  bool ok = true;
+  for (int i = 0; i < accesses.count && ok; i++) {
+    const IRAccess *access = accesses.items[i].access;
+    if (access->tensor != tensor)
+      continue;
+    for (int d = 0; d < access->count && ok; d++)
+      ok = access->indices[d].affine;
+    if (first == NULL)
+      first = access;
+    ok = ok && ir_access_equal(first, access);
+  }
+  free_loop_accesses(&accesses);
+
+  bool written = false;
+  if (!ok || !written_before_read(&loop->data.loop.body, tensor, &written))
+    return false;
+
+  drop_subscripts(&fn->body, tensor);
+  info->rank = 0;
+  info->shape = NULL;
+  return true;
+}
+
+int fuse_function(IRFunction *fn) {
+  int fused = fuse_list(fn, &fn->body);
+  for (int t = fn->param_count; t < fn->tensor_count; t++)
+    contract_tensor(fn, t);
+  return fused;
+}
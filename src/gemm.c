@@ -0,0 +1,131 @@
+#include "transform.h"
+#include <assert.h>
+
+// Position in the band of the loop whose variable is the whole of `index`,
+// or -1. The kernel checks no bounds, so the subscript must be proven.
+static int band_position(const IRIndex *index, IRNode **band, int depth) {
+  if (!index->affine || !index->proven || index->expr.constant != 0 ||
+      index->expr.term_count != 1 || index->expr.terms[0].coeff != 1)
+    return -1;
+  for (int d = 0; d < depth; d++) {
+    if (band[d]->data.loop.var == index->expr.terms[0].symbol)
+      return d;
+  }
+  return -1;
+}
+
+// A rank-2 access subscripted by two loops of the band, as positions.
+static bool matrix_access(const IRFunction *fn, const IRExpr *expr,
+                          IRNode **band, int depth, int *row, int *col) {
+  if (expr->kind != IR_EXPR_LOAD)
+    return false;
+  const IRAccess *access = &expr->data.load;
+  if (fn->tensors[access->tensor].rank != 2 || access->count != 2)
+    return false;
+  *row = band_position(&access->indices[0], band, depth);
+  *col = band_position(&access->indices[1], band, depth);
+  return *row >= 0 && *col >= 0 && *row != *col;
+}
+
+// Loops from 0 to an extent over size parameters only.
+static bool full_range(const IRFunction *fn, const IRNode *loop) {
+  const IRBound *lower = &loop->data.loop.lower;
+  const IRBound *upper = &loop->data.loop.upper;
+  if (lower->count != 1 || !affine_is_constant(&lower->exprs[0]) ||
+      lower->exprs[0].constant != 0 || upper->count != 1)
+    return false;
+  for (int t = 0; t < upper->exprs[0].term_count; t++) {
+    if (fn->symbols[upper->exprs[0].terms[t].symbol].kind != IR_SYM_PARAM)
+      return false;
+  }
+  return true;
+}
+
+static IRGemm *match_gemm(IRFunction *fn, IRNode **band) {
+  for (int d = 0; d < 3; d++) {
+    if (!full_range(fn, band[d]))
+      return NULL;
+  }
+  const IRList *body = &band[2]->data.loop.body;
+  if (body->count != 1 || body->items[0]->kind != IR_STMT)
+    return NULL;
+  const IRNode *stmt = body->items[0];
+  const IRAccess *target = &stmt->data.stmt.target;
+  const IRExpr *product = ir_reduction_operand(stmt);
+  if (target->tensor < 0 || product == NULL ||
+      product->kind != IR_EXPR_BINARY || product->data.binary.op != STAR)
+    return NULL;
+
+  // C[m, n] names the m and n loops; k is the one left.
+  IRExpr c_expr;
+  c_expr.kind = IR_EXPR_LOAD;
+  c_expr.data.load = *target;
+  int m, n;
+  if (!matrix_access(fn, &c_expr, band, 3, &m, &n))
+    return NULL;
+  int k = 3 - m - n;
+
+  const IRExpr *left = product->data.binary.left;
+  const IRExpr *right = product->data.binary.right;
+  int left_row, left_col, right_row, right_col;
+  if (!matrix_access(fn, left, band, 3, &left_row, &left_col) ||
+      !matrix_access(fn, right, band, 3, &right_row, &right_col))
+    return NULL;
+  // The operand that moves with m is A.
+  if (left_row != m && left_col != m) {
+    const IRExpr *swap = left;
+    left = right;
+    right = swap;
+    int row = left_row, col = left_col;
+    left_row = right_row;
+    left_col = right_col;
+    right_row = row;
+    right_col = col;
+  }
+  bool a_ok = (left_row == m && left_col == k) ||
+              (left_row == k && left_col == m);
+  bool b_ok = (right_row == k && right_col == n) ||
+              (right_row == n && right_col == k);
+  int a = left->data.load.tensor, b = right->data.load.tensor;
+  if (!a_ok || !b_ok || a == target->tensor || b == target->tensor)
+    return NULL;
+
+  IRGemm *gemm = (IRGemm *)arena_alloc(fn->arena, sizeof(IRGemm));
+  assert(gemm != NULL);
+  gemm->c = target->tensor;
+  gemm->a = a;
+  gemm->b = b;
+  gemm->trans_a = left_row == k;
+  gemm->trans_b = right_row == n;
+  gemm->alpha = stmt->data.stmt.value->data.binary.op == MINUS ? -1.0f : 1.0f;
+  gemm->m = band[m]->data.loop.upper.exprs[0];
+  gemm->n = band[n]->data.loop.upper.exprs[0];
+  gemm->k = band[k]->data.loop.upper.exprs[0];
+  return gemm;
+}
+
+static int gemm_list(IRFunction *fn, IRList *list) {
+  int matched = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      matched += gemm_list(fn, &node->data.if_else.then_body);
+      matched += gemm_list(fn, &node->data.if_else.else_body);
+      continue;
+    }
+    if (node->kind != IR_LOOP)
+      continue;
+
+    IRNode *band[3];
+    if (find_loop_band(node, band, 3) == 3 &&
+        (node->data.loop.gemm = match_gemm(fn, band)) != NULL)
+      matched++;
+    else
+      matched += gemm_list(fn, &node->data.loop.body);
+  }
+  return matched;
+}
+
+int gemm_function(IRFunction *fn) {
+  return gemm_list(fn, &fn->body);
+}
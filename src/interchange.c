@@ -0,0 +1,139 @@
+#include "dependence.h"
+#include "transform.h"
+
+// Permutations of deeper bands are not searched.
+#define INTERCHANGE_MAX_DEPTH 6
+
+// Cost of making `var` innermost for one access: nothing when the access
+// does not move with it, 1 for unit stride, and a large penalty growing with
+// the stride when it indexes an outer dimension.
+static long access_cost(const IRFunction *fn, const IRAccess *access,
+                        int var) {
+  int rank = fn->tensors[access->tensor].rank;
+  for (int d = 0; d < access->count; d++) {
+    const IRIndex *index = &access->indices[d];
+    if (!index->affine)
+      continue;
+    long coeff = affine_coeff(&index->expr, var);
+    if (coeff == 0)
+      continue;
+    if (d == access->count - 1 && (coeff == 1 || coeff == -1))
+      return 1;
+    return 8L * (rank - d);
+  }
+  return 0;
+}
+
+typedef struct Search {
+  const DependenceList *deps;
+  const long *costs;
+  int depth;
+  int perm[INTERCHANGE_MAX_DEPTH];
+  int best[INTERCHANGE_MAX_DEPTH];
+  bool used[INTERCHANGE_MAX_DEPTH];
+} Search;
+
+// Orders permutations by the cost of their innermost loop, then the next one
+// out, and so on.
+static bool cheaper(const Search *s, const int *perm, const int *than) {
+  for (int p = s->depth - 1; p >= 0; p--) {
+    if (s->costs[perm[p]] != s->costs[than[p]])
+      return s->costs[perm[p]] < s->costs[than[p]];
+  }
+  return false;
+}
+
+static void search(Search *s, int position) {
+  if (position == s->depth) {
+    if (cheaper(s, s->perm, s->best) &&
+        dependences_permutable(s->deps, s->perm, s->depth))
+      memcpy(s->best, s->perm, sizeof(s->perm));
+    return;
+  }
+  for (int d = 0; d < s->depth; d++) {
+    if (s->used[d])
+      continue;
+    s->used[d] = true;
+    s->perm[position] = d;
+    search(s, position + 1);
+    s->used[d] = false;
+  }
+}
+
+static bool interchange_band(const IRFunction *fn, IRNode **band, int depth) {
+  LoopAccessList accesses = {NULL, 0, 0, false};
+  collect_loop_accesses(&accesses, &band[depth - 1]->data.loop.body);
+  if (accesses.has_return) {
+    free_loop_accesses(&accesses);
+    return false;
+  }
+
+  long costs[INTERCHANGE_MAX_DEPTH];
+  for (int d = 0; d < depth; d++) {
+    int var = band[d]->data.loop.var;
+    costs[d] = 0;
+    for (int i = 0; i < accesses.count; i++)
+      costs[d] += access_cost(fn, accesses.items[i].access, var);
+  }
+  free_loop_accesses(&accesses);
+
+  DependenceList deps = {NULL, 0, 0, false};
+  analyze_dependences(band[0], &deps);
+
+  Search s;
+  memset(&s, 0, sizeof(s));
+  s.deps = &deps;
+  s.costs = costs;
+  s.depth = depth;
+  for (int d = 0; d < depth; d++)
+    s.best[d] = d;
+  search(&s, 0);
+  free_dependences(&deps);
+
+  bool changed = false;
+  for (int d = 0; d < depth; d++)
+    changed = changed || s.best[d] != d;
+  if (!changed)
+    return false;
+
+  // Bounds do not refer to other loops of the band, so the loop headers can
+  // simply be exchanged.
+  IRNode headers[INTERCHANGE_MAX_DEPTH];
+  for (int d = 0; d < depth; d++)
+    headers[d] = *band[d];
+  for (int d = 0; d < depth; d++) {
+    const IRNode *from = &headers[s.best[d]];
+    band[d]->line = from->line;
+    band[d]->data.loop.var = from->data.loop.var;
+    band[d]->data.loop.lower = from->data.loop.lower;
+    band[d]->data.loop.upper = from->data.loop.upper;
+    band[d]->data.loop.step = from->data.loop.step;
+  }
+  return true;
+}
+
+static int interchange_list(IRFunction *fn, IRList *list) {
+  int changed = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      changed += interchange_list(fn, &node->data.if_else.then_body);
+      changed += interchange_list(fn, &node->data.if_else.else_body);
+      continue;
+    }
+    if (node->kind != IR_LOOP || node->data.loop.gemm != NULL)
+      continue;
+
+    IRNode *band[INTERCHANGE_MAX_DEPTH];
+    int depth = find_loop_band(node, band, INTERCHANGE_MAX_DEPTH);
+    if (depth >= 2 && interchange_band(fn, band, depth))
+      changed++;
+    IRNode *inner = depth > 0 ? band[depth - 1] : node;
+    changed += interchange_list(fn, &inner->data.loop.body);
+  }
+  return changed;
+}
+
+int interchange_function(IRFunction *fn) {
+  return interchange_list(fn, &fn->body);
+}
@@ -0,0 +1,158 @@
+#include "intern.h"
+#include "arena.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Strings are spread over independently locked shards by hash so parallel
+// parsers rarely contend.
+#define INTERN_SHARDS 16
+#define INTERN_INITIAL_CAPACITY 256
+
+// Stored in front of every interned string.
+typedef struct SymbolHeader {
+  uint32_t id;
+  uint32_t length;
+} SymbolHeader;
+
+typedef struct InternEntry {
+  uint32_t hash;
+  const char *text;
+} InternEntry;
+
+typedef struct InternShard {
+  pthread_mutex_t mutex;
+  InternEntry *entries;
+  uint32_t capacity;
+  uint32_t count;
+  Arena *arena;
+} InternShard;
+
+static InternShard shards[INTERN_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+static atomic_uint next_id;
+
+static void init_shards(void) {
+  for (int i = 0; i < INTERN_SHARDS; i++)
+    pthread_mutex_init(&shards[i].mutex, NULL);
+}
+
+static uint32_t hash_string(const char *str, int length) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static const SymbolHeader *header_of(const char *symbol) {
+  return (const SymbolHeader *)symbol - 1;
+}
+
+static bool grow_shard(InternShard *shard) {
+  uint32_t capacity =
+      shard->capacity > 0 ? shard->capacity * 2 : INTERN_INITIAL_CAPACITY;
+  InternEntry *entries = (InternEntry *)calloc(capacity, sizeof(InternEntry));
+  if (entries == NULL)
+    return false;
+
+  for (uint32_t i = 0; i < shard->capacity; i++) {
+    InternEntry entry = shard->entries[i];
+    if (entry.text == NULL)
+      continue;
+    uint32_t slot = entry.hash & (capacity - 1);
+    while (entries[slot].text != NULL)
+      slot = (slot + 1) & (capacity - 1);
+    entries[slot] = entry;
+  }
+
+  free(shard->entries);
+  shard->entries = entries;
+  shard->capacity = capacity;
+  return true;
+}
+
+const char *intern_string(const char *str, int length) {
+  if (str == NULL || length < 0)
+    return NULL;
+
+  pthread_once(&shards_once, init_shards);
+
+  uint32_t hash = hash_string(str, length);
+  InternShard *shard = &shards[(hash >> 28) % INTERN_SHARDS];
+  const char *result = NULL;
+
+  pthread_mutex_lock(&shard->mutex);
+
+  if (shard->count * 4 >= shard->capacity * 3 && !grow_shard(shard))
+    goto done;
+
+  uint32_t mask = shard->capacity - 1;
+  uint32_t slot = hash & mask;
+  for (;;) {
+    InternEntry *entry = &shard->entries[slot];
+    if (entry->text == NULL)
+      break;
+    if (entry->hash == hash && (int)header_of(entry->text)->length == length &&
+        memcmp(entry->text, str, length) == 0) {
+      result = entry->text;
+      goto done;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (shard->arena == NULL) {
+    shard->arena = init_arena(16 * 1024);
+    if (shard->arena == NULL)
+      goto done;
+  }
+
+  SymbolHeader *header = (SymbolHeader *)arena_alloc(
+      shard->arena, sizeof(SymbolHeader) + length + 1);
+  if (header == NULL)
+    goto done;
+  header->id = atomic_fetch_add(&next_id, 1);
+  header->length = (uint32_t)length;
+  char *text = (char *)(header + 1);
+  memcpy(text, str, length);
+  text[length] = '\0';
+
+  shard->entries[slot].hash = hash;
+  shard->entries[slot].text = text;
+  shard->count++;
+  result = text;
+
+done:
+  pthread_mutex_unlock(&shard->mutex);
+  return result;
+}
+
+const char *intern_cstring(const char *str) {
+  return str != NULL ? intern_string(str, (int)strlen(str)) : NULL;
+}
+
+uint32_t symbol_id(const char *symbol) { return header_of(symbol)->id; }
+
+int symbol_length(const char *symbol) {
+  return (int)header_of(symbol)->length;
+}
+
+uint32_t interned_count(void) { return atomic_load(&next_id); }
+
+void free_interner(void) {
+  pthread_once(&shards_once, init_shards);
+  for (int i = 0; i < INTERN_SHARDS; i++) {
+    InternShard *shard = &shards[i];
+    pthread_mutex_lock(&shard->mutex);
+    free(shard->entries);
+    free_arena(shard->arena);
+    shard->entries = NULL;
+    shard->arena = NULL;
+    shard->capacity = 0;
+    shard->count = 0;
+    pthread_mutex_unlock(&shard->mutex);
+  }
+  atomic_store(&next_id, 0);
+}
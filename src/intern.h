@@ -0,0 +1,23 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Process-wide string interner. Every distinct string is stored once, so two
+// interned strings are equal exactly when their pointers are equal, and names
+// in the AST can be compared and hashed by address. Interned strings stay
+// valid until free_interner and are safe to create from several threads.
+
+const char *intern_string(const char *str, int length);
+const char *intern_cstring(const char *str);
+
+// O(1) accessors for interned strings. Ids are dense, start at 0 and are
+// assigned in interning order.
+uint32_t symbol_id(const char *symbol);
+int symbol_length(const char *symbol);
+uint32_t interned_count(void);
+
+void free_interner(void);
+
+#endif // !INTERN_H
@@ -0,0 +1,413 @@
+#include "jit.h"
+#include "codegen.h"
+#include "flat_ast.h"
+#include "loop_ir.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+extern char **environ;
+
+#define JIT_DEFAULT_FLAGS "-O3 -march=native"
+#define JIT_MAX_ARGS 64
+
+static void jit_error(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "JIT error: ");
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Two independent 64-bit lanes: FNV-1a and a multiply-xorshift mix.
+typedef struct JitHash {
+  uint64_t a;
+  uint64_t b;
+} JitHash;
+
+static void hash_bytes(JitHash *hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash->a = (hash->a ^ bytes[i]) * 0x100000001b3ull;
+    hash->b = (hash->b + bytes[i] + 1) * 0x9e3779b97f4a7c15ull;
+    hash->b ^= hash->b >> 29;
+  }
+}
+
+static void hash_u32(JitHash *hash, uint32_t value) {
+  hash_bytes(hash, &value, sizeof(value));
+}
+
+// Strings are hashed with their terminator so adjacent fields cannot run
+// into each other.
+static void hash_string(JitHash *hash, const char *str) {
+  hash_bytes(hash, str, strlen(str) + 1);
+}
+
+// Line numbers are the only part of the flat form that depends on layout
+// rather than meaning, so they are skipped.
+static void hash_program(JitHash *hash, const FlatAST *ast) {
+  hash_u32(hash, ast->node_count);
+  hash_u32(hash, ast->root);
+  for (uint32_t i = 0; i < ast->node_count; i++) {
+    const FlatNode *node = &ast->nodes[i];
+    hash_u32(hash, node->type | (uint32_t)node->op << 8);
+    hash_u32(hash, node->a);
+    hash_u32(hash, node->b);
+    hash_u32(hash, node->c);
+  }
+  hash_u32(hash, ast->extra_count);
+  hash_bytes(hash, ast->extra, sizeof(uint32_t) * ast->extra_count);
+  hash_u32(hash, ast->strings_size);
+  hash_bytes(hash, ast->strings, ast->strings_size);
+}
+
+static char *format_path(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  char *path = (char *)malloc(length + 1);
+  if (path == NULL)
+    return NULL;
+  va_start(args, format);
+  vsnprintf(path, length + 1, format, args);
+  va_end(args);
+  return path;
+}
+
+static char *default_cache_dir(void) {
+  const char *dir = getenv("EIN_CACHE_DIR");
+  if (dir != NULL && *dir != '\0')
+    return format_path("%s", dir);
+  dir = getenv("XDG_CACHE_HOME");
+  if (dir != NULL && *dir != '\0')
+    return format_path("%s/ein", dir);
+  dir = getenv("HOME");
+  if (dir != NULL && *dir != '\0')
+    return format_path("%s/.cache/ein", dir);
+  return format_path("/tmp/ein-cache");
+}
+
+// mkdir -p. Races with other processes creating the same directories are
+// fine, since EEXIST is accepted.
+static bool make_dirs(char *path) {
+  for (char *p = path + 1;; p++) {
+    if (*p != '/' && *p != '\0')
+      continue;
+    char saved = *p;
+    *p = '\0';
+    bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+    *p = saved;
+    if (!ok || saved == '\0')
+      return ok;
+  }
+}
+
+// Hashes what -march=native resolves from: the CPU's vendor, family, model
+// and feature bits, or the kernel's hardware capabilities where there is no
+// cpuid. An object cached on one machine is then never loaded on another
+// that may lack its instructions, even with the cache directory shared.
+static void hash_host(JitHash *hash) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned eax, ebx, ecx, edx;
+  unsigned max = __get_cpuid_max(0, NULL);
+  if (__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+    hash_u32(hash, ebx);
+    hash_u32(hash, edx);
+    hash_u32(hash, ecx);
+  }
+  // EBX of leaf 1 holds the APIC ID, which differs between cores.
+  if (max >= 1 && __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    hash_u32(hash, eax);
+    hash_u32(hash, ecx);
+    hash_u32(hash, edx);
+  }
+  if (max >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    hash_u32(hash, ebx);
+    hash_u32(hash, ecx);
+    hash_u32(hash, edx);
+    __cpuid_count(7, 1, eax, ebx, ecx, edx);
+    hash_u32(hash, eax);
+  }
+  if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+    hash_u32(hash, ecx);
+    hash_u32(hash, edx);
+  }
+#elif defined(__linux__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  hash_bytes(hash, &hwcap, sizeof(hwcap));
+#ifdef AT_HWCAP2
+  unsigned long hwcap2 = getauxval(AT_HWCAP2);
+  hash_bytes(hash, &hwcap2, sizeof(hwcap2));
+#endif
+#else
+  (void)hash;
+#endif
+}
+
+// Hashes what `compiler --version` prints, so that objects built by one
+// release of the compiler are not loaded after an upgrade to another.
+static bool hash_compiler_version(JitHash *hash, const char *compiler) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    jit_error("cannot run '%s': %s", compiler, strerror(errno));
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+  char *argv[] = {(char *)compiler, "--version", NULL};
+  pid_t pid;
+  int error = posix_spawnp(&pid, compiler, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (error != 0) {
+    close(fds[0]);
+    jit_error("cannot run '%s': %s", compiler, strerror(error));
+    return false;
+  }
+
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+    if (n < 0 && errno != EINTR)
+      break;
+    if (n > 0)
+      hash_bytes(hash, buffer, (size_t)n);
+  }
+  close(fds[0]);
+
+  int status = 0;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    jit_error("'%s --version' failed", compiler);
+    return false;
+  }
+  return true;
+}
+
+// Runs `compiler flags -shared -fPIC -o so_path c_path -lm` without a shell,
+// so paths need no quoting.
+static bool run_compiler(const char *compiler, const char *flags,
+                         const char *c_path, const char *so_path) {
+  char *words = format_path("%s", flags);
+  if (words == NULL)
+    return false;
+
+  char *argv[JIT_MAX_ARGS + 8];
+  int argc = 0;
+  argv[argc++] = (char *)compiler;
+  char *save = NULL;
+  for (char *word = strtok_r(words, " \t", &save); word != NULL;
+       word = strtok_r(NULL, " \t", &save)) {
+    // The key covers every flag, so none may be dropped.
+    if (argc == JIT_MAX_ARGS) {
+      jit_error("too many compiler flags");
+      free(words);
+      return false;
+    }
+    argv[argc++] = word;
+  }
+  argv[argc++] = "-shared";
+  argv[argc++] = "-fPIC";
+  argv[argc++] = "-o";
+  argv[argc++] = (char *)so_path;
+  argv[argc++] = (char *)c_path;
+  argv[argc++] = "-lm";
+  argv[argc] = NULL;
+
+  pid_t pid;
+  int status = 0;
+  int error = posix_spawnp(&pid, compiler, NULL, NULL, argv, environ);
+  free(words);
+  if (error != 0) {
+    jit_error("cannot run '%s': %s", compiler, strerror(error));
+    return false;
+  }
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    jit_error("'%s' failed on %s", compiler, c_path);
+    return false;
+  }
+  return true;
+}
+
+// Generates and compiles the program, then moves the object into place with
+// rename so concurrent processes only ever see complete files.
+static bool build_object(Arena *arena, ASTNode *program,
+                         const TransformOptions *transforms,
+                         const char *compiler, const char *flags,
+                         const char *dir, const char *key, const char *path) {
+  IRModule *module = lower_program(arena, program);
+  if (module == NULL || verify_ir_module(module) > 0)
+    return false;
+  if (transforms != NULL) {
+    transform_module(module, transforms);
+    if (verify_ir_module(module) > 0)
+      return false;
+  }
+
+  long pid = (long)getpid();
+  char *c_path = format_path("%s/%s.%ld.c", dir, key, pid);
+  char *so_path = format_path("%s/%s.%ld.so", dir, key, pid);
+  if (c_path == NULL || so_path == NULL) {
+    free(c_path);
+    free(so_path);
+    return false;
+  }
+
+  FILE *fp = fopen(c_path, "w");
+  bool ok = fp != NULL;
+  if (!ok)
+    jit_error("cannot write '%s': %s", c_path, strerror(errno));
+  else
+    ok = emit_c_module(fp, module);
+  if (fp != NULL && fclose(fp) != 0)
+    ok = false;
+
+  ok = ok && run_compiler(compiler, flags, c_path, so_path);
+  if (ok && rename(so_path, path) != 0) {
+    jit_error("cannot move '%s' into the cache: %s", so_path,
+              strerror(errno));
+    ok = false;
+  }
+
+  remove(c_path);
+  if (!ok)
+    remove(so_path);
+  free(c_path);
+  free(so_path);
+  return ok;
+}
+
+static void jit_parallel_for(void *pool, long count, ThreadPoolRange body,
+                             void *context) {
+  thread_pool_for((ThreadPool *)pool, count, 0, body, context);
+}
+
+// Points the unit's parallel-loop hook, if it has one, at `pool`. The pool
+// is not part of the cache key, since it only decides where loops run.
+static void bind_thread_pool(JitModule *module, ThreadPool *pool) {
+  void *pool_address = dlsym(module->handle, "ein_parallel_pool");
+  void *for_address = dlsym(module->handle, "ein_parallel_for");
+  if (pool == NULL || pool_address == NULL || for_address == NULL)
+    return;
+
+  void (*parallel_for)(void *, long, ThreadPoolRange, void *) =
+      jit_parallel_for;
+  memcpy(pool_address, &pool, sizeof(pool));
+  memcpy(for_address, &parallel_for, sizeof(parallel_for));
+}
+
+JitModule *jit_compile(Arena *arena, ASTNode *program,
+                       const JitOptions *options) {
+  JitOptions defaults = {NULL, NULL, NULL, NULL, NULL};
+  if (options == NULL)
+    options = &defaults;
+
+  const char *compiler = options->compiler;
+  if (compiler == NULL)
+    compiler = getenv("CC");
+  if (compiler == NULL || *compiler == '\0')
+    compiler = "cc";
+  const char *flags =
+      options->flags != NULL ? options->flags : JIT_DEFAULT_FLAGS;
+  char *dir = options->cache_dir != NULL
+                  ? format_path("%s", options->cache_dir)
+                  : default_cache_dir();
+
+  FlatAST *ast = flatten_ast(program);
+  JitModule *module = (JitModule *)calloc(1, sizeof(JitModule));
+  if (dir == NULL || ast == NULL || module == NULL) {
+    jit_error("out of memory");
+    free(dir);
+    free_flat_ast(ast);
+    free(module);
+    return NULL;
+  }
+
+  JitHash hash = {0xcbf29ce484222325ull, 0x6a09e667f3bcc909ull};
+  hash_u32(&hash, JIT_FORMAT_VERSION);
+  hash_string(&hash, compiler);
+  hash_string(&hash, flags);
+  hash_host(&hash);
+  if (!hash_compiler_version(&hash, compiler)) {
+    free(dir);
+    free_flat_ast(ast);
+    free(module);
+    return NULL;
+  }
+  char transforms[256] = "";
+  if (options->transforms != NULL)
+    describe_transforms(options->transforms, transforms, sizeof(transforms));
+  hash_string(&hash, transforms);
+  hash_program(&hash, ast);
+  free_flat_ast(ast);
+  snprintf(module->key, sizeof(module->key), "%016llx%016llx",
+           (unsigned long long)hash.a, (unsigned long long)hash.b);
+
+  module->path = format_path("%s/%s.so", dir, module->key);
+  if (module->path == NULL || !make_dirs(dir)) {
+    jit_error("cannot create cache directory '%s'", dir);
+    free(dir);
+    free_jit_module(module);
+    return NULL;
+  }
+
+  // A cached object that fails to load (say, truncated by a crash) is
+  // rebuilt in place.
+  module->handle = dlopen(module->path, RTLD_NOW | RTLD_LOCAL);
+  module->cached = module->handle != NULL;
+  if (module->handle == NULL &&
+      build_object(arena, program, options->transforms, compiler, flags, dir,
+                   module->key, module->path)) {
+    module->handle = dlopen(module->path, RTLD_NOW | RTLD_LOCAL);
+    if (module->handle == NULL)
+      jit_error("cannot load '%s': %s", module->path, dlerror());
+  }
+  free(dir);
+
+  if (module->handle == NULL) {
+    free_jit_module(module);
+    return NULL;
+  }
+  bind_thread_pool(module, options->pool);
+  return module;
+}
+
+JitEntry jit_entry(JitModule *module, const char *name) {
+  char symbol[256];
+  c_entry_name(symbol, sizeof(symbol), name);
+
+  // dlsym returns an object pointer; POSIX guarantees the round trip.
+  JitEntry entry;
+  void *address = dlsym(module->handle, symbol);
+  memcpy(&entry, &address, sizeof(entry));
+  return address != NULL ? entry : NULL;
+}
+
+void free_jit_module(JitModule *module) {
+  if (module == NULL)
+    return;
+
+  if (module->handle != NULL)
+    dlclose(module->handle);
+  free(module->path);
+  free(module);
+}
@@ -0,0 +1,51 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "arena.h"
+#include "ast.h"
+#include "thread_pool.h"
+#include "transform.h"
+#include <stdint.h>
+
+// In-process JIT. A program is compiled through the C back end with the host
+// compiler into a shared object, which is loaded with dlopen. Shared objects
+// are kept in a cache directory under a content hash of the program and the
+// build settings, so a later run with the same source loads the cached object
+// without lowering or compiling anything.
+//
+// The hash covers the flat AST with line numbers left out, so edits to
+// comments and layout still hit the cache, together with the compiler and
+// the version it reports, its flags, the host CPU, the loop transformations
+// applied and JIT_FORMAT_VERSION. The host CPU is part of it because the
+// default flags target whatever machine compiles the object.
+
+// Bumped whenever generated code changes meaning for the same AST.
+#define JIT_FORMAT_VERSION 10
+
+typedef struct JitOptions {
+  const char *compiler;  // NULL for $CC, or "cc".
+  const char *flags;     // NULL for "-O3 -march=native".
+  const char *cache_dir; // NULL for $EIN_CACHE_DIR, or ~/.cache/ein.
+  const TransformOptions *transforms; // NULL for none.
+  ThreadPool *pool; // Runs parallel loops; NULL runs them on the caller.
+} JitOptions;
+
+// Signature shared by every generated entry point; see codegen.h.
+typedef void (*JitEntry)(const long *sizes, float *const *args, float *out);
+
+typedef struct JitModule {
+  void *handle;
+  char key[33]; // 128-bit content hash in hex.
+  char *path;   // Shared object in the cache.
+  bool cached;  // Loaded without compiling.
+} JitModule;
+
+// Returns the loaded module for a parsed and shape-checked program, compiling
+// it first on a cache miss. Failures are reported as "JIT error: ..." and
+// NULL is returned. `options` may be NULL.
+JitModule *jit_compile(Arena *arena, ASTNode *program,
+                       const JitOptions *options);
+JitEntry jit_entry(JitModule *module, const char *name);
+void free_jit_module(JitModule *module);
+
+#endif // !JIT_H
@@ -1,65 +1,222 @@
 #include "lexer.h"
 
-bool isalphanumeric(char *str) {
-  if (str == NULL || *str == '\0') {
-    return false;
-  }
-  while (*str) {
-    char c = *str;
-    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
-          (c >= '0' && c <= '9'))) {
-      return false;
+// Character classes used to find lexeme boundaries and classify words in a
+// single pass. Bytes outside ASCII and unlisted punctuation have no class and
+// make a word UNKNOWN.
+enum {
+  LEX_SPACE = 1 << 0,
+  LEX_NEWLINE = 1 << 1,
+  LEX_DELIM = 1 << 2,
+  LEX_ALPHA = 1 << 3,
+  LEX_DIGIT = 1 << 4,
+  LEX_DOT = 1 << 5,
+};
+
+#define S LEX_SPACE
+#define N (LEX_SPACE | LEX_NEWLINE)
+#define D LEX_DELIM
+#define A LEX_ALPHA
+#define G LEX_DIGIT
+#define P LEX_DOT
+static const unsigned char lex_char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, S, N, 0, 0, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    S, D, 0, 0, 0, 0, 0, 0, D, D, D, D, D, D, P, 0,
+    G, G, G, G, G, G, G, G, G, G, D, D, D, D, D, 0,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, D, 0, D, 0, 0,
+    0, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+    A, A, A, A, A, A, A, A, A, A, A, D, 0, D, 0, 0,
+};
+#undef S
+#undef N
+#undef D
+#undef A
+#undef G
+#undef P
+
+// Vectorised scanning of whitespace runs and word bodies. Each helper
+// consumes as many whole blocks as it can and returns the number of bytes
+// consumed; the caller finishes the lexeme with the table-driven loop, which
+// is also the complete fallback when no vector unit is available. Define
+// EIN_NO_SIMD to force the fallback.
+//
+// Most lexemes and gaps are only a few bytes long, where setting up a vector
+// compare costs more than it saves, so the scalar loops hand over only once a
+// run has reached LEX_SIMD_THRESHOLD bytes.
+#define LEX_SIMD_THRESHOLD 8
+
+#if !defined(EIN_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define LEX_SIMD_WIDTH 32
+typedef __m256i lex_vec;
+#define lex_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define lex_splat(c) _mm256_set1_epi8((char)(c))
+#define lex_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define lex_or(a, b) _mm256_or_si256(a, b)
+#define lex_and(a, b) _mm256_and_si256(a, b)
+#define lex_max(a, b) _mm256_max_epu8(a, b)
+#define lex_min(a, b) _mm256_min_epu8(a, b)
+#define lex_mask(v) ((unsigned long)(unsigned)_mm256_movemask_epi8(v))
+#elif !defined(EIN_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define LEX_SIMD_WIDTH 16
+typedef __m128i lex_vec;
+#define lex_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define lex_splat(c) _mm_set1_epi8((char)(c))
+#define lex_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define lex_or(a, b) _mm_or_si128(a, b)
+#define lex_and(a, b) _mm_and_si128(a, b)
+#define lex_max(a, b) _mm_max_epu8(a, b)
+#define lex_min(a, b) _mm_min_epu8(a, b)
+#define lex_mask(v) ((unsigned long)(unsigned)_mm_movemask_epi8(v))
+#endif
+
+#ifdef LEX_SIMD_WIDTH
+#define LEX_FULL_MASK ((1UL << LEX_SIMD_WIDTH) - 1)
+
+// Bytes of `v` that lie in [lo, hi], compared as unsigned.
+static lex_vec lex_in_range(lex_vec v, char lo, char hi) {
+  return lex_and(lex_eq(lex_max(v, lex_splat(lo)), v),
+                 lex_eq(lex_min(v, lex_splat(hi)), v));
+}
+
+// Skips spaces, tabs, carriage returns and newlines, adding the number of
+// newlines skipped to `*newlines`.
+static int skip_space_run(const char *s, int n, int *newlines) {
+  int i = 0;
+  while (i + LEX_SIMD_WIDTH <= n) {
+    lex_vec v = lex_load(s + i);
+    lex_vec nl = lex_eq(v, lex_splat('\n'));
+    lex_vec space = lex_or(lex_or(lex_eq(v, lex_splat(' ')), nl),
+                           lex_or(lex_eq(v, lex_splat('\t')),
+                                  lex_eq(v, lex_splat('\r'))));
+    unsigned long space_mask = lex_mask(space);
+    unsigned long nl_mask = lex_mask(nl);
+    if (space_mask != LEX_FULL_MASK) {
+      int run = __builtin_ctzl(~space_mask);
+      *newlines += __builtin_popcountl(nl_mask & ((1UL << run) - 1));
+      return i + run;
     }
-    str++;
+    *newlines += __builtin_popcountl(nl_mask);
+    i += LEX_SIMD_WIDTH;
   }
-  return true;
+  return i;
 }
 
-bool isint(const char *str) {
-  if (str == NULL || *str == '\0') {
-    return false;
-  }
-  if (*str == '+' || *str == '-') {
-    str++;
-  }
-  if (*str == '\0') {
-    return false;
+// Consumes letters, digits and dots, recording which of those classes were
+// seen and how many dots there were.
+static int scan_word_run(const char *s, int n, unsigned *seen, int *dots) {
+  int i = 0;
+  while (i + LEX_SIMD_WIDTH <= n) {
+    lex_vec v = lex_load(s + i);
+    lex_vec digit = lex_in_range(v, '0', '9');
+    lex_vec alpha = lex_in_range(lex_or(v, lex_splat(0x20)), 'a', 'z');
+    lex_vec dot = lex_eq(v, lex_splat('.'));
+    unsigned long word_mask = lex_mask(lex_or(lex_or(digit, alpha), dot));
+
+    unsigned long take = LEX_FULL_MASK;
+    if (word_mask != LEX_FULL_MASK)
+      take = (1UL << __builtin_ctzl(~word_mask)) - 1;
+
+    unsigned long dot_mask = lex_mask(dot) & take;
+    *seen |= (lex_mask(digit) & take ? LEX_DIGIT : 0) |
+             (lex_mask(alpha) & take ? LEX_ALPHA : 0) |
+             (dot_mask ? LEX_DOT : 0);
+    *dots += __builtin_popcountl(dot_mask);
+
+    if (take != LEX_FULL_MASK)
+      return i + __builtin_popcountl(take);
+    i += LEX_SIMD_WIDTH;
   }
-  while (*str) {
-    if (*str < '0' || *str > '9') {
-      return false;
-    }
-    str++;
+  return i;
+}
+#else
+static int skip_space_run(const char *s, int n, int *newlines) {
+  (void)s;
+  (void)n;
+  (void)newlines;
+  return 0;
+}
+
+static int scan_word_run(const char *s, int n, unsigned *seen, int *dots) {
+  (void)s;
+  (void)n;
+  (void)seen;
+  (void)dots;
+  return 0;
+}
+#endif
+
+// Keywords are recognised by length and first character, so a word costs at
+// most one comparison against a single candidate keyword.
+static TokenType keyword_type(const char *s, int length) {
+  switch (length) {
+  case 2:
+    if (s[0] == 'i' && s[1] == 'f')
+      return IF;
+    if (s[0] == 'i' && s[1] == 'n')
+      return IN;
+    if ((s[0] == 'o' && s[1] == 'r') || (s[0] == 'O' && s[1] == 'R'))
+      return OR;
+    break;
+  case 3:
+    if (s[0] == 'f' && memcmp(s, "for", 3) == 0)
+      return FOR;
+    if (s[0] == 'a' && memcmp(s, "and", 3) == 0)
+      return AND;
+    break;
+  case 4:
+    if (s[0] == 'f' && memcmp(s, "func", 4) == 0)
+      return FUNC;
+    if (s[0] == 'e' && memcmp(s, "else", 4) == 0)
+      return ELSE;
+    break;
+  case 5:
+    if (s[0] == 'r' && memcmp(s, "range", 5) == 0)
+      return RANGE;
+    break;
+  case 6:
+    if (s[0] == 'r' && memcmp(s, "return", 6) == 0)
+      return RETURN;
+    if (s[0] == 't' && memcmp(s, "tensor", 6) == 0)
+      return TENSOR;
+    break;
   }
-  return true;
+  return IDENTIFIER;
 }
 
-bool isfloat(const char *str) {
-  if (str == NULL || *str == '\0')
-    return false;
+const char *token_text(const char *source, Token token) {
+  return source + token.offset;
+}
 
-  if (*str == '+' || *str == '-')
-    str++;
-
-  bool has_digit = false;
-  bool has_dot = false;
-  while (*str) {
-    if (*str >= '0' && *str <= '9') {
-      has_digit = true;
-    } else if (*str == '.') {
-      if (has_dot)
-        return false;
-      has_dot = true;
-    } else {
-      return false;
-    }
-    str++;
+long token_int_value(const char *source, Token token) {
+  const char *s = token_text(source, token);
+  long value = 0;
+  int i = 0;
+  bool negative = false;
+  if (i < token.length && (s[i] == '+' || s[i] == '-')) {
+    negative = s[i] == '-';
+    i++;
+  }
+  for (; i < token.length; i++) {
+    value = value * 10 + (s[i] - '0');
   }
+  return negative ? -value : value;
+}
 
-  return has_digit;
+double token_float_value(const char *source, Token token) {
+  // strtod needs a terminated string; float lexemes are short, so copy the
+  // slice onto the stack rather than allocating.
+  char buffer[64];
+  int length = token.length < (int)sizeof(buffer) - 1 ? token.length
+                                                      : (int)sizeof(buffer) - 1;
+  memcpy(buffer, token_text(source, token), length);
+  buffer[length] = '\0';
+  return strtod(buffer, NULL);
 }
 
-Lexer *init_lexer(char *input, int total_length) {
+Lexer *init_lexer(const char *input, int total_length) {
   if (input == NULL || total_length < 0) {
     return NULL;
   }
@@ -74,12 +231,10 @@ Lexer *init_lexer(char *input, int total_length) {
   lexer->line = 0;
   lexer->position = 0;
 
-  lexer->token_capacity = 50;
-  lexer->token_list = (Token *)malloc(lexer->token_capacity * sizeof(Token));
-  if (lexer->token_list == NULL) {
-    free(lexer);
-    return NULL;
-  }
+  // The token list is only materialised by scan(); a parser pulling tokens
+  // through next_token() never needs it.
+  lexer->token_capacity = 0;
+  lexer->token_list = NULL;
   lexer->token_count = 0;
 
   return lexer;
@@ -90,9 +245,6 @@ void free_lexer(Lexer *lexer) {
     return;
   }
 
-  for (int i = 0; i < lexer->token_count; i++) {
-    free(lexer->token_list[i].literal);
-  }
   free(lexer->token_list);
   free(lexer);
 }
@@ -101,6 +253,7 @@ void skip_whitespace(Lexer *lexer) {
   if (lexer == NULL) {
     return;
   }
+  int run = 0;
   while (lexer->position < lexer->total_length) {
     char c = lexer->input[lexer->position];
     if (c == ' ' || c == '\t' || c == '\r') {
@@ -111,6 +264,13 @@ void skip_whitespace(Lexer *lexer) {
     } else {
       break;
     }
+    if (++run == LEX_SIMD_THRESHOLD) {
+      int newlines = 0;
+      lexer->position +=
+          skip_space_run(lexer->input + lexer->position,
+                         lexer->total_length - lexer->position, &newlines);
+      lexer->line += newlines;
+    }
   }
 }
 
@@ -118,7 +278,8 @@ bool grow_lexer(Lexer *lexer) {
   if (lexer == NULL) {
     return false;
   }
-  int new_capacity = 2 * lexer->token_capacity;
+  int new_capacity =
+      lexer->token_capacity > 0 ? 2 * lexer->token_capacity : 64;
   Token *new_list = realloc(lexer->token_list, new_capacity * sizeof(Token));
   if (new_list == NULL) {
     return false;
@@ -127,51 +288,37 @@ bool grow_lexer(Lexer *lexer) {
   lexer->token_capacity = new_capacity;
   return true;
 }
-Token *create_token(const char *literal, TokenType tokenType, int line) {
-  Token *t = (Token *)malloc(sizeof(Token));
-  if (!t)
-    return NULL;
-  t->literal = strdup(literal);
-  if (!t->literal) {
-    free(t);
-    return NULL;
-  }
-  t->line = line;
-  t->tokenType = tokenType;
-  return t;
-}
 
-void add_token(Lexer *lexer, Token *token) {
-  if (!lexer || !token) {
+void add_token(Lexer *lexer, Token token) {
+  if (!lexer) {
     return;
   }
   if (lexer->token_count >= lexer->token_capacity) {
     if (!grow_lexer(lexer)) {
-      free(token->literal);
-      free(token);
       return;
     }
   }
-  lexer->token_list[lexer->token_count++] = *token;
-  free(token);
+  lexer->token_list[lexer->token_count++] = token;
 }
 
-void scan(Lexer *lexer) {
-  if (lexer == NULL) {
-    return;
-  }
-
-  Token *t = NULL;
+static Token make_token(Lexer *lexer, TokenType tokenType, int offset,
+                        int length) {
+  Token t;
+  t.offset = offset;
+  t.length = length;
+  t.line = lexer->line;
+  t.tokenType = tokenType;
+  return t;
+}
 
-  while (lexer->position < lexer->total_length &&
-         lexer->input[lexer->position] != '\0') {
+// Lexes one token and advances past it. Once the input is exhausted this
+// returns an END_OF_FILE token, and keeps doing so on further calls.
+Token next_token(Lexer *lexer) {
+  for (;;) {
     skip_whitespace(lexer);
-    if (lexer->position >= lexer->total_length ||
-        lexer->input[lexer->position] == '\0') {
-      break;
+    if (lexer->position >= lexer->total_length) {
+      return make_token(lexer, END_OF_FILE, lexer->position, 0);
     }
-    t = NULL;
-
     char c = lexer->input[lexer->position];
     switch (c) {
     case '(':
@@ -184,56 +331,44 @@ void scan(Lexer *lexer) {
     case ':':
     case '*':
     case ';': {
-      char *literal = NULL;
       TokenType token_type = UNKNOWN;
 
       switch (c) {
       case '(':
-        literal = "(";
         token_type = LEFT_PAREN;
         break;
       case ')':
-        literal = ")";
         token_type = RIGHT_PAREN;
         break;
       case '[':
-        literal = "[";
         token_type = LEFT_BRACKET;
         break;
       case ']':
-        literal = "]";
         token_type = RIGHT_BRACKET;
         break;
       case '{':
-        literal = "{";
         token_type = LEFT_BRACE;
         break;
       case '}':
-        literal = "}";
         token_type = RIGHT_BRACE;
         break;
       case ',':
-        literal = ",";
         token_type = COMMA;
         break;
       case ':':
-        literal = ":";
         token_type = COLON;
         break;
       case '*':
-        literal = "*";
         token_type = STAR;
         break;
       default:
-        literal = ";";
         token_type = SEMICOLON;
         break;
       }
 
-      t = create_token(literal, token_type, lexer->line);
-      add_token(lexer, t);
+      Token t = make_token(lexer, token_type, lexer->position, 1);
       lexer->position++;
-      break;
+      return t;
     }
     case '-':
     case '+':
@@ -247,141 +382,136 @@ void scan(Lexer *lexer) {
       }
 
       int advance = 1;
-      char *literal = NULL;
       TokenType token_type = UNKNOWN;
 
       if (c == '-' && next == '>') {
-        literal = "->";
         token_type = ARROW;
         advance = 2;
       } else if (next == '=') {
         advance = 2;
         switch (c) {
         case '-':
-          literal = "-=";
           token_type = MINUS_EQUAL;
           break;
         case '+':
-          literal = "+=";
           token_type = PLUS_EQUAL;
           break;
         case '=':
-          literal = "==";
           token_type = EQUAL_EQUAL;
           break;
         case '<':
-          literal = "<=";
           token_type = LESS_EQUAL;
           break;
         case '>':
-          literal = ">=";
           token_type = GREATER_EQUAL;
           break;
         default:
-          literal = "!=";
           token_type = BANG_EQUAL;
           break;
         }
       } else {
         switch (c) {
         case '-':
-          literal = "-";
           token_type = MINUS;
           break;
         case '+':
-          literal = "+";
           token_type = PLUS;
           break;
         case '=':
-          literal = "=";
           token_type = EQUAL;
           break;
         case '<':
-          literal = "<";
           token_type = LESS;
           break;
         case '>':
-          literal = ">";
           token_type = GREATER;
           break;
         default:
-          literal = "!";
           token_type = BANG;
           break;
         }
       }
 
-      t = create_token(literal, token_type, lexer->line);
-      add_token(lexer, t);
+      Token t = make_token(lexer, token_type, lexer->position, advance);
       lexer->position += advance;
-      break;
+      return t;
     }
     default: {
+      // Find the end of the word and collect the classes of its characters
+      // in the same pass, then classify it from those alone.
       int current_position = lexer->position;
+      unsigned seen = 0;
+      int dots = 0;
+      bool has_other = false;
       while (current_position < lexer->total_length) {
-        char c = lexer->input[current_position];
-        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        unsigned char c = (unsigned char)lexer->input[current_position];
+        unsigned char cls = lex_char_class[c];
+        if (cls & (LEX_SPACE | LEX_DELIM)) {
           break;
         }
-        if (c == '+' || c == '-' || c == '(' || c == ')' || c == '{' ||
-            c == '}' || c == '!' || c == '>' || c == '<' || c == ',' ||
-            c == ':' || c == ';' || c == '=' || c == '*' || c == '[' ||
-            c == ']') {
-          break;
-        }
-
+        seen |= cls;
+        dots += cls == LEX_DOT;
+        has_other |= cls == 0;
         current_position++;
+        if (current_position - lexer->position == LEX_SIMD_THRESHOLD) {
+          current_position += scan_word_run(
+              lexer->input + current_position,
+              lexer->total_length - current_position, &seen, &dots);
+        }
       }
 
       if (current_position == lexer->position) {
         lexer->position++;
-        break;
+        continue;
       }
 
-      char *literal = strndup(lexer->input + lexer->position,
-                              current_position - lexer->position);
-      if (literal == NULL) {
-        return;
-      }
-
-      if (strcmp(literal, "func") == 0) {
-        t = create_token(literal, FUNC, lexer->line);
-      } else if (strcmp(literal, "range") == 0) {
-        t = create_token(literal, RANGE, lexer->line);
-      } else if (strcmp(literal, "for") == 0) {
-        t = create_token(literal, FOR, lexer->line);
-      } else if (strcmp(literal, "if") == 0) {
-        t = create_token(literal, IF, lexer->line);
-      } else if (strcmp(literal, "else") == 0) {
-        t = create_token(literal, ELSE, lexer->line);
-      } else if (strcmp(literal, "return") == 0) {
-        t = create_token(literal, RETURN, lexer->line);
-      } else if (strcmp(literal, "tensor") == 0) {
-        t = create_token(literal, TENSOR, lexer->line);
-      } else if (strcmp(literal, "in") == 0) {
-        t = create_token(literal, IN, lexer->line);
-      } else if (strcmp(literal, "or") == 0 || strcmp(literal, "OR") == 0) {
-        t = create_token(literal, OR, lexer->line);
-      } else if (strcmp(literal, "and") == 0) {
-        t = create_token(literal, AND, lexer->line);
-      } else if (isint(literal)) {
-        t = create_token(literal, INT, lexer->line);
-      } else if (isfloat(literal)) {
-        t = create_token(literal, FLOAT, lexer->line);
-      } else if (isalphanumeric(literal)) {
-        t = create_token(literal, IDENTIFIER, lexer->line);
-      } else {
-        t = create_token(literal, UNKNOWN, lexer->line);
-      }
+      const char *literal = lexer->input + lexer->position;
+      int length = current_position - lexer->position;
+      TokenType token_type = UNKNOWN;
 
-      if (t != NULL) {
-        add_token(lexer, t);
+      if (has_other) {
+        token_type = UNKNOWN;
+      } else if (!(seen & LEX_ALPHA)) {
+        if (dots == 0) {
+          token_type = INT;
+        } else if (dots == 1 && (seen & LEX_DIGIT)) {
+          token_type = FLOAT;
+        }
+      } else if (dots == 0) {
+        token_type =
+            (seen & LEX_DIGIT) ? IDENTIFIER : keyword_type(literal, length);
       }
-      free(literal);
 
+      Token t = make_token(lexer, token_type, lexer->position, length);
       lexer->position = current_position;
-    } break;
+      return t;
+    }
+    }
+  }
+}
+
+void scan(Lexer *lexer) {
+  if (lexer == NULL) {
+    return;
+  }
+
+  // Tokens average a few bytes of source each; sizing the stream up front
+  // keeps large inputs from repeatedly reallocating it.
+  int estimate = lexer->total_length / 4;
+  if (estimate > lexer->token_capacity) {
+    Token *list = realloc(lexer->token_list, estimate * sizeof(Token));
+    if (list != NULL) {
+      lexer->token_list = list;
+      lexer->token_capacity = estimate;
+    }
+  }
+
+  for (;;) {
+    Token t = next_token(lexer);
+    if (t.tokenType == END_OF_FILE) {
+      break;
     }
+    add_token(lexer, t);
   }
 }
 
@@ -403,19 +533,17 @@ void print_tokens(Lexer *lexer) {
       "OR",           "BANG",        "ARROW",         "LEFT_PAREN",
       "RIGHT_PAREN",  "LEFT_BRACE",  "RIGHT_BRACE",   "COMMA",
       "COLON",        "SEMICOLON",   "UNKNOWN",       "LEFT_BRACKET",
-      "RIGHT_BRACKET"};
+      "RIGHT_BRACKET", "END_OF_FILE"};
   size_t token_type_count =
       sizeof(token_type_names) / sizeof(token_type_names[0]);
   for (int i = 0; i < lexer->token_count; i++) {
-    char *literal = lexer->token_list[i].literal != NULL
-                        ? lexer->token_list[i].literal
-                        : "NULL";
-    TokenType token_type = lexer->token_list[i].tokenType;
+    Token token = lexer->token_list[i];
+    TokenType token_type = token.tokenType;
     char *token_type_name =
         (token_type >= 0 && (size_t)token_type < token_type_count)
             ? token_type_names[token_type]
             : "INVALID_TOKEN_TYPE";
-    printf("line: %d | literal: %s | type: %s\n", lexer->token_list[i].line,
-           literal, token_type_name);
+    printf("line: %d | literal: %.*s | type: %s\n", token.line, token.length,
+           token_text(lexer->input, token), token_type_name);
   }
 }
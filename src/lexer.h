@@ -44,19 +44,25 @@ typedef enum TokenType {
   UNKNOWN,
   LEFT_BRACKET,
   RIGHT_BRACKET,
+  END_OF_FILE,
 } TokenType;
 
+// Tokens do not own their text: offset and length locate the lexeme in the
+// source buffer the lexer was created with, which must outlive the tokens.
 typedef struct Token {
-  TokenType tokenType;
-  char *literal;
+  int offset;
+  int length;
   int line;
+  TokenType tokenType;
 } Token;
 
+// The input is length-delimited and need not be NUL-terminated, so the lexer
+// can run directly over a memory-mapped file.
 typedef struct Lexer {
   int total_length;
   int position;
   int line;
-  char *input;
+  const char *input;
 
   Token *token_list;
   int token_count;
@@ -64,17 +70,17 @@ typedef struct Lexer {
 
 } Lexer;
 
-Lexer *init_lexer(char *input, int total_length);
+Lexer *init_lexer(const char *input, int total_length);
 void free_lexer(Lexer *lexer);
 
-bool isalphanumeric(char *str);
-bool isint(const char *str);
-bool isfloat(const char *str);
+Token next_token(Lexer *lexer);
 void scan(Lexer *lexer);
 void skip_whitespace(Lexer *lexer);
 bool grow_lexer(Lexer *lexer);
-Token *create_token(const char *literal, TokenType tokenType, int line);
-void add_token(Lexer *lexer, Token *token);
+void add_token(Lexer *lexer, Token token);
+const char *token_text(const char *source, Token token);
+long token_int_value(const char *source, Token token);
+double token_float_value(const char *source, Token token);
 void print_tokens(Lexer *lexer);
 
 #endif // !LEXER_H
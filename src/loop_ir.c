@@ -0,0 +1,1324 @@
+#include "loop_ir.h"
+#include <assert.h>
+#include <stdarg.h>
+
+typedef struct ScopeEntry {
+  const char *name;
+  bool is_tensor;
+  int id; // Tensor index or symbol index.
+} ScopeEntry;
+
+typedef struct Lowerer {
+  Arena *arena;
+  IRFunction *fn;
+  int errors;
+
+  ScopeEntry *scope;
+  int scope_count;
+  int scope_capacity;
+
+  // Statement lists are collected here and copied into the arena once
+  // complete, as the parser does with child lists.
+  IRNode **scratch;
+  int scratch_count;
+  int scratch_capacity;
+} Lowerer;
+
+static void *grow(void *items, int *capacity, int needed, size_t item_size) {
+  if (needed <= *capacity)
+    return items;
+
+  int new_capacity = *capacity > 0 ? *capacity : 32;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  items = realloc(items, (size_t)new_capacity * item_size);
+  assert(items != NULL);
+  *capacity = new_capacity;
+  return items;
+}
+
+// Like grow, for arrays that live in the arena; the old array is abandoned.
+static void *arena_grow(Arena *arena, void *items, int count, int *capacity,
+                        int needed, size_t item_size) {
+  if (needed <= *capacity)
+    return items;
+
+  int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  void *grown = arena_alloc(arena, (size_t)new_capacity * item_size);
+  assert(grown != NULL);
+  if (count > 0)
+    memcpy(grown, items, (size_t)count * item_size);
+  *capacity = new_capacity;
+  return grown;
+}
+
+static void lower_error(Lowerer *l, int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "Lowering error at line %d: ", line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  l->errors++;
+}
+
+AffineExpr affine_constant(long value) {
+  AffineExpr expr;
+  memset(&expr, 0, sizeof(expr));
+  expr.constant = value;
+  return expr;
+}
+
+AffineExpr affine_symbol(int symbol) {
+  AffineExpr expr = affine_constant(0);
+  expr.term_count = 1;
+  expr.terms[0].symbol = symbol;
+  expr.terms[0].coeff = 1;
+  return expr;
+}
+
+// Keeps terms sorted by symbol and drops terms that cancel out. Fails only
+// when the result would need more than IR_MAX_TERMS symbols.
+bool affine_add_term(AffineExpr *expr, int symbol, long coeff) {
+  if (coeff == 0)
+    return true;
+
+  int i = 0;
+  while (i < expr->term_count && expr->terms[i].symbol < symbol)
+    i++;
+
+  if (i < expr->term_count && expr->terms[i].symbol == symbol) {
+    expr->terms[i].coeff += coeff;
+    if (expr->terms[i].coeff == 0) {
+      memmove(&expr->terms[i], &expr->terms[i + 1],
+              (size_t)(expr->term_count - i - 1) * sizeof(IRTerm));
+      expr->term_count--;
+    }
+    return true;
+  }
+
+  if (expr->term_count == IR_MAX_TERMS)
+    return false;
+  memmove(&expr->terms[i + 1], &expr->terms[i],
+          (size_t)(expr->term_count - i) * sizeof(IRTerm));
+  expr->terms[i].symbol = symbol;
+  expr->terms[i].coeff = coeff;
+  expr->term_count++;
+  return true;
+}
+
+// expr += scale * other
+bool affine_add(AffineExpr *expr, const AffineExpr *other, long scale) {
+  expr->constant += scale * other->constant;
+  for (int i = 0; i < other->term_count; i++) {
+    if (!affine_add_term(expr, other->terms[i].symbol,
+                         scale * other->terms[i].coeff))
+      return false;
+  }
+  return true;
+}
+
+// Replaces every occurrence of `symbol` with `replacement`.
+bool affine_substitute(AffineExpr *expr, int symbol,
+                       const AffineExpr *replacement) {
+  long coeff = affine_coeff(expr, symbol);
+  if (coeff == 0)
+    return true;
+  affine_add_term(expr, symbol, -coeff);
+  return affine_add(expr, replacement, coeff);
+}
+
+long affine_coeff(const AffineExpr *expr, int symbol) {
+  for (int i = 0; i < expr->term_count; i++) {
+    if (expr->terms[i].symbol == symbol)
+      return expr->terms[i].coeff;
+  }
+  return 0;
+}
+
+bool affine_is_constant(const AffineExpr *expr) {
+  return expr->term_count == 0;
+}
+
+bool affine_equal(const AffineExpr *a, const AffineExpr *b) {
+  if (a->constant != b->constant || a->term_count != b->term_count)
+    return false;
+  for (int i = 0; i < a->term_count; i++) {
+    if (a->terms[i].symbol != b->terms[i].symbol ||
+        a->terms[i].coeff != b->terms[i].coeff)
+      return false;
+  }
+  return true;
+}
+
+IRBound ir_bound(AffineExpr expr) {
+  IRBound bound;
+  memset(&bound, 0, sizeof(bound));
+  bound.count = 1;
+  bound.exprs[0] = expr;
+  return bound;
+}
+
+int ir_add_symbol(IRFunction *fn, const char *name, IRSymbolKind kind) {
+  fn->symbols = (IRSymbol *)arena_grow(
+      fn->arena, fn->symbols, fn->symbol_count, &fn->symbol_capacity,
+      fn->symbol_count + 1, sizeof(IRSymbol));
+  fn->symbols[fn->symbol_count].name = name;
+  fn->symbols[fn->symbol_count].kind = kind;
+  return fn->symbol_count++;
+}
+
+int ir_add_tensor(IRFunction *fn, IRTensor tensor) {
+  fn->tensors = (IRTensor *)arena_grow(
+      fn->arena, fn->tensors, fn->tensor_count, &fn->tensor_capacity,
+      fn->tensor_count + 1, sizeof(IRTensor));
+  fn->tensors[fn->tensor_count] = tensor;
+  return fn->tensor_count++;
+}
+
+IRNode *ir_new_node(Arena *arena, IRNodeKind kind, int line) {
+  IRNode *node = (IRNode *)arena_alloc(arena, sizeof(IRNode));
+  if (node == NULL)
+    return NULL;
+
+  memset(node, 0, sizeof(IRNode));
+  node->kind = kind;
+  node->line = line;
+  return node;
+}
+
+IRExpr *ir_new_expr(Arena *arena, IRExprKind kind) {
+  IRExpr *expr = (IRExpr *)arena_alloc(arena, sizeof(IRExpr));
+  if (expr == NULL)
+    return NULL;
+
+  memset(expr, 0, sizeof(IRExpr));
+  expr->kind = kind;
+  return expr;
+}
+
+IRNode *ir_new_loop(Arena *arena, int var, AffineExpr lower,
+                    AffineExpr upper, int line) {
+  IRNode *node = ir_new_node(arena, IR_LOOP, line);
+  if (node == NULL)
+    return NULL;
+
+  node->data.loop.var = var;
+  node->data.loop.lower = ir_bound(lower);
+  node->data.loop.upper = ir_bound(upper);
+  node->data.loop.step = 1;
+  return node;
+}
+
+IRList ir_list_copy(Arena *arena, IRNode **items, int count) {
+  IRList list = {NULL, count};
+  if (count > 0) {
+    list.items =
+        (IRNode **)arena_memdup(arena, items, count * sizeof(IRNode *));
+    assert(list.items != NULL);
+  }
+  return list;
+}
+
+bool ir_access_uses_symbol(const IRAccess *access, int symbol) {
+  for (int d = 0; d < access->count; d++) {
+    const IRIndex *index = &access->indices[d];
+    if (index->affine ? affine_coeff(&index->expr, symbol) != 0
+                      : ir_expr_uses_symbol(index->general, symbol))
+      return true;
+  }
+  return false;
+}
+
+bool ir_expr_uses_symbol(const IRExpr *expr, int symbol) {
+  if (expr == NULL)
+    return false;
+
+  switch (expr->kind) {
+  case IR_EXPR_SYMBOL:
+    return expr->data.symbol == symbol;
+  case IR_EXPR_LOAD:
+    return ir_access_uses_symbol(&expr->data.load, symbol);
+  case IR_EXPR_BINARY:
+    return ir_expr_uses_symbol(expr->data.binary.left, symbol) ||
+           ir_expr_uses_symbol(expr->data.binary.right, symbol);
+  case IR_EXPR_UNARY:
+    return ir_expr_uses_symbol(expr->data.unary.operand, symbol);
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++) {
+      if (ir_expr_uses_symbol(expr->data.call.args[i], symbol))
+        return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+bool ir_expr_reads_tensor(const IRExpr *expr, int tensor) {
+  if (expr == NULL)
+    return false;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    if (expr->data.load.tensor == tensor)
+      return true;
+    for (int d = 0; d < expr->data.load.count; d++) {
+      if (ir_expr_reads_tensor(expr->data.load.indices[d].general, tensor))
+        return true;
+    }
+    return false;
+  case IR_EXPR_BINARY:
+    return ir_expr_reads_tensor(expr->data.binary.left, tensor) ||
+           ir_expr_reads_tensor(expr->data.binary.right, tensor);
+  case IR_EXPR_UNARY:
+    return ir_expr_reads_tensor(expr->data.unary.operand, tensor);
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++) {
+      if (ir_expr_reads_tensor(expr->data.call.args[i], tensor))
+        return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+bool ir_access_equal(const IRAccess *a, const IRAccess *b) {
+  if (a->tensor != b->tensor || a->count != b->count)
+    return false;
+  for (int d = 0; d < a->count; d++) {
+    const IRIndex *x = &a->indices[d];
+    const IRIndex *y = &b->indices[d];
+    if (!x->affine || !y->affine || !affine_equal(&x->expr, &y->expr))
+      return false;
+  }
+  return true;
+}
+
+const IRExpr *ir_reduction_operand(const IRNode *stmt) {
+  const IRAccess *target = &stmt->data.stmt.target;
+  const IRExpr *value = stmt->data.stmt.value;
+  if (value == NULL || value->kind != IR_EXPR_BINARY)
+    return NULL;
+
+  const IRExpr *left = value->data.binary.left;
+  const IRExpr *right = value->data.binary.right;
+  bool left_self = left->kind == IR_EXPR_LOAD &&
+                   ir_access_equal(&left->data.load, target);
+  bool right_self = right->kind == IR_EXPR_LOAD &&
+                    ir_access_equal(&right->data.load, target);
+  if (value->data.binary.op == PLUS && left_self)
+    return right;
+  if (value->data.binary.op == PLUS && right_self)
+    return left;
+  if (value->data.binary.op == MINUS && left_self)
+    return right;
+  return NULL;
+}
+
+IRFunction *ir_find_function(IRModule *module, const char *name) {
+  for (int i = 0; i < module->function_count; i++) {
+    if (module->functions[i]->name == name)
+      return module->functions[i];
+  }
+  return NULL;
+}
+
+static void push_scope(Lowerer *l, const char *name, bool is_tensor, int id) {
+  l->scope = (ScopeEntry *)grow(l->scope, &l->scope_capacity,
+                                l->scope_count + 1, sizeof(ScopeEntry));
+  l->scope[l->scope_count].name = name;
+  l->scope[l->scope_count].is_tensor = is_tensor;
+  l->scope[l->scope_count].id = id;
+  l->scope_count++;
+}
+
+static ScopeEntry *lookup(Lowerer *l, const char *name) {
+  for (int i = l->scope_count - 1; i >= 0; i--) {
+    if (l->scope[i].name == name)
+      return &l->scope[i];
+  }
+  return NULL;
+}
+
+static void push_node(Lowerer *l, IRNode *node) {
+  l->scratch = (IRNode **)grow(l->scratch, &l->scratch_capacity,
+                               l->scratch_count + 1, sizeof(IRNode *));
+  l->scratch[l->scratch_count++] = node;
+}
+
+static IRList finish_list(Lowerer *l, int mark) {
+  IRList list =
+      ir_list_copy(l->arena, l->scratch + mark, l->scratch_count - mark);
+  l->scratch_count = mark;
+  return list;
+}
+
+// Names that are not bound to a variable or loop are size parameters: the
+// dims of tensor types, also usable as values (`range(0, M)`).
+static int param_symbol(Lowerer *l, const char *name) {
+  IRFunction *fn = l->fn;
+  for (int i = 0; i < fn->symbol_count; i++) {
+    if (fn->symbols[i].name == name && fn->symbols[i].kind == IR_SYM_PARAM)
+      return i;
+  }
+  return ir_add_symbol(fn, name, IR_SYM_PARAM);
+}
+
+static AffineExpr dim_extent(Lowerer *l, const char *dim) {
+  const char *s = dim;
+  while (*s >= '0' && *s <= '9')
+    s++;
+  if (s != dim && *s == '\0')
+    return affine_constant(strtol(dim, NULL, 10));
+  return affine_symbol(param_symbol(l, dim));
+}
+
+// The VM and the C back end compute in f32 only, so other dtypes are
+// rejected here rather than silently read as f32.
+static IRTensor tensor_from_type(Lowerer *l, const char *name,
+                                 IRTensorKind kind, ASTNode *type, int line) {
+  IRTensor tensor = {name, kind, TENSOR_F32, -1, NULL};
+  if (type == NULL)
+    return tensor;
+
+  const char *dtype = NULL;
+  if (type->nodeType == NODE_IDENTIFIER) {
+    dtype = type->data.identifier.name;
+    tensor.rank = 0;
+  } else if (type->nodeType == NODE_TENSOR_TYPE) {
+    dtype = type->data.tensor_type.data_type;
+    tensor.rank = type->data.tensor_type.dim_count;
+    tensor.shape =
+        (AffineExpr *)arena_alloc(l->arena, sizeof(AffineExpr) * tensor.rank);
+    assert(tensor.shape != NULL);
+    for (int i = 0; i < tensor.rank; i++)
+      tensor.shape[i] = dim_extent(l, type->data.tensor_type.dims[i]);
+  }
+  if (dtype != NULL && !tensor_parse_dtype(dtype, &tensor.dtype))
+    lower_error(l, line, "unsupported dtype '%s'; only f32 is supported",
+                dtype);
+  return tensor;
+}
+
+static int add_tensor(Lowerer *l, IRTensor tensor) {
+  int id = ir_add_tensor(l->fn, tensor);
+  push_scope(l, tensor.name, true, id);
+  return id;
+}
+
+// Converts an index or bound expression to affine form over loop variables
+// and size parameters. Fails for anything that reads a variable or is not
+// linear.
+static bool to_affine(Lowerer *l, ASTNode *node, AffineExpr *out) {
+  if (node == NULL)
+    return false;
+
+  switch (node->nodeType) {
+  case NODE_INT_LITERAL:
+    *out = affine_constant(node->data.int_literal.value);
+    return true;
+  case NODE_IDENTIFIER: {
+    ScopeEntry *entry = lookup(l, node->data.identifier.name);
+    if (entry != NULL && entry->is_tensor)
+      return false;
+    int symbol = entry != NULL ? entry->id
+                               : param_symbol(l, node->data.identifier.name);
+    *out = affine_symbol(symbol);
+    return true;
+  }
+  case NODE_UNARY_EXPR: {
+    AffineExpr operand;
+    if (node->data.unary_op.op != MINUS ||
+        !to_affine(l, node->data.unary_op.operand, &operand))
+      return false;
+    *out = affine_constant(0);
+    return affine_add(out, &operand, -1);
+  }
+  case NODE_BINARY_EXPR: {
+    AffineExpr left, right;
+    if (!to_affine(l, node->data.binary_op.left, &left) ||
+        !to_affine(l, node->data.binary_op.right, &right))
+      return false;
+
+    switch (node->data.binary_op.op) {
+    case PLUS:
+      *out = left;
+      return affine_add(out, &right, 1);
+    case MINUS:
+      *out = left;
+      return affine_add(out, &right, -1);
+    case STAR:
+      if (affine_is_constant(&left)) {
+        *out = affine_constant(0);
+        return affine_add(out, &right, left.constant);
+      }
+      if (affine_is_constant(&right)) {
+        *out = affine_constant(0);
+        return affine_add(out, &left, right.constant);
+      }
+      return false;
+    default:
+      return false;
+    }
+  }
+  default:
+    return false;
+  }
+}
+
+static IRExpr *lower_expr(Lowerer *l, ASTNode *node, const int *element,
+                          int element_rank);
+
+static IRExpr *load_tensor(Lowerer *l, int tensor, const int *element,
+                           int element_rank) {
+  IRExpr *expr = ir_new_expr(l->arena, IR_EXPR_LOAD);
+  assert(expr != NULL);
+  expr->data.load.tensor = tensor;
+  expr->data.load.count = element_rank;
+  if (element_rank > 0) {
+    expr->data.load.indices =
+        (IRIndex *)arena_alloc(l->arena, sizeof(IRIndex) * element_rank);
+    assert(expr->data.load.indices != NULL);
+    for (int i = 0; i < element_rank; i++) {
+      expr->data.load.indices[i].affine = true;
+      expr->data.load.indices[i].proven = true;
+      expr->data.load.indices[i].expr = affine_symbol(element[i]);
+      expr->data.load.indices[i].general = NULL;
+    }
+  }
+  return expr;
+}
+
+static bool lower_access(Lowerer *l, ASTNode *node, IRAccess *access) {
+  ASTNode *object = node->data.index_expression.object;
+  if (object == NULL || object->nodeType != NODE_IDENTIFIER) {
+    lower_error(l, node->line, "only named tensors can be indexed");
+    return false;
+  }
+
+  ScopeEntry *entry = lookup(l, object->data.identifier.name);
+  if (entry == NULL || !entry->is_tensor) {
+    lower_error(l, node->line, "'%s' is not a tensor",
+                object->data.identifier.name);
+    return false;
+  }
+
+  int count = node->data.index_expression.index_count;
+  const bool *proven = node->data.index_expression.proven;
+  access->tensor = entry->id;
+  access->count = count;
+  access->indices = (IRIndex *)arena_alloc(l->arena, sizeof(IRIndex) * count);
+  assert(access->indices != NULL);
+
+  for (int i = 0; i < count; i++) {
+    IRIndex *index = &access->indices[i];
+    ASTNode *subscript = node->data.index_expression.indices[i];
+    index->general = NULL;
+    index->proven = proven != NULL && proven[i];
+    index->affine = to_affine(l, subscript, &index->expr);
+    if (!index->affine) {
+      index->expr = affine_constant(0);
+      index->general = lower_expr(l, subscript, NULL, 0);
+    }
+  }
+  return true;
+}
+
+// `element` names the loop variables of an enclosing whole-tensor operation;
+// tensors of that rank are read at those indices. Outside one, element_rank
+// is 0 and only scalars may be read by name.
+static IRExpr *lower_expr(Lowerer *l, ASTNode *node, const int *element,
+                          int element_rank) {
+  if (node == NULL)
+    return NULL;
+
+  IRExpr *expr = NULL;
+  switch (node->nodeType) {
+  case NODE_INT_LITERAL:
+    expr = ir_new_expr(l->arena, IR_EXPR_INT);
+    expr->data.int_value = node->data.int_literal.value;
+    return expr;
+  case NODE_FLOAT_LITERAL:
+    expr = ir_new_expr(l->arena, IR_EXPR_FLOAT);
+    expr->data.float_value = node->data.float_literal.value;
+    return expr;
+  case NODE_IDENTIFIER: {
+    const char *name = node->data.identifier.name;
+    ScopeEntry *entry = lookup(l, name);
+    if (entry == NULL || !entry->is_tensor) {
+      expr = ir_new_expr(l->arena, IR_EXPR_SYMBOL);
+      expr->data.symbol = entry != NULL ? entry->id : param_symbol(l, name);
+      return expr;
+    }
+
+    int rank = l->fn->tensors[entry->id].rank;
+    if (rank <= 0)
+      return load_tensor(l, entry->id, NULL, 0);
+    if (rank != element_rank) {
+      lower_error(l, node->line, "tensor '%s' used where a scalar is expected",
+                  name);
+      return NULL;
+    }
+    return load_tensor(l, entry->id, element, element_rank);
+  }
+  case NODE_BINARY_EXPR:
+    expr = ir_new_expr(l->arena, IR_EXPR_BINARY);
+    expr->data.binary.op = node->data.binary_op.op;
+    expr->data.binary.left =
+        lower_expr(l, node->data.binary_op.left, element, element_rank);
+    expr->data.binary.right =
+        lower_expr(l, node->data.binary_op.right, element, element_rank);
+    return expr;
+  case NODE_UNARY_EXPR:
+    expr = ir_new_expr(l->arena, IR_EXPR_UNARY);
+    expr->data.unary.op = node->data.unary_op.op;
+    expr->data.unary.operand =
+        lower_expr(l, node->data.unary_op.operand, element, element_rank);
+    return expr;
+  case NODE_INDEX_EXPR:
+    expr = ir_new_expr(l->arena, IR_EXPR_LOAD);
+    if (!lower_access(l, node, &expr->data.load))
+      return NULL;
+    return expr;
+  case NODE_FUNC_CALL: {
+    int count = node->data.func_call.arg_count;
+    expr = ir_new_expr(l->arena, IR_EXPR_CALL);
+    expr->data.call.name = node->data.func_call.func_name;
+    expr->data.call.arg_count = count;
+    if (count > 0) {
+      expr->data.call.args =
+          (IRExpr **)arena_alloc(l->arena, sizeof(IRExpr *) * count);
+      assert(expr->data.call.args != NULL);
+    }
+    for (int i = 0; i < count; i++) {
+      expr->data.call.args[i] = lower_expr(l, node->data.func_call.args[i],
+                                           element, element_rank);
+    }
+    return expr;
+  }
+  default:
+    lower_error(l, node->line, "unsupported expression");
+    return NULL;
+  }
+}
+
+// Lowers `tensor = value` for a whole tensor into a loop nest over its
+// shape that stores one element per iteration.
+static IRNode *lower_whole_store(Lowerer *l, int tensor, ASTNode *value,
+                                 int line) {
+  const IRTensor *t = &l->fn->tensors[tensor];
+  int rank = t->rank;
+  int element[IR_MAX_TERMS];
+  if (rank > IR_MAX_TERMS) {
+    lower_error(l, line, "tensor '%s' has more than %d dimensions", t->name,
+                IR_MAX_TERMS);
+    return NULL;
+  }
+
+  char name[32];
+  for (int i = 0; i < rank; i++) {
+    snprintf(name, sizeof(name), "d%d", i);
+    element[i] = ir_add_symbol(l->fn, intern_cstring(name), IR_SYM_LOOP);
+  }
+
+  IRNode *stmt = ir_new_node(l->arena, IR_STMT, line);
+  IRExpr *target = load_tensor(l, tensor, element, rank);
+  stmt->data.stmt.target = target->data.load;
+  stmt->data.stmt.value = lower_expr(l, value, element, rank);
+
+  IRNode *inner = stmt;
+  for (int i = rank - 1; i >= 0; i--) {
+    IRNode *loop = ir_new_loop(l->arena, element[i], affine_constant(0),
+                               t->shape[i], line);
+    loop->data.loop.body = ir_list_copy(l->arena, &inner, 1);
+    inner = loop;
+  }
+  return inner;
+}
+
+static void lower_stmt(Lowerer *l, ASTNode *node);
+
+static IRList lower_block(Lowerer *l, ASTNode *block) {
+  int mark = l->scratch_count;
+  int scope_mark = l->scope_count;
+  if (block != NULL && block->nodeType == NODE_BLOCK) {
+    for (int i = 0; i < block->data.block.count_statements; i++)
+      lower_stmt(l, block->data.block.statements[i]);
+  } else if (block != NULL) {
+    lower_stmt(l, block);
+  }
+  l->scope_count = scope_mark;
+  return finish_list(l, mark);
+}
+
+static void lower_assignment(Lowerer *l, ASTNode *node) {
+  ASTNode *target = node->data.assignment.target;
+  ASTNode *value = node->data.assignment.value;
+  TokenType op = node->data.assignment.op;
+
+  // `x += v` is lowered as `x = x + v`, for elements and whole tensors alike.
+  if (op == PLUS_EQUAL || op == MINUS_EQUAL) {
+    value = ast_node_binary_expr(l->arena, op == PLUS_EQUAL ? PLUS : MINUS,
+                                 target, value, node->line);
+    assert(value != NULL);
+  }
+
+  if (target != NULL && target->nodeType == NODE_IDENTIFIER) {
+    ScopeEntry *entry = lookup(l, target->data.identifier.name);
+    if (entry == NULL || !entry->is_tensor) {
+      lower_error(l, node->line, "cannot assign to '%s'",
+                  target->data.identifier.name);
+      return;
+    }
+    if (l->fn->tensors[entry->id].rank > 0) {
+      push_node(l, lower_whole_store(l, entry->id, value, node->line));
+      return;
+    }
+    IRNode *stmt = ir_new_node(l->arena, IR_STMT, node->line);
+    stmt->data.stmt.target = load_tensor(l, entry->id, NULL, 0)->data.load;
+    stmt->data.stmt.value = lower_expr(l, value, NULL, 0);
+    push_node(l, stmt);
+    return;
+  }
+
+  if (target == NULL || target->nodeType != NODE_INDEX_EXPR) {
+    lower_error(l, node->line, "invalid assignment target");
+    return;
+  }
+  IRNode *stmt = ir_new_node(l->arena, IR_STMT, node->line);
+  if (!lower_access(l, target, &stmt->data.stmt.target))
+    return;
+  stmt->data.stmt.value = lower_expr(l, value, NULL, 0);
+  push_node(l, stmt);
+}
+
+static void lower_for(Lowerer *l, ASTNode *node) {
+  ASTNode *variable = node->data.for_loop.variable;
+  ASTNode *iterable = node->data.for_loop.iterable;
+  if (iterable == NULL || iterable->nodeType != NODE_FUNC_CALL ||
+      strcmp(iterable->data.func_call.func_name, "range") != 0 ||
+      iterable->data.func_call.arg_count < 1 ||
+      iterable->data.func_call.arg_count > 2) {
+    lower_error(l, node->line, "only loops over range(lo, hi) are supported");
+    return;
+  }
+
+  int count = iterable->data.func_call.arg_count;
+  ASTNode **args = iterable->data.func_call.args;
+  AffineExpr lower = affine_constant(0);
+  AffineExpr upper;
+  if ((count == 2 && !to_affine(l, args[0], &lower)) ||
+      !to_affine(l, args[count - 1], &upper)) {
+    lower_error(l, node->line, "loop bounds must be affine in the enclosing "
+                               "loop variables and dims");
+    return;
+  }
+
+  int var = ir_add_symbol(l->fn, variable->data.identifier.name, IR_SYM_LOOP);
+  IRNode *loop = ir_new_loop(l->arena, var, lower, upper, node->line);
+
+  int scope_mark = l->scope_count;
+  push_scope(l, variable->data.identifier.name, false, var);
+  loop->data.loop.body = lower_block(l, node->data.for_loop.body);
+  l->scope_count = scope_mark;
+  push_node(l, loop);
+}
+
+static void lower_stmt(Lowerer *l, ASTNode *node) {
+  if (node == NULL)
+    return;
+
+  switch (node->nodeType) {
+  case NODE_VAR_DECL: {
+    IRTensor tensor =
+        tensor_from_type(l, node->data.var_decl.name, IR_TENSOR_LOCAL,
+                         node->data.var_decl.type, node->line);
+    ASTNode *initializer = node->data.var_decl.initializer;
+    // The initializer is lowered before the name is in scope, so it can
+    // still refer to a shadowed outer variable.
+    IRNode *init = NULL;
+    IRExpr *value = NULL;
+    if (initializer != NULL && tensor.rank <= 0)
+      value = lower_expr(l, initializer, NULL, 0);
+    int id = add_tensor(l, tensor);
+    if (initializer != NULL && tensor.rank > 0) {
+      init = lower_whole_store(l, id, initializer, node->line);
+    } else if (initializer != NULL) {
+      init = ir_new_node(l->arena, IR_STMT, node->line);
+      init->data.stmt.target = load_tensor(l, id, NULL, 0)->data.load;
+      init->data.stmt.value = value;
+    }
+    if (init != NULL)
+      push_node(l, init);
+    break;
+  }
+  case NODE_ASSIGNMENT:
+    lower_assignment(l, node);
+    break;
+  case NODE_FOR:
+    lower_for(l, node);
+    break;
+  case NODE_IF: {
+    IRNode *branch = ir_new_node(l->arena, IR_IF, node->line);
+    branch->data.if_else.condition =
+        lower_expr(l, node->data.if_else.condition, NULL, 0);
+    branch->data.if_else.then_body = lower_block(l, node->data.if_else.then);
+    branch->data.if_else.else_body =
+        lower_block(l, node->data.if_else.else_block);
+    push_node(l, branch);
+    break;
+  }
+  case NODE_RETURN: {
+    IRNode *ret = ir_new_node(l->arena, IR_RETURN, node->line);
+    ASTNode *value = node->data.return_value.return_val;
+    ret->data.ret.tensor = -1;
+    if (value != NULL && value->nodeType == NODE_IDENTIFIER) {
+      ScopeEntry *entry = lookup(l, value->data.identifier.name);
+      if (entry != NULL && entry->is_tensor &&
+          l->fn->tensors[entry->id].rank > 0)
+        ret->data.ret.tensor = entry->id;
+    }
+    if (ret->data.ret.tensor < 0)
+      ret->data.ret.value = lower_expr(l, value, NULL, 0);
+    push_node(l, ret);
+    break;
+  }
+  case NODE_BLOCK: {
+    IRList list = lower_block(l, node);
+    for (int i = 0; i < list.count; i++)
+      push_node(l, list.items[i]);
+    break;
+  }
+  default: {
+    IRNode *stmt = ir_new_node(l->arena, IR_STMT, node->line);
+    stmt->data.stmt.target.tensor = -1;
+    stmt->data.stmt.value = lower_expr(l, node, NULL, 0);
+    push_node(l, stmt);
+    break;
+  }
+  }
+}
+
+static IRFunction *lower_function(Lowerer *l, ASTNode *node) {
+  IRFunction *fn = (IRFunction *)arena_alloc(l->arena, sizeof(IRFunction));
+  assert(fn != NULL);
+  memset(fn, 0, sizeof(IRFunction));
+  fn->name = node->data.function_decl.name;
+  fn->line = node->line;
+  fn->arena = l->arena;
+  l->fn = fn;
+  l->scope_count = 0;
+
+  for (int i = 0; i < node->data.function_decl.count_params; i++) {
+    ASTNode *param = node->data.function_decl.params[i];
+    add_tensor(l, tensor_from_type(l, param->data.var_decl.name,
+                                   IR_TENSOR_PARAM, param->data.var_decl.type,
+                                   param->line));
+  }
+  fn->param_count = fn->tensor_count;
+  fn->result = tensor_from_type(l, NULL, IR_TENSOR_LOCAL,
+                                node->data.function_decl.return_type,
+                                node->line);
+  fn->body = lower_block(l, node->data.function_decl.body);
+  return fn;
+}
+
+IRModule *lower_program(Arena *arena, ASTNode *program) {
+  if (program == NULL || program->nodeType != NODE_PROGRAM)
+    return NULL;
+
+  Lowerer l;
+  memset(&l, 0, sizeof(l));
+  l.arena = arena;
+
+  IRModule *module = (IRModule *)arena_alloc(arena, sizeof(IRModule));
+  assert(module != NULL);
+  module->function_count = program->data.program.function_count;
+  module->functions = (IRFunction **)arena_alloc(
+      arena, sizeof(IRFunction *) * (module->function_count + 1));
+  assert(module->functions != NULL);
+
+  for (int i = 0; i < module->function_count; i++)
+    module->functions[i] =
+        lower_function(&l, program->data.program.functions[i]);
+
+  free(l.scope);
+  free(l.scratch);
+  return l.errors > 0 ? NULL : module;
+}
+
+static void print_indent(FILE *out, int indent) {
+  for (int i = 0; i < indent; i++) {
+    fprintf(out, "  ");
+  }
+}
+
+void print_affine(FILE *out, const IRFunction *fn, const AffineExpr *expr) {
+  bool first = true;
+  for (int i = 0; i < expr->term_count; i++) {
+    long coeff = expr->terms[i].coeff;
+    const char *name = fn->symbols[expr->terms[i].symbol].name;
+    if (!first)
+      fprintf(out, coeff < 0 ? " - " : " + ");
+    else if (coeff < 0)
+      fprintf(out, "-");
+    long magnitude = coeff < 0 ? -coeff : coeff;
+    if (magnitude != 1)
+      fprintf(out, "%ld*", magnitude);
+    fprintf(out, "%s", name);
+    first = false;
+  }
+  if (first)
+    fprintf(out, "%ld", expr->constant);
+  else if (expr->constant != 0)
+    fprintf(out, " %c %ld", expr->constant < 0 ? '-' : '+',
+            expr->constant < 0 ? -expr->constant : expr->constant);
+}
+
+static void print_bound(FILE *out, const IRFunction *fn, const IRBound *bound,
+                        const char *combine) {
+  if (bound->count == 1) {
+    print_affine(out, fn, &bound->exprs[0]);
+    return;
+  }
+  fprintf(out, "%s(", combine);
+  for (int i = 0; i < bound->count; i++) {
+    if (i > 0)
+      fprintf(out, ", ");
+    print_affine(out, fn, &bound->exprs[i]);
+  }
+  fprintf(out, ")");
+}
+
+static const char *op_text(TokenType op) {
+  switch (op) {
+  case PLUS:
+    return "+";
+  case MINUS:
+    return "-";
+  case STAR:
+    return "*";
+  case EQUAL_EQUAL:
+    return "==";
+  case BANG_EQUAL:
+    return "!=";
+  case LESS:
+    return "<";
+  case LESS_EQUAL:
+    return "<=";
+  case GREATER:
+    return ">";
+  case GREATER_EQUAL:
+    return ">=";
+  case AND:
+    return "and";
+  case OR:
+    return "or";
+  case BANG:
+    return "!";
+  default:
+    return token_type_name(op);
+  }
+}
+
+void print_ir_access(FILE *out, const IRFunction *fn,
+                         const IRAccess *access) {
+  fprintf(out, "%s", fn->tensors[access->tensor].name);
+  if (access->count == 0)
+    return;
+
+  fprintf(out, "[");
+  for (int i = 0; i < access->count; i++) {
+    if (i > 0)
+      fprintf(out, ", ");
+    if (access->indices[i].affine)
+      print_affine(out, fn, &access->indices[i].expr);
+    else
+      print_ir_expr(out, fn, access->indices[i].general);
+  }
+  fprintf(out, "]");
+}
+
+void print_ir_expr(FILE *out, const IRFunction *fn, const IRExpr *expr) {
+  if (expr == NULL) {
+    fprintf(out, "(null)");
+    return;
+  }
+
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+    fprintf(out, "%ld", expr->data.int_value);
+    break;
+  case IR_EXPR_FLOAT:
+    fprintf(out, "%f", expr->data.float_value);
+    break;
+  case IR_EXPR_SYMBOL:
+    fprintf(out, "%s", fn->symbols[expr->data.symbol].name);
+    break;
+  case IR_EXPR_LOAD:
+    print_ir_access(out, fn, &expr->data.load);
+    break;
+  case IR_EXPR_BINARY:
+    fprintf(out, "(");
+    print_ir_expr(out, fn, expr->data.binary.left);
+    fprintf(out, " %s ", op_text(expr->data.binary.op));
+    print_ir_expr(out, fn, expr->data.binary.right);
+    fprintf(out, ")");
+    break;
+  case IR_EXPR_UNARY:
+    fprintf(out, "%s", op_text(expr->data.unary.op));
+    print_ir_expr(out, fn, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    fprintf(out, "%s(", expr->data.call.name);
+    for (int i = 0; i < expr->data.call.arg_count; i++) {
+      if (i > 0)
+        fprintf(out, ", ");
+      print_ir_expr(out, fn, expr->data.call.args[i]);
+    }
+    fprintf(out, ")");
+    break;
+  }
+}
+
+static void print_ir_list(FILE *out, const IRFunction *fn, const IRList *list,
+                          int indent);
+
+static void print_ir_node(FILE *out, const IRFunction *fn, const IRNode *node,
+                          int indent) {
+  print_indent(out, indent);
+  switch (node->kind) {
+  case IR_LOOP:
+    fprintf(out, "for %s in [", fn->symbols[node->data.loop.var].name);
+    print_bound(out, fn, &node->data.loop.lower, "max");
+    fprintf(out, ", ");
+    print_bound(out, fn, &node->data.loop.upper, "min");
+    fprintf(out, ")");
+    if (node->data.loop.step != 1)
+      fprintf(out, " step %ld", node->data.loop.step);
+    if (node->data.loop.parallel)
+      fprintf(out, " parallel");
+    if (node->data.loop.vector_width > 0)
+      fprintf(out, " vector %d", node->data.loop.vector_width);
+    if (node->data.loop.gemm != NULL) {
+      const IRGemm *gemm = node->data.loop.gemm;
+      fprintf(out, " gemm %s %c= %s%s * %s%s%s",
+              fn->tensors[gemm->c].name, gemm->alpha < 0 ? '-' : '+',
+              fn->tensors[gemm->a].name, gemm->trans_a ? "^T" : "",
+              fn->tensors[gemm->b].name, gemm->trans_b ? "^T" : "",
+              gemm->parallel ? " parallel" : "");
+    }
+    fprintf(out, " {\n");
+    print_ir_list(out, fn, &node->data.loop.body, indent + 1);
+    print_indent(out, indent);
+    fprintf(out, "}\n");
+    break;
+  case IR_STMT:
+    if (node->data.stmt.target.tensor >= 0) {
+      print_ir_access(out, fn, &node->data.stmt.target);
+      fprintf(out, " = ");
+    }
+    print_ir_expr(out, fn, node->data.stmt.value);
+    fprintf(out, "\n");
+    break;
+  case IR_IF:
+    fprintf(out, "if ");
+    print_ir_expr(out, fn, node->data.if_else.condition);
+    fprintf(out, " {\n");
+    print_ir_list(out, fn, &node->data.if_else.then_body, indent + 1);
+    if (node->data.if_else.else_body.count > 0) {
+      print_indent(out, indent);
+      fprintf(out, "} else {\n");
+      print_ir_list(out, fn, &node->data.if_else.else_body, indent + 1);
+    }
+    print_indent(out, indent);
+    fprintf(out, "}\n");
+    break;
+  case IR_RETURN:
+    fprintf(out, "return ");
+    if (node->data.ret.tensor >= 0)
+      fprintf(out, "%s", fn->tensors[node->data.ret.tensor].name);
+    else
+      print_ir_expr(out, fn, node->data.ret.value);
+    fprintf(out, "\n");
+    break;
+  }
+}
+
+static void print_ir_list(FILE *out, const IRFunction *fn, const IRList *list,
+                          int indent) {
+  for (int i = 0; i < list->count; i++)
+    print_ir_node(out, fn, list->items[i], indent);
+}
+
+static void print_tensor_type(FILE *out, const IRFunction *fn,
+                              const IRTensor *tensor) {
+  fprintf(out, "%s",
+          tensor->rank >= 0 ? tensor_dtype_name(tensor->dtype) : "?");
+  if (tensor->rank <= 0)
+    return;
+
+  fprintf(out, "[");
+  for (int i = 0; i < tensor->rank; i++) {
+    if (i > 0)
+      fprintf(out, ", ");
+    print_affine(out, fn, &tensor->shape[i]);
+  }
+  fprintf(out, "]");
+}
+
+void print_ir_function(FILE *out, const IRFunction *fn) {
+  fprintf(out, "func %s(", fn->name);
+  for (int i = 0; i < fn->param_count; i++) {
+    if (i > 0)
+      fprintf(out, ", ");
+    fprintf(out, "%s: ", fn->tensors[i].name);
+    print_tensor_type(out, fn, &fn->tensors[i]);
+  }
+  fprintf(out, ")");
+  if (fn->result.rank >= 0) {
+    fprintf(out, " -> ");
+    print_tensor_type(out, fn, &fn->result);
+  }
+  fprintf(out, " {\n");
+
+  for (int i = fn->param_count; i < fn->tensor_count; i++) {
+    print_indent(out, 1);
+    fprintf(out, "local %s: ", fn->tensors[i].name);
+    print_tensor_type(out, fn, &fn->tensors[i]);
+    fprintf(out, "\n");
+  }
+  print_ir_list(out, fn, &fn->body, 1);
+  fprintf(out, "}\n");
+}
+
+void print_ir_module(FILE *out, const IRModule *module) {
+  for (int i = 0; i < module->function_count; i++) {
+    if (i > 0)
+      fprintf(out, "\n");
+    print_ir_function(out, module->functions[i]);
+  }
+}
+
+typedef struct Verifier {
+  const IRFunction *fn;
+  int errors;
+  bool *in_scope; // Loop variables of the loops enclosing the current node.
+  bool *bound;    // Loop variables already bound by some loop.
+} Verifier;
+
+static void verify_error(Verifier *v, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "IR error in function '%s': ", v->fn->name);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  v->errors++;
+}
+
+static bool verify_symbol(Verifier *v, int symbol, const char *where) {
+  if (symbol < 0 || symbol >= v->fn->symbol_count) {
+    verify_error(v, "%s refers to unknown symbol %d", where, symbol);
+    return false;
+  }
+  if (v->fn->symbols[symbol].kind == IR_SYM_LOOP && !v->in_scope[symbol]) {
+    verify_error(v, "%s uses loop variable '%s' outside its loop", where,
+                 v->fn->symbols[symbol].name);
+    return false;
+  }
+  return true;
+}
+
+static void verify_affine(Verifier *v, const AffineExpr *expr,
+                          const char *where) {
+  if (expr->term_count < 0 || expr->term_count > IR_MAX_TERMS) {
+    verify_error(v, "%s has %d terms", where, expr->term_count);
+    return;
+  }
+  for (int i = 0; i < expr->term_count; i++) {
+    verify_symbol(v, expr->terms[i].symbol, where);
+    if (expr->terms[i].coeff == 0)
+      verify_error(v, "%s has a zero coefficient", where);
+    if (i > 0 && expr->terms[i].symbol <= expr->terms[i - 1].symbol)
+      verify_error(v, "%s has unsorted terms", where);
+  }
+}
+
+static void verify_expr(Verifier *v, const IRExpr *expr);
+
+static void verify_access(Verifier *v, const IRAccess *access) {
+  if (access->tensor < 0 || access->tensor >= v->fn->tensor_count) {
+    verify_error(v, "access to unknown tensor %d", access->tensor);
+    return;
+  }
+  const IRTensor *tensor = &v->fn->tensors[access->tensor];
+  if (tensor->rank >= 0 && access->count != tensor->rank) {
+    verify_error(v, "'%s' has rank %d but is accessed with %d subscripts",
+                 tensor->name, tensor->rank, access->count);
+  }
+  for (int i = 0; i < access->count; i++) {
+    const IRIndex *index = &access->indices[i];
+    if (index->affine)
+      verify_affine(v, &index->expr, "subscript");
+    else if (index->general == NULL)
+      verify_error(v, "subscript %d of '%s' is empty", i, tensor->name);
+    else
+      verify_expr(v, index->general);
+  }
+}
+
+static void verify_expr(Verifier *v, const IRExpr *expr) {
+  if (expr == NULL) {
+    verify_error(v, "missing expression");
+    return;
+  }
+
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+  case IR_EXPR_FLOAT:
+    break;
+  case IR_EXPR_SYMBOL:
+    verify_symbol(v, expr->data.symbol, "expression");
+    break;
+  case IR_EXPR_LOAD:
+    verify_access(v, &expr->data.load);
+    break;
+  case IR_EXPR_BINARY:
+    verify_expr(v, expr->data.binary.left);
+    verify_expr(v, expr->data.binary.right);
+    break;
+  case IR_EXPR_UNARY:
+    verify_expr(v, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      verify_expr(v, expr->data.call.args[i]);
+    break;
+  default:
+    verify_error(v, "unknown expression kind %d", (int)expr->kind);
+    break;
+  }
+}
+
+static void verify_list(Verifier *v, const IRList *list);
+
+static void verify_bound(Verifier *v, const IRBound *bound, const char *where) {
+  if (bound->count < 1 || bound->count > IR_MAX_BOUNDS) {
+    verify_error(v, "%s has %d expressions", where, bound->count);
+    return;
+  }
+  for (int i = 0; i < bound->count; i++)
+    verify_affine(v, &bound->exprs[i], where);
+}
+
+static bool gemm_tensor_ok(const IRFunction *fn, int tensor) {
+  return tensor >= 0 && tensor < fn->tensor_count &&
+         fn->tensors[tensor].rank == 2;
+}
+
+static void verify_node(Verifier *v, const IRNode *node) {
+  if (node == NULL) {
+    verify_error(v, "missing node");
+    return;
+  }
+
+  switch (node->kind) {
+  case IR_LOOP: {
+    int var = node->data.loop.var;
+    if (var < 0 || var >= v->fn->symbol_count ||
+        v->fn->symbols[var].kind != IR_SYM_LOOP) {
+      verify_error(v, "loop at line %d has no loop variable", node->line);
+      return;
+    }
+    if (v->bound[var]) {
+      verify_error(v, "loop variable '%s' is bound by more than one loop",
+                   v->fn->symbols[var].name);
+    }
+    v->bound[var] = true;
+    verify_bound(v, &node->data.loop.lower, "lower bound");
+    verify_bound(v, &node->data.loop.upper, "upper bound");
+    if (node->data.loop.step <= 0) {
+      verify_error(v, "loop over '%s' has step %ld", v->fn->symbols[var].name,
+                   node->data.loop.step);
+    }
+    if (node->data.loop.vector_width < 0 ||
+        (node->data.loop.vector_width > 0 && node->data.loop.step != 1)) {
+      verify_error(v, "loop over '%s' has vector width %d with step %ld",
+                   v->fn->symbols[var].name, node->data.loop.vector_width,
+                   node->data.loop.step);
+    }
+    const IRGemm *gemm = node->data.loop.gemm;
+    if (gemm != NULL && (!gemm_tensor_ok(v->fn, gemm->c) ||
+                         !gemm_tensor_ok(v->fn, gemm->a) ||
+                         !gemm_tensor_ok(v->fn, gemm->b))) {
+      verify_error(v, "GEMM over '%s' needs three matrices",
+                   v->fn->symbols[var].name);
+    }
+    v->in_scope[var] = true;
+    verify_list(v, &node->data.loop.body);
+    v->in_scope[var] = false;
+    break;
+  }
+  case IR_STMT:
+    if (node->data.stmt.target.tensor >= 0)
+      verify_access(v, &node->data.stmt.target);
+    verify_expr(v, node->data.stmt.value);
+    break;
+  case IR_IF:
+    verify_expr(v, node->data.if_else.condition);
+    verify_list(v, &node->data.if_else.then_body);
+    verify_list(v, &node->data.if_else.else_body);
+    break;
+  case IR_RETURN:
+    if (node->data.ret.tensor >= v->fn->tensor_count)
+      verify_error(v, "return of unknown tensor %d", node->data.ret.tensor);
+    else if (node->data.ret.tensor < 0 && node->data.ret.value != NULL)
+      verify_expr(v, node->data.ret.value);
+    break;
+  default:
+    verify_error(v, "unknown node kind %d", (int)node->kind);
+    break;
+  }
+}
+
+static void verify_list(Verifier *v, const IRList *list) {
+  if (list->count > 0 && list->items == NULL) {
+    verify_error(v, "list of %d nodes has no storage", list->count);
+    return;
+  }
+  for (int i = 0; i < list->count; i++)
+    verify_node(v, list->items[i]);
+}
+
+int verify_ir_function(const IRFunction *fn) {
+  Verifier v = {fn, 0, NULL, NULL};
+  v.in_scope = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  v.bound = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  assert(v.in_scope != NULL && v.bound != NULL);
+
+  for (int i = 0; i < fn->tensor_count; i++) {
+    const IRTensor *tensor = &fn->tensors[i];
+    for (int d = 0; d < tensor->rank; d++)
+      verify_affine(&v, &tensor->shape[d], "tensor extent");
+  }
+  if (fn->param_count > fn->tensor_count)
+    verify_error(&v, "%d params but %d tensors", fn->param_count,
+                 fn->tensor_count);
+  verify_list(&v, &fn->body);
+
+  free(v.in_scope);
+  free(v.bound);
+  return v.errors;
+}
+
+int verify_ir_module(const IRModule *module) {
+  int errors = 0;
+  for (int i = 0; i < module->function_count; i++)
+    errors += verify_ir_function(module->functions[i]);
+  return errors;
+}
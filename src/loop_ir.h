@@ -0,0 +1,277 @@
+#ifndef LOOP_IR_H
+#define LOOP_IR_H
+
+#include "arena.h"
+#include "ast.h"
+#include "tensor.h"
+#include <stdio.h>
+
+// Loop-nest IR. Each function is a tree of explicit loops, conditionals and
+// scalar statements over named tensors. Loop bounds and tensor subscripts are
+// affine expressions over symbols: loop induction variables and the size
+// parameters (named dims such as `M`) of the function. This is the form the
+// loop transformations and back ends work on.
+//
+// Whole-tensor operations in the source (`C: tensor<MxNxf32> = 0.0`,
+// `y = A + B`) are lowered to explicit loop nests, so every statement in the
+// IR stores one scalar element.
+
+// Upper limit on the number of symbols in one affine expression and on the
+// number of expressions combined in one loop bound.
+#define IR_MAX_TERMS 6
+#define IR_MAX_BOUNDS 4
+
+typedef enum IRSymbolKind {
+  IR_SYM_LOOP,  // Induction variable of exactly one loop.
+  IR_SYM_PARAM, // Size parameter, fixed for the whole call.
+} IRSymbolKind;
+
+typedef struct IRSymbol {
+  const char *name;
+  IRSymbolKind kind;
+} IRSymbol;
+
+typedef struct IRTerm {
+  int symbol;
+  long coeff;
+} IRTerm;
+
+// constant + sum(coeff * symbol). Terms are kept sorted by symbol id with no
+// zero coefficients, so equal expressions compare equal field by field.
+typedef struct AffineExpr {
+  long constant;
+  int term_count;
+  IRTerm terms[IR_MAX_TERMS];
+} AffineExpr;
+
+// A lower bound is the max of its expressions and an upper bound the min;
+// upper bounds are exclusive.
+typedef struct IRBound {
+  int count;
+  AffineExpr exprs[IR_MAX_BOUNDS];
+} IRBound;
+
+typedef enum IRTensorKind {
+  IR_TENSOR_PARAM,
+  IR_TENSOR_LOCAL,
+} IRTensorKind;
+
+// Parameters and locals, tensors and scalars alike. Scalars have rank 0.
+typedef struct IRTensor {
+  const char *name;
+  IRTensorKind kind;
+  TensorDType dtype;
+  int rank;
+  AffineExpr *shape; // `rank` extents over size parameters.
+} IRTensor;
+
+typedef struct IRExpr IRExpr;
+
+// One subscript: affine when it could be expressed over loop variables and
+// size parameters, otherwise a general expression evaluated at run time.
+// `proven` subscripts were shown to stay within their dimension by the shape
+// pass, or index a whole-tensor operation over that tensor's own shape, and
+// need no check at run time; back ends check all others where they are used.
+typedef struct IRIndex {
+  bool affine;
+  bool proven;
+  AffineExpr expr;
+  IRExpr *general;
+} IRIndex;
+
+typedef struct IRAccess {
+  int tensor;
+  int count;
+  IRIndex *indices;
+} IRAccess;
+
+typedef enum IRExprKind {
+  IR_EXPR_INT,
+  IR_EXPR_FLOAT,
+  IR_EXPR_SYMBOL,
+  IR_EXPR_LOAD,
+  IR_EXPR_BINARY,
+  IR_EXPR_UNARY,
+  IR_EXPR_CALL,
+} IRExprKind;
+
+struct IRExpr {
+  IRExprKind kind;
+  union {
+    long int_value;
+    double float_value;
+    int symbol;
+    IRAccess load;
+
+    struct {
+      TokenType op;
+      IRExpr *left;
+      IRExpr *right;
+    } binary;
+
+    struct {
+      TokenType op;
+      IRExpr *operand;
+    } unary;
+
+    struct {
+      const char *name;
+      IRExpr **args;
+      int arg_count;
+    } call;
+  } data;
+};
+
+typedef enum IRNodeKind {
+  IR_LOOP,
+  IR_STMT,
+  IR_IF,
+  IR_RETURN,
+} IRNodeKind;
+
+typedef struct IRNode IRNode;
+
+// C[m, n] = C[m, n] + alpha * sum over k of A[m, k] * B[k, n], with A
+// stored as [k, m] when trans_a and B as [n, k] when trans_b. Extents are
+// over size parameters; leading dimensions come from the tensors' shapes.
+typedef struct IRGemm {
+  int c;
+  int a;
+  int b;
+  bool trans_a;
+  bool trans_b;
+  float alpha; // 1 or -1.
+  AffineExpr m;
+  AffineExpr n;
+  AffineExpr k;
+  // The product may be split across threads. Set by parallelize_function.
+  bool parallel;
+} IRGemm;
+
+typedef struct IRList {
+  IRNode **items;
+  int count;
+} IRList;
+
+struct IRNode {
+  IRNodeKind kind;
+  int line;
+
+  union {
+    // for var in [max(lower), min(upper)) step step
+    struct {
+      int var;
+      IRBound lower;
+      IRBound upper;
+      long step;
+      IRList body;
+      // f32 lanes per vector when the back end may run `vector_width`
+      // iterations at once, otherwise 0. Set by vectorize_function.
+      int vector_width;
+      // Set on the outermost loop of a nest that computes exactly this
+      // product, which a back end may call a GEMM routine for instead.
+      // Set by gemm_function.
+      IRGemm *gemm;
+      // Iterations are independent once the scalar locals written in the
+      // body are made private to each, so the back end may run them on
+      // several threads. Set by parallelize_function.
+      bool parallel;
+    } loop;
+
+    // target = value. A target tensor of -1 evaluates `value` and discards
+    // the result.
+    struct {
+      IRAccess target;
+      IRExpr *value;
+    } stmt;
+
+    struct {
+      IRExpr *condition;
+      IRList then_body;
+      IRList else_body;
+    } if_else;
+
+    // Returns a whole tensor when `tensor` is set, otherwise `value`.
+    struct {
+      int tensor;
+      IRExpr *value;
+    } ret;
+  } data;
+};
+
+typedef struct IRFunction {
+  const char *name;
+  int line;
+  Arena *arena;
+
+  IRSymbol *symbols;
+  int symbol_count;
+  int symbol_capacity;
+
+  // Parameters come first, in declaration order.
+  IRTensor *tensors;
+  int tensor_count;
+  int tensor_capacity;
+  int param_count;
+
+  // Declared return type as a shape, rank -1 when there is none.
+  IRTensor result;
+
+  IRList body;
+} IRFunction;
+
+typedef struct IRModule {
+  IRFunction **functions;
+  int function_count;
+} IRModule;
+
+// Lowers a parsed and shape-checked program. Everything is allocated from
+// `arena`. Constructs without an affine form (non-range loops, non-affine
+// loop bounds) are reported as "Lowering error at line N: ..." and NULL is
+// returned.
+IRModule *lower_program(Arena *arena, ASTNode *program);
+IRFunction *ir_find_function(IRModule *module, const char *name);
+
+int ir_add_symbol(IRFunction *fn, const char *name, IRSymbolKind kind);
+int ir_add_tensor(IRFunction *fn, IRTensor tensor);
+IRNode *ir_new_node(Arena *arena, IRNodeKind kind, int line);
+IRExpr *ir_new_expr(Arena *arena, IRExprKind kind);
+IRNode *ir_new_loop(Arena *arena, int var, AffineExpr lower,
+                    AffineExpr upper, int line);
+IRList ir_list_copy(Arena *arena, IRNode **items, int count);
+
+bool ir_expr_uses_symbol(const IRExpr *expr, int symbol);
+bool ir_access_uses_symbol(const IRAccess *access, int symbol);
+// Loads from `tensor` anywhere in `expr`, subscripts included.
+bool ir_expr_reads_tensor(const IRExpr *expr, int tensor);
+// Same tensor at the same affine subscripts; general subscripts never
+// compare equal.
+bool ir_access_equal(const IRAccess *a, const IRAccess *b);
+// For a reduction statement `s = s + x`, `s = x + s` or `s = s - x`,
+// returns `x`; otherwise NULL.
+const IRExpr *ir_reduction_operand(const IRNode *stmt);
+
+AffineExpr affine_constant(long value);
+AffineExpr affine_symbol(int symbol);
+bool affine_add_term(AffineExpr *expr, int symbol, long coeff);
+bool affine_add(AffineExpr *expr, const AffineExpr *other, long scale);
+bool affine_substitute(AffineExpr *expr, int symbol,
+                       const AffineExpr *replacement);
+long affine_coeff(const AffineExpr *expr, int symbol);
+bool affine_is_constant(const AffineExpr *expr);
+bool affine_equal(const AffineExpr *a, const AffineExpr *b);
+IRBound ir_bound(AffineExpr expr);
+
+void print_affine(FILE *out, const IRFunction *fn, const AffineExpr *expr);
+void print_ir_expr(FILE *out, const IRFunction *fn, const IRExpr *expr);
+void print_ir_access(FILE *out, const IRFunction *fn, const IRAccess *access);
+void print_ir_function(FILE *out, const IRFunction *fn);
+void print_ir_module(FILE *out, const IRModule *module);
+
+// Structural checks: symbols and tensors exist, loop variables are used only
+// inside their loop and bind exactly one loop, subscripts match tensor ranks,
+// steps are positive. Problems go to stderr; returns the number found.
+int verify_ir_function(const IRFunction *fn);
+int verify_ir_module(const IRModule *module);
+
+#endif // !LOOP_IR_H
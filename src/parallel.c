@@ -0,0 +1,70 @@
+#include "dependence.h"
+#include "transform.h"
+
+static bool contains_loop(const IRList *list) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP ||
+        (node->kind == IR_IF &&
+         (contains_loop(&node->data.if_else.then_body) ||
+          contains_loop(&node->data.if_else.else_body))))
+      return true;
+  }
+  return false;
+}
+
+static bool loop_parallel(const IRFunction *fn, const IRNode *loop) {
+  const IRList *body = &loop->data.loop.body;
+  if (!contains_loop(body))
+    return false;
+
+  DependenceList deps = {NULL, 0, 0, false};
+  analyze_dependences(loop, &deps);
+  bool ok = !deps.has_return;
+  for (int i = 0; i < deps.count && ok; i++) {
+    const Dependence *dep = &deps.items[i];
+    int tensor = dep->sink->tensor;
+    if (fn->tensors[tensor].rank > 0) {
+      ok = !dependence_carried(dep, 0);
+      continue;
+    }
+    // Each thread gets its own copy of a scalar local written here.
+    bool written = false;
+    ok = fn->tensors[tensor].kind == IR_TENSOR_LOCAL &&
+         !used_outside(&fn->body, loop, tensor) &&
+         written_before_read(body, tensor, &written);
+  }
+  free_dependences(&deps);
+  return ok;
+}
+
+static int parallelize_list(IRFunction *fn, IRList *list) {
+  int marked = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      marked += parallelize_list(fn, &node->data.if_else.then_body);
+      marked += parallelize_list(fn, &node->data.if_else.else_body);
+      continue;
+    }
+    if (node->kind != IR_LOOP)
+      continue;
+
+    // A GEMM only writes C, one element per (m, n), so its nest can be
+    // split by blocks of C whatever the loop order.
+    if (node->data.loop.gemm != NULL) {
+      node->data.loop.gemm->parallel = true;
+      marked++;
+    } else if (loop_parallel(fn, node)) {
+      node->data.loop.parallel = true;
+      marked++;
+    } else {
+      marked += parallelize_list(fn, &node->data.loop.body);
+    }
+  }
+  return marked;
+}
+
+int parallelize_function(IRFunction *fn) {
+  return parallelize_list(fn, &fn->body);
+}
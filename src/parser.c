@@ -5,22 +5,27 @@
 #include <stdlib.h>
 #include <string.h>
 
-Parser *init_parser(Lexer *lexer) {
+Parser *init_parser(Lexer *lexer, Arena *arena) {
+  if (lexer == NULL || arena == NULL)
+    return NULL;
+
   Parser *p = (Parser *)malloc(sizeof(Parser));
-  if (p == NULL || lexer == NULL)
+  if (p == NULL)
     return NULL;
 
-  p->current = 0;
-  p->token_count = lexer->token_count;
-  p->tokens = (Token *)malloc(sizeof(Token) * lexer->token_count);
-  if (p->tokens == NULL) {
+  p->arena = arena;
+  p->scratch_capacity = 64;
+  p->scratch_count = 0;
+  p->scratch = (ASTNode **)malloc(sizeof(ASTNode *) * p->scratch_capacity);
+  if (p->scratch == NULL) {
     free(p);
     return NULL;
   }
 
-  for (int i = 0; i < lexer->token_count; i++) {
-    p->tokens[i] = lexer->token_list[i];
-  }
+  p->lexer = lexer;
+  p->source = lexer->input;
+  p->current = 0;
+  p->fetched = 0;
 
   return p;
 }
@@ -29,35 +34,71 @@ void free_parser(Parser *p) {
   if (p == NULL)
     return;
 
-  free(p->tokens);
+  free(p->scratch);
   free(p);
 }
 
-Token peek(Parser *p) { return p->tokens[p->current]; }
+// Returns the interned lexeme of a token.
+static const char *token_string(Parser *p, Token t) {
+  return intern_string(token_text(p->source, t), t.length);
+}
+
+static void scratch_push(Parser *p, ASTNode *node) {
+  if (p->scratch_count >= p->scratch_capacity) {
+    p->scratch_capacity *= 2;
+    p->scratch = (ASTNode **)realloc(p->scratch,
+                                     sizeof(ASTNode *) * p->scratch_capacity);
+    assert(p->scratch != NULL);
+  }
+  p->scratch[p->scratch_count++] = node;
+}
+
+// Moves the entries pushed since `mark` into a contiguous arena array and
+// pops them off the scratch stack.
+static ASTNode **scratch_finish(Parser *p, int mark) {
+  int count = p->scratch_count - mark;
+  ASTNode **list = (ASTNode **)arena_memdup(p->arena, p->scratch + mark,
+                                            sizeof(ASTNode *) * count);
+  p->scratch_count = mark;
+  return list;
+}
+
+// Pulls tokens from the lexer until the one at `index` is in the ring.
+static Token *fill(Parser *p, int index) {
+  assert(index - p->current < PARSER_LOOKAHEAD - 1);
+  while (p->fetched <= index) {
+    p->ring[p->fetched & (PARSER_LOOKAHEAD - 1)] = next_token(p->lexer);
+    p->fetched++;
+  }
+  return &p->ring[index & (PARSER_LOOKAHEAD - 1)];
+}
+
+Token peek(Parser *p) { return *fill(p, p->current); }
 
 Token previous(Parser *p) {
   assert(p->current > 0);
-  return p->tokens[p->current - 1];
+  return p->ring[(p->current - 1) & (PARSER_LOOKAHEAD - 1)];
 }
 
-bool is_at_end(Parser *p) { return (p->current >= p->token_count); }
+bool is_at_end(Parser *p) { return peek(p).tokenType == END_OF_FILE; }
 
 bool check(Parser *p, TokenType tokenType) {
   if (is_at_end(p))
     return false;
-  return (p->tokens[p->current].tokenType == tokenType);
+  return peek(p).tokenType == tokenType;
 }
 
 bool check_next(Parser *p, TokenType tokenType) {
   if (is_at_end(p)) {
     return false;
   }
-  return p->tokens[p->current + 1].tokenType == tokenType;
+  return fill(p, p->current + 1)->tokenType == tokenType;
 }
 
 Token advance(Parser *p) {
-  Token t = p->tokens[p->current];
-  p->current++;
+  Token t = peek(p);
+  if (t.tokenType != END_OF_FILE)
+    p->current++;
   return t;
 }
 
@@ -66,8 +107,10 @@ Token expect(Parser *p, TokenType tokenType) {
     return advance(p);
   }
 
-  fprintf(stderr, "Parse error at line %d: expected token type %d, got '%s'\n",
-          peek(p).line, tokenType, peek(p).literal);
+  Token t = peek(p);
+  fprintf(stderr,
+          "Parse error at line %d: expected token type %d, got '%.*s'\n",
+          t.line, tokenType, t.length, token_text(p->source, t));
   exit(1);
 }
 
@@ -79,21 +122,21 @@ Token expect(Parser *p, TokenType tokenType) {
 ASTNode *parse_primary(Parser *p) {
   if (check(p, INT)) {
     Token t = advance(p);
-    long value = atol(t.literal);
-    return ast_node_int_literal(value, t.line);
+    long value = token_int_value(p->source, t);
+    return ast_node_int_literal(p->arena, value, t.line);
   }
   if (check(p, FLOAT)) {
     Token t = advance(p);
-    double value = atof(t.literal);
-    return ast_node_float_literal(value, t.line);
+    double value = token_float_value(p->source, t);
+    return ast_node_float_literal(p->arena, value, t.line);
   }
   if (check(p, IDENTIFIER)) {
     Token t = advance(p);
-    return ast_node_identifier(t.literal, t.line);
+    return ast_node_identifier(p->arena, token_string(p, t), t.line);
   }
   if (check(p, RANGE)) {
     Token t = advance(p);
-    return ast_node_identifier(t.literal, t.line);
+    return ast_node_identifier(p->arena, token_string(p, t), t.line);
   }
   if (check(p, LEFT_PAREN)) {
     advance(p);
@@ -102,8 +145,9 @@ ASTNode *parse_primary(Parser *p) {
     return expr;
   }
 
-  fprintf(stderr, "Parse error at line %d: unexpected token '%s'\n",
-          peek(p).line, peek(p).literal);
+  Token t = peek(p);
+  fprintf(stderr, "Parse error at line %d: unexpected token '%.*s'\n", t.line,
+          t.length, token_text(p->source, t));
   exit(1);
 }
 
@@ -114,51 +158,40 @@ ASTNode *parse_postfix(Parser *p) {
   while (!is_at_end(p)) {
     if (check(p, LEFT_BRACKET)) {
       advance(p);
-      int capacity = 4;
-      int index_count = 0;
-      ASTNode **indices = (ASTNode **)malloc(sizeof(ASTNode *) * capacity);
-      indices[index_count++] = parse_expression(p);
+      int mark = p->scratch_count;
+      scratch_push(p, parse_expression(p));
 
       while (check(p, COMMA)) {
         advance(p);
-        if (index_count >= capacity) {
-          capacity *= 2;
-          indices = (ASTNode **)realloc(indices, sizeof(ASTNode *) * capacity);
-        }
-
-        indices[index_count++] = parse_expression(p);
+        scratch_push(p, parse_expression(p));
       }
 
       expect(p, RIGHT_BRACKET);
+      int index_count = p->scratch_count - mark;
+      ASTNode **indices = scratch_finish(p, mark);
       int line = node->line;
-      node = ast_node_index_expr(node, indices, index_count, line);
+      node = ast_node_index_expr(p->arena, node, indices, index_count, line);
       return node;
 
     } else if (check(p, LEFT_PAREN)) {
       advance(p);
 
-      char *name = node->data.identifier.name;
-      int capacity = 4;
-      int args_count = 0;
-      ASTNode **args = (ASTNode **)malloc(sizeof(ASTNode *) * capacity);
+      const char *name = node->data.identifier.name;
+      int mark = p->scratch_count;
 
       if (!check(p, RIGHT_PAREN)) {
-        args[args_count++] = parse_expression(p);
+        scratch_push(p, parse_expression(p));
         while (check(p, COMMA)) {
           advance(p);
-          if (args_count >= capacity) {
-            capacity *= 2;
-            args = (ASTNode **)realloc(args, sizeof(ASTNode *) * capacity);
-          }
-
-          args[args_count++] = parse_expression(p);
+          scratch_push(p, parse_expression(p));
         }
       }
 
       expect(p, RIGHT_PAREN);
+      int args_count = p->scratch_count - mark;
+      ASTNode **args = scratch_finish(p, mark);
       int line = node->line;
-      free(node);
-      node = ast_node_func_call(name, args, args_count, line);
+      node = ast_node_func_call(p->arena, name, args, args_count, line);
       return node;
 
     } else {
@@ -174,7 +207,7 @@ ASTNode *parse_unary(Parser *p) {
   if (check(p, BANG) || check(p, MINUS)) {
     Token op = advance(p);
     ASTNode *operand = parse_unary(p);
-    return ast_node_unary_expr(op.tokenType, operand, op.line);
+    return ast_node_unary_expr(p->arena, op.tokenType, operand, op.line);
   } else
     return parse_postfix(p);
 }
@@ -185,7 +218,7 @@ ASTNode *parse_factor(Parser *p) {
   while (check(p, STAR)) {
     Token t = advance(p);
     ASTNode *right = parse_unary(p);
-    left = ast_node_binary_expr(STAR, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, STAR, left, right, t.line);
   }
   return left;
 }
@@ -196,7 +229,7 @@ ASTNode *parse_term(Parser *p) {
   while (check(p, PLUS) || check(p, MINUS)) {
     Token t = advance(p);
     ASTNode *right = parse_factor(p);
-    left = ast_node_binary_expr(t.tokenType, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, t.tokenType, left, right, t.line);
   }
   return left;
 }
@@ -208,7 +241,7 @@ ASTNode *parse_comparison(Parser *p) {
          check(p, GREATER)) {
     Token t = advance(p);
     ASTNode *right = parse_term(p);
-    left = ast_node_binary_expr(t.tokenType, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, t.tokenType, left, right, t.line);
   }
   return left;
 }
@@ -219,7 +252,7 @@ ASTNode *parse_equality(Parser *p) {
   while (check(p, EQUAL_EQUAL) || check(p, BANG_EQUAL)) {
     Token t = advance(p);
     ASTNode *right = parse_comparison(p);
-    left = ast_node_binary_expr(t.tokenType, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, t.tokenType, left, right, t.line);
   }
   return left;
 }
@@ -230,7 +263,7 @@ ASTNode *parse_logic_and(Parser *p) {
   while (check(p, AND)) {
     Token t = advance(p);
     ASTNode *right = parse_equality(p);
-    left = ast_node_binary_expr(t.tokenType, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, t.tokenType, left, right, t.line);
   }
   return left;
 }
@@ -241,7 +274,7 @@ ASTNode *parse_logic_or(Parser *p) {
   while (check(p, OR)) {
     Token t = advance(p);
     ASTNode *right = parse_logic_and(p);
-    left = ast_node_binary_expr(t.tokenType, left, right, t.line);
+    left = ast_node_binary_expr(p->arena, t.tokenType, left, right, t.line);
   }
   return left;
 }
@@ -257,49 +290,44 @@ ASTNode *parse_type(Parser *p) {
     Token identifier = expect(p, IDENTIFIER);
     expect(p, GREATER);
 
-    char *s = identifier.literal;
+    const char *s = token_text(p->source, identifier);
+    const char *end = s + identifier.length;
     int segs = 0;
-    while (*s != '\0') {
+    while (s < end) {
       if (*s == 'x')
         segs++;
       s++;
     }
     segs++;
 
-    char **dims = (char **)malloc(segs * sizeof(char *));
+    const char **dims =
+        (const char **)arena_alloc(p->arena, segs * sizeof(char *));
     assert(dims != NULL);
 
-    s = identifier.literal;
+    s = token_text(p->source, identifier);
     for (int i = 0; i < segs; i++) {
       if (*s == 'x') {
         s++;
       }
       int len = 0;
-      while (*s != '\0' && *s != 'x') {
+      while (s < end && *s != 'x') {
         len++;
         s++;
       }
-      char *segment = strndup(s - len, len);
-      dims[i] = segment;
+      dims[i] = intern_string(s - len, len);
     }
 
-    ASTNode *result =
-        ast_node_tensor_type(dims, segs - 1, dims[segs - 1], tensor.line);
-
-    for (int i = 0; i < segs; i++) {
-      free(dims[i]);
-    }
-    free(dims);
-    return result;
+    return ast_node_tensor_type(p->arena, dims, segs - 1, dims[segs - 1],
+                                tensor.line);
 
   } else if (check(p, IDENTIFIER)) {
     Token t = advance(p);
-    return ast_node_identifier(t.literal, t.line);
+    return ast_node_identifier(p->arena, token_string(p, t), t.line);
   } else {
+    Token t = peek(p);
     fprintf(stderr,
-            "Parse error at line %d: expected token type %d, got '%s'\n",
-            p->tokens[p->current].line, p->tokens[p->current].tokenType,
-            p->tokens[p->current].literal);
+            "Parse error at line %d: expected token type %d, got '%.*s'\n",
+            t.line, t.tokenType, t.length, token_text(p->source, t));
     exit(1);
   }
 }
@@ -311,7 +339,7 @@ ASTNode *parse_return_stmt(Parser *p) {
   if (is_at_end(p) == false && !check(p, RIGHT_BRACE)) {
     return_val = parse_expression(p);
   }
-  return ast_node_return(return_val, return_t.line);
+  return ast_node_return(p->arena, return_val, return_t.line);
 }
 
 // var_decl ::= IDENTIFIER COLON type ( EQUAL expression )?
@@ -325,8 +353,8 @@ ASTNode *parse_var_decl(Parser *p) {
     advance(p);
     initializer = parse_expression(p);
   }
-  char *name = strdup(identifier.literal);
-  return ast_node_var_decl(name, type, initializer, identifier.line);
+  return ast_node_var_decl(p->arena, token_string(p, identifier), type,
+                           initializer, identifier.line);
 }
 
 // assignment_or_expr ::= expression ( ( EQUAL | PLUS_EQUAL | MINUS_EQUAL )
@@ -334,10 +362,10 @@ ASTNode *parse_var_decl(Parser *p) {
 ASTNode *parse_assignment_or_expr(Parser *p) {
   ASTNode *left = parse_expression(p);
 
-  if (check(p, EQUAL)) {
+  if (check(p, EQUAL) || check(p, PLUS_EQUAL) || check(p, MINUS_EQUAL)) {
     Token op = advance(p);
     ASTNode *right = parse_expression(p);
-    return ast_node_assignment(left, right, op.line);
+    return ast_node_assignment(p->arena, op.tokenType, left, right, op.line);
   }
   return left;
 }
@@ -366,34 +394,29 @@ ASTNode *parse_stmt(Parser *p) {
 // block ::= LEFT_BRACE statement* RIGHT_BRACE
 ASTNode *parse_block(Parser *p) {
   Token left_brace = expect(p, LEFT_BRACE);
-  int current_capacity = 8;
-  int current_count = 0;
-  ASTNode **statements =
-      (ASTNode **)malloc(sizeof(ASTNode *) * current_capacity);
+  int mark = p->scratch_count;
 
   while (check(p, RIGHT_BRACE) == false && is_at_end(p) == false) {
-    if (current_count >= current_capacity) {
-      current_capacity *= 2;
-      statements =
-          (ASTNode **)realloc(statements, sizeof(ASTNode *) * current_capacity);
-    }
-    statements[current_count++] = parse_stmt(p);
+    scratch_push(p, parse_stmt(p));
   }
   expect(p, RIGHT_BRACE);
-  return ast_node_block(statements, current_count, left_brace.line);
+  int count = p->scratch_count - mark;
+  ASTNode **statements = scratch_finish(p, mark);
+  return ast_node_block(p->arena, statements, count, left_brace.line);
 }
 
 // for_stmt ::= FOR IDENTIFIER IN expression block
 ASTNode *parse_for(Parser *p) {
   Token for_token = expect(p, FOR);
   Token loop_var = expect(p, IDENTIFIER);
-  char *name = strdup(loop_var.literal);
-  ASTNode *identifier = ast_node_identifier(name, loop_var.line);
+  ASTNode *identifier =
+      ast_node_identifier(p->arena, token_string(p, loop_var), loop_var.line);
 
   expect(p, IN);
   ASTNode *iterable = parse_expression(p);
   ASTNode *block_body = parse_block(p);
-  return ast_node_for(identifier, iterable, block_body, for_token.line);
+  return ast_node_for(p->arena, identifier, iterable, block_body,
+                      for_token.line);
 }
 
 // if_stmt ::= IF expression block ( ELSE block )?
@@ -408,7 +431,8 @@ ASTNode *parse_if(Parser *p) {
     else_block = parse_block(p);
   }
 
-  return ast_node_if(condition, then_block, else_block, if_token.line);
+  return ast_node_if(p->arena, condition, then_block, else_block,
+                     if_token.line);
 }
 
 // function_def ::= FUNC IDENTIFIER LEFT_PAREN param_list? RIGHT_PAREN ARROW
@@ -416,49 +440,160 @@ ASTNode *parse_if(Parser *p) {
 ASTNode *parse_function_def(Parser *p) {
   expect(p, FUNC);
   Token identifier = expect(p, IDENTIFIER);
-  char *func_name = strdup(identifier.literal);
 
   expect(p, LEFT_PAREN);
-  int current_capacity = 4;
-  int current_count = 0;
-  ASTNode **params = (ASTNode **)malloc(current_capacity * sizeof(ASTNode *));
+  int mark = p->scratch_count;
 
   if (check(p, RIGHT_PAREN) == false) {
-    params[current_count++] = parse_var_decl(p);
+    scratch_push(p, parse_var_decl(p));
     while (check(p, COMMA) && is_at_end(p) == false) {
       advance(p);
-
-      if (current_count >= current_capacity) {
-        current_capacity *= 2;
-        params =
-            (ASTNode **)realloc(params, sizeof(ASTNode *) * current_capacity);
-      }
-      params[current_count++] = parse_var_decl(p);
+      scratch_push(p, parse_var_decl(p));
     }
   }
   expect(p, RIGHT_PAREN);
+  int count_params = p->scratch_count - mark;
+  ASTNode **params = scratch_finish(p, mark);
   expect(p, ARROW);
 
   ASTNode *type = parse_type(p);
   ASTNode *body = parse_block(p);
 
-  return ast_node_function_decl(func_name, params, current_count, type, body,
-                                identifier.line);
+  return ast_node_function_decl(p->arena, token_string(p, identifier), params,
+                                count_params, type, body, identifier.line);
 }
 
 // program ::= function_def*
 ASTNode *parse_program(Parser *p) {
-  int capacity = 4;
-  int count = 0;
-  ASTNode **functions = (ASTNode **)malloc(sizeof(ASTNode *) * capacity);
+  int mark = p->scratch_count;
 
   while (!is_at_end(p)) {
-    if (count >= capacity) {
-      capacity *= 2;
-      functions = (ASTNode **)realloc(functions, sizeof(ASTNode *) * capacity);
+    scratch_push(p, parse_function_def(p));
+  }
+
+  int count = p->scratch_count - mark;
+  ASTNode **functions = scratch_finish(p, mark);
+  return ast_node_program(p->arena, functions, count, 0);
+}
+
+typedef struct SourceChunk {
+  int offset;
+  int length;
+  int line;
+} SourceChunk;
+
+typedef struct ParallelParse {
+  const char *source;
+  SourceChunk *chunks;
+  ASTNode **results;
+  Arena **arenas;
+} ParallelParse;
+
+static void parse_chunk(void *context, int index, int worker) {
+  ParallelParse *job = (ParallelParse *)context;
+  SourceChunk chunk = job->chunks[index];
+
+  Lexer *lexer = init_lexer(job->source + chunk.offset, chunk.length);
+  assert(lexer != NULL);
+  lexer->line = chunk.line;
+
+  Parser *p = init_parser(lexer, job->arenas[worker]);
+  assert(p != NULL);
+  job->results[index] = parse_program(p);
+
+  free_parser(p);
+  free_lexer(lexer);
+}
+
+// Splits the input at FUNC tokens that appear outside any braces. Each chunk
+// holds one function definition, except the first, which also covers
+// anything before the first FUNC so that stray tokens still fail to parse.
+static SourceChunk *split_functions(Lexer *lexer, int *out_count) {
+  int capacity = 64;
+  int count = 0;
+  SourceChunk *chunks = (SourceChunk *)malloc(sizeof(SourceChunk) * capacity);
+  assert(chunks != NULL);
+
+  int depth = 0;
+  for (;;) {
+    Token t = next_token(lexer);
+    if (t.tokenType == END_OF_FILE)
+      break;
+    if (t.tokenType == LEFT_BRACE) {
+      depth++;
+    } else if (t.tokenType == RIGHT_BRACE) {
+      depth--;
+    } else if (t.tokenType == FUNC && depth == 0) {
+      if (count == 0) {
+        chunks[count++] = (SourceChunk){0, 0, 0};
+        continue;
+      }
+      if (count >= capacity) {
+        capacity *= 2;
+        chunks =
+            (SourceChunk *)realloc(chunks, sizeof(SourceChunk) * capacity);
+        assert(chunks != NULL);
+      }
+      chunks[count++] = (SourceChunk){t.offset, 0, t.line};
     }
-    functions[count++] = parse_function_def(p);
   }
 
-  return ast_node_program(functions, count, 0);
+  if (count == 0)
+    chunks[count++] = (SourceChunk){0, 0, 0};
+  for (int i = 0; i < count; i++) {
+    int end = i + 1 < count ? chunks[i + 1].offset : lexer->total_length;
+    chunks[i].length = end - chunks[i].offset;
+  }
+
+  *out_count = count;
+  return chunks;
+}
+
+// program ::= function_def*
+//
+// Parses each top-level function on the thread pool. Workers lex their own
+// slice of the source and allocate from a private arena, which is merged into
+// `arena` afterwards, so the result has the same shape and lifetime as the
+// output of parse_program. The lexer must not have been read from yet.
+ASTNode *parse_program_parallel(Lexer *lexer, Arena *arena, ThreadPool *pool) {
+  if (lexer == NULL || arena == NULL)
+    return NULL;
+
+  int chunk_count = 0;
+  SourceChunk *chunks = split_functions(lexer, &chunk_count);
+
+  int workers = thread_pool_size(pool);
+  ParallelParse job;
+  job.source = lexer->input;
+  job.chunks = chunks;
+  job.results = (ASTNode **)malloc(sizeof(ASTNode *) * chunk_count);
+  job.arenas = (Arena **)malloc(sizeof(Arena *) * workers);
+  assert(job.results != NULL && job.arenas != NULL);
+  for (int i = 0; i < workers; i++) {
+    job.arenas[i] = init_arena(arena->chunk_size);
+    assert(job.arenas[i] != NULL);
+  }
+
+  thread_pool_run(pool, chunk_count, parse_chunk, &job);
+
+  int count = 0;
+  for (int i = 0; i < chunk_count; i++)
+    count += job.results[i]->data.program.function_count;
+
+  ASTNode **functions =
+      (ASTNode **)arena_alloc(arena, sizeof(ASTNode *) * count);
+  int next = 0;
+  for (int i = 0; i < chunk_count; i++) {
+    ASTNode *chunk_program = job.results[i];
+    for (int j = 0; j < chunk_program->data.program.function_count; j++)
+      functions[next++] = chunk_program->data.program.functions[j];
+  }
+
+  for (int i = 0; i < workers; i++)
+    arena_adopt(arena, job.arenas[i]);
+
+  free(job.arenas);
+  free(job.results);
+  free(chunks);
+  return ast_node_program(arena, functions, count, 0);
 }
@@ -1,17 +1,38 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include "assert.h"
+#include "arena.h"
 #include "ast.h"
 #include "lexer.h"
+#include "thread_pool.h"
+#include <assert.h>
 
+// Size of the token ring buffer. It holds the previous token, the current
+// one and the single token of lookahead the grammar needs. Must be a power of
+// two.
+#define PARSER_LOOKAHEAD 4
+
+// The parser pulls tokens from the lexer on demand, so lexing and parsing run
+// interleaved and the token stream is never materialised.
 typedef struct Parser {
-  Token *tokens;
-  int token_count;
-  int current;
+  Lexer *lexer;
+  const char *source;
+  Token ring[PARSER_LOOKAHEAD];
+  int current; // Index of the current token in the stream.
+  int fetched; // Number of tokens pulled from the lexer so far.
+
+  // Every node built by this parser is allocated from the arena.
+  Arena *arena;
+
+  // Shared stack for collecting child lists while they are being parsed.
+  // Nested lists push above their parent's entries and are copied into the
+  // arena once complete, so no list needs its own heap buffer.
+  ASTNode **scratch;
+  int scratch_count;
+  int scratch_capacity;
 } Parser;
 
-Parser *init_parser(Lexer *lexer);
+Parser *init_parser(Lexer *lexer, Arena *arena);
 void free_parser(Parser *p);
 
 bool is_at_end(Parser *p);
@@ -42,4 +63,5 @@ ASTNode *parse_for(Parser *p);
 ASTNode *parse_if(Parser *p);
 ASTNode *parse_function_def(Parser *p);
 ASTNode *parse_program(Parser *p);
+ASTNode *parse_program_parallel(Lexer *lexer, Arena *arena, ThreadPool *pool);
 #endif // !PARSER_H
@@ -0,0 +1,204 @@
+#include "intern.h"
+#include "transform.h"
+#include <assert.h>
+
+// Marks the variables of every loop under `list`.
+static void mark_loops(const IRList *list, bool *bound) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node->kind == IR_LOOP) {
+      bound[node->data.loop.var] = true;
+      mark_loops(&node->data.loop.body, bound);
+    } else if (node->kind == IR_IF) {
+      mark_loops(&node->data.if_else.then_body, bound);
+      mark_loops(&node->data.if_else.else_body, bound);
+    }
+  }
+}
+
+// The element must be a fixed one for the whole loop: affine subscripts over
+// size parameters and variables of enclosing loops only.
+static bool fixed_element(const IRFunction *fn, const IRAccess *access,
+                          const bool *bound) {
+  if (fn->tensors[access->tensor].rank <= 0)
+    return false;
+  for (int d = 0; d < access->count; d++) {
+    const IRIndex *index = &access->indices[d];
+    if (!index->affine)
+      return false;
+    for (int t = 0; t < index->expr.term_count; t++) {
+      if (bound[index->expr.terms[t].symbol])
+        return false;
+    }
+  }
+  return true;
+}
+
+static void replace_list(IRList *list, const IRAccess *from, int scalar);
+
+static void replace_access(IRAccess *access, const IRAccess *from,
+                           int scalar) {
+  if (!ir_access_equal(access, from))
+    return;
+  access->tensor = scalar;
+  access->count = 0;
+  access->indices = NULL;
+}
+
+static void replace_expr(IRExpr *expr, const IRAccess *from, int scalar) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    for (int d = 0; d < expr->data.load.count; d++)
+      replace_expr(expr->data.load.indices[d].general, from, scalar);
+    replace_access(&expr->data.load, from, scalar);
+    break;
+  case IR_EXPR_BINARY:
+    replace_expr(expr->data.binary.left, from, scalar);
+    replace_expr(expr->data.binary.right, from, scalar);
+    break;
+  case IR_EXPR_UNARY:
+    replace_expr(expr->data.unary.operand, from, scalar);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      replace_expr(expr->data.call.args[i], from, scalar);
+    break;
+  default:
+    break;
+  }
+}
+
+static void replace_list(IRList *list, const IRAccess *from, int scalar) {
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      replace_list(&node->data.loop.body, from, scalar);
+      break;
+    case IR_STMT:
+      replace_expr(node->data.stmt.value, from, scalar);
+      if (node->data.stmt.target.tensor >= 0) {
+        for (int d = 0; d < node->data.stmt.target.count; d++)
+          replace_expr(node->data.stmt.target.indices[d].general, from,
+                       scalar);
+        replace_access(&node->data.stmt.target, from, scalar);
+      }
+      break;
+    case IR_IF:
+      replace_expr(node->data.if_else.condition, from, scalar);
+      replace_list(&node->data.if_else.then_body, from, scalar);
+      replace_list(&node->data.if_else.else_body, from, scalar);
+      break;
+    case IR_RETURN:
+      replace_expr(node->data.ret.value, from, scalar);
+      break;
+    }
+  }
+}
+
+static IRNode *copy_stmt(IRFunction *fn, IRAccess target, IRAccess source,
+                         int line) {
+  IRNode *stmt = ir_new_node(fn->arena, IR_STMT, line);
+  IRExpr *load = ir_new_expr(fn->arena, IR_EXPR_LOAD);
+  assert(stmt != NULL && load != NULL);
+  load->data.load = source;
+  stmt->data.stmt.target = target;
+  stmt->data.stmt.value = load;
+  return stmt;
+}
+
+// Promotes every element `loop` reads and writes at a fixed subscript, with
+// no other access to its tensor inside the loop, to a new scalar local.
+// The loads before the loop and stores after it go to `before` and `after`.
+static int promote_loop(IRFunction *fn, IRNode *loop, IRNode **before,
+                        IRNode **after, int max_count) {
+  LoopAccessList accesses = {NULL, 0, 0, false};
+  collect_loop_accesses(&accesses, &loop->data.loop.body);
+  if (accesses.has_return) {
+    free_loop_accesses(&accesses);
+    return 0;
+  }
+
+  bool *bound = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  assert(bound != NULL);
+  bound[loop->data.loop.var] = true;
+  mark_loops(&loop->data.loop.body, bound);
+
+  int count = 0;
+  for (int i = 0; i < accesses.count && count < max_count; i++) {
+    const LoopAccess *write = &accesses.items[i];
+    if (!write->write || !fixed_element(fn, write->access, bound))
+      continue;
+    bool alone = true;
+    for (int j = 0; j < accesses.count && alone; j++) {
+      const IRAccess *other = accesses.items[j].access;
+      alone = other->tensor != write->access->tensor ||
+              ir_access_equal(other, write->access);
+    }
+    if (!alone)
+      continue;
+
+    // Replacing rewrites the accesses in place, including `write`, so the
+    // element is copied first. Its subscripts are left untouched.
+    const IRTensor *tensor = &fn->tensors[write->access->tensor];
+    char name[256];
+    snprintf(name, sizeof(name), "%s_acc", tensor->name);
+    IRTensor local = {intern_cstring(name), IR_TENSOR_LOCAL, tensor->dtype, 0,
+                      NULL};
+    IRAccess element = *write->access;
+    int scalar = ir_add_tensor(fn, local);
+    IRAccess scalar_access = {scalar, 0, NULL};
+    replace_list(&loop->data.loop.body, &element, scalar);
+
+    before[count] = copy_stmt(fn, scalar_access, element, loop->line);
+    after[count] = copy_stmt(fn, element, scalar_access, loop->line);
+    count++;
+  }
+
+  free(bound);
+  free_loop_accesses(&accesses);
+  return count;
+}
+
+#define PROMOTE_MAX_PER_LOOP 16
+
+static int promote_list(IRFunction *fn, IRList *list) {
+  int promoted = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      promoted += promote_list(fn, &node->data.if_else.then_body);
+      promoted += promote_list(fn, &node->data.if_else.else_body);
+      continue;
+    }
+    if (node->kind != IR_LOOP || node->data.loop.gemm != NULL)
+      continue;
+
+    IRNode *before[PROMOTE_MAX_PER_LOOP], *after[PROMOTE_MAX_PER_LOOP];
+    int count = promote_loop(fn, node, before, after, PROMOTE_MAX_PER_LOOP);
+    if (count > 0) {
+      IRNode **items = (IRNode **)arena_alloc(
+          fn->arena, sizeof(IRNode *) * (list->count + 2 * count));
+      assert(items != NULL);
+      memcpy(items, list->items, sizeof(IRNode *) * i);
+      memcpy(&items[i], before, sizeof(IRNode *) * count);
+      items[i + count] = node;
+      memcpy(&items[i + count + 1], after, sizeof(IRNode *) * count);
+      memcpy(&items[i + 2 * count + 1], &list->items[i + 1],
+             sizeof(IRNode *) * (list->count - i - 1));
+      list->items = items;
+      list->count += 2 * count;
+      i += 2 * count;
+      promoted += count;
+    }
+    promoted += promote_list(fn, &node->data.loop.body);
+  }
+  return promoted;
+}
+
+int promote_function(IRFunction *fn) {
+  return promote_list(fn, &fn->body);
+}
@@ -0,0 +1,803 @@
+#include "shape.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+// Shape of a value: rank -1 when unknown, 0 for scalars. `dims` is an offset
+// into the checker's dim pool holding its `rank` dims.
+typedef struct Shape {
+  int rank;
+  int dims;
+  const char *dtype;
+} Shape;
+
+#define SHAPE_MAX_TERMS 8
+
+// One term of a Linear: a loop variable, by its binding index, or a dim.
+typedef struct LinearTerm {
+  int loop; // -1 for a dim.
+  const char *dim;
+  long coeff;
+} LinearTerm;
+
+// Affine form of a subscript or loop bound over loop variables and dims.
+typedef struct Linear {
+  long constant;
+  int count;
+  LinearTerm terms[SHAPE_MAX_TERMS];
+} Linear;
+
+typedef struct Binding {
+  const char *name;
+  Shape shape;
+  // Loop variables range over [lower, upper) when `bounded`, which needs the
+  // loop to be over a range with affine ends.
+  bool loop;
+  bool bounded;
+  Linear lower;
+  Linear upper;
+} Binding;
+
+typedef struct ShapeChecker {
+  Arena *arena;
+  const char *function;
+  const char *range;
+  int errors;
+  // Number of enclosing if branches.
+  int guards;
+
+  Dim *dim_pool;
+  int dim_count;
+  int dim_capacity;
+
+  // Scoped bindings; inner scopes push on top and are popped on exit.
+  Binding *bindings;
+  int binding_count;
+  int binding_capacity;
+
+  // What the enclosing if conditions say, each as a form that is at least 0,
+  // scoped like the bindings.
+  Linear *facts;
+  int fact_count;
+  int fact_capacity;
+} ShapeChecker;
+
+static const Shape unknown_shape = {-1, 0, NULL};
+static const Shape scalar_shape = {0, 0, NULL};
+
+static void *grow(void *items, int *capacity, int needed, size_t item_size) {
+  if (needed <= *capacity)
+    return items;
+
+  int new_capacity = *capacity > 0 ? *capacity : 32;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  items = realloc(items, (size_t)new_capacity * item_size);
+  assert(items != NULL);
+  *capacity = new_capacity;
+  return items;
+}
+
+static void shape_error(ShapeChecker *c, int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "Shape error at line %d: ", line);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, " (in function '%s')\n", c->function);
+  va_end(args);
+  c->errors++;
+}
+
+// Dims in a tensor type are written as names; all-digit names are sizes.
+static Dim named_dim(const char *name) {
+  Dim dim = {DIM_SYMBOL, 0, name};
+  const char *s = name;
+  if (*s != '\0') {
+    while (*s >= '0' && *s <= '9')
+      s++;
+    if (*s == '\0') {
+      dim.kind = DIM_CONST;
+      dim.value = strtol(name, NULL, 10);
+      dim.symbol = NULL;
+    }
+  }
+  return dim;
+}
+
+static bool same_dim(Dim a, Dim b) {
+  if (a.kind != b.kind)
+    return false;
+  return a.kind == DIM_CONST ? a.value == b.value : a.symbol == b.symbol;
+}
+
+static const char *format_dim(Dim dim, char *buffer, size_t size) {
+  if (dim.kind == DIM_SYMBOL)
+    return dim.symbol;
+  if (dim.kind == DIM_CONST)
+    snprintf(buffer, size, "%ld", dim.value);
+  else
+    snprintf(buffer, size, "?");
+  return buffer;
+}
+
+// Writes a shape in source syntax, e.g. `tensor<MxNxf32>`, for messages.
+static const char *format_shape(ShapeChecker *c, Shape shape, char *buffer,
+                                size_t size) {
+  if (shape.rank <= 0) {
+    snprintf(buffer, size, "%s", shape.dtype ? shape.dtype : "scalar");
+    return buffer;
+  }
+
+  size_t used = (size_t)snprintf(buffer, size, "tensor<");
+  for (int i = 0; i < shape.rank && used < size; i++) {
+    char dim_buffer[32];
+    Dim dim = c->dim_pool[shape.dims + i];
+    used += (size_t)snprintf(buffer + used, size - used, "%s%s",
+                             i > 0 ? "x" : "",
+                             format_dim(dim, dim_buffer, sizeof(dim_buffer)));
+  }
+  if (used < size) {
+    snprintf(buffer + used, size - used, "%s%s>", shape.dtype ? "x" : "",
+             shape.dtype ? shape.dtype : "");
+  }
+  return buffer;
+}
+
+static Shape shape_of_type(ShapeChecker *c, ASTNode *type) {
+  if (type == NULL)
+    return unknown_shape;
+
+  if (type->nodeType == NODE_IDENTIFIER) {
+    Shape shape = {0, 0, type->data.identifier.name};
+    return shape;
+  }
+  if (type->nodeType != NODE_TENSOR_TYPE)
+    return unknown_shape;
+
+  int rank = type->data.tensor_type.dim_count;
+  Shape shape = {rank, c->dim_count, type->data.tensor_type.data_type};
+  c->dim_pool = (Dim *)grow(c->dim_pool, &c->dim_capacity,
+                            c->dim_count + rank, sizeof(Dim));
+  for (int i = 0; i < rank; i++)
+    c->dim_pool[c->dim_count++] = named_dim(type->data.tensor_type.dims[i]);
+  return shape;
+}
+
+static Binding *bind(ShapeChecker *c, const char *name, Shape shape) {
+  c->bindings =
+      (Binding *)grow(c->bindings, &c->binding_capacity, c->binding_count + 1,
+                      sizeof(Binding));
+  Binding *binding = &c->bindings[c->binding_count++];
+  memset(binding, 0, sizeof(Binding));
+  binding->name = name;
+  binding->shape = shape;
+  return binding;
+}
+
+// Names are interned, so they compare by pointer. Inner scopes shadow outer
+// ones because the search runs from the top of the stack.
+static Binding *lookup(ShapeChecker *c, const char *name) {
+  for (int i = c->binding_count - 1; i >= 0; i--) {
+    if (c->bindings[i].name == name)
+      return &c->bindings[i];
+  }
+  return NULL;
+}
+
+static Linear linear_constant(long value) {
+  Linear expr;
+  memset(&expr, 0, sizeof(expr));
+  expr.constant = value;
+  return expr;
+}
+
+// Adds `scale` times `other` to `expr`; fails if that needs more terms than
+// fit.
+static bool linear_add(Linear *expr, const Linear *other, long scale) {
+  expr->constant += scale * other->constant;
+  for (int i = 0; i < other->count; i++) {
+    const LinearTerm *term = &other->terms[i];
+    int j = 0;
+    while (j < expr->count && (expr->terms[j].loop != term->loop ||
+                               expr->terms[j].dim != term->dim))
+      j++;
+    if (j == expr->count) {
+      if (expr->count == SHAPE_MAX_TERMS)
+        return false;
+      expr->terms[expr->count++] = *term;
+      expr->terms[j].coeff = 0;
+    }
+    expr->terms[j].coeff += scale * term->coeff;
+    if (expr->terms[j].coeff == 0)
+      expr->terms[j] = expr->terms[--expr->count];
+  }
+  return true;
+}
+
+// Converts a subscript or loop bound to affine form, as lowering does. Fails
+// for anything that reads a variable or is not linear.
+static bool to_linear(ShapeChecker *c, ASTNode *node, Linear *out) {
+  if (node == NULL)
+    return false;
+
+  switch (node->nodeType) {
+  case NODE_INT_LITERAL:
+    *out = linear_constant(node->data.int_literal.value);
+    return true;
+  case NODE_IDENTIFIER: {
+    Binding *binding = lookup(c, node->data.identifier.name);
+    if (binding != NULL && !binding->loop)
+      return false;
+    LinearTerm term = {-1, NULL, 1};
+    if (binding != NULL)
+      term.loop = (int)(binding - c->bindings);
+    else
+      term.dim = node->data.identifier.name;
+    *out = linear_constant(0);
+    out->terms[out->count++] = term;
+    return true;
+  }
+  case NODE_UNARY_EXPR: {
+    Linear operand;
+    if (node->data.unary_op.op != MINUS ||
+        !to_linear(c, node->data.unary_op.operand, &operand))
+      return false;
+    *out = linear_constant(0);
+    return linear_add(out, &operand, -1);
+  }
+  case NODE_BINARY_EXPR: {
+    Linear left, right;
+    if (!to_linear(c, node->data.binary_op.left, &left) ||
+        !to_linear(c, node->data.binary_op.right, &right))
+      return false;
+
+    switch (node->data.binary_op.op) {
+    case PLUS:
+      *out = left;
+      return linear_add(out, &right, 1);
+    case MINUS:
+      *out = left;
+      return linear_add(out, &right, -1);
+    case STAR:
+      *out = linear_constant(0);
+      if (left.count == 0)
+        return linear_add(out, &right, left.constant);
+      if (right.count == 0)
+        return linear_add(out, &left, right.constant);
+      return false;
+    default:
+      return false;
+    }
+  }
+  default:
+    return false;
+  }
+}
+
+// Binding index of the innermost loop variable in `expr`, or -1.
+static int innermost_term(const Linear *expr) {
+  int inner = -1;
+  for (int i = 0; i < expr->count; i++) {
+    if (expr->terms[i].loop >= 0 &&
+        (inner < 0 || expr->terms[i].loop > expr->terms[inner].loop))
+      inner = i;
+  }
+  return inner;
+}
+
+// Bounds `expr` from above, or from below when `upper` is false, by a form
+// over dims alone. Loop variables are replaced innermost first, since the
+// bounds of a loop only use the variables of loops around it, each by the
+// end of its range that takes the term furthest in that direction. Fails if
+// some loop's range is not known.
+static bool bound_linear(ShapeChecker *c, Linear expr, bool upper,
+                         Linear *out) {
+  for (;;) {
+    int inner = innermost_term(&expr);
+    if (inner < 0)
+      break;
+
+    LinearTerm term = expr.terms[inner];
+    const Binding *loop = &c->bindings[term.loop];
+    if (!loop->bounded)
+      return false;
+    expr.terms[inner] = expr.terms[--expr.count];
+    // The variable is at most upper - 1.
+    bool high = (term.coeff > 0) == upper;
+    if (!linear_add(&expr, high ? &loop->upper : &loop->lower, term.coeff))
+      return false;
+    if (high)
+      expr.constant -= term.coeff;
+  }
+  *out = expr;
+  return true;
+}
+
+// Dims are never negative, so a form over them with no negative part is
+// never negative either.
+static bool nonnegative(const Linear *expr) {
+  if (expr->constant < 0)
+    return false;
+  for (int i = 0; i < expr->count; i++) {
+    if (expr->terms[i].coeff < 0)
+      return false;
+  }
+  return true;
+}
+
+// Whether `expr`, over dims alone, is at least 0 wherever the code being
+// checked runs. Code in a loop only runs when the loop's range is not empty,
+// which gives the extra fact upper - lower - 1 >= 0 for each enclosing loop.
+static bool provably_nonnegative(ShapeChecker *c, const Linear *expr) {
+  if (nonnegative(expr))
+    return true;
+  for (int i = 0; i < c->fact_count; i++) {
+    Linear rest = *expr;
+    if (innermost_term(&c->facts[i]) < 0 &&
+        linear_add(&rest, &c->facts[i], -1) && nonnegative(&rest))
+      return true;
+  }
+  for (int i = 0; i < c->binding_count; i++) {
+    const Binding *loop = &c->bindings[i];
+    Linear high, low;
+    if (!loop->loop || !loop->bounded ||
+        !bound_linear(c, loop->upper, true, &high) ||
+        !bound_linear(c, loop->lower, false, &low))
+      continue;
+    Linear rest = *expr;
+    if (linear_add(&rest, &high, -1) && linear_add(&rest, &low, 1)) {
+      rest.constant += 1;
+      if (nonnegative(&rest))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Whether `expr` is at least 0 wherever the code being checked runs. The
+// innermost loop variable is replaced by each bound on it that moves the
+// term the wrong way, the end of its range or one an if condition gives,
+// until one substitution leaves a form over dims that is provably
+// nonnegative.
+static bool prove_nonnegative(ShapeChecker *c, Linear expr) {
+  int inner = innermost_term(&expr);
+  if (inner < 0)
+    return provably_nonnegative(c, &expr);
+
+  LinearTerm term = expr.terms[inner];
+  const Binding *loop = &c->bindings[term.loop];
+  expr.terms[inner] = expr.terms[--expr.count];
+  // A positive term needs the variable's least value, a negative one its
+  // greatest.
+  bool low = term.coeff > 0;
+  if (loop->bounded) {
+    Linear next = expr;
+    if (linear_add(&next, low ? &loop->lower : &loop->upper, term.coeff)) {
+      if (!low)
+        next.constant -= term.coeff;
+      if (prove_nonnegative(c, next))
+        return true;
+    }
+  }
+
+  // A fact `v + rest >= 0` gives v >= -rest, and `-v + rest >= 0` gives
+  // v <= rest. Facts are only used where the rest is over outer loops.
+  for (int i = 0; i < c->fact_count; i++) {
+    Linear rest = c->facts[i];
+    int j = innermost_term(&rest);
+    if (j < 0 || rest.terms[j].loop != term.loop ||
+        rest.terms[j].coeff != (low ? 1 : -1))
+      continue;
+    rest.terms[j] = rest.terms[--rest.count];
+    Linear next = expr;
+    if (linear_add(&next, &rest, low ? -term.coeff : term.coeff) &&
+        prove_nonnegative(c, next))
+      return true;
+  }
+  return false;
+}
+
+static const char *format_linear(ShapeChecker *c, const Linear *expr,
+                                 char *buffer, size_t size) {
+  size_t used = 0;
+  buffer[0] = '\0';
+  for (int i = 0; i < expr->count && used < size; i++) {
+    const LinearTerm *term = &expr->terms[i];
+    const char *name =
+        term->loop >= 0 ? c->bindings[term->loop].name : term->dim;
+    long magnitude = term->coeff < 0 ? -term->coeff : term->coeff;
+    const char *sign = term->coeff < 0 ? (i > 0 ? " - " : "-")
+                                       : (i > 0 ? " + " : "");
+    if (magnitude == 1)
+      used += (size_t)snprintf(buffer + used, size - used, "%s%s", sign,
+                               name);
+    else
+      used += (size_t)snprintf(buffer + used, size - used, "%s%ld * %s",
+                               sign, magnitude, name);
+  }
+  if (used < size && (expr->count == 0 || expr->constant != 0)) {
+    long constant = expr->constant;
+    if (expr->count == 0)
+      snprintf(buffer + used, size - used, "%ld", constant);
+    else
+      snprintf(buffer + used, size - used, " %c %ld", constant < 0 ? '-' : '+',
+               constant < 0 ? -constant : constant);
+  }
+  return buffer;
+}
+
+// Checks an affine subscript into a dimension of extent `dim`, returning
+// whether it provably lies in [0, dim) for every value it takes. One that
+// may not is an error, unless it is under an if, whose condition may keep it
+// in bounds in ways not understood here; it is then left to be checked at
+// run time, as subscripts that are not affine are.
+static bool check_subscript(ShapeChecker *c, ASTNode *index, Dim dim, int i,
+                            const char *name) {
+  Linear expr;
+  if (!to_linear(c, index, &expr) || dim.kind == DIM_UNKNOWN)
+    return false;
+
+  // extent - 1 - expr >= 0
+  Linear room = linear_constant(dim.kind == DIM_CONST ? dim.value - 1 : -1);
+  if (dim.kind == DIM_SYMBOL) {
+    LinearTerm term = {-1, dim.symbol, 1};
+    room.terms[room.count++] = term;
+  }
+  if (prove_nonnegative(c, expr) && linear_add(&room, &expr, -1) &&
+      prove_nonnegative(c, room))
+    return true;
+
+  Linear low, high;
+  if (c->guards == 0 && bound_linear(c, expr, false, &low) &&
+      bound_linear(c, expr, true, &high)) {
+    char text[128], from[128], to[128], extent[32];
+    shape_error(c, index->line,
+                "index %s ranges over [%s, %s] but dimension %d of '%s' is %s",
+                format_linear(c, &expr, text, sizeof(text)),
+                format_linear(c, &low, from, sizeof(from)),
+                format_linear(c, &high, to, sizeof(to)), i, name,
+                format_dim(dim, extent, sizeof(extent)));
+  }
+  return false;
+}
+
+// Checks that `value` can be stored where `expected` is declared. Scalars
+// broadcast into tensors; tensors must agree in rank and in every dim.
+static void check_compatible(ShapeChecker *c, Shape expected, Shape value,
+                             int line, const char *what) {
+  if (expected.rank < 0 || value.rank < 0 || value.rank == 0)
+    return;
+
+  bool ok = expected.rank == value.rank;
+  for (int i = 0; ok && i < expected.rank; i++) {
+    ok = same_dim(c->dim_pool[expected.dims + i],
+                  c->dim_pool[value.dims + i]);
+  }
+  if (!ok) {
+    char want[128], got[128];
+    shape_error(c, line, "%s: expected %s, got %s", what,
+                format_shape(c, expected, want, sizeof(want)),
+                format_shape(c, value, got, sizeof(got)));
+  }
+}
+
+static Shape infer(ShapeChecker *c, ASTNode *node);
+
+static Shape infer_index(ShapeChecker *c, ASTNode *node) {
+  ASTNode *object = node->data.index_expression.object;
+  int count = node->data.index_expression.index_count;
+  ASTNode **indices = node->data.index_expression.indices;
+
+  for (int i = 0; i < count; i++)
+    infer(c, indices[i]);
+
+  if (object == NULL || object->nodeType != NODE_IDENTIFIER) {
+    infer(c, object);
+    return unknown_shape;
+  }
+
+  const char *name = object->data.identifier.name;
+  Binding *binding = lookup(c, name);
+  if (binding == NULL) {
+    shape_error(c, node->line, "indexing undeclared tensor '%s'", name);
+    return unknown_shape;
+  }
+
+  Shape shape = binding->shape;
+  if (shape.rank < 0)
+    return unknown_shape;
+  if (shape.rank == 0) {
+    shape_error(c, node->line, "cannot index scalar '%s'", name);
+    return unknown_shape;
+  }
+  if (shape.rank != count) {
+    shape_error(c, node->line, "'%s' has rank %d but is indexed with %d %s",
+                name, shape.rank, count, count == 1 ? "index" : "indices");
+    return unknown_shape;
+  }
+
+  Dim *extents = (Dim *)arena_alloc(c->arena, sizeof(Dim) * count);
+  bool *proven = (bool *)arena_alloc(c->arena, sizeof(bool) * count);
+  assert(extents != NULL && proven != NULL);
+
+  for (int i = 0; i < count; i++) {
+    extents[i] = c->dim_pool[shape.dims + i];
+    proven[i] = check_subscript(c, indices[i], extents[i], i, name);
+  }
+
+  node->data.index_expression.extents = extents;
+  node->data.index_expression.proven = proven;
+  Shape element = {0, 0, shape.dtype};
+  return element;
+}
+
+static Shape infer(ShapeChecker *c, ASTNode *node) {
+  if (node == NULL)
+    return unknown_shape;
+
+  switch (node->nodeType) {
+  case NODE_INT_LITERAL:
+  case NODE_FLOAT_LITERAL:
+    return scalar_shape;
+  case NODE_IDENTIFIER: {
+    // Unbound names are dim symbols used as values, e.g. `range(0, M)`.
+    Binding *binding = lookup(c, node->data.identifier.name);
+    return binding != NULL ? binding->shape : scalar_shape;
+  }
+  case NODE_BINARY_EXPR: {
+    Shape left = infer(c, node->data.binary_op.left);
+    Shape right = infer(c, node->data.binary_op.right);
+    if (left.rank < 0 || right.rank < 0)
+      return unknown_shape;
+    if (left.rank == 0)
+      return right;
+    if (right.rank == 0)
+      return left;
+    check_compatible(c, left, right, node->line, "elementwise operands");
+    return left;
+  }
+  case NODE_UNARY_EXPR:
+    return infer(c, node->data.unary_op.operand);
+  case NODE_INDEX_EXPR:
+    return infer_index(c, node);
+  case NODE_FUNC_CALL:
+    for (int i = 0; i < node->data.func_call.arg_count; i++)
+      infer(c, node->data.func_call.args[i]);
+    return unknown_shape;
+  default:
+    return unknown_shape;
+  }
+}
+
+// Range of a loop over `range(hi)` or `range(lo, hi)` with affine ends.
+static void loop_range(ShapeChecker *c, ASTNode *iterable, Binding *loop) {
+  if (iterable == NULL || iterable->nodeType != NODE_FUNC_CALL ||
+      iterable->data.func_call.func_name != c->range)
+    return;
+
+  int count = iterable->data.func_call.arg_count;
+  ASTNode **args = iterable->data.func_call.args;
+  loop->lower = linear_constant(0);
+  loop->bounded = (count == 1 || count == 2) &&
+                  (count == 1 || to_linear(c, args[0], &loop->lower)) &&
+                  to_linear(c, args[count - 1], &loop->upper);
+}
+
+static void add_fact(ShapeChecker *c, const Linear *fact) {
+  c->facts = (Linear *)grow(c->facts, &c->fact_capacity, c->fact_count + 1,
+                            sizeof(Linear));
+  c->facts[c->fact_count++] = *fact;
+}
+
+// Records what `condition` says when it is true, or when it is false if
+// `holds` is not set, as far as that is a conjunction of affine
+// comparisons.
+static void add_facts(ShapeChecker *c, ASTNode *condition, bool holds) {
+  if (condition == NULL)
+    return;
+  if (condition->nodeType == NODE_UNARY_EXPR &&
+      condition->data.unary_op.op == BANG) {
+    add_facts(c, condition->data.unary_op.operand, !holds);
+    return;
+  }
+  if (condition->nodeType != NODE_BINARY_EXPR)
+    return;
+
+  ASTNode *left = condition->data.binary_op.left;
+  ASTNode *right = condition->data.binary_op.right;
+  TokenType op = condition->data.binary_op.op;
+  if ((op == AND && holds) || (op == OR && !holds)) {
+    add_facts(c, left, holds);
+    add_facts(c, right, holds);
+    return;
+  }
+
+  // Each comparison is put as `left - right + bias >= 0`, times `sign`.
+  Linear a, b, fact;
+  if (!to_linear(c, left, &a) || !to_linear(c, right, &b))
+    return;
+  long sign = 1, bias = 0;
+  bool both = false;
+  switch (op) {
+  case GREATER:
+    bias = holds ? -1 : 0;
+    sign = holds ? 1 : -1;
+    break;
+  case GREATER_EQUAL:
+    bias = holds ? 0 : -1;
+    sign = holds ? 1 : -1;
+    break;
+  case LESS:
+    bias = holds ? -1 : 0;
+    sign = holds ? -1 : 1;
+    break;
+  case LESS_EQUAL:
+    bias = holds ? 0 : -1;
+    sign = holds ? -1 : 1;
+    break;
+  case EQUAL_EQUAL:
+  case BANG_EQUAL:
+    if (holds != (op == EQUAL_EQUAL))
+      return;
+    both = true;
+    break;
+  default:
+    return;
+  }
+  fact = linear_constant(bias);
+  if (!linear_add(&fact, &a, sign) || !linear_add(&fact, &b, -sign))
+    return;
+  add_fact(c, &fact);
+  if (both) {
+    fact = linear_constant(0);
+    if (linear_add(&fact, &a, -1) && linear_add(&fact, &b, 1))
+      add_fact(c, &fact);
+  }
+}
+
+static void check_stmt(ShapeChecker *c, ASTNode *node, Shape return_shape);
+
+static void check_block(ShapeChecker *c, ASTNode *block, Shape return_shape) {
+  if (block == NULL)
+    return;
+  if (block->nodeType != NODE_BLOCK) {
+    check_stmt(c, block, return_shape);
+    return;
+  }
+
+  int mark = c->binding_count;
+  for (int i = 0; i < block->data.block.count_statements; i++)
+    check_stmt(c, block->data.block.statements[i], return_shape);
+  c->binding_count = mark;
+}
+
+// Checks one branch of an if, knowing whether its condition held.
+static void check_branch(ShapeChecker *c, ASTNode *condition, bool holds,
+                         ASTNode *block, Shape return_shape) {
+  int mark = c->fact_count;
+  add_facts(c, condition, holds);
+  c->guards++;
+  check_block(c, block, return_shape);
+  c->guards--;
+  c->fact_count = mark;
+}
+
+static void check_stmt(ShapeChecker *c, ASTNode *node, Shape return_shape) {
+  if (node == NULL)
+    return;
+
+  switch (node->nodeType) {
+  case NODE_VAR_DECL: {
+    Shape declared = shape_of_type(c, node->data.var_decl.type);
+    if (node->data.var_decl.initializer != NULL) {
+      Shape value = infer(c, node->data.var_decl.initializer);
+      check_compatible(c, declared, value, node->line, "initializer");
+    }
+    bind(c, node->data.var_decl.name, declared);
+    break;
+  }
+  case NODE_ASSIGNMENT: {
+    Shape target = infer(c, node->data.assignment.target);
+    Shape value = infer(c, node->data.assignment.value);
+    if (target.rank == 0 && value.rank > 0) {
+      char got[128];
+      shape_error(c, node->line, "cannot assign %s to a scalar",
+                  format_shape(c, value, got, sizeof(got)));
+    } else {
+      check_compatible(c, target, value, node->line, "assignment");
+    }
+    break;
+  }
+  case NODE_FOR: {
+    ASTNode *variable = node->data.for_loop.variable;
+    infer(c, node->data.for_loop.iterable);
+
+    // The range is read before the variable is bound, in the enclosing scope.
+    Binding loop;
+    memset(&loop, 0, sizeof(loop));
+    loop_range(c, node->data.for_loop.iterable, &loop);
+    int mark = c->binding_count;
+    if (variable != NULL && variable->nodeType == NODE_IDENTIFIER) {
+      Binding *binding = bind(c, variable->data.identifier.name, scalar_shape);
+      binding->loop = true;
+      binding->bounded = loop.bounded;
+      binding->lower = loop.lower;
+      binding->upper = loop.upper;
+    }
+    check_block(c, node->data.for_loop.body, return_shape);
+    c->binding_count = mark;
+    break;
+  }
+  case NODE_IF:
+    infer(c, node->data.if_else.condition);
+    check_branch(c, node->data.if_else.condition, true,
+                 node->data.if_else.then, return_shape);
+    check_branch(c, node->data.if_else.condition, false,
+                 node->data.if_else.else_block, return_shape);
+    break;
+  case NODE_RETURN: {
+    Shape value = infer(c, node->data.return_value.return_val);
+    if (return_shape.rank < 0 || value.rank < 0)
+      break;
+
+    char want[128], got[128];
+    if (return_shape.rank != value.rank ||
+        (return_shape.dtype != NULL && value.dtype != NULL &&
+         return_shape.dtype != value.dtype)) {
+      shape_error(c, node->line, "returns %s but declares %s",
+                  format_shape(c, value, got, sizeof(got)),
+                  format_shape(c, return_shape, want, sizeof(want)));
+    } else {
+      check_compatible(c, return_shape, value, node->line, "return value");
+    }
+    break;
+  }
+  case NODE_BLOCK:
+    check_block(c, node, return_shape);
+    break;
+  default:
+    infer(c, node);
+    break;
+  }
+}
+
+static void check_function(ShapeChecker *c, ASTNode *function) {
+  c->function = function->data.function_decl.name;
+  c->dim_count = 0;
+  c->binding_count = 0;
+  c->fact_count = 0;
+  c->guards = 0;
+
+  for (int i = 0; i < function->data.function_decl.count_params; i++) {
+    ASTNode *param = function->data.function_decl.params[i];
+    if (param == NULL || param->nodeType != NODE_VAR_DECL)
+      continue;
+    bind(c, param->data.var_decl.name,
+         shape_of_type(c, param->data.var_decl.type));
+  }
+
+  Shape return_shape =
+      shape_of_type(c, function->data.function_decl.return_type);
+  check_block(c, function->data.function_decl.body, return_shape);
+}
+
+int check_shapes(Arena *arena, ASTNode *program) {
+  if (program == NULL || program->nodeType != NODE_PROGRAM)
+    return 0;
+
+  ShapeChecker c;
+  memset(&c, 0, sizeof(c));
+  c.arena = arena;
+  c.range = intern_cstring("range");
+
+  for (int i = 0; i < program->data.program.function_count; i++) {
+    ASTNode *function = program->data.program.functions[i];
+    if (function != NULL && function->nodeType == NODE_FUNC_DEF)
+      check_function(&c, function);
+  }
+
+  free(c.dim_pool);
+  free(c.bindings);
+  free(c.facts);
+  return c.errors;
+}
@@ -0,0 +1,30 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include "arena.h"
+#include "ast.h"
+
+// Static shape checking for tensor code. Dims named in tensor types (`M` in
+// `tensor<MxKxf32>`) are treated as fixed per function and shared by name
+// across parameters, locals and the return type. Ranks of indexing,
+// assignments and returns are checked against the declarations.
+//
+// Loop variables range over [lo, hi) of their `range(lo, hi)`, narrowed by
+// the affine comparisons of enclosing if conditions, such as `i > 0`. A
+// subscript that is affine in loop variables and dims, such as
+// `A[2 * i + 1]`, must provably lie within the dimension it indexes for
+// every value of the dims; otherwise it is rejected, unless it is under an
+// if, whose condition may keep it in bounds in ways the pass cannot follow.
+// Such subscripts, and ones that are not affine, such as ones read from a
+// tensor, are left to be checked at run time.
+//
+// Each index expression is annotated with the extent of every dimension it
+// indexes and with whether each subscript was proven in bounds
+// (index_expression.extents and .proven, allocated from `arena`), so later
+// stages know buffer sizes and which subscripts to check at run time.
+//
+// Problems are reported to stderr as "Shape error at line N: ..." and the
+// number of errors is returned.
+int check_shapes(Arena *arena, ASTNode *program);
+
+#endif // !SHAPE_H
@@ -0,0 +1,108 @@
+#include "tensor.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+  const char *name;
+  size_t size;
+} dtypes[TENSOR_DTYPE_COUNT] = {
+    [TENSOR_F32] = {"f32", sizeof(float)},
+};
+
+size_t tensor_dtype_size(TensorDType dtype) { return dtypes[dtype].size; }
+
+const char *tensor_dtype_name(TensorDType dtype) {
+  return dtypes[dtype].name;
+}
+
+bool tensor_parse_dtype(const char *name, TensorDType *dtype) {
+  for (int i = 0; i < TENSOR_DTYPE_COUNT; i++) {
+    if (strcmp(name, dtypes[i].name) == 0) {
+      *dtype = (TensorDType)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void row_major(Tensor *tensor) {
+  long stride = 1;
+  for (int d = tensor->rank - 1; d >= 0; d--) {
+    tensor->strides[d] = stride;
+    stride *= tensor->shape[d];
+  }
+}
+
+bool tensor_alloc(Tensor *tensor, TensorDType dtype, int rank,
+                  const long *shape) {
+  memset(tensor, 0, sizeof(Tensor));
+  if (rank < 0 || rank > TENSOR_MAX_RANK)
+    return false;
+
+  size_t size = tensor_dtype_size(dtype);
+  for (int d = 0; d < rank; d++) {
+    if (shape[d] < 0 ||
+        (shape[d] > 0 && size > SIZE_MAX / TENSOR_ALIGNMENT / shape[d]))
+      return false;
+    size *= shape[d];
+  }
+
+  // aligned_alloc wants a multiple of the alignment, and some
+  // implementations return NULL for zero bytes.
+  size_t bytes = (size + TENSOR_ALIGNMENT - 1) / TENSOR_ALIGNMENT *
+                 TENSOR_ALIGNMENT;
+  void *data = aligned_alloc(TENSOR_ALIGNMENT,
+                             bytes > 0 ? bytes : TENSOR_ALIGNMENT);
+  if (data == NULL)
+    return false;
+  memset(data, 0, bytes);
+
+  tensor->data = data;
+  tensor->dtype = dtype;
+  tensor->rank = rank;
+  if (rank > 0)
+    memcpy(tensor->shape, shape, sizeof(long) * rank);
+  row_major(tensor);
+  tensor->owned = true;
+  return true;
+}
+
+void tensor_wrap(Tensor *tensor, TensorDType dtype, void *data, int rank,
+                 const long *shape, const long *strides) {
+  memset(tensor, 0, sizeof(Tensor));
+  tensor->data = data;
+  tensor->dtype = dtype;
+  tensor->rank = rank;
+  if (rank == 0)
+    return;
+  memcpy(tensor->shape, shape, sizeof(long) * rank);
+  if (strides != NULL)
+    memcpy(tensor->strides, strides, sizeof(long) * rank);
+  else
+    row_major(tensor);
+}
+
+void tensor_release(Tensor *tensor) {
+  if (tensor->owned)
+    free(tensor->data);
+  tensor->data = NULL;
+  tensor->owned = false;
+}
+
+long tensor_element_count(const Tensor *tensor) {
+  long count = 1;
+  for (int d = 0; d < tensor->rank; d++)
+    count *= tensor->shape[d];
+  return count;
+}
+
+bool tensor_is_contiguous(const Tensor *tensor) {
+  long stride = 1;
+  for (int d = tensor->rank - 1; d >= 0; d--) {
+    if (tensor->shape[d] != 1 && tensor->strides[d] != stride)
+      return false;
+    stride *= tensor->shape[d];
+  }
+  return true;
+}
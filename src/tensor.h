@@ -0,0 +1,51 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runtime tensors: a typed, strided view of memory. Tensors allocated here
+// are zeroed, row-major and start on a TENSOR_ALIGNMENT boundary, so the
+// first element of every row of a tensor whose rows are a multiple of 16
+// floats sits at the start of a cache line and of an AVX-512 vector.
+
+#define TENSOR_MAX_RANK 6
+#define TENSOR_ALIGNMENT 64
+
+// Programs compute in f32 only, so that is the only dtype there is.
+typedef enum TensorDType {
+  TENSOR_F32,
+  TENSOR_DTYPE_COUNT,
+} TensorDType;
+
+typedef struct Tensor {
+  void *data;
+  TensorDType dtype;
+  int rank; // 0 for a scalar, which holds one element.
+  long shape[TENSOR_MAX_RANK];
+  long strides[TENSOR_MAX_RANK]; // In elements, not bytes.
+  bool owned; // Allocated by tensor_alloc; release with tensor_release.
+} Tensor;
+
+size_t tensor_dtype_size(TensorDType dtype);
+const char *tensor_dtype_name(TensorDType dtype);
+// Parses a dtype name as written in a tensor type, such as "f32".
+bool tensor_parse_dtype(const char *name, TensorDType *dtype);
+
+// Allocates a zeroed, row-major tensor. Returns false, leaving `tensor`
+// empty, when the rank is too large, an extent is negative or memory runs
+// out.
+bool tensor_alloc(Tensor *tensor, TensorDType dtype, int rank,
+                  const long *shape);
+
+// Describes memory owned by someone else; NULL `strides` means row-major.
+void tensor_wrap(Tensor *tensor, TensorDType dtype, void *data, int rank,
+                 const long *shape, const long *strides);
+
+void tensor_release(Tensor *tensor);
+
+long tensor_element_count(const Tensor *tensor);
+// Row-major with no gaps, as the generated code expects.
+bool tensor_is_contiguous(const Tensor *tensor);
+
+#endif // !TENSOR_H
@@ -0,0 +1,232 @@
+#include "thread_pool.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+// Worker id of the calling thread, for bodies run inline by a nested call.
+static _Thread_local int current_worker = 0;
+
+static long chunk_size(const ThreadPool *pool, long left) {
+  if (pool->grain > 0)
+    return pool->grain < left ? pool->grain : left;
+  return left >= 8 ? left / 4 : left < 2 ? left : 2;
+}
+
+// Takes the next chunk from the front of the worker's own share.
+static bool take_chunk(ThreadPool *pool, int worker, long *begin, long *end) {
+  ThreadPoolSlot *slot = &pool->slots[worker];
+  pthread_mutex_lock(&slot->mutex);
+  long left = slot->end - slot->begin;
+  bool found = left > 0;
+  if (found) {
+    *begin = slot->begin;
+    *end = slot->begin + chunk_size(pool, left);
+    slot->begin = *end;
+  }
+  pthread_mutex_unlock(&slot->mutex);
+  return found;
+}
+
+// Moves the back half of the first non-empty share after the worker's own
+// into it. The owner keeps working from the front undisturbed.
+static bool steal_share(ThreadPool *pool, int worker) {
+  int workers = pool->thread_count + 1;
+  for (int i = 1; i < workers; i++) {
+    ThreadPoolSlot *victim = &pool->slots[(worker + i) % workers];
+    pthread_mutex_lock(&victim->mutex);
+    long left = victim->end - victim->begin;
+    long begin = victim->end - (left + 1) / 2;
+    long end = victim->end;
+    if (left > 0)
+      victim->end = begin;
+    pthread_mutex_unlock(&victim->mutex);
+    if (left <= 0)
+      continue;
+
+    ThreadPoolSlot *slot = &pool->slots[worker];
+    pthread_mutex_lock(&slot->mutex);
+    slot->begin = begin;
+    slot->end = end;
+    pthread_mutex_unlock(&slot->mutex);
+    return true;
+  }
+  return false;
+}
+
+// Runs chunks until no share has work left. Chunks shrink as a share
+// drains, so the last ones are small enough to balance across threads.
+static void run_tasks(ThreadPool *pool, int worker) {
+  long begin, end;
+  while (take_chunk(pool, worker, &begin, &end) ||
+         (steal_share(pool, worker) &&
+          take_chunk(pool, worker, &begin, &end)))
+    pool->body(pool->context, begin, end, worker);
+}
+
+typedef struct WorkerStart {
+  ThreadPool *pool;
+  int worker;
+} WorkerStart;
+
+static void *worker_main(void *arg) {
+  WorkerStart start = *(WorkerStart *)arg;
+  free(arg);
+  ThreadPool *pool = start.pool;
+  unsigned long seen = 0;
+  current_worker = start.worker;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (!pool->shutting_down && pool->generation == seen)
+      pthread_cond_wait(&pool->work_ready, &pool->mutex);
+    if (pool->shutting_down)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool, start.worker);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->active == 0)
+      pthread_cond_signal(&pool->work_done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+ThreadPool *init_thread_pool(int worker_count) {
+  if (worker_count <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cpus > 0 ? (int)cpus : 1;
+  }
+
+  ThreadPool *pool = (ThreadPool *)malloc(sizeof(ThreadPool));
+  if (pool == NULL)
+    return NULL;
+
+  // The caller is worker 0; only the remaining workers get their own thread.
+  pool->thread_count = worker_count - 1;
+  pool->threads = NULL;
+  pool->generation = 0;
+  pool->active = 0;
+  pool->shutting_down = false;
+  pool->body = NULL;
+  pool->context = NULL;
+  pool->grain = 0;
+  atomic_init(&pool->busy, false);
+
+  pool->slots = (ThreadPoolSlot *)aligned_alloc(
+      _Alignof(ThreadPoolSlot), sizeof(ThreadPoolSlot) * worker_count);
+  if (pool->slots == NULL) {
+    free(pool);
+    return NULL;
+  }
+  if (pool->thread_count > 0) {
+    pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * pool->thread_count);
+    if (pool->threads == NULL) {
+      free(pool->slots);
+      free(pool);
+      return NULL;
+    }
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_ready, NULL);
+  pthread_cond_init(&pool->work_done, NULL);
+  for (int i = 0; i < worker_count; i++) {
+    pthread_mutex_init(&pool->slots[i].mutex, NULL);
+    pool->slots[i].begin = pool->slots[i].end = 0;
+  }
+
+  for (int i = 0; i < pool->thread_count; i++) {
+    WorkerStart *start = (WorkerStart *)malloc(sizeof(WorkerStart));
+    if (start != NULL) {
+      start->pool = pool;
+      start->worker = i + 1;
+    }
+    if (start == NULL ||
+        pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+      free(start);
+      pool->thread_count = i;
+      break;
+    }
+  }
+
+  return pool;
+}
+
+void free_thread_pool(ThreadPool *pool) {
+  if (pool == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutting_down = true;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (int i = 0; i < pool->thread_count; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->work_ready);
+  pthread_cond_destroy(&pool->work_done);
+  for (int i = 0; i <= pool->thread_count; i++)
+    pthread_mutex_destroy(&pool->slots[i].mutex);
+  free(pool->slots);
+  free(pool->threads);
+  free(pool);
+}
+
+int thread_pool_size(ThreadPool *pool) {
+  return pool != NULL ? pool->thread_count + 1 : 1;
+}
+
+typedef struct TaskJob {
+  ThreadPoolTask task;
+  void *context;
+} TaskJob;
+
+static void run_task_range(void *context, long begin, long end, int worker) {
+  const TaskJob *job = (const TaskJob *)context;
+  for (long i = begin; i < end; i++)
+    job->task(job->context, (int)i, worker);
+}
+
+// Tasks are handed out one at a time, so uneven tasks balance across threads.
+void thread_pool_run(ThreadPool *pool, int task_count, ThreadPoolTask task,
+                     void *context) {
+  TaskJob job = {task, context};
+  thread_pool_for(pool, task_count, 1, run_task_range, &job);
+}
+
+void thread_pool_for(ThreadPool *pool, long count, long grain,
+                     ThreadPoolRange body, void *context) {
+  if (count <= 0)
+    return;
+
+  if (pool == NULL || pool->thread_count == 0 || count == 1 ||
+      atomic_exchange(&pool->busy, true)) {
+    body(context, 0, count, current_worker);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->body = body;
+  pool->context = context;
+  pool->grain = grain;
+  int workers = pool->thread_count + 1;
+  for (int i = 0; i < workers; i++) {
+    pool->slots[i].begin = count * i / workers;
+    pool->slots[i].end = count * (i + 1) / workers;
+  }
+  pool->active = pool->thread_count;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_ready);
+  pthread_mutex_unlock(&pool->mutex);
+
+  run_tasks(pool, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->active > 0)
+    pthread_cond_wait(&pool->work_done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+  atomic_store(&pool->busy, false);
+}
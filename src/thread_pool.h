@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Runs `task(context, index, worker)` for every index in [0, task_count).
+// `worker` identifies the executing thread in [0, thread_pool_size(pool)), so
+// tasks can keep per-thread state such as an arena.
+typedef void (*ThreadPoolTask)(void *context, int index, int worker);
+
+// Runs `body(context, begin, end, worker)` for disjoint ranges that together
+// cover [0, count) once.
+typedef void (*ThreadPoolRange)(void *context, long begin, long end,
+                                int worker);
+
+// The part of the current job a worker still owns. Slots sit on separate
+// cache lines, since every chunk taken or stolen writes one.
+typedef struct ThreadPoolSlot {
+  _Alignas(64) pthread_mutex_t mutex;
+  long begin;
+  long end;
+} ThreadPoolSlot;
+
+typedef struct ThreadPool {
+  pthread_t *threads;
+  int thread_count;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+  unsigned long generation;
+  int active;
+  bool shutting_down;
+
+  ThreadPoolRange body;
+  void *context;
+  long grain;
+  ThreadPoolSlot *slots; // One per worker, the caller's first.
+  atomic_bool busy;      // A job is running.
+} ThreadPool;
+
+// Starts `worker_count` threads, or one per online CPU when it is <= 0. The
+// calling thread also executes tasks during thread_pool_run, so a pool of
+// size one runs everything inline.
+ThreadPool *init_thread_pool(int worker_count);
+void free_thread_pool(ThreadPool *pool);
+int thread_pool_size(ThreadPool *pool);
+void thread_pool_run(ThreadPool *pool, int task_count, ThreadPoolTask task,
+                     void *context);
+
+// Work-stealing loop over [0, count). Every worker starts with an equal
+// contiguous share and runs it in chunks of at most `grain` iterations, or
+// with `grain` <= 0 a quarter of what it has left; a worker that runs out
+// steals the back half of another's share. A call made while the pool is
+// already busy, such as from inside a running body, runs inline on the
+// calling thread.
+void thread_pool_for(ThreadPool *pool, long count, long grain,
+                     ThreadPoolRange body, void *context);
+
+#endif // !THREAD_POOL_H
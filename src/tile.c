@@ -0,0 +1,153 @@
+#include "dependence.h"
+#include "intern.h"
+#include "transform.h"
+#include <assert.h>
+
+static IRBound add_bound_expr(IRBound bound, AffineExpr expr, bool *ok) {
+  for (int i = 0; i < bound.count; i++) {
+    if (affine_equal(&bound.exprs[i], &expr))
+      return bound;
+  }
+  if (bound.count == IR_MAX_BOUNDS) {
+    *ok = false;
+    return bound;
+  }
+  bound.exprs[bound.count++] = expr;
+  return bound;
+}
+
+static AffineExpr offset_symbol(int symbol, long offset) {
+  AffineExpr expr = affine_symbol(symbol);
+  expr.constant = offset;
+  return expr;
+}
+
+static int tile_symbol(IRFunction *fn, int var, int level) {
+  char name[256];
+  snprintf(name, sizeof(name), "%s_L%d", fn->symbols[var].name, level + 1);
+  return ir_add_symbol(fn, intern_cstring(name), IR_SYM_LOOP);
+}
+
+// Rewrites band[0..depth) into tile loops for each level, outermost level
+// first, around the original loops restricted to one innermost tile.
+static IRNode *tile_band(IRFunction *fn, IRNode **band, int depth,
+                         const TransformOptions *options) {
+  IRNode *loops[TILE_MAX_LEVELS * TILE_MAX_DEPTH + TILE_MAX_DEPTH];
+  int loop_count = 0;
+
+  // Per band loop: the enclosing tile variable and size so far, and the
+  // point loop's bounds.
+  int outer_var[TILE_MAX_DEPTH];
+  long outer_size[TILE_MAX_DEPTH];
+  IRBound upper[TILE_MAX_DEPTH];
+  for (int d = 0; d < depth; d++) {
+    outer_var[d] = -1;
+    outer_size[d] = 0;
+    upper[d] = band[d]->data.loop.upper;
+  }
+
+  for (int level = TILE_MAX_LEVELS - 1; level >= 0; level--) {
+    for (int d = 0; d < depth; d++) {
+      long size = options->tile_sizes[level][d];
+      if (size <= 1 || (outer_size[d] > 0 && size >= outer_size[d]))
+        continue;
+
+      const IRNode *point = band[d];
+      bool ok = true;
+      IRNode *tile = ir_new_node(fn->arena, IR_LOOP, point->line);
+      assert(tile != NULL);
+      tile->data.loop.var = fn->symbol_count;
+      tile->data.loop.step = size;
+      if (outer_var[d] < 0) {
+        tile->data.loop.lower = point->data.loop.lower;
+      } else {
+        tile->data.loop.lower = ir_bound(affine_symbol(outer_var[d]));
+      }
+      tile->data.loop.upper = upper[d];
+
+      // The point loop (and deeper tiles) end at the tile boundary. When the
+      // outer size is a multiple of this one, this tile never crosses the
+      // outer boundary, so that bound can be dropped.
+      IRBound inner = point->data.loop.upper;
+      inner = add_bound_expr(inner, offset_symbol(tile->data.loop.var, size),
+                             &ok);
+      for (int e = 0; e < upper[d].count && ok; e++) {
+        const AffineExpr *expr = &upper[d].exprs[e];
+        bool outer_end = outer_var[d] >= 0 &&
+                         affine_coeff(expr, outer_var[d]) == 1 &&
+                         expr->term_count == 1;
+        if (outer_end && outer_size[d] % size != 0)
+          inner = add_bound_expr(inner, *expr, &ok);
+      }
+      if (!ok)
+        continue;
+
+      // The new symbol takes the id reserved for it above.
+      tile_symbol(fn, point->data.loop.var, level);
+      loops[loop_count++] = tile;
+      outer_var[d] = tile->data.loop.var;
+      outer_size[d] = size;
+      upper[d] = inner;
+    }
+  }
+  if (loop_count == 0)
+    return NULL;
+
+  for (int d = 0; d < depth; d++) {
+    IRNode *point = band[d];
+    if (outer_var[d] >= 0) {
+      point->data.loop.lower = ir_bound(affine_symbol(outer_var[d]));
+      point->data.loop.upper = upper[d];
+    }
+    loops[loop_count++] = point;
+  }
+
+  // Chain the loops; the innermost point loop keeps its original body.
+  for (int i = 0; i + 1 < loop_count; i++)
+    loops[i]->data.loop.body = ir_list_copy(fn->arena, &loops[i + 1], 1);
+  return loops[0];
+}
+
+static int tile_list(IRFunction *fn, IRList *list,
+                     const TransformOptions *options) {
+  int tiled = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    if (node->kind == IR_IF) {
+      tiled += tile_list(fn, &node->data.if_else.then_body, options);
+      tiled += tile_list(fn, &node->data.if_else.else_body, options);
+      continue;
+    }
+    if (node->kind != IR_LOOP || node->data.loop.gemm != NULL)
+      continue;
+
+    IRNode *band[TILE_MAX_DEPTH];
+    int depth = find_loop_band(node, band, TILE_MAX_DEPTH);
+    if (depth < 2) {
+      tiled += tile_list(fn, &node->data.loop.body, options);
+      continue;
+    }
+    // Tiling needs the band fully permutable: no dependence may run
+    // backwards along any of its loops.
+    DependenceList deps = {NULL, 0, 0, false};
+    analyze_dependences(node, &deps);
+    while (depth >= 2 &&
+           (deps.has_return || !dependences_tileable(&deps, depth)))
+      depth--;
+    free_dependences(&deps);
+
+    IRNode *tiled_nest = depth >= 2 ? tile_band(fn, band, depth, options)
+                                    : NULL;
+    if (tiled_nest != NULL) {
+      list->items[i] = tiled_nest;
+      tiled++;
+    } else {
+      tiled += tile_list(fn, &node->data.loop.body, options);
+    }
+  }
+  return tiled;
+}
+
+int tile_function(IRFunction *fn, const TransformOptions *options) {
+  return tile_list(fn, &fn->body, options);
+}
@@ -0,0 +1,298 @@
+#include "transform.h"
+#include <assert.h>
+#include <stdlib.h>
+
+static bool parse_level(long sizes[TILE_MAX_DEPTH], const char *text,
+                        const char *end) {
+  int count = 0;
+  while (text < end) {
+    char *next;
+    long size = strtol(text, &next, 10);
+    if (next == text || size < 0 || count == TILE_MAX_DEPTH)
+      return false;
+    sizes[count++] = size;
+    text = next;
+    if (text < end && *text++ != 'x')
+      return false;
+  }
+  for (int i = count; i < TILE_MAX_DEPTH && count > 0; i++)
+    sizes[i] = sizes[count - 1];
+  return count > 0;
+}
+
+bool parse_tile_sizes(TransformOptions *options, const char *text) {
+  memset(options->tile_sizes, 0, sizeof(options->tile_sizes));
+  for (int level = 0; level < TILE_MAX_LEVELS; level++) {
+    const char *end = strchr(text, ',');
+    if (end == NULL)
+      end = text + strlen(text);
+    if (!parse_level(options->tile_sizes[level], text, end))
+      return false;
+    if (*end == '\0')
+      return true;
+    text = end + 1;
+  }
+  return false;
+}
+
+bool parse_vector_width(TransformOptions *options, const char *text) {
+  static const struct {
+    const char *name;
+    int width;
+  } names[] = {
+      {"sse", 4}, {"avx2", 8}, {"avx512", 16}, {"4", 4}, {"8", 8}, {"16", 16},
+  };
+
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(text, names[i].name) == 0) {
+      options->vector_width = names[i].width;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void append(char *buffer, size_t size, size_t *length,
+                   const char *format, long value) {
+  if (*length < size)
+    *length += snprintf(buffer + *length, size - *length, format, value);
+}
+
+void describe_transforms(const TransformOptions *options, char *buffer,
+                         size_t size) {
+  size_t length = 0;
+  buffer[0] = '\0';
+  if (options->gemm)
+    append(buffer, size, &length, "gemm;", 0);
+  if (options->fuse)
+    append(buffer, size, &length, "fuse;", 0);
+  if (options->interchange)
+    append(buffer, size, &length, "interchange;", 0);
+
+  int levels = 0;
+  for (int level = 0; level < TILE_MAX_LEVELS; level++) {
+    for (int d = 0; d < TILE_MAX_DEPTH; d++) {
+      if (options->tile_sizes[level][d] != 0)
+        levels = level + 1;
+    }
+  }
+  for (int level = 0; level < levels; level++) {
+    const long *sizes = options->tile_sizes[level];
+    int count = TILE_MAX_DEPTH;
+    while (count > 1 && sizes[count - 1] == sizes[count - 2])
+      count--;
+    append(buffer, size, &length, level == 0 ? "tile=" : ",", 0);
+    for (int d = 0; d < count; d++)
+      append(buffer, size, &length, d == 0 ? "%ld" : "x%ld", sizes[d]);
+  }
+  if (levels > 0)
+    append(buffer, size, &length, ";", 0);
+  if (options->promote)
+    append(buffer, size, &length, "promote;", 0);
+  if (options->parallel)
+    append(buffer, size, &length, "parallel;", 0);
+  if (options->vector_width > 0) {
+    append(buffer, size, &length, "vector=%ld;",
+           (long)options->vector_width);
+  }
+}
+
+static void add_access(LoopAccessList *list, const IRAccess *access,
+                       bool write) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+    list->items = (LoopAccess *)realloc(list->items,
+                                        sizeof(LoopAccess) * list->capacity);
+    assert(list->items != NULL);
+  }
+  list->items[list->count].access = access;
+  list->items[list->count].write = write;
+  list->count++;
+}
+
+static void collect_expr(LoopAccessList *list, const IRExpr *expr) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    add_access(list, &expr->data.load, false);
+    for (int i = 0; i < expr->data.load.count; i++)
+      collect_expr(list, expr->data.load.indices[i].general);
+    break;
+  case IR_EXPR_BINARY:
+    collect_expr(list, expr->data.binary.left);
+    collect_expr(list, expr->data.binary.right);
+    break;
+  case IR_EXPR_UNARY:
+    collect_expr(list, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      collect_expr(list, expr->data.call.args[i]);
+    break;
+  default:
+    break;
+  }
+}
+
+void collect_loop_accesses(LoopAccessList *list, const IRList *nodes) {
+  for (int i = 0; i < nodes->count; i++) {
+    const IRNode *node = nodes->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      collect_loop_accesses(list, &node->data.loop.body);
+      break;
+    case IR_STMT: {
+      const IRAccess *target = &node->data.stmt.target;
+      collect_expr(list, node->data.stmt.value);
+      if (target->tensor >= 0) {
+        add_access(list, target, true);
+        for (int d = 0; d < target->count; d++)
+          collect_expr(list, target->indices[d].general);
+      }
+      break;
+    }
+    case IR_IF:
+      collect_expr(list, node->data.if_else.condition);
+      collect_loop_accesses(list, &node->data.if_else.then_body);
+      collect_loop_accesses(list, &node->data.if_else.else_body);
+      break;
+    case IR_RETURN:
+      list->has_return = true;
+      break;
+    }
+  }
+}
+
+void free_loop_accesses(LoopAccessList *list) {
+  free(list->items);
+  list->items = NULL;
+  list->count = list->capacity = 0;
+}
+
+static bool uses_symbols(const IRBound *bound, const int *symbols,
+                         int count) {
+  for (int e = 0; e < bound->count; e++) {
+    for (int i = 0; i < count; i++) {
+      if (affine_coeff(&bound->exprs[e], symbols[i]) != 0)
+        return true;
+    }
+  }
+  return false;
+}
+
+int find_loop_band(IRNode *loop, IRNode **band, int max_depth) {
+  int depth = 0;
+  int vars[TILE_MAX_DEPTH];
+  if (max_depth > TILE_MAX_DEPTH)
+    max_depth = TILE_MAX_DEPTH;
+  while (depth < max_depth && loop->data.loop.step == 1 &&
+         loop->data.loop.gemm == NULL &&
+         !uses_symbols(&loop->data.loop.lower, vars, depth) &&
+         !uses_symbols(&loop->data.loop.upper, vars, depth)) {
+    band[depth] = loop;
+    vars[depth++] = loop->data.loop.var;
+    IRList *body = &loop->data.loop.body;
+    if (body->count != 1 || body->items[0]->kind != IR_LOOP)
+      break;
+    loop = body->items[0];
+  }
+  return depth;
+}
+
+static bool stmt_reads(const IRNode *stmt, int tensor) {
+  const IRAccess *target = &stmt->data.stmt.target;
+  if (ir_expr_reads_tensor(stmt->data.stmt.value, tensor))
+    return true;
+  for (int d = 0; d < target->count; d++) {
+    if (ir_expr_reads_tensor(target->indices[d].general, tensor))
+      return true;
+  }
+  return false;
+}
+
+bool written_before_read(const IRList *list, int tensor, bool *written) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP: {
+      bool inner = *written;
+      if (!written_before_read(&node->data.loop.body, tensor, &inner))
+        return false;
+      break;
+    }
+    case IR_STMT:
+      if (!*written && stmt_reads(node, tensor))
+        return false;
+      if (node->data.stmt.target.tensor == tensor)
+        *written = true;
+      break;
+    case IR_IF: {
+      if (!*written &&
+          ir_expr_reads_tensor(node->data.if_else.condition, tensor))
+        return false;
+      bool then_written = *written, else_written = *written;
+      if (!written_before_read(&node->data.if_else.then_body, tensor,
+                               &then_written) ||
+          !written_before_read(&node->data.if_else.else_body, tensor,
+                               &else_written))
+        return false;
+      *written = then_written && else_written;
+      break;
+    }
+    case IR_RETURN:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool used_outside(const IRList *list, const IRNode *skip, int tensor) {
+  for (int i = 0; i < list->count; i++) {
+    const IRNode *node = list->items[i];
+    if (node == skip)
+      continue;
+    switch (node->kind) {
+    case IR_LOOP:
+      if (used_outside(&node->data.loop.body, skip, tensor))
+        return true;
+      break;
+    case IR_STMT:
+      if (node->data.stmt.target.tensor == tensor || stmt_reads(node, tensor))
+        return true;
+      break;
+    case IR_IF:
+      if (ir_expr_reads_tensor(node->data.if_else.condition, tensor) ||
+          used_outside(&node->data.if_else.then_body, skip, tensor) ||
+          used_outside(&node->data.if_else.else_body, skip, tensor))
+        return true;
+      break;
+    case IR_RETURN:
+      if (node->data.ret.tensor == tensor ||
+          ir_expr_reads_tensor(node->data.ret.value, tensor))
+        return true;
+      break;
+    }
+  }
+  return false;
+}
+
+void transform_module(IRModule *module, const TransformOptions *options) {
+  for (int i = 0; i < module->function_count; i++) {
+    IRFunction *fn = module->functions[i];
+    if (options->gemm)
+      gemm_function(fn);
+    if (options->fuse)
+      fuse_function(fn);
+    if (options->interchange)
+      interchange_function(fn);
+    tile_function(fn, options);
+    if (options->promote)
+      promote_function(fn);
+    if (options->parallel)
+      parallelize_function(fn);
+    if (options->vector_width > 0)
+      vectorize_function(fn, options->vector_width);
+  }
+}
@@ -0,0 +1,149 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "loop_ir.h"
+
+// Loop transformations over the loop-nest IR. Each pass rewrites a verified
+// function in place, allocating from the function's arena, and leaves it
+// verified; a nest the pass cannot prove safe to rewrite is left as it was.
+
+// Tiling levels, innermost first: L1, L2, L3.
+#define TILE_MAX_LEVELS 3
+// Deepest band of perfectly nested loops that is considered for tiling.
+#define TILE_MAX_DEPTH 8
+
+typedef struct TransformOptions {
+  // Hand matrix-multiply nests to the back end's GEMM routine.
+  bool gemm;
+
+  // Merge adjacent loops with the same bounds and turn intermediates used
+  // within one iteration into scalars.
+  bool fuse;
+
+  // Reorder loop nests so the innermost loop walks memory with unit stride.
+  bool interchange;
+
+  // Tile sizes by cache level and by position in the band, outermost loop
+  // first. 0 leaves that loop untiled at that level; a level with no sizes
+  // is skipped.
+  long tile_sizes[TILE_MAX_LEVELS][TILE_MAX_DEPTH];
+
+  // Keep accumulators such as `C[i, j]` in a reduction loop in registers.
+  bool promote;
+
+  // Run loops whose iterations are independent on several threads.
+  bool parallel;
+
+  // f32 lanes per vector for innermost loops: 4 (SSE), 8 (AVX2) or 16
+  // (AVX-512). 0 leaves loops scalar.
+  int vector_width;
+} TransformOptions;
+
+// Parses "32,256" (L1 then L2, every loop the same size) or "64x64x16,256"
+// (per-loop sizes, the last one repeating for deeper loops) into `options`.
+bool parse_tile_sizes(TransformOptions *options, const char *text);
+
+// Parses "sse", "avx2", "avx512" or a lane count of 4, 8 or 16.
+bool parse_vector_width(TransformOptions *options, const char *text);
+
+// Canonical description of the enabled passes, each ended by ';', e.g.
+// "gemm;tile=32,256;promote;". Equal options give equal strings; the
+// JIT hashes it into its cache key.
+void describe_transforms(const TransformOptions *options, char *buffer,
+                         size_t size);
+
+// Runs the enabled passes over every function of the module.
+void transform_module(IRModule *module, const TransformOptions *options);
+
+// Recognises nests of exactly three loops over [0, extent) around a single
+// `C[m, n] = C[m, n] + A[m, k] * B[k, n]`, in any loop order, with either
+// operand transposed, `-` for `+` or the factors swapped, and marks the
+// outermost loop with the equivalent IRGemm. C must differ from A and B.
+// The later passes leave marked nests alone. Returns the number marked.
+int gemm_function(IRFunction *fn);
+
+// Merges each pair of adjacent loops with the same bounds and step into one,
+// running the second body after the first in every iteration, as long as no
+// element that the first loop touches in some iteration is touched by the
+// second in an earlier one with either access a store. Loops whose bodies
+// then sit side by side are fused in turn. Afterwards, a local tensor
+// accessed only inside one loop, always at the same affine subscript and
+// written before it is read in every iteration, becomes a scalar local.
+// Returns the number of loops fused away.
+int fuse_function(IRFunction *fn);
+
+// Permutes each band of perfectly nested, rectangular loops so that the
+// loops with the largest memory strides are outermost and the innermost loop
+// walks as many accesses as possible with unit stride, as far as the
+// dependences allow. Returns the number of bands reordered.
+int interchange_function(IRFunction *fn);
+
+// Tiles every band of at least two perfectly nested, rectangular loops whose
+// dependences allow any order. Each tiled loop `i` becomes a loop per level
+// stepping by the tile size (`i_L2`, `i_L1`) around a point loop over one
+// tile, with min bounds for partial tiles. Returns the number of bands tiled.
+int tile_function(IRFunction *fn, const TransformOptions *options);
+
+// Keeps each tensor element that a loop reads and writes at one fixed
+// subscript, such as `C[i, j]` in `for k { C[i, j] = C[i, j] + ... }`, in a
+// new scalar local for the whole loop, so it lives in a register instead of
+// being loaded and stored every iteration. The local is loaded before the
+// loop and stored back after it; no other access to the tensor may occur in
+// the loop. Returns the number of elements promoted.
+int promote_function(IRFunction *fn);
+
+// Marks the outermost loops whose iterations are independent, so the back
+// end may run them on several threads. Two accesses to the same tensor, one
+// of them a store, must never touch the same element from different
+// iterations; a scalar local written in the loop must be used nowhere else
+// and be written before it is read in each iteration, so every thread can
+// keep its own copy. Only loops around another loop are marked, since
+// innermost ones are too small to share out and are left to
+// vectorize_function; a GEMM nest is marked as a whole. Returns the number
+// of loops and nests marked.
+int parallelize_function(IRFunction *fn);
+
+// Marks innermost unit-step loops for the back end to run `width` iterations
+// at once. The body must be scalar statements whose tensor accesses either
+// do not move with the loop or walk the last dimension with unit stride,
+// using only +, -, *, min and max on values that vary; a statement of the
+// form `s = s + x` with an invariant `s` becomes a reduction. A tensor
+// written in the loop must be accessed at the same subscripts everywhere in
+// it. Returns the number of loops marked.
+int vectorize_function(IRFunction *fn, int width);
+
+// Helpers shared by the passes.
+
+typedef struct LoopAccess {
+  const IRAccess *access;
+  bool write;
+} LoopAccess;
+
+typedef struct LoopAccessList {
+  LoopAccess *items;
+  int count;
+  int capacity;
+  bool has_return; // A return statement was seen.
+} LoopAccessList;
+
+// Appends every tensor access under `nodes`, loads and stores alike.
+void collect_loop_accesses(LoopAccessList *list, const IRList *nodes);
+void free_loop_accesses(LoopAccessList *list);
+
+// Collects into `band` the perfectly nested loops from `loop` down, at most
+// `max_depth` of them, with unit steps and bounds that do not depend on other
+// loops of the band, stopping at a nest marked for GEMM. Returns how many
+// there are.
+int find_loop_band(IRNode *loop, IRNode **band, int max_depth);
+
+// Whether every read of `tensor` in `list` follows a write to it earlier in
+// the same iteration, all accesses taken to touch one element. `*written`
+// holds on entry whether one has happened and is updated past the list. A
+// nested loop may run no iterations, so writes inside it do not count after
+// it.
+bool written_before_read(const IRList *list, int tensor, bool *written);
+
+// Whether `tensor` is accessed anywhere under `list` outside `skip`.
+bool used_outside(const IRList *list, const IRNode *skip, int tensor);
+
+#endif // !TRANSFORM_H
@@ -1,4 +1,12 @@
 #include "utils.h"
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 char *read_ein_file(char *filename, long *out_length) {
   FILE *fp = fopen(filename, "rb");
@@ -39,3 +47,125 @@ char *read_ein_file(char *filename, long *out_length) {
 
   return buffer;
 }
+
+// Reads a stream that cannot be sized up front, such as a pipe or stdin.
+char *read_ein_stream(FILE *fp, long *out_length) {
+  if (!fp)
+    return NULL;
+
+  size_t capacity = 4096;
+  size_t size = 0;
+  char *buffer = malloc(capacity);
+  if (!buffer)
+    return NULL;
+
+  for (;;) {
+    if (size + 1 >= capacity) {
+      capacity *= 2;
+      char *grown = realloc(buffer, capacity);
+      if (!grown) {
+        free(buffer);
+        return NULL;
+      }
+      buffer = grown;
+    }
+    size_t n = fread(buffer + size, 1, capacity - size - 1, fp);
+    size += n;
+    if (n == 0)
+      break;
+  }
+
+  if (ferror(fp)) {
+    free(buffer);
+    return NULL;
+  }
+
+  buffer[size] = '\0';
+
+  if (out_length)
+    *out_length = (long)size;
+
+  return buffer;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+static bool map_ein_file(const char *filename, SourceFile *source) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  source->data = data;
+  source->length = (long)st.st_size;
+  source->mapped = true;
+  return true;
+}
+#else
+static bool map_ein_file(const char *filename, SourceFile *source) {
+  (void)filename;
+  (void)source;
+  return false;
+}
+#endif
+
+// Loads a source file for the lexer. Regular files are memory-mapped
+// read-only, so no private copy is made. "-" reads stdin; pipes, devices
+// and platforms without mmap fall back to reading into a heap buffer.
+bool load_ein_source(const char *filename, SourceFile *source) {
+  if (filename == NULL || source == NULL)
+    return false;
+
+  char *buffer = NULL;
+  long length = 0;
+
+  if (strcmp(filename, "-") == 0) {
+    buffer = read_ein_stream(stdin, &length);
+  } else {
+    if (map_ein_file(filename, source))
+      return true;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+      return false;
+    buffer = read_ein_stream(fp, &length);
+    fclose(fp);
+  }
+
+  if (!buffer)
+    return false;
+
+  source->data = buffer;
+  source->length = length;
+  source->mapped = false;
+  return true;
+}
+
+void release_ein_source(SourceFile *source) {
+  if (source == NULL || source->data == NULL)
+    return;
+
+#if defined(__unix__) || defined(__APPLE__)
+  if (source->mapped)
+    munmap((void *)source->data, source->length);
+  else
+    free((void *)source->data);
+#else
+  free((void *)source->data);
+#endif
+
+  source->data = NULL;
+  source->length = 0;
+  source->mapped = false;
+}
@@ -1,9 +1,22 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+// Source text handed to the lexer. When `mapped` is set, `data` is a
+// read-only view of the file and is not NUL-terminated; consumers must rely on
+// `length` alone.
+typedef struct SourceFile {
+  const char *data;
+  long length;
+  bool mapped;
+} SourceFile;
+
 char *read_ein_file(char *file_name, long *out_size);
+char *read_ein_stream(FILE *fp, long *out_size);
+bool load_ein_source(const char *file_name, SourceFile *source);
+void release_ein_source(SourceFile *source);
 
 #endif // ! UTILS_H
@@ -0,0 +1,161 @@
+#include "transform.h"
+#include <assert.h>
+#include <stdlib.h>
+
+typedef enum Stride {
+  STRIDE_INVARIANT,
+  STRIDE_UNIT,
+  STRIDE_OTHER,
+} Stride;
+
+// Unit stride means `var` appears only in the last subscript, with
+// coefficient 1, so consecutive iterations touch consecutive elements.
+// Subscripts the shape pass left unproven are checked where they are used,
+// which a vector access cannot do for each lane.
+static Stride access_stride(const IRAccess *access, int var) {
+  Stride stride = STRIDE_INVARIANT;
+  for (int d = 0; d < access->count; d++) {
+    const IRIndex *index = &access->indices[d];
+    if (!index->affine) {
+      if (ir_expr_uses_symbol(index->general, var))
+        return STRIDE_OTHER;
+      continue;
+    }
+    long coeff = affine_coeff(&index->expr, var);
+    if (coeff == 0)
+      continue;
+    if (d != access->count - 1 || coeff != 1 || !index->proven)
+      return STRIDE_OTHER;
+    stride = STRIDE_UNIT;
+  }
+  return stride;
+}
+
+// Values that do not move with the loop are computed once per vector and
+// broadcast, so anything goes there.
+static bool vector_expr(const IRExpr *expr, int var) {
+  if (!ir_expr_uses_symbol(expr, var))
+    return true;
+
+  switch (expr->kind) {
+  case IR_EXPR_SYMBOL:
+    return true;
+  case IR_EXPR_LOAD:
+    return access_stride(&expr->data.load, var) == STRIDE_UNIT;
+  case IR_EXPR_BINARY: {
+    TokenType op = expr->data.binary.op;
+    return (op == PLUS || op == MINUS || op == STAR) &&
+           vector_expr(expr->data.binary.left, var) &&
+           vector_expr(expr->data.binary.right, var);
+  }
+  case IR_EXPR_UNARY:
+    return expr->data.unary.op == MINUS &&
+           vector_expr(expr->data.unary.operand, var);
+  case IR_EXPR_CALL:
+    return expr->data.call.arg_count == 2 &&
+           (strcmp(expr->data.call.name, "min") == 0 ||
+            strcmp(expr->data.call.name, "max") == 0) &&
+           vector_expr(expr->data.call.args[0], var) &&
+           vector_expr(expr->data.call.args[1], var);
+  default:
+    return false;
+  }
+}
+
+static bool loop_vectorizable(const IRFunction *fn, const IRNode *loop) {
+  const IRList *body = &loop->data.loop.body;
+  int var = loop->data.loop.var;
+  if (loop->data.loop.step != 1 || body->count == 0)
+    return false;
+
+  // Tensors that some statement reduces into. They may appear nowhere else
+  // in the loop, since the running value only exists after it.
+  bool *reduced = (bool *)calloc(fn->tensor_count + 1, sizeof(bool));
+  assert(reduced != NULL);
+  bool ok = true;
+  for (int i = 0; i < body->count && ok; i++) {
+    const IRNode *node = body->items[i];
+    if (node->kind != IR_STMT || node->data.stmt.target.tensor < 0) {
+      ok = false;
+      break;
+    }
+    const IRAccess *target = &node->data.stmt.target;
+    switch (access_stride(target, var)) {
+    case STRIDE_UNIT:
+      ok = vector_expr(node->data.stmt.value, var);
+      break;
+    case STRIDE_INVARIANT: {
+      const IRExpr *operand = ir_reduction_operand(node);
+      ok = operand != NULL && vector_expr(operand, var);
+      reduced[target->tensor] = true;
+      break;
+    }
+    case STRIDE_OTHER:
+      ok = false;
+      break;
+    }
+  }
+
+  for (int i = 0; i < body->count && ok; i++) {
+    const IRNode *node = body->items[i];
+    const IRAccess *target = &node->data.stmt.target;
+    bool reduction = access_stride(target, var) == STRIDE_INVARIANT;
+    const IRExpr *value =
+        reduction ? ir_reduction_operand(node) : node->data.stmt.value;
+    for (int t = 0; t < fn->tensor_count && ok; t++) {
+      if (reduced[t])
+        ok = (reduction || target->tensor != t) &&
+             !ir_expr_reads_tensor(value, t);
+    }
+  }
+  free(reduced);
+  if (!ok)
+    return false;
+
+  // Every other written tensor is touched at a single element per
+  // iteration, so running the statements lane-wise one after another keeps
+  // each iteration's reads and writes in order.
+  LoopAccessList accesses = {NULL, 0, 0, false};
+  collect_loop_accesses(&accesses, body);
+  for (int i = 0; i < accesses.count && ok; i++) {
+    const LoopAccess *a = &accesses.items[i];
+    if (!a->write)
+      continue;
+    for (int j = 0; j < accesses.count && ok; j++) {
+      const LoopAccess *b = &accesses.items[j];
+      if (b->access->tensor == a->access->tensor)
+        ok = ir_access_equal(a->access, b->access);
+    }
+  }
+  free_loop_accesses(&accesses);
+  return ok;
+}
+
+static int vectorize_list(IRFunction *fn, IRList *list, int width) {
+  int marked = 0;
+  for (int i = 0; i < list->count; i++) {
+    IRNode *node = list->items[i];
+    switch (node->kind) {
+    case IR_LOOP:
+      if (node->data.loop.gemm != NULL)
+        break;
+      marked += vectorize_list(fn, &node->data.loop.body, width);
+      if (loop_vectorizable(fn, node)) {
+        node->data.loop.vector_width = width;
+        marked++;
+      }
+      break;
+    case IR_IF:
+      marked += vectorize_list(fn, &node->data.if_else.then_body, width);
+      marked += vectorize_list(fn, &node->data.if_else.else_body, width);
+      break;
+    default:
+      break;
+    }
+  }
+  return marked;
+}
+
+int vectorize_function(IRFunction *fn, int width) {
+  return vectorize_list(fn, &fn->body, width);
+}
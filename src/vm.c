@@ -0,0 +1,1047 @@
+#include "vm.h"
+#include "workspace.h"
+#include <assert.h>
+#include <math.h>
+#include <stdarg.h>
+
+// Operands are register numbers unless noted. Jump targets are instruction
+// indices packed into b and c; BLT_I keeps its target in the following slot.
+#define VM_OPCODES(X)                                                          \
+  X(HALT)    /* return nothing */                                              \
+  X(RET_F)   /* return F[a] */                                                 \
+  X(RET_T)   /* return tensor a */                                             \
+  X(MOV_I)   /* I[a] = I[b] */                                                 \
+  X(ADD_I)   /* I[a] = I[b] + I[c] */                                          \
+  X(SUB_I)   /* I[a] = I[b] - I[c] */                                          \
+  X(MUL_I)   /* I[a] = I[b] * I[c] */                                          \
+  X(MADD_I)  /* I[a] += I[b] * I[c] */                                         \
+  X(MIN_I)   /* I[a] = min(I[b], I[c]) */                                      \
+  X(MAX_I)   /* I[a] = max(I[b], I[c]) */                                      \
+  X(AND_I)   /* I[a] = I[b] && I[c] */                                         \
+  X(OR_I)    /* I[a] = I[b] || I[c] */                                         \
+  X(NOT_I)   /* I[a] = !I[b] */                                                \
+  X(I2F)     /* F[a] = I[b] */                                                 \
+  X(F2I)     /* I[a] = (long)F[b] */                                           \
+  X(TRUTH_F) /* I[a] = F[b] != 0 */                                            \
+  X(MOV_F)   /* F[a] = F[b] */                                                 \
+  X(ADD_F)   /* F[a] = F[b] + F[c] */                                          \
+  X(SUB_F)   /* F[a] = F[b] - F[c] */                                          \
+  X(MUL_F)   /* F[a] = F[b] * F[c] */                                          \
+  X(NEG_F)   /* F[a] = -F[b] */                                                \
+  X(MIN_F)   /* F[a] = fminf(F[b], F[c]) */                                    \
+  X(MAX_F)   /* F[a] = fmaxf(F[b], F[c]) */                                    \
+  X(SQRT_F)  /* F[a] = sqrtf(F[b]) */                                          \
+  X(EXP_F)   /* F[a] = expf(F[b]) */                                           \
+  X(LOG_F)   /* F[a] = logf(F[b]) */                                           \
+  X(ABS_F)   /* F[a] = fabsf(F[b]) */                                          \
+  X(TANH_F)  /* F[a] = tanhf(F[b]) */                                          \
+  X(LT_F)    /* I[a] = F[b] < F[c] */                                          \
+  X(LE_F)    /* I[a] = F[b] <= F[c] */                                         \
+  X(GT_F)    /* I[a] = F[b] > F[c] */                                          \
+  X(GE_F)    /* I[a] = F[b] >= F[c] */                                         \
+  X(EQ_F)    /* I[a] = F[b] == F[c] */                                         \
+  X(NE_F)    /* I[a] = F[b] != F[c] */                                         \
+  X(LOAD_F)  /* F[a] = tensor b [I[c]] */                                      \
+  X(STORE_F) /* tensor a [I[b]] = F[c] */                                      \
+  X(CHECK_I) /* fault unless 0 <= I[a] < I[b] */                               \
+  X(JMP)     /* goto target */                                                 \
+  X(JZ)      /* if (!I[a]) goto target */                                      \
+  X(BLT_I)   /* if (I[a] < I[b]) goto target in next slot */
+
+typedef enum VMOpcode {
+#define VM_ENUM(name) OP_##name,
+  VM_OPCODES(VM_ENUM)
+#undef VM_ENUM
+} VMOpcode;
+
+static const char *const vm_opcode_names[] = {
+#define VM_NAME(name) #name,
+    VM_OPCODES(VM_NAME)
+#undef VM_NAME
+};
+
+#define VM_TARGET(instr) ((int)((instr)->b | ((uint32_t)(instr)->c << 16)))
+#define VM_MAX_REGS 0xffff
+
+typedef struct VMCompiler {
+  VMFunction *fn;
+  const IRFunction *ir;
+  int int_temp;
+  int float_temp;
+  bool failed;
+} VMCompiler;
+
+static void vm_error(VMCompiler *c, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "VM error in function '%s': ", c->fn->name);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  c->failed = true;
+}
+
+static void *grow(void *items, int *capacity, int needed, size_t item_size) {
+  if (needed <= *capacity)
+    return items;
+
+  int new_capacity = *capacity > 0 ? *capacity : 64;
+  while (new_capacity < needed)
+    new_capacity *= 2;
+  items = realloc(items, (size_t)new_capacity * item_size);
+  assert(items != NULL);
+  *capacity = new_capacity;
+  return items;
+}
+
+static int emit(VMCompiler *c, VMOpcode op, int a, int b, int d) {
+  VMFunction *fn = c->fn;
+  fn->code = (VMInstr *)grow(fn->code, &fn->code_capacity, fn->code_count + 1,
+                             sizeof(VMInstr));
+  VMInstr *instr = &fn->code[fn->code_count];
+  instr->op = (uint8_t)op;
+  instr->reserved = 0;
+  instr->a = (uint16_t)a;
+  instr->b = (uint16_t)b;
+  instr->c = (uint16_t)d;
+  return fn->code_count++;
+}
+
+static void set_target(VMCompiler *c, int at, int target) {
+  c->fn->code[at].b = (uint16_t)(target & 0xffff);
+  c->fn->code[at].c = (uint16_t)((uint32_t)target >> 16);
+}
+
+static int new_int(VMCompiler *c) {
+  int reg = c->int_temp++;
+  if (reg >= VM_MAX_REGS) {
+    if (!c->failed)
+      vm_error(c, "out of integer registers");
+    return 0;
+  }
+  if (c->int_temp > c->fn->int_regs)
+    c->fn->int_regs = c->int_temp;
+  return reg;
+}
+
+static int new_float(VMCompiler *c) {
+  int reg = c->float_temp++;
+  if (reg >= VM_MAX_REGS) {
+    if (!c->failed)
+      vm_error(c, "out of float registers");
+    return 0;
+  }
+  if (c->float_temp > c->fn->float_regs)
+    c->fn->float_regs = c->float_temp;
+  return reg;
+}
+
+static int int_const(VMCompiler *c, long value) {
+  VMFunction *fn = c->fn;
+  for (int i = 0; i < fn->int_const_count; i++) {
+    if (fn->int_consts[i] == value)
+      return fn->int_const_base + i;
+  }
+  fn->int_consts = (long *)grow(fn->int_consts, &fn->int_const_capacity,
+                                fn->int_const_count + 1, sizeof(long));
+  fn->int_consts[fn->int_const_count] = value;
+  return fn->int_const_base + fn->int_const_count++;
+}
+
+static int float_const(VMCompiler *c, float value) {
+  VMFunction *fn = c->fn;
+  for (int i = 0; i < fn->float_const_count; i++) {
+    if (memcmp(&fn->float_consts[i], &value, sizeof(float)) == 0)
+      return fn->float_const_base + i;
+  }
+  fn->float_consts =
+      (float *)grow(fn->float_consts, &fn->float_const_capacity,
+                    fn->float_const_count + 1, sizeof(float));
+  fn->float_consts[fn->float_const_count] = value;
+  return fn->float_const_base + fn->float_const_count++;
+}
+
+// Returns a register holding the value of `expr`. Plain symbols are used in
+// place; everything else goes through a temporary.
+static int compile_affine(VMCompiler *c, const AffineExpr *expr) {
+  if (expr->term_count == 0)
+    return int_const(c, expr->constant);
+  if (expr->term_count == 1 && expr->terms[0].coeff == 1 &&
+      expr->constant == 0)
+    return expr->terms[0].symbol;
+
+  int reg = new_int(c);
+  for (int i = 0; i < expr->term_count; i++) {
+    int symbol = expr->terms[i].symbol;
+    long coeff = expr->terms[i].coeff;
+    if (i == 0 && coeff == 1)
+      emit(c, OP_MOV_I, reg, symbol, 0);
+    else if (i == 0)
+      emit(c, OP_MUL_I, reg, symbol, int_const(c, coeff));
+    else if (coeff == 1)
+      emit(c, OP_ADD_I, reg, reg, symbol);
+    else
+      emit(c, OP_MADD_I, reg, symbol, int_const(c, coeff));
+  }
+  if (expr->constant != 0)
+    emit(c, OP_ADD_I, reg, reg, int_const(c, expr->constant));
+  return reg;
+}
+
+static int compile_bound(VMCompiler *c, const IRBound *bound, bool upper) {
+  int reg = compile_affine(c, &bound->exprs[0]);
+  if (bound->count == 1)
+    return reg;
+
+  int combined = new_int(c);
+  emit(c, OP_MOV_I, combined, reg, 0);
+  for (int i = 1; i < bound->count; i++) {
+    emit(c, upper ? OP_MIN_I : OP_MAX_I, combined, combined,
+         compile_affine(c, &bound->exprs[i]));
+  }
+  return combined;
+}
+
+static int compile_value(VMCompiler *c, const IRExpr *expr);
+static int compile_cond(VMCompiler *c, const IRExpr *expr);
+
+// Integer value of a general (non-affine) subscript.
+static int compile_index(VMCompiler *c, const IRExpr *expr) {
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+    return int_const(c, expr->data.int_value);
+  case IR_EXPR_SYMBOL:
+    return expr->data.symbol;
+  case IR_EXPR_BINARY:
+    if (expr->data.binary.op == PLUS || expr->data.binary.op == MINUS ||
+        expr->data.binary.op == STAR) {
+      int left = compile_index(c, expr->data.binary.left);
+      int right = compile_index(c, expr->data.binary.right);
+      int reg = new_int(c);
+      VMOpcode op = expr->data.binary.op == PLUS    ? OP_ADD_I
+                    : expr->data.binary.op == MINUS ? OP_SUB_I
+                                                    : OP_MUL_I;
+      emit(c, op, reg, left, right);
+      return reg;
+    }
+    break;
+  default:
+    break;
+  }
+
+  int reg = new_int(c);
+  emit(c, OP_F2I, reg, compile_value(c, expr), 0);
+  return reg;
+}
+
+// Row-major element offset of an access into a tensor of rank >= 1.
+static int compile_offset(VMCompiler *c, const IRAccess *access) {
+  const VMTensorInfo *tensor = &c->fn->tensors[access->tensor];
+  int index_regs[VM_MAX_RANK];
+  for (int i = 0; i < access->count; i++) {
+    const IRIndex *index = &access->indices[i];
+    if (index->affine) {
+      index_regs[i] = compile_affine(c, &index->expr);
+      if (!index->proven)
+        emit(c, OP_CHECK_I, index_regs[i],
+             compile_affine(c, &tensor->shape[i]), 0);
+    } else {
+      index_regs[i] = compile_index(c, index->general);
+      emit(c, OP_CHECK_I, index_regs[i],
+           compile_affine(c, &tensor->shape[i]), 0);
+    }
+  }
+
+  int last = access->count - 1;
+  if (last == 0)
+    return index_regs[0];
+
+  int reg = new_int(c);
+  emit(c, OP_MOV_I, reg, index_regs[last], 0);
+  for (int i = last - 1; i >= 0; i--)
+    emit(c, OP_MADD_I, reg, index_regs[i], tensor->stride_regs + i);
+  return reg;
+}
+
+static int compile_call(VMCompiler *c, const IRExpr *expr) {
+  static const struct {
+    const char *name;
+    int args;
+    VMOpcode op;
+  } builtins[] = {
+      {"sqrt", 1, OP_SQRT_F}, {"exp", 1, OP_EXP_F}, {"log", 1, OP_LOG_F},
+      {"abs", 1, OP_ABS_F},   {"tanh", 1, OP_TANH_F}, {"min", 2, OP_MIN_F},
+      {"max", 2, OP_MAX_F},
+  };
+
+  const char *name = expr->data.call.name;
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+    if (strcmp(name, builtins[i].name) != 0)
+      continue;
+    if (expr->data.call.arg_count != builtins[i].args) {
+      vm_error(c, "%s takes %d argument%s", name, builtins[i].args,
+               builtins[i].args == 1 ? "" : "s");
+      return 0;
+    }
+    int a = compile_value(c, expr->data.call.args[0]);
+    int b = builtins[i].args == 2 ? compile_value(c, expr->data.call.args[1])
+                                  : 0;
+    int reg = new_float(c);
+    emit(c, builtins[i].op, reg, a, b);
+    return reg;
+  }
+
+  vm_error(c, "unsupported call to '%s'", name);
+  return 0;
+}
+
+static bool is_condition(TokenType op) {
+  switch (op) {
+  case LESS:
+  case LESS_EQUAL:
+  case GREATER:
+  case GREATER_EQUAL:
+  case EQUAL_EQUAL:
+  case BANG_EQUAL:
+  case AND:
+  case OR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static int compile_value(VMCompiler *c, const IRExpr *expr) {
+  if (expr == NULL) {
+    vm_error(c, "missing expression");
+    return 0;
+  }
+
+  int reg;
+  switch (expr->kind) {
+  case IR_EXPR_INT:
+    return float_const(c, (float)expr->data.int_value);
+  case IR_EXPR_FLOAT:
+    return float_const(c, (float)expr->data.float_value);
+  case IR_EXPR_SYMBOL:
+    reg = new_float(c);
+    emit(c, OP_I2F, reg, expr->data.symbol, 0);
+    return reg;
+  case IR_EXPR_LOAD: {
+    const VMTensorInfo *tensor = &c->fn->tensors[expr->data.load.tensor];
+    if (tensor->rank == 0)
+      return tensor->reg;
+    int offset = compile_offset(c, &expr->data.load);
+    reg = new_float(c);
+    emit(c, OP_LOAD_F, reg, expr->data.load.tensor, offset);
+    return reg;
+  }
+  case IR_EXPR_BINARY: {
+    TokenType op = expr->data.binary.op;
+    if (is_condition(op)) {
+      reg = new_float(c);
+      emit(c, OP_I2F, reg, compile_cond(c, expr), 0);
+      return reg;
+    }
+    int left = compile_value(c, expr->data.binary.left);
+    int right = compile_value(c, expr->data.binary.right);
+    reg = new_float(c);
+    switch (op) {
+    case PLUS:
+      emit(c, OP_ADD_F, reg, left, right);
+      break;
+    case MINUS:
+      emit(c, OP_SUB_F, reg, left, right);
+      break;
+    case STAR:
+      emit(c, OP_MUL_F, reg, left, right);
+      break;
+    default:
+      vm_error(c, "unsupported operator %s", token_type_name(op));
+      break;
+    }
+    return reg;
+  }
+  case IR_EXPR_UNARY:
+    reg = new_float(c);
+    if (expr->data.unary.op == BANG) {
+      emit(c, OP_I2F, reg, compile_cond(c, expr), 0);
+    } else {
+      emit(c, OP_NEG_F, reg, compile_value(c, expr->data.unary.operand), 0);
+    }
+    return reg;
+  case IR_EXPR_CALL:
+    return compile_call(c, expr);
+  }
+  return 0;
+}
+
+// Integer register that is non-zero when `expr` is true.
+static int compile_cond(VMCompiler *c, const IRExpr *expr) {
+  int reg;
+  if (expr->kind == IR_EXPR_UNARY && expr->data.unary.op == BANG) {
+    reg = new_int(c);
+    emit(c, OP_NOT_I, reg, compile_cond(c, expr->data.unary.operand), 0);
+    return reg;
+  }
+  if (expr->kind != IR_EXPR_BINARY || !is_condition(expr->data.binary.op)) {
+    reg = new_int(c);
+    emit(c, OP_TRUTH_F, reg, compile_value(c, expr), 0);
+    return reg;
+  }
+
+  TokenType op = expr->data.binary.op;
+  if (op == AND || op == OR) {
+    int left = compile_cond(c, expr->data.binary.left);
+    int right = compile_cond(c, expr->data.binary.right);
+    reg = new_int(c);
+    emit(c, op == AND ? OP_AND_I : OP_OR_I, reg, left, right);
+    return reg;
+  }
+
+  int left = compile_value(c, expr->data.binary.left);
+  int right = compile_value(c, expr->data.binary.right);
+  VMOpcode code = op == LESS            ? OP_LT_F
+                  : op == LESS_EQUAL    ? OP_LE_F
+                  : op == GREATER       ? OP_GT_F
+                  : op == GREATER_EQUAL ? OP_GE_F
+                  : op == EQUAL_EQUAL   ? OP_EQ_F
+                                        : OP_NE_F;
+  reg = new_int(c);
+  emit(c, code, reg, left, right);
+  return reg;
+}
+
+static void compile_list(VMCompiler *c, const IRList *list);
+
+static void compile_loop(VMCompiler *c, const IRNode *node) {
+  int var = node->data.loop.var;
+  int lower = compile_bound(c, &node->data.loop.lower, false);
+  if (lower != var)
+    emit(c, OP_MOV_I, var, lower, 0);
+
+  // The bound and step registers stay live for the whole loop, so the body
+  // allocates its temporaries above them.
+  int upper = compile_bound(c, &node->data.loop.upper, true);
+  int step = int_const(c, node->data.loop.step);
+  int jump = emit(c, OP_JMP, 0, 0, 0);
+
+  int body = c->fn->code_count;
+  compile_list(c, &node->data.loop.body);
+  emit(c, OP_ADD_I, var, var, step);
+
+  set_target(c, jump, c->fn->code_count);
+  emit(c, OP_BLT_I, var, upper, 0);
+  int target = emit(c, OP_HALT, 0, 0, 0);
+  set_target(c, target, body);
+}
+
+static void compile_node(VMCompiler *c, const IRNode *node) {
+  int int_mark = c->int_temp;
+  int float_mark = c->float_temp;
+
+  switch (node->kind) {
+  case IR_LOOP:
+    compile_loop(c, node);
+    break;
+  case IR_STMT: {
+    const IRAccess *target = &node->data.stmt.target;
+    int value = compile_value(c, node->data.stmt.value);
+    if (target->tensor < 0)
+      break;
+    const VMTensorInfo *tensor = &c->fn->tensors[target->tensor];
+    if (tensor->rank == 0) {
+      if (value != tensor->reg)
+        emit(c, OP_MOV_F, tensor->reg, value, 0);
+    } else {
+      emit(c, OP_STORE_F, target->tensor, compile_offset(c, target), value);
+    }
+    break;
+  }
+  case IR_IF: {
+    int cond = compile_cond(c, node->data.if_else.condition);
+    int skip_then = emit(c, OP_JZ, cond, 0, 0);
+    compile_list(c, &node->data.if_else.then_body);
+    if (node->data.if_else.else_body.count > 0) {
+      int skip_else = emit(c, OP_JMP, 0, 0, 0);
+      set_target(c, skip_then, c->fn->code_count);
+      compile_list(c, &node->data.if_else.else_body);
+      set_target(c, skip_else, c->fn->code_count);
+    } else {
+      set_target(c, skip_then, c->fn->code_count);
+    }
+    break;
+  }
+  case IR_RETURN:
+    if (node->data.ret.tensor >= 0)
+      emit(c, OP_RET_T, node->data.ret.tensor, 0, 0);
+    else if (node->data.ret.value != NULL)
+      emit(c, OP_RET_F, compile_value(c, node->data.ret.value), 0, 0);
+    else
+      emit(c, OP_HALT, 0, 0, 0);
+    break;
+  }
+
+  c->int_temp = int_mark;
+  c->float_temp = float_mark;
+}
+
+static void compile_list(VMCompiler *c, const IRList *list) {
+  for (int i = 0; i < list->count && !c->failed; i++)
+    compile_node(c, list->items[i]);
+}
+
+// Register layout. Integer: symbols, strides, constants, temporaries.
+// Float: scalar variables, constants, temporaries. Constant counts are only
+// known after compiling, so the body is compiled twice; the second pass
+// reuses the constant pool from the first and so assigns the same slots.
+static void compile_body(VMCompiler *c) {
+  VMFunction *fn = c->fn;
+  int int_fixed = fn->symbol_count;
+  int float_fixed = 0;
+  for (int i = 0; i < fn->tensor_count; i++) {
+    VMTensorInfo *tensor = &fn->tensors[i];
+    tensor->reg = tensor->rank == 0 ? float_fixed++ : -1;
+    tensor->stride_regs = int_fixed;
+    int_fixed += tensor->rank > 0 ? tensor->rank : 0;
+  }
+
+  for (int pass = 0; pass < 2 && !c->failed; pass++) {
+    fn->code_count = 0;
+    fn->int_const_base = int_fixed;
+    fn->float_const_base = float_fixed;
+    c->int_temp = fn->int_regs = int_fixed + fn->int_const_count;
+    c->float_temp = fn->float_regs = float_fixed + fn->float_const_count;
+
+    compile_list(c, &c->ir->body);
+    emit(c, OP_HALT, 0, 0, 0);
+  }
+}
+
+static void compile_function(VMFunction *fn, const IRFunction *ir,
+                             bool *failed) {
+  memset(fn, 0, sizeof(VMFunction));
+  fn->name = ir->name;
+  fn->param_count = ir->param_count;
+  fn->result_rank = ir->result.rank;
+
+  fn->symbol_count = ir->symbol_count;
+  fn->symbol_names = (const char **)malloc(sizeof(char *) *
+                                           (ir->symbol_count + 1));
+  fn->symbol_kinds =
+      (IRSymbolKind *)malloc(sizeof(IRSymbolKind) * (ir->symbol_count + 1));
+  fn->tensor_count = ir->tensor_count;
+  fn->tensors =
+      (VMTensorInfo *)calloc(ir->tensor_count + 1, sizeof(VMTensorInfo));
+  assert(fn->symbol_names != NULL && fn->symbol_kinds != NULL &&
+         fn->tensors != NULL);
+
+  for (int i = 0; i < ir->symbol_count; i++) {
+    fn->symbol_names[i] = ir->symbols[i].name;
+    fn->symbol_kinds[i] = ir->symbols[i].kind;
+  }
+
+  WorkspacePlan plan;
+  plan_workspace(ir, &plan);
+  fn->slot_count = plan.slot_count;
+
+  VMCompiler c = {fn, ir, 0, 0, false};
+  for (int i = 0; i < ir->tensor_count; i++) {
+    const IRTensor *src = &ir->tensors[i];
+    VMTensorInfo *dst = &fn->tensors[i];
+    dst->name = src->name;
+    dst->param = i < ir->param_count;
+    dst->rank = src->rank < 0 ? 0 : src->rank;
+    dst->slot = plan.slots[i];
+    if (dst->rank > VM_MAX_RANK) {
+      vm_error(&c, "'%s' has more than %d dimensions", src->name,
+               VM_MAX_RANK);
+      break;
+    }
+    for (int d = 0; d < dst->rank; d++)
+      dst->shape[d] = src->shape[d];
+  }
+
+  free_workspace_plan(&plan);
+
+  if (!c.failed)
+    compile_body(&c);
+  *failed = *failed || c.failed;
+}
+
+VMProgram *compile_vm_program(const IRModule *module) {
+  VMProgram *program = (VMProgram *)malloc(sizeof(VMProgram));
+  if (program == NULL)
+    return NULL;
+
+  program->function_count = module->function_count;
+  program->functions =
+      (VMFunction *)calloc(module->function_count + 1, sizeof(VMFunction));
+  if (program->functions == NULL) {
+    free(program);
+    return NULL;
+  }
+
+  bool failed = false;
+  for (int i = 0; i < module->function_count; i++)
+    compile_function(&program->functions[i], module->functions[i], &failed);
+
+  if (failed) {
+    free_vm_program(program);
+    return NULL;
+  }
+  return program;
+}
+
+void free_vm_program(VMProgram *program) {
+  if (program == NULL)
+    return;
+
+  for (int i = 0; i < program->function_count; i++) {
+    VMFunction *fn = &program->functions[i];
+    free(fn->code);
+    free(fn->int_consts);
+    free(fn->float_consts);
+    free(fn->symbol_names);
+    free(fn->symbol_kinds);
+    free(fn->tensors);
+  }
+  free(program->functions);
+  free(program);
+}
+
+VMFunction *vm_find_function(VMProgram *program, const char *name) {
+  for (int i = 0; i < program->function_count; i++) {
+    if (strcmp(program->functions[i].name, name) == 0)
+      return &program->functions[i];
+  }
+  return NULL;
+}
+
+typedef enum VMStatus {
+  VM_RETURN_NONE,
+  VM_RETURN_FLOAT,
+  VM_RETURN_TENSOR,
+  VM_FAULT,
+} VMStatus;
+
+#if defined(__GNUC__) && !defined(EIN_VM_SWITCH)
+#define VM_THREADED 1
+#endif
+
+// Runs the bytecode of `fn`. `value` receives the returned register or
+// tensor, or the faulting index and extent on VM_FAULT.
+static VMStatus vm_execute(const VMFunction *fn, long *restrict I,
+                           float *restrict F, float *const *bases,
+                           long value[2]) {
+  const VMInstr *code = fn->code;
+  const VMInstr *ip = code;
+
+#ifdef VM_THREADED
+  static const void *const dispatch[] = {
+#define VM_LABEL(name) &&op_##name,
+      VM_OPCODES(VM_LABEL)
+#undef VM_LABEL
+  };
+#define VM_CASE(name) op_##name:
+#define VM_NEXT() goto *dispatch[(++ip)->op]
+#define VM_JUMP(target)                                                        \
+  do {                                                                         \
+    ip = code + (target);                                                      \
+    goto *dispatch[ip->op];                                                    \
+  } while (0)
+
+  goto *dispatch[ip->op];
+#else
+#define VM_CASE(name) case OP_##name:
+#define VM_NEXT()                                                              \
+  {                                                                            \
+    ip++;                                                                      \
+    continue;                                                                  \
+  }
+#define VM_JUMP(target)                                                        \
+  {                                                                            \
+    ip = code + (target);                                                      \
+    continue;                                                                  \
+  }
+
+  for (;;) {
+    switch ((VMOpcode)ip->op) {
+#endif
+
+  VM_CASE(HALT) return VM_RETURN_NONE;
+  VM_CASE(RET_F) {
+    value[0] = ip->a;
+    return VM_RETURN_FLOAT;
+  }
+  VM_CASE(RET_T) {
+    value[0] = ip->a;
+    return VM_RETURN_TENSOR;
+  }
+  VM_CASE(MOV_I) {
+    I[ip->a] = I[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(ADD_I) {
+    I[ip->a] = I[ip->b] + I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(SUB_I) {
+    I[ip->a] = I[ip->b] - I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(MUL_I) {
+    I[ip->a] = I[ip->b] * I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(MADD_I) {
+    I[ip->a] += I[ip->b] * I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(MIN_I) {
+    I[ip->a] = I[ip->b] < I[ip->c] ? I[ip->b] : I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(MAX_I) {
+    I[ip->a] = I[ip->b] > I[ip->c] ? I[ip->b] : I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(AND_I) {
+    I[ip->a] = I[ip->b] && I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(OR_I) {
+    I[ip->a] = I[ip->b] || I[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(NOT_I) {
+    I[ip->a] = !I[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(I2F) {
+    F[ip->a] = (float)I[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(F2I) {
+    I[ip->a] = (long)F[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(TRUTH_F) {
+    I[ip->a] = F[ip->b] != 0.0f;
+    VM_NEXT();
+  }
+  VM_CASE(MOV_F) {
+    F[ip->a] = F[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(ADD_F) {
+    F[ip->a] = F[ip->b] + F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(SUB_F) {
+    F[ip->a] = F[ip->b] - F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(MUL_F) {
+    F[ip->a] = F[ip->b] * F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(NEG_F) {
+    F[ip->a] = -F[ip->b];
+    VM_NEXT();
+  }
+  VM_CASE(MIN_F) {
+    F[ip->a] = fminf(F[ip->b], F[ip->c]);
+    VM_NEXT();
+  }
+  VM_CASE(MAX_F) {
+    F[ip->a] = fmaxf(F[ip->b], F[ip->c]);
+    VM_NEXT();
+  }
+  VM_CASE(SQRT_F) {
+    F[ip->a] = sqrtf(F[ip->b]);
+    VM_NEXT();
+  }
+  VM_CASE(EXP_F) {
+    F[ip->a] = expf(F[ip->b]);
+    VM_NEXT();
+  }
+  VM_CASE(LOG_F) {
+    F[ip->a] = logf(F[ip->b]);
+    VM_NEXT();
+  }
+  VM_CASE(ABS_F) {
+    F[ip->a] = fabsf(F[ip->b]);
+    VM_NEXT();
+  }
+  VM_CASE(TANH_F) {
+    F[ip->a] = tanhf(F[ip->b]);
+    VM_NEXT();
+  }
+  VM_CASE(LT_F) {
+    I[ip->a] = F[ip->b] < F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(LE_F) {
+    I[ip->a] = F[ip->b] <= F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(GT_F) {
+    I[ip->a] = F[ip->b] > F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(GE_F) {
+    I[ip->a] = F[ip->b] >= F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(EQ_F) {
+    I[ip->a] = F[ip->b] == F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(NE_F) {
+    I[ip->a] = F[ip->b] != F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(LOAD_F) {
+    F[ip->a] = bases[ip->b][I[ip->c]];
+    VM_NEXT();
+  }
+  VM_CASE(STORE_F) {
+    bases[ip->a][I[ip->b]] = F[ip->c];
+    VM_NEXT();
+  }
+  VM_CASE(CHECK_I) {
+    if ((unsigned long)I[ip->a] >= (unsigned long)I[ip->b]) {
+      value[0] = I[ip->a];
+      value[1] = I[ip->b];
+      return VM_FAULT;
+    }
+    VM_NEXT();
+  }
+  VM_CASE(JMP) { VM_JUMP(VM_TARGET(ip)); }
+  VM_CASE(JZ) {
+    if (!I[ip->a])
+      VM_JUMP(VM_TARGET(ip));
+    VM_NEXT();
+  }
+  VM_CASE(BLT_I) {
+    if (I[ip->a] < I[ip->b])
+      VM_JUMP(VM_TARGET(ip + 1));
+    ip++;
+    VM_NEXT();
+  }
+
+#ifndef VM_THREADED
+    }
+  }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+}
+
+static long eval_affine(const AffineExpr *expr, const long *I) {
+  long value = expr->constant;
+  for (int i = 0; i < expr->term_count; i++)
+    value += expr->terms[i].coeff * I[expr->terms[i].symbol];
+  return value;
+}
+
+static void runtime_error(const VMFunction *fn, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "Runtime error in function '%s': ", fn->name);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Binds size parameters from the shapes of the arguments. A dim written as a
+// single name binds it; any other dim is checked once everything is bound.
+static bool bind_sizes(const VMFunction *fn, const Tensor *args, long *I,
+                       bool *bound) {
+  for (int t = 0; t < fn->param_count; t++) {
+    const VMTensorInfo *tensor = &fn->tensors[t];
+    if (args[t].rank != tensor->rank) {
+      runtime_error(fn, "argument '%s' has rank %d, expected %d",
+                    tensor->name, args[t].rank, tensor->rank);
+      return false;
+    }
+    if (tensor->rank > 0 && args[t].strides[tensor->rank - 1] != 1 &&
+        args[t].shape[tensor->rank - 1] > 1) {
+      runtime_error(fn, "argument '%s' has stride %ld in its last dimension",
+                    tensor->name, args[t].strides[tensor->rank - 1]);
+      return false;
+    }
+    for (int d = 0; d < tensor->rank; d++) {
+      const AffineExpr *dim = &tensor->shape[d];
+      if (dim->term_count != 1 || dim->terms[0].coeff != 1 ||
+          dim->constant != 0)
+        continue;
+      int symbol = dim->terms[0].symbol;
+      if (!bound[symbol]) {
+        I[symbol] = args[t].shape[d];
+        bound[symbol] = true;
+      } else if (I[symbol] != args[t].shape[d]) {
+        runtime_error(fn, "dimension %d of '%s' is %ld but %s is %ld", d,
+                      tensor->name, args[t].shape[d],
+                      fn->symbol_names[symbol], I[symbol]);
+        return false;
+      }
+    }
+  }
+
+  for (int i = 0; i < fn->symbol_count; i++) {
+    if (fn->symbol_kinds[i] == IR_SYM_PARAM && !bound[i]) {
+      runtime_error(fn, "size '%s' cannot be inferred from the arguments",
+                    fn->symbol_names[i]);
+      return false;
+    }
+  }
+
+  for (int t = 0; t < fn->param_count; t++) {
+    const VMTensorInfo *tensor = &fn->tensors[t];
+    for (int d = 0; d < tensor->rank; d++) {
+      long expected = eval_affine(&tensor->shape[d], I);
+      if (args[t].shape[d] != expected) {
+        runtime_error(fn, "dimension %d of '%s' is %ld, expected %ld", d,
+                      tensor->name, args[t].shape[d], expected);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool vm_call(VMFunction *fn, const Tensor *args, int arg_count,
+             Tensor *result) {
+  memset(result, 0, sizeof(Tensor));
+  if (arg_count != fn->param_count) {
+    runtime_error(fn, "expected %d arguments, got %d", fn->param_count,
+                  arg_count);
+    return false;
+  }
+
+  long *I = (long *)calloc(fn->int_regs + 1, sizeof(long));
+  float *F = (float *)calloc(fn->float_regs + 1, sizeof(float));
+  bool *bound = (bool *)calloc(fn->symbol_count + 1, sizeof(bool));
+  float **bases = (float **)calloc(fn->tensor_count + 1, sizeof(float *));
+  Tensor *tensors = (Tensor *)calloc(fn->tensor_count + 1, sizeof(Tensor));
+  long *offsets = (long *)calloc(fn->slot_count + 1, sizeof(long));
+  Tensor workspace = {0};
+  bool ok = I != NULL && F != NULL && bound != NULL && bases != NULL &&
+            tensors != NULL && offsets != NULL &&
+            bind_sizes(fn, args, I, bound);
+
+  // Shapes of the locals first, to size the workspace slots; `offsets`
+  // holds each slot's size until the layout is known.
+  for (int t = fn->param_count; ok && t < fn->tensor_count; t++) {
+    const VMTensorInfo *tensor = &fn->tensors[t];
+    if (tensor->rank == 0)
+      continue;
+    long shape[VM_MAX_RANK];
+    for (int d = 0; d < tensor->rank; d++) {
+      shape[d] = eval_affine(&tensor->shape[d], I);
+      shape[d] = shape[d] > 0 ? shape[d] : 0;
+    }
+    if (tensor->slot < 0) {
+      ok = tensor_alloc(&tensors[t], TENSOR_F32, tensor->rank, shape);
+      if (!ok)
+        runtime_error(fn, "cannot allocate '%s'", tensor->name);
+      continue;
+    }
+    tensor_wrap(&tensors[t], TENSOR_F32, NULL, tensor->rank, shape, NULL);
+    long size = workspace_slot_size(tensor_element_count(&tensors[t]));
+    if (size > offsets[tensor->slot])
+      offsets[tensor->slot] = size;
+  }
+  if (ok && fn->slot_count > 0) {
+    long total = 0;
+    for (int s = 0; s < fn->slot_count; s++) {
+      long size = offsets[s];
+      offsets[s] = total;
+      total += size;
+    }
+    ok = tensor_alloc(&workspace, TENSOR_F32, 1, &total);
+    if (!ok)
+      runtime_error(fn, "cannot allocate a workspace of %ld floats", total);
+  }
+
+  for (int t = 0; ok && t < fn->tensor_count; t++) {
+    const VMTensorInfo *tensor = &fn->tensors[t];
+    if (tensor->param) {
+      tensors[t] = args[t];
+      tensors[t].owned = false;
+    } else if (tensor->slot >= 0) {
+      tensors[t].data = (float *)workspace.data + offsets[tensor->slot];
+    }
+
+    for (int d = 0; d < tensor->rank; d++)
+      I[tensor->stride_regs + d] = tensors[t].strides[d];
+    if (tensor->rank == 0) {
+      if (tensor->param)
+        F[tensor->reg] = *(const float *)args[t].data;
+    } else {
+      bases[t] = (float *)tensors[t].data;
+    }
+  }
+
+  if (ok) {
+    for (int i = 0; i < fn->int_const_count; i++)
+      I[fn->int_const_base + i] = fn->int_consts[i];
+    for (int i = 0; i < fn->float_const_count; i++)
+      F[fn->float_const_base + i] = fn->float_consts[i];
+
+    long value[2] = {-1, 0};
+    VMStatus status = vm_execute(fn, I, F, bases, value);
+    if (status == VM_FAULT) {
+      runtime_error(fn, "index %ld out of bounds for extent %ld", value[0],
+                    value[1]);
+      ok = false;
+    } else if (status == VM_RETURN_TENSOR) {
+      // The result takes over a local's storage.
+      *result = tensors[value[0]];
+      tensors[value[0]].owned = false;
+    } else if (status == VM_RETURN_FLOAT) {
+      ok = tensor_alloc(result, TENSOR_F32, 0, NULL);
+      if (ok)
+        *(float *)result->data = F[value[0]];
+    }
+  }
+
+  for (int t = 0; tensors != NULL && t < fn->tensor_count; t++)
+    tensor_release(&tensors[t]);
+  tensor_release(&workspace);
+  free(offsets);
+  free(I);
+  free(F);
+  free(bound);
+  free(bases);
+  free(tensors);
+  return ok;
+}
+
+void print_vm_function(FILE *out, const VMFunction *fn) {
+  fprintf(out, "vm %s: %d instructions, %d int / %d float registers\n",
+          fn->name, fn->code_count, fn->int_regs, fn->float_regs);
+  for (int i = 0; i < fn->code_count; i++) {
+    const VMInstr *instr = &fn->code[i];
+    fprintf(out, "%5d  %-8s", i, vm_opcode_names[instr->op]);
+    switch ((VMOpcode)instr->op) {
+    case OP_JMP:
+      fprintf(out, " -> %d\n", VM_TARGET(instr));
+      break;
+    case OP_JZ:
+      fprintf(out, " %d -> %d\n", instr->a, VM_TARGET(instr));
+      break;
+    case OP_BLT_I:
+      fprintf(out, " %d %d -> %d\n", instr->a, instr->b,
+              VM_TARGET(instr + 1));
+      i++;
+      break;
+    default:
+      fprintf(out, " %d %d %d\n", instr->a, instr->b, instr->c);
+      break;
+    }
+  }
+}
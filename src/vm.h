@@ -0,0 +1,101 @@
+#ifndef VM_H
+#define VM_H
+
+#include "loop_ir.h"
+#include "tensor.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Register bytecode interpreter for the loop-nest IR. Each function is
+// compiled to a flat array of 8-byte instructions over two register files,
+// one of integers (loop variables, sizes, element offsets) and one of f32
+// values, and run with threaded dispatch where the compiler supports
+// computed goto.
+//
+// Size parameters are bound from the argument shapes on every call, local
+// tensors are allocated from the evaluated shapes, and scalar locals and
+// parameters live directly in registers. Affine subscripts the shape pass
+// proved in bounds are trusted; every other subscript is bounds-checked
+// where it is used.
+//
+// Arguments are f32 tensors whose last dimension is contiguous; the strides
+// of the other dimensions are taken as given, so a view of part of a larger
+// tensor or one with padded rows can be passed without copying.
+
+#define VM_MAX_RANK TENSOR_MAX_RANK
+
+typedef struct VMInstr {
+  uint8_t op;
+  uint8_t reserved;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+} VMInstr;
+
+typedef struct VMTensorInfo {
+  const char *name;
+  bool param;
+  int rank;
+  AffineExpr shape[VM_MAX_RANK];
+  int reg;         // Float register holding a scalar, -1 for tensors.
+  int stride_regs; // First of `rank` integer registers holding strides.
+  int slot;        // Workspace slot of a local tensor, or -1.
+} VMTensorInfo;
+
+typedef struct VMFunction {
+  const char *name;
+
+  VMInstr *code;
+  int code_count;
+  int code_capacity;
+
+  int int_regs;
+  int float_regs;
+
+  // Constants are loaded into consecutive registers starting at the base
+  // once per call, not per use.
+  long *int_consts;
+  int int_const_count;
+  int int_const_capacity;
+  int int_const_base;
+  float *float_consts;
+  int float_const_count;
+  int float_const_capacity;
+  int float_const_base;
+
+  // Symbol i of the IR function lives in integer register i.
+  const char **symbol_names;
+  IRSymbolKind *symbol_kinds;
+  int symbol_count;
+
+  VMTensorInfo *tensors;
+  int tensor_count;
+  int param_count;
+  int slot_count; // Local tensors share one workspace; see workspace.h.
+  int result_rank; // -1 when the function declares no return type.
+} VMFunction;
+
+typedef struct VMProgram {
+  VMFunction *functions;
+  int function_count;
+} VMProgram;
+
+// Compiles every function of a verified module. The program does not refer
+// to the module afterwards. Unsupported constructs are reported as
+// "VM error in function '...': ..." and NULL is returned.
+VMProgram *compile_vm_program(const IRModule *module);
+void free_vm_program(VMProgram *program);
+VMFunction *vm_find_function(VMProgram *program, const char *name);
+
+// Runs `fn`. Arguments are given in parameter order; scalars are rank-0
+// tensors pointing at one float. A returned local tensor is handed over in
+// `result` with `owned` set, and a returned parameter is a view of the
+// argument; a returned scalar is stored in a newly allocated rank-0 tensor.
+// Release the result with tensor_release. Returns false after printing a
+// runtime error.
+bool vm_call(VMFunction *fn, const Tensor *args, int arg_count,
+             Tensor *result);
+
+void print_vm_function(FILE *out, const VMFunction *fn);
+
+#endif // !VM_H
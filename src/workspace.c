@@ -0,0 +1,216 @@
+#include "workspace.h"
+#include <assert.h>
+#include <stdlib.h>
+
+typedef struct Liveness {
+  // Per tensor: first and last top-level statement touching it, -1 if none.
+  int *first;
+  int *last;
+  bool *returned;
+  int statement;
+} Liveness;
+
+static void touch(Liveness *l, int t) {
+  if (t < 0)
+    return;
+  if (l->first[t] < 0)
+    l->first[t] = l->statement;
+  l->last[t] = l->statement;
+}
+
+static void touch_access(Liveness *l, const IRAccess *access);
+
+static void touch_expr(Liveness *l, const IRExpr *expr) {
+  if (expr == NULL)
+    return;
+
+  switch (expr->kind) {
+  case IR_EXPR_LOAD:
+    touch_access(l, &expr->data.load);
+    break;
+  case IR_EXPR_BINARY:
+    touch_expr(l, expr->data.binary.left);
+    touch_expr(l, expr->data.binary.right);
+    break;
+  case IR_EXPR_UNARY:
+    touch_expr(l, expr->data.unary.operand);
+    break;
+  case IR_EXPR_CALL:
+    for (int i = 0; i < expr->data.call.arg_count; i++)
+      touch_expr(l, expr->data.call.args[i]);
+    break;
+  default:
+    break;
+  }
+}
+
+static void touch_access(Liveness *l, const IRAccess *access) {
+  touch(l, access->tensor);
+  for (int d = 0; d < access->count; d++)
+    touch_expr(l, access->indices[d].general);
+}
+
+static void touch_list(Liveness *l, const IRList *list);
+
+static void touch_node(Liveness *l, const IRNode *node) {
+  switch (node->kind) {
+  case IR_LOOP:
+    if (node->data.loop.gemm != NULL) {
+      touch(l, node->data.loop.gemm->c);
+      touch(l, node->data.loop.gemm->a);
+      touch(l, node->data.loop.gemm->b);
+    }
+    touch_list(l, &node->data.loop.body);
+    break;
+  case IR_STMT:
+    touch_access(l, &node->data.stmt.target);
+    touch_expr(l, node->data.stmt.value);
+    break;
+  case IR_IF:
+    touch_expr(l, node->data.if_else.condition);
+    touch_list(l, &node->data.if_else.then_body);
+    touch_list(l, &node->data.if_else.else_body);
+    break;
+  case IR_RETURN:
+    if (node->data.ret.tensor >= 0)
+      l->returned[node->data.ret.tensor] = true;
+    touch(l, node->data.ret.tensor);
+    touch_expr(l, node->data.ret.value);
+    break;
+  }
+}
+
+static void touch_list(Liveness *l, const IRList *list) {
+  for (int i = 0; i < list->count; i++)
+    touch_node(l, list->items[i]);
+}
+
+bool stores_every_element(const IRFunction *fn, const IRNode *node, int t) {
+  const IRTensor *tensor = &fn->tensors[t];
+  int vars[IR_MAX_TERMS];
+  int depth = 0;
+  while (node->kind == IR_LOOP && node->data.loop.gemm == NULL &&
+         depth < tensor->rank && depth < IR_MAX_TERMS) {
+    const IRBound *lower = &node->data.loop.lower;
+    const IRBound *upper = &node->data.loop.upper;
+    AffineExpr zero = affine_constant(0);
+    if (lower->count != 1 || !affine_equal(&lower->exprs[0], &zero) ||
+        upper->count != 1 ||
+        !affine_equal(&upper->exprs[0], &tensor->shape[depth]) ||
+        node->data.loop.step != 1 || node->data.loop.body.count != 1)
+      return false;
+    vars[depth++] = node->data.loop.var;
+    node = node->data.loop.body.items[0];
+  }
+  if (node->kind != IR_STMT || depth != tensor->rank ||
+      node->data.stmt.target.tensor != t ||
+      ir_expr_reads_tensor(node->data.stmt.value, t))
+    return false;
+
+  const IRAccess *target = &node->data.stmt.target;
+  for (int d = 0; d < depth; d++) {
+    AffineExpr var = affine_symbol(vars[d]);
+    if (!target->indices[d].affine ||
+        !affine_equal(&target->indices[d].expr, &var))
+      return false;
+  }
+  return true;
+}
+
+static bool same_shape(const IRTensor *a, const IRTensor *b) {
+  if (a->rank != b->rank)
+    return false;
+  for (int d = 0; d < a->rank; d++) {
+    if (!affine_equal(&a->shape[d], &b->shape[d]))
+      return false;
+  }
+  return true;
+}
+
+// Locals are placed in the order their live ranges begin. Each takes a slot
+// whose last user is already dead, preferring one first used by a local of
+// the same shape so slots do not grow, or else opens a new slot.
+void plan_workspace(const IRFunction *fn, WorkspacePlan *plan) {
+  int count = fn->tensor_count;
+  Liveness l = {NULL, NULL, NULL, 0};
+  l.first = (int *)malloc(sizeof(int) * (count + 1));
+  l.last = (int *)malloc(sizeof(int) * (count + 1));
+  l.returned = (bool *)calloc(count + 1, sizeof(bool));
+  plan->slots = (int *)malloc(sizeof(int) * (count + 1));
+  // Per slot: the local that opened it and the last statement of its latest
+  // user. There are at most as many slots as tensors.
+  int *owner = (int *)malloc(sizeof(int) * (count + 1));
+  int *end = (int *)malloc(sizeof(int) * (count + 1));
+  assert(l.first != NULL && l.last != NULL && l.returned != NULL &&
+         plan->slots != NULL && owner != NULL && end != NULL);
+  plan->tensor_count = count;
+  plan->slot_count = 0;
+
+  for (int t = 0; t < count; t++) {
+    l.first[t] = -1;
+    l.last[t] = -1;
+    plan->slots[t] = -1;
+  }
+  for (int i = 0; i < fn->body.count; i++) {
+    l.statement = i;
+    touch_node(&l, fn->body.items[i]);
+  }
+
+  for (int i = 0; i < fn->body.count; i++) {
+    for (int t = fn->param_count; t < count; t++) {
+      if (l.first[t] != i || fn->tensors[t].rank <= 0 || l.returned[t])
+        continue;
+
+      int slot = -1;
+      if (stores_every_element(fn, fn->body.items[i], t)) {
+        for (int s = 0; s < plan->slot_count; s++) {
+          if (end[s] >= i)
+            continue;
+          bool same = same_shape(&fn->tensors[owner[s]], &fn->tensors[t]);
+          if (slot < 0 || same)
+            slot = s;
+          if (same)
+            break;
+        }
+      }
+      if (slot < 0) {
+        slot = plan->slot_count++;
+        owner[slot] = t;
+      }
+      end[slot] = l.last[t];
+      plan->slots[t] = slot;
+    }
+  }
+
+  // Locals nothing touches still need somewhere to point.
+  for (int t = fn->param_count; t < count; t++) {
+    if (l.first[t] < 0 && fn->tensors[t].rank > 0 && !l.returned[t])
+      plan->slots[t] = plan->slot_count > 0 ? 0 : plan->slot_count++;
+  }
+
+  free(l.first);
+  free(l.last);
+  free(l.returned);
+  free(owner);
+  free(end);
+}
+
+void free_workspace_plan(WorkspacePlan *plan) {
+  free(plan->slots);
+  plan->slots = NULL;
+  plan->slot_count = 0;
+}
+
+bool workspace_slot_shared(const WorkspacePlan *plan, int t) {
+  for (int u = 0; u < plan->tensor_count; u++) {
+    if (u != t && plan->slots[u] >= 0 && plan->slots[u] == plan->slots[t])
+      return true;
+  }
+  return false;
+}
+
+long workspace_slot_size(long elements) {
+  long size = elements > 0 ? elements : 1;
+  return (size + WORKSPACE_SLOT_ALIGN - 1) / WORKSPACE_SLOT_ALIGN *
+         WORKSPACE_SLOT_ALIGN;
+}
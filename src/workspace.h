@@ -0,0 +1,44 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "loop_ir.h"
+
+// Storage plan for the local tensors of a function. A local is live from the
+// first to the last top-level statement of the body that touches it, a whole
+// loop nest counting as one statement. Locals whose live ranges do not
+// overlap share a slot, and the slots are laid out one after another in a
+// single workspace, so a call makes one allocation for all of them instead of
+// one per local and needs only as much memory as the locals live at once.
+//
+// The workspace is allocated zeroed, as separate locals were. A local that
+// reuses a slot must therefore begin with a store to every element, as
+// `T: tensor<MxNxf32> = 0.0` does; a local that may read an element before
+// writing it gets a slot to itself, or is the first to use one.
+
+// Slots start on 64-byte boundaries of the workspace: every slot is a whole
+// number of these many floats.
+#define WORKSPACE_SLOT_ALIGN 16
+
+typedef struct WorkspacePlan {
+  // Per tensor: its slot, or -1 for parameters, scalars and returned locals,
+  // which are stored elsewhere.
+  int *slots;
+  int tensor_count;
+  int slot_count;
+} WorkspacePlan;
+
+void plan_workspace(const IRFunction *fn, WorkspacePlan *plan);
+void free_workspace_plan(WorkspacePlan *plan);
+
+// Whether `node` is a perfect nest over [0, extent) of every dimension of
+// `t` whose single statement stores every element of `t` without reading
+// it, as a whole-tensor initialiser lowers to.
+bool stores_every_element(const IRFunction *fn, const IRNode *node, int t);
+
+// Whether some other local shares the slot of tensor `t`.
+bool workspace_slot_shared(const WorkspacePlan *plan, int t);
+
+// Rounds an element count up to a whole slot.
+long workspace_slot_size(long elements);
+
+#endif // !WORKSPACE_H